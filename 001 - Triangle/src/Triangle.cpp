@@ -24,6 +24,7 @@ Triangle::Triangle(int argc, const char* argv[])
 , m_bindir(argv[0])
 {
    m_bindir.remove_filename();
+   ParseCommandLine(argc, argv);
    Init();
 }
 
@@ -68,11 +69,8 @@ void Triangle::CreateVertexBuffer() {
 
    vk::DeviceSize size = vertices.size() * sizeof(Vertex);
 
-   Vulkan::Buffer stagingBuffer(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-   stagingBuffer.CopyFromHost(0, size, vertices.data());
-
    m_VertexBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
-   CopyBuffer(stagingBuffer.m_Buffer, m_VertexBuffer->m_Buffer, 0, 0, size);
+   UploadToBuffer(vertices.data(), size, m_VertexBuffer->m_Buffer);
 }
 
 
@@ -87,11 +85,8 @@ void Triangle::CreateIndexBuffer() {
    uint32_t count = static_cast<uint32_t>(indices.size());
    vk::DeviceSize size = count * sizeof(uint32_t);
 
-   Vulkan::Buffer stagingBuffer(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-   stagingBuffer.CopyFromHost(0, size, indices.data());
-
    m_IndexBuffer = std::make_unique<Vulkan::IndexBuffer>(m_Device, m_PhysicalDevice, size, count, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
-   CopyBuffer(stagingBuffer.m_Buffer, m_IndexBuffer->m_Buffer, 0, 0, size);
+   UploadToBuffer(indices.data(), size, m_IndexBuffer->m_Buffer);
 }
 
 
@@ -105,25 +100,21 @@ void Triangle::CreateUniformBuffers() {
 
    // We are potentially queuing up more than one command buffer for rendering at once.
    // (see m_Settings.MaxFramesInFlight).
-   // This means that each command buffer needs its own uniform buffer.
-   // (if they all shared one uniform buffer, then we might start updating the uniform buffer
+   // This means that each command buffer needs its own uniform data.
+   // (if they all shared the same data, then we might start updating it
    // when a previously queued command buffer hasn't yet finished rendering).
    //
-   // If we had instead made sure that only one command buffer is ever rendering at once,
-   // then we could get away with just one uniform buffer.
-
+   // So we have one (persistently mapped) ring buffer with a slice for each command buffer,
+   // and each command buffer binds its own slice via a dynamic offset.
    //
-   // TODO: experiment: We are creating the uniform buffers as hostVisible and hostCoherent
-   //                   Would it be better to have them as device-local  (and copy after each update)?
-   m_UniformBuffers.reserve(m_CommandBuffers.size());
-   for (const auto& commandBuffer : m_CommandBuffers) {
-      m_UniformBuffers.emplace_back(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eUniformBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-   }
+   // TODO: experiment: We are creating the uniform buffer as hostVisible and hostCoherent
+   //                   Would it be better to have it as device-local  (and copy after each update)?
+   m_UniformBuffer = std::make_unique<Vulkan::RingBuffer>(m_Device, m_PhysicalDevice, size, size, static_cast<uint32_t>(m_CommandBuffers.size()));
 }
 
 
 void Triangle::DestroyUniformBuffers() {
-   m_UniformBuffers.clear();
+   m_UniformBuffer.reset(nullptr);
 }
 
 
@@ -134,7 +125,7 @@ void Triangle::CreateDescriptorSetLayout() {
 
    vk::DescriptorSetLayoutBinding uboLayoutBinding = {
       0                                   /*binding*/,
-      vk::DescriptorType::eUniformBuffer  /*descriptorType*/,
+      vk::DescriptorType::eUniformBufferDynamic /*descriptorType*/,
       1                                   /*descriptorCount*/,
       {vk::ShaderStageFlagBits::eVertex}  /*stageFlags*/,
       nullptr                             /*pImmutableSamplers*/
@@ -377,7 +368,7 @@ void Triangle::DestroyPipeline() {
 void Triangle::CreateDescriptorPool() {
    std::array<vk::DescriptorPoolSize, 1> typeCounts = {
       vk::DescriptorPoolSize {
-         vk::DescriptorType::eUniformBuffer,
+         vk::DescriptorType::eUniformBufferDynamic,
          static_cast<uint32_t>(m_SwapChainFrameBuffers.size())
       }
    };
@@ -419,9 +410,9 @@ void Triangle::CreateDescriptorSets() {
          0                                               /*dstBinding*/,
          0                                               /*dstArrayElement*/,
          1                                               /*descriptorCount*/,
-         vk::DescriptorType::eUniformBuffer              /*descriptorType*/,
+         vk::DescriptorType::eUniformBufferDynamic       /*descriptorType*/,
          nullptr                                         /*pImageInfo*/,
-         &m_UniformBuffers[i].m_Descriptor               /*pBufferInfo*/,
+         &m_UniformBuffer->m_Descriptor                  /*pBufferInfo*/,
          nullptr                                         /*pTexelBufferView*/
       };
       m_Device.updateDescriptorSets(writeDescriptorSet, nullptr);
@@ -471,7 +462,9 @@ void Triangle::RecordCommandBuffers() {
       vk::CommandBuffer& commandBuffer = m_CommandBuffers[i];
 
       commandBuffer.begin(commandBufferBI);
+      m_Profiler->BeginCommandBuffer(commandBuffer, i);
 
+      uint32_t renderPassScope = m_Profiler->BeginGPUScope(commandBuffer, i, "RenderPass");
       // Start the first sub pass specified in the default render pass setup by the base application.
       // This will clear the color and depth attachment
       commandBuffer.beginRenderPass(renderPassBI, vk::SubpassContents::eInline);
@@ -491,13 +484,14 @@ void Triangle::RecordCommandBuffers() {
       };
       commandBuffer.setScissor(0, scissor);
 
-      commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_PipelineLayout, 0, m_DescriptorSets[i], nullptr);  // (i)th command buffer is bound to the (i)th descriptor set
+      commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_PipelineLayout, 0, m_DescriptorSets[i], m_UniformBuffer->GetFrameOffset(i));  // (i)th command buffer is bound to the (i)th descriptor set, and the (i)th slice of the uniform buffer
       commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, m_Pipeline);
       commandBuffer.bindVertexBuffers(0, m_VertexBuffer->m_Buffer, {0});
       commandBuffer.bindIndexBuffer(m_IndexBuffer->m_Buffer, 0, vk::IndexType::eUint32);
       commandBuffer.drawIndexed(m_IndexBuffer->m_Count, 1, 0, 0, 0);
 
       commandBuffer.endRenderPass();
+      m_Profiler->EndGPUScope(commandBuffer, i, renderPassScope);
       // Ending the render pass will add an implicit barrier transitioning the frame buffer color attachment to 
       // VK_IMAGE_LAYOUT_PRESENT_SRC_KHR for presenting it to the windowing system
 
@@ -519,7 +513,8 @@ void Triangle::RenderFrame() {
       proj * view * model
    };
 
-   m_UniformBuffers[m_CurrentImage].CopyFromHost(0, sizeof(ubo), &ubo);
+   m_UniformBuffer->BeginFrame(m_CurrentImage);
+   m_UniformBuffer->Push(ubo);
 
    EndFrame();
 }
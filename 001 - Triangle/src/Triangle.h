@@ -1,6 +1,7 @@
 #include "Application.h"
 
 #include "Buffer.h"
+#include "RingBuffer.h"
 
 #include <filesystem>
 #include <memory>
@@ -83,7 +84,7 @@ private:
    std::filesystem::path m_bindir;
    std::unique_ptr<Vulkan::Buffer> m_VertexBuffer;
    std::unique_ptr<Vulkan::IndexBuffer> m_IndexBuffer;
-   std::vector<Vulkan::Buffer> m_UniformBuffers;
+   std::unique_ptr<Vulkan::RingBuffer> m_UniformBuffer;
    vk::DescriptorSetLayout m_DescriptorSetLayout;
    vk::PipelineLayout m_PipelineLayout;
    vk::Pipeline m_Pipeline;
@@ -30,6 +30,7 @@ TexturedModel::TexturedModel(int argc, const char* argv[])
 , m_bindir(argv[0])
 {
    m_bindir.remove_filename();
+   ParseCommandLine(argc, argv);
    Init();
 }
 
@@ -127,11 +128,8 @@ void TexturedModel::CreateVertexBuffer() {
 
    vk::DeviceSize size = m_Vertices.size() * sizeof(Vertex);
 
-   Vulkan::Buffer stagingBuffer(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-   stagingBuffer.CopyFromHost(0, size, m_Vertices.data());
-
    m_VertexBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
-   CopyBuffer(stagingBuffer.m_Buffer, m_VertexBuffer->m_Buffer, 0, 0, size);
+   UploadToBuffer(m_Vertices.data(), size, m_VertexBuffer->m_Buffer);
 }
 
 
@@ -144,11 +142,8 @@ void TexturedModel::CreateIndexBuffer() {
    uint32_t count = static_cast<uint32_t>(m_Indices.size());
    vk::DeviceSize size = count * sizeof(uint32_t);
 
-   Vulkan::Buffer stagingBuffer(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-   stagingBuffer.CopyFromHost(0, size, m_Indices.data());
-
    m_IndexBuffer = std::make_unique<Vulkan::IndexBuffer>(m_Device, m_PhysicalDevice, size, count, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
-   CopyBuffer(stagingBuffer.m_Buffer, m_IndexBuffer->m_Buffer, 0, 0, size);
+   UploadToBuffer(m_Indices.data(), size, m_IndexBuffer->m_Buffer);
 }
 
 
@@ -170,14 +165,9 @@ void TexturedModel::CreateTextureResources() {
       throw std::runtime_error("failed to load texture image!");
    }
 
-   Vulkan::Buffer stagingBuffer(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-   stagingBuffer.CopyFromHost(0, size, pixels);
-
-   stbi_image_free(pixels);
-
    m_Texture = std::make_unique<Vulkan::Image>(m_Device, m_PhysicalDevice, vk::ImageViewType::e2D, texWidth, texHeight, mipLevels, vk::SampleCountFlagBits::e1, vk::Format::eR8G8B8A8Unorm, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled, vk::MemoryPropertyFlagBits::eDeviceLocal);
-   TransitionImageLayout(m_Texture->m_Image, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, mipLevels);
-   CopyBufferToImage(stagingBuffer.m_Buffer, m_Texture->m_Image, texWidth, texHeight);
+   UploadToImage(pixels, size, m_Texture->m_Image, texWidth, texHeight, mipLevels);
+   stbi_image_free(pixels);
    GenerateMIPMaps(m_Texture->m_Image, vk::Format::eR8G8B8A8Unorm, texWidth, texHeight, mipLevels);
 
    m_Texture->CreateImageView(vk::Format::eR8G8B8A8Unorm, vk::ImageAspectFlagBits::eColor, mipLevels);
@@ -216,25 +206,21 @@ void TexturedModel::CreateUniformBuffers() {
 
    // We are potentially queuing up more than one command buffer for rendering at once.
    // (see m_Settings.MaxFramesInFlight).
-   // This means that each command buffer needs its own uniform buffer.
-   // (if they all shared one uniform buffer, then we might start updating the uniform buffer
+   // This means that each command buffer needs its own uniform data.
+   // (if they all shared the same data, then we might start updating it
    // when a previously queued command buffer hasn't yet finished rendering).
    //
-   // If we had instead made sure that only one command buffer is ever rendering at once,
-   // then we could get away with just one uniform buffer.
-
+   // So we have one (persistently mapped) ring buffer with a slice for each command buffer,
+   // and each command buffer binds its own slice via a dynamic offset.
    //
-   // TODO: experiment: We are creating the uniform buffers as hostVisible and hostCoherent
-   //                   Would it be better to have them as device-local  (and copy after each update)?
-   m_UniformBuffers.reserve(m_CommandBuffers.size());
-   for (const auto& commandBuffer : m_CommandBuffers) {
-      m_UniformBuffers.emplace_back(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eUniformBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-   }
+   // TODO: experiment: We are creating the uniform buffer as hostVisible and hostCoherent
+   //                   Would it be better to have it as device-local  (and copy after each update)?
+   m_UniformBuffer = std::make_unique<Vulkan::RingBuffer>(m_Device, m_PhysicalDevice, size, size, static_cast<uint32_t>(m_CommandBuffers.size()));
 }
 
 
 void TexturedModel::DestroyUniformBuffers() {
-   m_UniformBuffers.clear();
+   m_UniformBuffer.reset(nullptr);
 }
 
 
@@ -245,7 +231,7 @@ void TexturedModel::CreateDescriptorSetLayout() {
 
    vk::DescriptorSetLayoutBinding uboLayoutBinding = {
       0                                   /*binding*/,
-      vk::DescriptorType::eUniformBuffer  /*descriptorType*/,
+      vk::DescriptorType::eUniformBufferDynamic /*descriptorType*/,
       1                                   /*descriptorCount*/,
       {vk::ShaderStageFlagBits::eVertex}  /*stageFlags*/,
       nullptr                             /*pImmutableSamplers*/
@@ -496,7 +482,7 @@ void TexturedModel::DestroyPipeline() {
 void TexturedModel::CreateDescriptorPool() {
    std::array<vk::DescriptorPoolSize, 2> typeCounts = {
       vk::DescriptorPoolSize {
-         vk::DescriptorType::eUniformBuffer,
+         vk::DescriptorType::eUniformBufferDynamic,
          static_cast<uint32_t>(m_SwapChainFrameBuffers.size())
       },
       vk::DescriptorPoolSize {
@@ -549,9 +535,9 @@ void TexturedModel::CreateDescriptorSets() {
             0                                  /*dstBinding*/,
             0                                  /*dstArrayElement*/,
             1                                  /*descriptorCount*/,
-            vk::DescriptorType::eUniformBuffer /*descriptorType*/,
+            vk::DescriptorType::eUniformBufferDynamic /*descriptorType*/,
             nullptr                            /*pImageInfo*/,
-            &m_UniformBuffers[i].m_Descriptor /*pBufferInfo*/,
+            &m_UniformBuffer->m_Descriptor    /*pBufferInfo*/,
             nullptr                            /*pTexelBufferView*/
          },
          {
@@ -612,7 +598,9 @@ void TexturedModel::RecordCommandBuffers() {
       vk::CommandBuffer& commandBuffer = m_CommandBuffers[i];
 
       commandBuffer.begin(commandBufferBI);
+      m_Profiler->BeginCommandBuffer(commandBuffer, i);
 
+      uint32_t renderPassScope = m_Profiler->BeginGPUScope(commandBuffer, i, "RenderPass");
       // Start the first sub pass specified in the default render pass setup by the base application.
       // This will clear the color and depth attachment
       commandBuffer.beginRenderPass(renderPassBI, vk::SubpassContents::eInline);
@@ -632,13 +620,14 @@ void TexturedModel::RecordCommandBuffers() {
       };
       commandBuffer.setScissor(0, scissor);
 
-      commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_PipelineLayout, 0, m_DescriptorSets[i], nullptr);  // (i)th command buffer is bound to the (i)th descriptor set
+      commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_PipelineLayout, 0, m_DescriptorSets[i], m_UniformBuffer->GetFrameOffset(i));  // (i)th command buffer is bound to the (i)th descriptor set, and the (i)th slice of the uniform buffer
       commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, m_Pipeline);
       commandBuffer.bindVertexBuffers(0, m_VertexBuffer->m_Buffer, {0});
       commandBuffer.bindIndexBuffer(m_IndexBuffer->m_Buffer, 0, vk::IndexType::eUint32);
       commandBuffer.drawIndexed(m_IndexBuffer->m_Count, 1, 0, 0, 0);
 
       commandBuffer.endRenderPass();
+      m_Profiler->EndGPUScope(commandBuffer, i, renderPassScope);
       // Ending the render pass will add an implicit barrier transitioning the frame buffer color attachment to 
       // VK_IMAGE_LAYOUT_PRESENT_SRC_KHR for presenting it to the windowing system
 
@@ -669,7 +658,8 @@ void TexturedModel::RenderFrame() {
       proj * view * model
    };
 
-   m_UniformBuffers[m_CurrentImage].CopyFromHost(0, sizeof(ubo), &ubo);
+   m_UniformBuffer->BeginFrame(m_CurrentImage);
+   m_UniformBuffer->Push(ubo);
 
    EndFrame();
 }
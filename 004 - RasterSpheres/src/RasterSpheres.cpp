@@ -36,6 +36,7 @@ RasterSpheres::RasterSpheres(int argc, const char* argv[])
 , m_bindir(argv[0])
 {
    m_bindir.remove_filename();
+   ParseCommandLine(argc, argv);
    Init();
 }
 
@@ -128,11 +129,8 @@ void RasterSpheres::CreateVertexBuffer() {
 
    vk::DeviceSize size = m_Vertices.size() * sizeof(Vertex);
 
-   Vulkan::Buffer stagingBuffer(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-   stagingBuffer.CopyFromHost(0, size, m_Vertices.data());
-
    m_VertexBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
-   CopyBuffer(stagingBuffer.m_Buffer, m_VertexBuffer->m_Buffer, 0, 0, size);
+   UploadToBuffer(m_Vertices.data(), size, m_VertexBuffer->m_Buffer);
 }
 
 
@@ -168,11 +166,8 @@ void RasterSpheres::CreateInstanceBuffer() {
    m_InstanceCount = static_cast<uint32_t>(instances.size());
 
    vk::DeviceSize size = instances.size() * sizeof(Instance);
-   Vulkan::Buffer stagingBuffer(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-   stagingBuffer.CopyFromHost(0, size, instances.data());
-
    m_InstanceBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
-   CopyBuffer(stagingBuffer.m_Buffer, m_InstanceBuffer->m_Buffer, 0, 0, size);
+   UploadToBuffer(instances.data(), size, m_InstanceBuffer->m_Buffer);
 }
 
 
@@ -185,11 +180,8 @@ void RasterSpheres::CreateIndexBuffer() {
    uint32_t count = static_cast<uint32_t>(m_Indices.size());
    vk::DeviceSize size = count * sizeof(uint32_t);
 
-   Vulkan::Buffer stagingBuffer(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-   stagingBuffer.CopyFromHost(0, size, m_Indices.data());
-
    m_IndexBuffer = std::make_unique<Vulkan::IndexBuffer>(m_Device, m_PhysicalDevice, size, count, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
-   CopyBuffer(stagingBuffer.m_Buffer, m_IndexBuffer->m_Buffer, 0, 0, size);
+   UploadToBuffer(m_Indices.data(), size, m_IndexBuffer->m_Buffer);
 }
 
 
@@ -203,25 +195,21 @@ void RasterSpheres::CreateUniformBuffers() {
 
    // We are potentially queuing up more than one command buffer for rendering at once.
    // (see m_Settings.MaxFramesInFlight).
-   // This means that each command buffer needs its own uniform buffer.
-   // (if they all shared one uniform buffer, then we might start updating the uniform buffer
+   // This means that each command buffer needs its own uniform data.
+   // (if they all shared the same data, then we might start updating it
    // when a previously queued command buffer hasn't yet finished rendering).
    //
-   // If we had instead made sure that only one command buffer is ever rendering at once,
-   // then we could get away with just one uniform buffer.
-
+   // So we have one (persistently mapped) ring buffer with a slice for each command buffer,
+   // and each command buffer binds its own slice via a dynamic offset.
    //
-   // TODO: experiment: We are creating the uniform buffers as hostVisible and hostCoherent
-   //                   Would it be better to have them as device-local  (and copy after each update)?
-   m_UniformBuffers.reserve(m_CommandBuffers.size());
-   for (const auto& commandBuffer : m_CommandBuffers) {
-      m_UniformBuffers.emplace_back(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eUniformBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-   }
+   // TODO: experiment: We are creating the uniform buffer as hostVisible and hostCoherent
+   //                   Would it be better to have it as device-local  (and copy after each update)?
+   m_UniformBuffer = std::make_unique<Vulkan::RingBuffer>(m_Device, m_PhysicalDevice, size, size, static_cast<uint32_t>(m_CommandBuffers.size()));
 }
 
 
 void RasterSpheres::DestroyUniformBuffers() {
-   m_UniformBuffers.clear();
+   m_UniformBuffer.reset(nullptr);
 }
 
 
@@ -232,7 +220,7 @@ void RasterSpheres::CreateDescriptorSetLayout() {
 
    vk::DescriptorSetLayoutBinding uboLayoutBinding = {
       0                                   /*binding*/,
-      vk::DescriptorType::eUniformBuffer  /*descriptorType*/,
+      vk::DescriptorType::eUniformBufferDynamic /*descriptorType*/,
       1                                   /*descriptorCount*/,
       {vk::ShaderStageFlagBits::eVertex}  /*stageFlags*/,
       nullptr                             /*pImmutableSamplers*/
@@ -497,7 +485,7 @@ void RasterSpheres::DestroyPipeline() {
 void RasterSpheres::CreateDescriptorPool() {
    std::array<vk::DescriptorPoolSize, 2> typeCounts = {
       vk::DescriptorPoolSize {
-         vk::DescriptorType::eUniformBuffer,
+         vk::DescriptorType::eUniformBufferDynamic,
          static_cast<uint32_t>(m_SwapChainFrameBuffers.size())
       },
       vk::DescriptorPoolSize {
@@ -544,9 +532,9 @@ void RasterSpheres::CreateDescriptorSets() {
             0                                  /*dstBinding*/,
             0                                  /*dstArrayElement*/,
             1                                  /*descriptorCount*/,
-            vk::DescriptorType::eUniformBuffer /*descriptorType*/,
+            vk::DescriptorType::eUniformBufferDynamic /*descriptorType*/,
             nullptr                            /*pImageInfo*/,
-            &m_UniformBuffers[i].m_Descriptor /*pBufferInfo*/,
+            &m_UniformBuffer->m_Descriptor    /*pBufferInfo*/,
             nullptr                            /*pTexelBufferView*/
          }
       };
@@ -597,7 +585,9 @@ void RasterSpheres::RecordCommandBuffers() {
       vk::CommandBuffer& commandBuffer = m_CommandBuffers[i];
 
       commandBuffer.begin(commandBufferBI);
+      m_Profiler->BeginCommandBuffer(commandBuffer, i);
 
+      uint32_t renderPassScope = m_Profiler->BeginGPUScope(commandBuffer, i, "RenderPass");
       // Start the first sub pass specified in the default render pass setup by the base application.
       // This will clear the color and depth attachment
       commandBuffer.beginRenderPass(renderPassBI, vk::SubpassContents::eInline);
@@ -617,7 +607,7 @@ void RasterSpheres::RecordCommandBuffers() {
       };
       commandBuffer.setScissor(0, scissor);
 
-      commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_PipelineLayout, 0, m_DescriptorSets[i], nullptr);  // (i)th command buffer is bound to the (i)th descriptor set
+      commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_PipelineLayout, 0, m_DescriptorSets[i], m_UniformBuffer->GetFrameOffset(i));  // (i)th command buffer is bound to the (i)th descriptor set, and the (i)th slice of the uniform buffer
       commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, m_Pipeline);
       commandBuffer.bindVertexBuffers(0, m_VertexBuffer->m_Buffer, {0});
       commandBuffer.bindVertexBuffers(1, m_InstanceBuffer->m_Buffer, {0});
@@ -625,6 +615,7 @@ void RasterSpheres::RecordCommandBuffers() {
       commandBuffer.drawIndexed(m_IndexBuffer->m_Count, m_InstanceCount, 0, 0, 0);
 
       commandBuffer.endRenderPass();
+      m_Profiler->EndGPUScope(commandBuffer, i, renderPassScope);
       // Ending the render pass will add an implicit barrier transitioning the frame buffer color attachment to 
       // VK_IMAGE_LAYOUT_PRESENT_SRC_KHR for presenting it to the windowing system
 
@@ -643,7 +634,8 @@ void RasterSpheres::Update(double deltaTime) {
 
 void RasterSpheres::RenderFrame() {
    BeginFrame();
-   m_UniformBuffers[m_CurrentImage].CopyFromHost(0, sizeof(UniformBufferObject), &m_UniformBufferObject);
+   m_UniformBuffer->BeginFrame(m_CurrentImage);
+   m_UniformBuffer->Push(m_UniformBufferObject);
    EndFrame();
 }
 
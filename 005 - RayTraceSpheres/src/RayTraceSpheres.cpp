@@ -61,6 +61,7 @@ RayTraceSpheres::RayTraceSpheres(int argc, const char* argv[])
 , m_UniformBufferObject { glm::identity<mat4>(), glm::identity<mat4>(), 0 }
 {
    m_bindir.remove_filename();
+   ParseCommandLine(argc, argv);
    Init();
 }
 
@@ -124,6 +125,7 @@ void* RayTraceSpheres::GetRequiredPhysicalDeviceFeaturesEXT() {
 
    static vk::PhysicalDeviceAccelerationStructureFeaturesKHR accelerationStructureFeatures;
    accelerationStructureFeatures.accelerationStructure = true;
+   accelerationStructureFeatures.accelerationStructureHostCommands = IsHostAccelerationStructureBuild();
    accelerationStructureFeatures.pNext = &indexingFeatures;
 
    static vk::PhysicalDeviceRayTracingPipelineFeaturesKHR rayTracingFeatures;
@@ -218,11 +220,8 @@ void RayTraceSpheres::CreateScene() {
    {
       vk::DeviceSize size = vertices.size() * sizeof(Vertex);
 
-      Vulkan::Buffer stagingBuffer(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-      stagingBuffer.CopyFromHost(0, size, vertices.data());
-
       m_VertexBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal);
-      CopyBuffer(stagingBuffer.m_Buffer, m_VertexBuffer->m_Buffer, 0, 0, size);
+      UploadToBuffer(vertices.data(), size, m_VertexBuffer->m_Buffer);
    }
 
    // Create Index buffer
@@ -230,17 +229,8 @@ void RayTraceSpheres::CreateScene() {
       uint32_t count = static_cast<uint32_t>(indices.size());
       vk::DeviceSize size = count * sizeof(uint32_t);
 
-      Vulkan::Buffer stagingBuffer = {
-         m_Device,
-         m_PhysicalDevice,
-         size,
-         vk::BufferUsageFlagBits::eTransferSrc,
-         vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
-      };
-      stagingBuffer.CopyFromHost(0, size, indices.data());
-
       m_IndexBuffer = std::make_unique<Vulkan::IndexBuffer>(m_Device, m_PhysicalDevice, size, count, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal);
-      CopyBuffer(stagingBuffer.m_Buffer, m_IndexBuffer->m_Buffer, 0, 0, size);
+      UploadToBuffer(indices.data(), size, m_IndexBuffer->m_Buffer);
    }
 
    // Create Transform buffer (if you want to instance the objects in BLAS)
@@ -264,8 +254,14 @@ void RayTraceSpheres::CreateScene() {
 
    // Could create multiple geometries here (on same vertex/index buffer) by specifying the offsets and counts.
    // You can also instantiate the same geometry more than once (using the transformData and transformOffset)
+   // (a host build reads the vertices and indices from where they were uploaded from)
    Vulkan::GeometryGroup geometryGroup;
-   geometryGroup.AddTrianglesIndexed(m_VertexBuffer->GetBufferDeviceAddress(), 0, sizeof(Vertex), vertices.size(), m_IndexBuffer->GetBufferDeviceAddress(), 0, indices.size(), 0, vertices.size());
+   if (IsHostAccelerationStructureBuild()) {
+      geometryGroup.m_IsOnHost = true;
+      geometryGroup.AddTrianglesIndexed(vertices.data(), 0, sizeof(Vertex), vertices.size(), indices.data(), 0, indices.size(), 0, vertices.size());
+   } else {
+      geometryGroup.AddTrianglesIndexed(m_VertexBuffer->GetBufferDeviceAddress(), 0, sizeof(Vertex), vertices.size(), m_IndexBuffer->GetBufferDeviceAddress(), 0, indices.size(), 0, vertices.size());
+   }
 
    CreateBottomLevelAccelerationStructures(geometryGroup);
 
@@ -368,30 +364,15 @@ void RayTraceSpheres::CreateScene() {
    );
    materials.emplace_back(Metallic({0.7, 0.6, 0.5}, 0.0));
 
-   // Create Instances buffer
-   Vulkan::Buffer instanceBuffer{
-      m_Device,
-      m_PhysicalDevice,
-      sizeof(vk::AccelerationStructureInstanceKHR) * instances.size(),
-      vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
-      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
-   };
-   instanceBuffer.CopyFromHost(0, VK_WHOLE_SIZE, instances.data());
-
    // Create Materials buffer
    {
       vk::DeviceSize size = materials.size() * sizeof(Material);
 
-      Vulkan::Buffer stagingBuffer(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-      stagingBuffer.CopyFromHost(0, size, materials.data());
-
       m_MaterialBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
-      CopyBuffer(stagingBuffer.m_Buffer, m_MaterialBuffer->m_Buffer, 0, 0, size);
+      UploadToBuffer(materials.data(), size, m_MaterialBuffer->m_Buffer);
    }
 
-   Vulkan::GeometryGroup group;
-   group.AddInstances(instanceBuffer.GetBufferDeviceAddress(), 0, false, instances.size());
-   CreateTopLevelAccelerationStructure(group);
+   CreateTopLevelAccelerationStructure(instances);
 
 }
 
@@ -429,25 +410,21 @@ void RayTraceSpheres::CreateUniformBuffers() {
 
    // We are potentially queuing up more than one command buffer for rendering at once.
    // (see m_Settings.MaxFramesInFlight).
-   // This means that each command buffer needs its own uniform buffer.
-   // (if they all shared one uniform buffer, then we might start updating the uniform buffer
+   // This means that each command buffer needs its own uniform data.
+   // (if they all shared the same data, then we might start updating it
    // when a previously queued command buffer hasn't yet finished rendering).
    //
-   // If we had instead made sure that only one command buffer is ever rendering at once,
-   // then we could get away with just one uniform buffer.
-
+   // So we have one (persistently mapped) ring buffer with a slice for each command buffer,
+   // and each command buffer binds its own slice via a dynamic offset.
    //
-   // TODO: experiment: We are creating the uniform buffers as hostVisible and hostCoherent
-   //                   Would it be better to have them as device-local  (and copy after each update)?
-   m_UniformBuffers.reserve(m_CommandBuffers.size());
-   for (const auto& commandBuffer : m_CommandBuffers) {
-      m_UniformBuffers.emplace_back(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eUniformBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-   }
+   // TODO: experiment: We are creating the uniform buffer as hostVisible and hostCoherent
+   //                   Would it be better to have it as device-local  (and copy after each update)?
+   m_UniformBuffer = std::make_unique<Vulkan::RingBuffer>(m_Device, m_PhysicalDevice, size, size, static_cast<uint32_t>(m_CommandBuffers.size()));
 }
 
 
 void RayTraceSpheres::DestroyUniformBuffers() {
-   m_UniformBuffers.clear();
+   m_UniformBuffer.reset(nullptr);
 }
 
 
@@ -482,7 +459,7 @@ void RayTraceSpheres::CreateDescriptorSetLayout() {
 
    vk::DescriptorSetLayoutBinding uniformBufferLB = {
       BINDING_UNIFORMBUFFER                                                                                              /*binding*/,
-      vk::DescriptorType::eUniformBuffer                                                                                 /*descriptorType*/,
+      vk::DescriptorType::eUniformBufferDynamic                                                                          /*descriptorType*/,
       1                                                                                                                  /*descriptorCount*/,
       vk::ShaderStageFlagBits::eRaygenKHR | vk::ShaderStageFlagBits::eClosestHitKHR | vk::ShaderStageFlagBits::eMissKHR  /*stageFlags*/,
       nullptr                                                                                                            /*pImmutableSamplers*/
@@ -713,7 +690,7 @@ void RayTraceSpheres::CreateDescriptorPool() {
          static_cast<uint32_t>(2 * m_SwapChainFrameBuffers.size())
       },
       vk::DescriptorPoolSize {
-         vk::DescriptorType::eUniformBuffer,
+         vk::DescriptorType::eUniformBufferDynamic,
          static_cast<uint32_t>(m_SwapChainFrameBuffers.size())
       },
       vk::DescriptorPoolSize {
@@ -808,9 +785,9 @@ void RayTraceSpheres::CreateDescriptorSets() {
          BINDING_UNIFORMBUFFER                        /*dstBinding*/,
          0                                            /*dstArrayElement*/,
          1                                            /*descriptorCount*/,
-         vk::DescriptorType::eUniformBuffer           /*descriptorType*/,
+         vk::DescriptorType::eUniformBufferDynamic    /*descriptorType*/,
          nullptr                                      /*pImageInfo*/,
-         &m_UniformBuffers[i].m_Descriptor            /*pBufferInfo*/,
+         &m_UniformBuffer->m_Descriptor               /*pBufferInfo*/,
          nullptr                                      /*pTexelBufferView*/
       };
 
@@ -930,10 +907,12 @@ void RayTraceSpheres::RecordCommandBuffers() {
    for (uint32_t i = 0; i < m_CommandBuffers.size(); ++i) {
       vk::CommandBuffer& commandBuffer = m_CommandBuffers[i];
       commandBuffer.begin(commandBufferBI);
+      m_Profiler->BeginCommandBuffer(commandBuffer, i);
       commandBuffer.pushConstants<Constants>(m_PipelineLayout, vk::ShaderStageFlagBits::eRaygenKHR, 0, m_Constants);
       commandBuffer.bindPipeline(vk::PipelineBindPoint::eRayTracingKHR, m_Pipeline);
-      commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eRayTracingKHR, m_PipelineLayout, 0, m_DescriptorSets[i], nullptr);  // (i)th command buffer is bound to the (i)th descriptor set
+      commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eRayTracingKHR, m_PipelineLayout, 0, m_DescriptorSets[i], m_UniformBuffer->GetFrameOffset(i));  // (i)th command buffer is bound to the (i)th descriptor set, and the (i)th slice of the uniform buffer
 
+      uint32_t traceRaysScope = m_Profiler->BeginGPUScope(commandBuffer, i, "TraceRays");
       commandBuffer.traceRaysKHR(
          raygenShaderBindingTable,
          missShaderBindingTable,
@@ -941,6 +920,9 @@ void RayTraceSpheres::RecordCommandBuffers() {
          callableShaderBindingTable,
          m_Extent.width, m_Extent.height, 1
       );
+      m_Profiler->EndGPUScope(commandBuffer, i, traceRaysScope);
+
+      uint32_t copyScope = m_Profiler->BeginGPUScope(commandBuffer, i, "CopyOutputImage");
 
       vk::ImageMemoryBarrier barrier = {
          {}                                    /*srcAccessMask*/,
@@ -979,7 +961,7 @@ void RayTraceSpheres::RecordCommandBuffers() {
          vk::AccessFlagBits::eTransferWrite    /*srcAccessMask*/,
          {}                                    /*dstAccessMask*/,
          vk::ImageLayout::eTransferDstOptimal  /*oldLayout*/,
-         vk::ImageLayout::ePresentSrcKHR       /*newLayout*/,
+         m_PresentLayout                       /*newLayout*/,
          VK_QUEUE_FAMILY_IGNORED               /*srcQueueFamilyIndex*/,
          VK_QUEUE_FAMILY_IGNORED               /*dstQueueFamilyIndex*/,
          m_SwapChainImages[i].m_Image          /*image*/,
@@ -999,6 +981,8 @@ void RayTraceSpheres::RecordCommandBuffers() {
       };
       commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands, {}, nullptr, nullptr, barrier);
 
+      m_Profiler->EndGPUScope(commandBuffer, i, copyScope);
+
       commandBuffer.end();
    }
 }
@@ -1013,15 +997,7 @@ void RayTraceSpheres::Update(double deltaTime) {
    m_UniformBufferObject.projInverse = glm::inverse(projection);
    m_UniformBufferObject.viewInverse = glm::inverse(modelView);
 
-   if (
-      (glfwGetKey(m_Window, GLFW_KEY_W) == GLFW_PRESS) ||
-      (glfwGetKey(m_Window, GLFW_KEY_A) == GLFW_PRESS) ||
-      (glfwGetKey(m_Window, GLFW_KEY_S) == GLFW_PRESS) ||
-      (glfwGetKey(m_Window, GLFW_KEY_D) == GLFW_PRESS) ||
-      (glfwGetKey(m_Window, GLFW_KEY_R) == GLFW_PRESS) ||
-      (glfwGetKey(m_Window, GLFW_KEY_F) == GLFW_PRESS) ||
-      m_LeftMouseDown
-   ) {
+   if (m_IsCameraMoved) {
       m_UniformBufferObject.accumulatedFrameCount = 0;
    }
    ++m_UniformBufferObject.accumulatedFrameCount;
@@ -1030,7 +1006,8 @@ void RayTraceSpheres::Update(double deltaTime) {
 
 void RayTraceSpheres::RenderFrame() {
    BeginFrame();
-   m_UniformBuffers[m_CurrentImage].CopyFromHost(0, sizeof(UniformBufferObject), &m_UniformBufferObject);
+   m_UniformBuffer->BeginFrame(m_CurrentImage);
+   m_UniformBuffer->Push(m_UniformBufferObject);
    EndFrame();
 }
 
@@ -8,6 +8,7 @@ using uint = uint32_t;
 #include "Buffer.h"
 #include "Constants.h"
 #include "Image.h"
+#include "RingBuffer.h"
 #include "UniformBufferObject.h"
 #include "Vertex.h"
 
@@ -78,7 +79,7 @@ private:
    std::unique_ptr<Vulkan::Image> m_OutputImage;
    std::unique_ptr<Vulkan::Image> m_AccumumlationImage;
    UniformBufferObject m_UniformBufferObject;
-   std::vector<Vulkan::Buffer> m_UniformBuffers;
+   std::unique_ptr<Vulkan::RingBuffer> m_UniformBuffer;
    vk::PhysicalDeviceRayTracingPipelinePropertiesKHR m_RayTracingProperties;
    vk::DescriptorSetLayout m_DescriptorSetLayout;
    vk::PipelineLayout m_PipelineLayout;
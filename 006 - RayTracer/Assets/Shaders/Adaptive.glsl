@@ -0,0 +1,27 @@
+//
+// Adaptive sampling.  Shared by RayTrace.rgen and RayTrace.comp (which add each sample to the moments image)
+// and AdaptiveSampling.comp (which decides, from the moments, which pixels are sampled again).
+//
+// Moments image holds, per pixel:
+//    x = sum of sample luminance
+//    y = sum of sample luminance squared
+//    z = relative standard error of the pixel's mean luminance (i.e. estimated variance of the mean, relative to the mean)
+//    w = number of samples
+//
+// (keeps its own count, rather than going by the accumulation image's, as temporal reprojection carries accumulated samples
+// over camera movement but the moments start again)
+
+
+// Returns moments with the given sample (color) added
+vec4 AddSampleMoments(const vec4 moments, const vec3 color) {
+   const float luminance = dot(color, vec3(0.2126, 0.7152, 0.0722));
+   const float sampleCount = moments.w + 1.0;
+   const float sum = moments.x + luminance;
+   const float sumSquares = moments.y + luminance * luminance;
+   const float mean = sum / sampleCount;
+
+   // unbiased sample variance, and from that the variance of the mean
+   const float variance = sampleCount > 1.0 ? max(0.0, sumSquares - sum * mean) / (sampleCount - 1.0) : 0.0;
+   const float error = sqrt(variance / sampleCount) / (mean + 0.001);
+   return vec4(sum, sumSquares, error, sampleCount);
+}
@@ -0,0 +1,33 @@
+//
+// Shared by C++ application code and glsl shader code.
+//
+// Flattened bounding volume hierarchies, for tracing rays without the ray tracing extensions (see RayTrace.comp).
+// Built on the CPU (class BVH), two level like the hardware acceleration structures: one BVH per model, plus one over the instances.
+//
+
+// BVH build stops splitting nodes at this depth.
+// Ordered traversal pushes at most one node per level, so a stack of twice this covers both levels.
+#define BVH_MAX_DEPTH 32
+
+// Which intersection (and closest hit) code an instance uses.  Same as its shader binding table record offset in the ray tracing pipeline
+#define HITGROUP_TRIANGLES 0
+#define HITGROUP_SPHERE    1
+#define HITGROUP_BOX       2
+
+// 32 bytes.  The two children of an interior node are next to each other.
+// Indices are relative to the start of the BVH that the node belongs to (see BVHInstance)
+struct BVHNode {
+   vec3 boundsMin;
+   uint leftOrFirst;   // interior node: index of left child (right child is the next node).  leaf: index of first primitive
+   vec3 boundsMax;
+   uint count;         // number of primitives in leaf.  0 for interior nodes
+};
+
+struct BVHInstance {
+   mat4 objectToWorld;
+   mat4 worldToObject;
+   uint firstNode;        // where the instance's model BVH starts in the node array
+   uint firstPrimitive;   // and where its primitives start in the primitive array
+   uint customIndex;      // first "slot" of the instance (same as gl_InstanceCustomIndexEXT)
+   uint hitGroup;         // HITGROUP_XXX
+};
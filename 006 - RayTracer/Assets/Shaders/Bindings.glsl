@@ -10,5 +10,37 @@
 #define BINDING_MATERIALBUFFER    7
 #define BINDING_TEXTURESAMPLERS   8
 #define BINDING_SKYBOX            9
+#define BINDING_SPHEREBUFFER     10
+#define BINDING_RAYCOUNTER       11
 
-#define BINDING_NUMBINDINGS      10
+// Software ray tracing only (in place of BINDING_TLAS)
+#define BINDING_BVHNODES         12
+#define BINDING_BVHPRIMITIVES    13
+#define BINDING_BVHINSTANCES     14
+
+#define BINDING_LIGHTBUFFER      15
+
+// Adaptive sampling (see Adaptive.glsl)
+#define BINDING_MOMENTSIMAGE     16
+#define BINDING_SAMPLEMASKIMAGE  17
+
+// Denoiser (see Denoise.comp)
+#define BINDING_ALBEDOIMAGE      18
+#define BINDING_NORMALDEPTHIMAGE 19
+#define BINDING_DENOISEIMAGES    20
+
+// Temporal reprojection (see Reproject.comp)
+#define BINDING_POSITIONIMAGE    21
+#define BINDING_HISTORYIMAGE     22
+#define BINDING_HISTORYPOSITIONIMAGE 23
+
+// Low discrepancy samplers (see Sampler.glsl)
+#define BINDING_SOBOLBUFFER      24
+#define BINDING_BLUENOISEBUFFER  25
+
+// Wavefront path tracing (see Wavefront.glsl)
+#define BINDING_PATHSTATES       26
+#define BINDING_RAYQUEUES        27
+#define BINDING_QUEUESTATS       28
+
+#define BINDING_NUMBINDINGS      29
@@ -1,8 +1,7 @@
 //
 // Shared by C++ application code and glsl shader code.
-struct Constants {
-   uint minRayBounces; // the minimum number of ray bounces before we will consider terminating rays (via Russian Roulette)
-   uint maxRayBounces;
-   float lensAperture;
-   float lensFocalLength;
+//
+// Push constants of the denoiser (see Denoise.comp), which has a pipeline layout of its own
+struct DenoiseConstants {
+   uint iteration;  // which pass this is.  Filter taps are 2^iteration pixels apart
 };
@@ -0,0 +1,17 @@
+//
+// Shared by C++ application code and glsl shader code.
+//
+// Emissive surfaces that are sampled directly, for next event estimation (see RayTracer::CreateLightBuffer() and Scatter.glsl)
+
+#define LIGHT_TRIANGLE 0
+#define LIGHT_SPHERE   1
+
+// 48 bytes.  All world space
+struct Light {
+   vec3 position;          // triangle: first vertex.  sphere: centre
+   uint type;              // LIGHT_XXX
+   vec3 edge1;             // triangle: second vertex - first vertex.  sphere: radius is in x
+   uint materialIndex;     // "slot" of the light's instance and primitive
+   vec3 edge2;             // triangle: third vertex - first vertex.  Edges are ordered so that cross(edge1, edge2) is on the same side as the surface normal
+   float cumulativePower;  // power of this light plus all of the ones before it.  For choosing lights with probability proportional to their power
+};
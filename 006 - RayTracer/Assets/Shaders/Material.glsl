@@ -8,6 +8,7 @@
 #define MATERIAL_DIELECTRIC   3
 #define MATERIAL_LIGHT        4
 #define MATERIAL_SMOKE        5
+#define MATERIAL_ANY          0xffffffffu  // shaders that are not specialized for one material type (see Scatter.glsl)
 
 // Be careful with alignment...
 struct Material {
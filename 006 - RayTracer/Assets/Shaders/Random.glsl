@@ -93,14 +93,22 @@ mat3x3 GetOrthoNormalBasis(const vec3 normal) {
 // alpha = 0 -> uniform sampling
 // alpha = 1 -> cosine sampling
 // alpha > 1 -> phong sampling
-vec3 RandomOnUnitHemisphere(const vec3 normal, const float alpha, inout uint seed) {
-   const float cosTheta = pow((1.0 - RandomFloat(0.0, 1.0, seed)), 1.0 / (alpha + 1.0));
+// u is a point in the unit square (e.g. from Sample() in Sampler.glsl)
+vec3 RandomOnUnitHemisphere(const vec3 normal, const float alpha, const vec2 u) {
+   const float cosTheta = pow((1.0 - u.x), 1.0 / (alpha + 1.0));
    const float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
-   const float phi = RandomFloat(0.0, 2.0 * 3.1415926535897932384626433832795, seed);
+   const float phi = 2.0 * 3.1415926535897932384626433832795 * u.y;
    return GetOrthoNormalBasis(normal) * vec3(cos(phi) * sinTheta, sin(phi) * sinTheta, cosTheta);
 }
 
 
+vec3 RandomOnUnitHemisphere(const vec3 normal, const float alpha, inout uint seed) {
+   const float u = RandomFloat(seed);
+   const float v = RandomFloat(seed);
+   return RandomOnUnitHemisphere(normal, alpha, vec2(u, v));
+}
+
+
 // Generate a unit vector on the hemisphere about specified normal,
 // with uniform probability distribution.
 // Excludes vectors exactly perpendicular to the normal.
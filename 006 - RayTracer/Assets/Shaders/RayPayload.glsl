@@ -1,7 +1,12 @@
 struct RayPayload
 {
    vec4 attenuationAndDistance; // rgb,t
-   vec4 emission;               // rgb,notused
+   vec4 emission;               // rgb,lightPdf          lightPdf is density (per solid angle) with which next event estimation would have chosen this point on a light.  0 if it would not have
    vec4 scatterDirection;       // xyz,isScattered
    uint randomSeed;
+   vec4 lightDirection;         // xyz,distance          next event estimation: direction and distance to a point chosen on a light.  distance is 0 if no light was sampled
+   vec4 lightContribution;      // rgb,scatterPdf        what that point contributes if nothing is in the way (already weighted for multiple importance sampling).  scatterPdf is density with which scatterDirection was chosen (0 if specular)
+   vec4 albedo;                 // rgb,unused            surface color and (world space) normal at the hit point.  The ray generation shader keeps those of the first hit for the denoiser (see Denoise.comp)
+   vec4 normal;                 // xyz,unused
+   uvec4 sampleState;           // sample generator state (see Sampler.glsl).  Passed through unchanged by the closest hit shaders
 };
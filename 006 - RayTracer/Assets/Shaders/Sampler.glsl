@@ -0,0 +1,141 @@
+#include "SamplerTables.glsl"
+
+// Sample generators for the dimensions of a path that matter most: where in the pixel the camera ray goes, and at each bounce,
+// the scatter direction and the point chosen on a light.
+// Everything else (Russian roulette, metallic fuzz, smoke, ...) still draws from the random number generator in Random.glsl.
+//
+// Dimensions are handed out in groups of four.  Each group gets its own scramble, so that the groups are independent of one
+// another (that is, a 4D sequence "padded" out to the length of the path), and the same group is used for the same thing
+// at the same bounce of every sample of a pixel.
+//
+// Sample state (uvec4, carried from bounce to bounce in RayPayload::sampleState):
+//    x = scramble seed
+//    y = sample index (0, 1, 2, ... since accumulation last started again)
+//    z = bounce (low 16 bits), SAMPLER_XXX (high 16 bits)
+//    w = pixel (x in the low 16 bits, y in the high 16 bits)
+
+#define SAMPLE_GROUP_CAMERA      0   // xy = position within pixel.  Once per sample
+#define SAMPLE_GROUP_SCATTER     1   // x = choice of lobe (or of reflection vs. refraction), yz = direction.  Once per bounce
+#define SAMPLE_GROUP_LIGHT       2   // x = choice of light, yz = point on it.  Once per bounce
+#define SAMPLE_GROUPS_PER_BOUNCE 2
+
+layout(set = 0, binding = BINDING_SOBOLBUFFER) readonly buffer SobolArray { uint sobolMatrices[]; };   // SOBOL_BITS per dimension
+layout(set = 0, binding = BINDING_BLUENOISEBUFFER) readonly buffer BlueNoiseArray { float blueNoise[]; };
+
+
+// "lowbias32" integer hash
+// https://nullprogram.com/blog/2018/07/31/
+uint Hash(uint x) {
+   x ^= x >> 16;
+   x *= 0x7feb352d;
+   x ^= x >> 15;
+   x *= 0x846ca68b;
+   x ^= x >> 16;
+   return x;
+}
+
+
+uint HashCombine(const uint seed, const uint value) {
+   return seed ^ (value + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+
+// Random permutation of the bits of x in which each bit only depends on the bits below it
+// Vegdahl "Building a Better LK Hash" (2021): better avalanche than the Laine-Karras style hash in
+// Burley "Practical Hash-based Owen Scrambling" (2020), which NestedUniformScramble() is otherwise as described in
+uint LaineKarrasPermutation(uint x, const uint seed) {
+   x ^= x * 0x3d20adea;
+   x += seed;
+   x *= (seed >> 16) | 1;
+   x ^= x * 0x05526c56;
+   x ^= x * 0x53a22864;
+   return x;
+}
+
+
+// Owen scrambling: each bit is flipped (or not) depending on the bits above it
+uint NestedUniformScramble(const uint x, const uint seed) {
+   return bitfieldReverse(LaineKarrasPermutation(bitfieldReverse(x), seed));
+}
+
+
+uint Sobol(uint index, const uint dimension) {
+   uint x = 0;
+   for (uint bit = 0; index != 0; ++bit, index >>= 1) {
+      if ((index & 1) != 0) {
+         x ^= sobolMatrices[dimension * SOBOL_BITS + bit];
+      }
+   }
+   return x;
+}
+
+
+// uint to float in [0, 1).  Top 24 bits only, so that it cannot round up to 1
+float UintToFloat(const uint x) {
+   return float(x >> 8) / 16777216.0;
+}
+
+
+vec4 SampleRandom(const uint index, const uint seed) {
+   const uint hash = HashCombine(seed, index);
+   return vec4(
+      UintToFloat(Hash(HashCombine(hash, 0))),
+      UintToFloat(Hash(HashCombine(hash, 1))),
+      UintToFloat(Hash(HashCombine(hash, 2))),
+      UintToFloat(Hash(HashCombine(hash, 3)))
+   );
+}
+
+
+// Sample index is shuffled (so that every pixel takes the points of the sequence in a different order) and then each dimension
+// is Owen scrambled (so that every pixel gets a different set of points, but with the same stratification)
+vec4 SampleSobol(uint index, const uint seed) {
+   index = NestedUniformScramble(index, seed);
+   vec4 u;
+   for (uint dimension = 0; dimension < SOBOL_DIMENSIONS; ++dimension) {
+      u[dimension] = UintToFloat(NestedUniformScramble(Sobol(index, dimension), HashCombine(seed, dimension)));
+   }
+   return u;
+}
+
+
+// Blue noise texture tiled over the pixels (shifted by a different amount for each dimension), and then for successive samples
+// stepped along by the golden ratio (additive recurrence), so that each pixel is also well spread over samples.
+// Seed must be the same for all pixels, or there is no blue noise left between them
+vec4 SampleBlueNoise(const uvec2 pixel, const uint index, const uint seed) {
+   vec4 u;
+   for (uint dimension = 0; dimension < 4; ++dimension) {
+      const uint shift = Hash(HashCombine(seed, dimension));
+      const uvec2 p = (pixel + uvec2(shift, shift >> 16)) % BLUENOISE_SIZE;
+      const uint noise = uint(blueNoise[p.y * BLUENOISE_SIZE + p.x] * 4294967296.0);
+      u[dimension] = UintToFloat(noise + index * 0x9e3779b9);  // 0x9e3779b9 = 2^32 / golden ratio
+   }
+   return u;
+}
+
+
+// accumulationSeed must change each time accumulation starts again (so that the new samples are not the same as the old ones)
+uvec4 InitSampler(const uvec2 pixel, const uint sampleIndex, const uint accumulationSeed, const uint samplerType) {
+   const uint scrambleSeed = samplerType == SAMPLER_BLUENOISE ? Hash(accumulationSeed) : Hash(HashCombine(HashCombine(accumulationSeed, pixel.x), pixel.y));
+   return uvec4(scrambleSeed, sampleIndex, samplerType << 16, (pixel.x & 0xffff) | (pixel.y << 16));
+}
+
+
+void SetSampleBounce(inout uvec4 sampleState, const uint bounce) {
+   sampleState.z = (sampleState.z & 0xffff0000) | bounce;
+}
+
+
+// Four dimensions, each in [0, 1), for the given group (SAMPLE_GROUP_XXX) at the current bounce of sampleState
+vec4 Sample(const uvec4 sampleState, const uint group) {
+   const uint bounce = sampleState.z & 0xffff;
+   const uint samplerType = sampleState.z >> 16;
+   const uint seed = Hash(HashCombine(sampleState.x, group == SAMPLE_GROUP_CAMERA ? group : group + SAMPLE_GROUPS_PER_BOUNCE * bounce));
+   switch (samplerType) {
+      case SAMPLER_SOBOL:
+         return SampleSobol(sampleState.y, seed);
+      case SAMPLER_BLUENOISE:
+         return SampleBlueNoise(uvec2(sampleState.w & 0xffff, sampleState.w >> 16), sampleState.y, seed);
+   }
+   return SampleRandom(sampleState.y, seed);
+}
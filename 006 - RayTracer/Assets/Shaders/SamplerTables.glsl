@@ -0,0 +1,14 @@
+//
+// Shared by C++ application code and glsl shader code.
+//
+// Sample generators (UniformBufferObject::samplerType), and the sizes of the tables that some of them need.
+// Tables are generated by the application (see SamplerTables.h) and read by Sampler.glsl
+
+#define SAMPLER_RANDOM    0   // hashed, independent random numbers
+#define SAMPLER_SOBOL     1   // Owen scrambled, shuffled Sobol sequence
+#define SAMPLER_BLUENOISE 2   // tiled blue noise over pixels, golden ratio sequence over samples
+
+#define SOBOL_DIMENSIONS  4   // Sobol generator matrices: one uint per bit (SOBOL_BITS) per dimension
+#define SOBOL_BITS       32
+
+#define BLUENOISE_SIZE   64   // blue noise texture is BLUENOISE_SIZE x BLUENOISE_SIZE floats, each in [0, 1)
@@ -1,16 +1,31 @@
 #extension GL_EXT_nonuniform_qualifier : require
 
+#include "Light.glsl"
 #include "Material.glsl"
 #include "Random.glsl"
 #include "RayPayload.glsl"
+#include "Sampler.glsl"
 #include "SNoise.glsl"
+#include "Specialization.glsl"
 #include "Texture.glsl"
+#include "UniformBufferObject.glsl"
 
-layout(set = 0, binding = BINDING_TLAS) uniform accelerationStructureEXT world;
+// Does not use any ray tracing built-ins (the incoming ray direction and hit distance are parameters instead),
+// so that it can be shared by the closest hit shaders and by software ray tracing (RayTrace.comp)
+
+layout(set = 0, binding = BINDING_UNIFORMBUFFER) readonly uniform UBO {
+   UniformBufferObject ubo;
+};
 layout(set = 0, binding = BINDING_MATERIALBUFFER) readonly buffer MaterialArray { Material materials[]; };
 layout(set = 0, binding = BINDING_TEXTURESAMPLERS) uniform sampler2D[] samplers;
+layout(set = 0, binding = BINDING_LIGHTBUFFER) readonly buffer LightArray { Light lights[]; };
+
+// Material type that ScatterMaterial() is compiled for.  The application specializes the closest hit shaders once for each material
+// in the scene (see RayTracer::CreatePipeline()), and the wavefront shade kernel once for each shade queue, so that each of those has
+// only its own material's code in it.  MATERIAL_ANY (for hits on more than one type of material) switches on the material's type instead
+layout(constant_id = SPECIALIZATION_MATERIALTYPE) const uint specializedMaterialType = MATERIAL_ANY;
 
-layout(location = 1) rayPayloadEXT RayPayload ray1;
+const float pi = 3.1415926535897932384626433832795;
 
 float Schlick(float cosine, float refractiveIndex) {
     float r0 = (1 - refractiveIndex) / (1 + refractiveIndex);
@@ -96,8 +111,119 @@ vec3 Color(const vec3 hitPoint, const vec3 normal, const vec2 texCoord, const in
    }
 }
 
+float Luminance(const vec3 color) {
+   return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+
+// Whether next event estimation samples surfaces with this material.  Must agree with RayTracer::CreateLightBuffer()
+bool IsSampledLight(const Material material) {
+   return (ubo.lightCount > 0) && (material.type == MATERIAL_LIGHT) && (material.diffuseTextureType == TEXTURE_FLATCOLOR) && (Luminance(material.diffuseTextureParam1.rgb) > 0.0);
+}
+
+
+// How much of a light material's color is emitted in the given direction (which is towards the light), from a point with the given normal
+float EmissionFactor(const Material material, const vec3 direction, const vec3 normal) {
+   if(material.materialParameter1 > 0.0) {
+      return pow(max(0.0, -dot(direction, normal)), material.materialParameter1);
+   }
+   return 1.0;
+}
+
+
+// Density (per unit solid angle) with which next event estimation chooses the point at the given distance and direction on a sampled light.
+// Lights are chosen with probability proportional to power (= luminance * area), and then a point on the light uniformly by area.
+// So density per unit area is the same everywhere on a light (its luminance / total power), and the area itself does not matter
+float LightPdf(const Material material, const float distance, const vec3 direction, const vec3 normal) {
+   const float cosine = abs(dot(direction, normal));
+   if (cosine <= 0.0) {
+      return 0.0;
+   }
+   return Luminance(material.diffuseTextureParam1.rgb) / ubo.totalLightPower * distance * distance / cosine;
+}
+
+
+// Chooses a light (with probability proportional to its power, by u.x), and then a point on it (uniformly by area, by u.yz).
+// Returns the light's material index
+uint SampleLight(const vec3 u, out vec3 lightPoint, out vec3 lightNormal) {
+   // first light whose cumulative power is more than a random fraction of the total
+   const float power = u.x * ubo.totalLightPower;
+   uint first = 0;
+   uint count = ubo.lightCount;
+   while (count > 0) {
+      const uint step = count / 2;
+      if (lights[first + step].cumulativePower <= power) {
+         first += step + 1;
+         count -= step + 1;
+      } else {
+         count = step;
+      }
+   }
+   const Light light = lights[min(first, ubo.lightCount - 1)];
+
+   if (light.type == LIGHT_SPHERE) {
+      const float z = 1.0 - 2.0 * u.y;
+      const float r = sqrt(max(0.0, 1.0 - z * z));
+      const float phi = 2.0 * pi * u.z;
+      lightNormal = vec3(r * cos(phi), r * sin(phi), z);
+      lightPoint = light.position + light.edge1.x * lightNormal;
+   } else {
+      const float su = sqrt(u.y);
+      lightPoint = light.position + su * (1.0 - u.z) * light.edge1 + su * u.z * light.edge2;
+      lightNormal = normalize(cross(light.edge1, light.edge2));
+   }
+   return light.materialIndex;
+}
 
-RayPayload ScatterLambertian(const vec3 hitPoint, const vec3 normal, const vec3 color, inout uint randomSeed) {
+
+// BRDF times cosine (rgb) for light leaving in the given direction, and the density with which Scatter() would have chosen that direction (w).
+// This is for the diffuse plus Phong specular lobes of MATERIAL_PHONG, chosen between with the given probabilities.
+// MATERIAL_LAMBERTIAN is the same, with diffuse lobe only.
+vec4 EvaluatePhong(const vec3 rayDirection, const vec3 normal, const vec3 direction, const vec3 diffuse, const vec3 specular, const float alpha, const float diffuseChance, const float specularChance) {
+   const float cosine = max(0.0, dot(normal, direction));
+   const float specularLobe = pow(max(0.0, dot(reflect(rayDirection, normal), direction)), alpha);
+   const vec3 brdf = diffuse / pi + specular * (alpha + 2.0) / (2.0 * pi) * specularLobe;
+   const float pdf = diffuseChance * cosine / pi + specularChance * (alpha + 1.0) / (2.0 * pi) * specularLobe;
+   return vec4(brdf * cosine, pdf);
+}
+
+
+// Next event estimation at a diffuse or Phong surface.  Chooses a point on a light, and fills in ray.lightDirection and ray.lightContribution
+// with what that point would contribute if nothing is in the way (the caller checks that, with a shadow ray).
+// Contribution is weighted (power heuristic) against the chance of the scattered ray having found the same point.
+void SampleLights(const vec3 rayDirection, const vec3 hitPoint, const vec3 normal, const vec3 diffuse, const vec3 specular, const float alpha, const float diffuseChance, const float specularChance, const uvec4 sampleState, inout RayPayload ray) {
+   ray.lightDirection = vec4(0.0);
+   ray.lightContribution.rgb = vec3(0.0);
+   if (ubo.lightCount == 0) {
+      return;
+   }
+
+   vec3 lightPoint;
+   vec3 lightNormal;
+   const Material light = materials[SampleLight(Sample(sampleState, SAMPLE_GROUP_LIGHT).xyz, lightPoint, lightNormal)];
+
+   const vec3 toLight = lightPoint - hitPoint;
+   const float distance = length(toLight);
+   if (distance <= 0.0) {
+      return;
+   }
+   const vec3 direction = toLight / distance;
+
+   const float lightPdf = LightPdf(light, distance, direction, lightNormal);
+   const vec4 bsdf = EvaluatePhong(rayDirection, normal, direction, diffuse, specular, alpha, diffuseChance, specularChance);
+   if ((lightPdf <= 0.0) || (bsdf.w <= 0.0)) {
+      return;
+   }
+
+   const vec3 emission = EmissionFactor(light, direction, lightNormal) * light.diffuseTextureParam1.rgb;
+   const float weight = (lightPdf * lightPdf) / (lightPdf * lightPdf + bsdf.w * bsdf.w);
+   ray.lightDirection = vec4(direction, distance);
+   ray.lightContribution.rgb = bsdf.rgb * emission * weight / lightPdf;
+}
+
+
+// u is a point in the unit square, for the scatter direction
+RayPayload ScatterLambertian(const float hitT, const vec3 hitPoint, const vec3 normal, const vec3 color, const vec2 u, inout uint randomSeed) {
    //
    // sample a scatter direction.
    //
@@ -118,29 +244,35 @@ RayPayload ScatterLambertian(const vec3 hitPoint, const vec3 normal, const vec3
    // color = kd/pi  *  dot(normal, scatter direction)  /  probability of choosing scatter direction
    //
    // Here we are returning the color for Lambertian with cosine weighted sampling, which is just Kd, irrespective of scatter direction
-   const vec3 scatterDirection = RandomOnUnitHemisphere(normal, 1.0, randomSeed);
-   return RayPayload(vec4(color, gl_HitTEXT), vec4(0.0), vec4(scatterDirection, 1.0), randomSeed);
+   const vec3 scatterDirection = RandomOnUnitHemisphere(normal, 1.0, u);
+   return RayPayload(vec4(color, hitT), vec4(0.0), vec4(scatterDirection, 1.0), randomSeed, vec4(0.0), vec4(0.0), vec4(0.0), vec4(0.0), uvec4(0));
 }
 
 
-RayPayload ScatterMetallic(const vec3 hitPoint, const vec3 normal, const vec3 color, const float roughness, inout uint randomSeed) {
-   const vec3 scatterDirection = normalize(reflect(gl_WorldRayDirectionEXT, normal) + roughness * RandomInUnitSphere(randomSeed));
-   return RayPayload(vec4(color, gl_HitTEXT), vec4(0.0), vec4(scatterDirection, 1.0), randomSeed);
+RayPayload ScatterMetallic(const vec3 rayDirection, const float hitT, const vec3 hitPoint, const vec3 normal, const vec3 color, const float roughness, inout uint randomSeed) {
+   const vec3 scatterDirection = normalize(reflect(rayDirection, normal) + roughness * RandomInUnitSphere(randomSeed));
+   return RayPayload(vec4(color, hitT), vec4(0.0), vec4(scatterDirection, 1.0), randomSeed, vec4(0.0), vec4(0.0), vec4(0.0), vec4(0.0), uvec4(0));
 }
 
 
-RayPayload Scatter(const vec3 hitPoint, const vec3 normal, const vec2 texCoord, const uint materialIndex, inout uint randomSeed) {
-   Material material = materials[materialIndex];
-
-   switch(material.type) {
+// albedo is the surface color that the denoiser divides out of the lighting (see Denoise.comp)
+RayPayload ScatterMaterial(const vec3 rayDirection, const float hitT, const vec3 hitPoint, const vec3 normal, const vec2 texCoord, const Material material, const uvec4 sampleState, out vec3 albedo, inout uint randomSeed) {
+   switch((specializedMaterialType == MATERIAL_ANY) ? material.type : specializedMaterialType) {
 
       case MATERIAL_LAMBERTIAN: {
-         return ScatterLambertian(hitPoint, normal, Color(hitPoint, normal, texCoord, material.diffuseTextureType, material.diffuseTextureParam1, material.diffuseTextureParam2), randomSeed);
+         const vec3 diffuse = Color(hitPoint, normal, texCoord, material.diffuseTextureType, material.diffuseTextureParam1, material.diffuseTextureParam2);
+         albedo = diffuse;
+         RayPayload ray = ScatterLambertian(hitT, hitPoint, normal, diffuse, Sample(sampleState, SAMPLE_GROUP_SCATTER).yz, randomSeed);
+         ray.lightContribution.w = EvaluatePhong(rayDirection, normal, ray.scatterDirection.xyz, diffuse, vec3(0.0), 1.0, 1.0, 0.0).w;
+         SampleLights(rayDirection, hitPoint, normal, diffuse, vec3(0.0), 1.0, 1.0, 0.0, sampleState, ray);
+         randomSeed = ray.randomSeed;
+         return ray;
       }
 
       case MATERIAL_PHONG: {
          const vec3 specular = Color(hitPoint, normal, texCoord, material.specularTextureType, material.specularTextureParam1, material.specularTextureParam2);
          const vec3 diffuse = min(1.0 - specular, Color(hitPoint, normal, texCoord, material.diffuseTextureType, material.diffuseTextureParam1, material.diffuseTextureParam2));
+         albedo = diffuse + specular;
 
          float specularChance = dot(specular, vec3(1.0 / 3.0));
          float diffuseChance = dot(diffuse, vec3(1.0 / 3.0));
@@ -153,21 +285,27 @@ RayPayload Scatter(const vec3 hitPoint, const vec3 normal, const vec2 texCoord,
             specularChance = 0.0f;
          }
 
-         const float select = RandomFloat(randomSeed);
-         if (select < specularChance) {
-            const float alpha = pow(10000.0f, material.materialParameter1 * material.materialParameter1);
-            const vec3 scatterDirection = RandomOnUnitHemisphere(reflect(gl_WorldRayDirectionEXT, normal), alpha, randomSeed);
+         const float alpha = pow(10000.0f, material.materialParameter1 * material.materialParameter1);
+         RayPayload ray;
+         const vec4 u = Sample(sampleState, SAMPLE_GROUP_SCATTER);
+         if (u.x < specularChance) {
+            const vec3 scatterDirection = RandomOnUnitHemisphere(reflect(rayDirection, normal), alpha, u.yz);
             const float f = (alpha + 2.0) / (alpha + 1.0);
             // note: cannot get here if specularChance is zero, so there is no division by zero.
-            return RayPayload(vec4(specular / specularChance * clamp(dot(normal, scatterDirection), 0.0, 1.0) * f, gl_HitTEXT), vec4(0.0), vec4(scatterDirection, 1.0), randomSeed);
+            ray = RayPayload(vec4(specular / specularChance * clamp(dot(normal, scatterDirection), 0.0, 1.0) * f, hitT), vec4(0.0), vec4(scatterDirection, 1.0), randomSeed, vec4(0.0), vec4(0.0), vec4(0.0), vec4(0.0), uvec4(0));
          } else {
             // note: cannot get here if diffuseChance is zero, so there is no division by zero.
-            return ScatterLambertian(hitPoint, normal, diffuse / diffuseChance, randomSeed);
+            ray = ScatterLambertian(hitT, hitPoint, normal, diffuse / diffuseChance, u.yz, randomSeed);
          }
+         ray.lightContribution.w = EvaluatePhong(rayDirection, normal, ray.scatterDirection.xyz, diffuse, specular, alpha, diffuseChance, specularChance).w;
+         SampleLights(rayDirection, hitPoint, normal, diffuse, specular, alpha, diffuseChance, specularChance, sampleState, ray);
+         randomSeed = ray.randomSeed;
+         return ray;
       }
 
       case MATERIAL_METALLIC: {
-         return ScatterMetallic(hitPoint, normal, Color(hitPoint, normal, texCoord, material.specularTextureType, material.specularTextureParam1, material.specularTextureParam2), material.materialParameter1, randomSeed);
+         albedo = Color(hitPoint, normal, texCoord, material.specularTextureType, material.specularTextureParam1, material.specularTextureParam2);
+         return ScatterMetallic(rayDirection, hitT, hitPoint, normal, albedo, material.materialParameter1, randomSeed);
       }
 
       case MATERIAL_DIELECTRIC: {
@@ -175,46 +313,61 @@ RayPayload Scatter(const vec3 hitPoint, const vec3 normal, const vec2 texCoord,
          float ni_over_nt;
          float reflectProbability;
          float cosine;
-         if (dot(gl_WorldRayDirectionEXT, normal) > 0.0) {
+         if (dot(rayDirection, normal) > 0.0) {
             outward_normal = -normal;
             ni_over_nt = material.materialParameter1;
-            cosine = ni_over_nt * dot(gl_WorldRayDirectionEXT, normal);
+            cosine = ni_over_nt * dot(rayDirection, normal);
          } else {
             outward_normal = normal;
             ni_over_nt = 1.0 / material.materialParameter1;
-            cosine = -dot(gl_WorldRayDirectionEXT, normal);
+            cosine = -dot(rayDirection, normal);
          }
-         const vec3 refracted = refract(gl_WorldRayDirectionEXT.xyz, outward_normal, ni_over_nt);
+         const vec3 refracted = refract(rayDirection, outward_normal, ni_over_nt);
 
          // fake colored glass.. I dont think it really behaves like this (e.g. shouldn't attenuation be proportional to how much
          // of the material the ray passes through)?
-         const vec4 attenuationAndDistance = vec4(Color(hitPoint, normal, texCoord, material.diffuseTextureType, material.diffuseTextureParam1, material.diffuseTextureParam2), gl_HitTEXT);
+         const vec4 attenuationAndDistance = vec4(Color(hitPoint, normal, texCoord, material.diffuseTextureType, material.diffuseTextureParam1, material.diffuseTextureParam2), hitT);
+         albedo = attenuationAndDistance.rgb;
 
          if(dot(refracted, refracted) > 0.0) {
             reflectProbability = Schlick(cosine, material.materialParameter1);
          } else {
             reflectProbability = 1.0;
          }
-         if(RandomFloat(randomSeed) < reflectProbability) {
-            const vec3 reflected = reflect(gl_WorldRayDirectionEXT, normal);
-            return RayPayload(attenuationAndDistance, vec4(0.0), vec4(reflected, 1), randomSeed);
+         if(Sample(sampleState, SAMPLE_GROUP_SCATTER).x < reflectProbability) {
+            const vec3 reflected = reflect(rayDirection, normal);
+            return RayPayload(attenuationAndDistance, vec4(0.0), vec4(reflected, 1), randomSeed, vec4(0.0), vec4(0.0), vec4(0.0), vec4(0.0), uvec4(0));
          }
-         return RayPayload(attenuationAndDistance, vec4(0.0), vec4(refracted, 1), randomSeed);
+         return RayPayload(attenuationAndDistance, vec4(0.0), vec4(refracted, 1), randomSeed, vec4(0.0), vec4(0.0), vec4(0.0), vec4(0.0), uvec4(0));
       } 
 
       case MATERIAL_LIGHT: {
-         float emit = 1.0;
-         if(material.materialParameter1 > 0.0) {
-            emit = pow(max(0.0, -dot(gl_WorldRayDirectionEXT, normal)), material.materialParameter1);
-         }
+         const float emit = EmissionFactor(material, rayDirection, normal);
          const vec3 color = Color(hitPoint, normal, texCoord, material.diffuseTextureType, material.diffuseTextureParam1, material.diffuseTextureParam2);
-         return RayPayload(vec4(0.0, 0.0, 0.0, gl_HitTEXT), emit * vec4(color, 0.0), vec4(0.0), randomSeed);
+         const float lightPdf = IsSampledLight(material) ? LightPdf(material, hitT, rayDirection, normal) : 0.0;
+         albedo = clamp(color, 0.0, 1.0);
+         return RayPayload(vec4(0.0, 0.0, 0.0, hitT), vec4(emit * color, lightPdf), vec4(0.0), randomSeed, vec4(0.0), vec4(0.0), vec4(0.0), vec4(0.0), uvec4(0));
       }
 
       case MATERIAL_SMOKE: {
-         const vec4 attenuationAndDistance = vec4(Color(hitPoint, normal, texCoord, material.diffuseTextureType, material.diffuseTextureParam1, material.diffuseTextureParam2), gl_HitTEXT);
+         const vec4 attenuationAndDistance = vec4(Color(hitPoint, normal, texCoord, material.diffuseTextureType, material.diffuseTextureParam1, material.diffuseTextureParam2), hitT);
+         albedo = attenuationAndDistance.rgb;
          const vec3 scatterDirection = RandomUnitVector(randomSeed);
-         return RayPayload(attenuationAndDistance, vec4(0.0), vec4(scatterDirection, 1.0), randomSeed);
+         return RayPayload(attenuationAndDistance, vec4(0.0), vec4(scatterDirection, 1.0), randomSeed, vec4(0.0), vec4(0.0), vec4(0.0), vec4(0.0), uvec4(0));
       }
    }
+   albedo = vec3(0.0);
+   return RayPayload(vec4(0.0, 0.0, 0.0, hitT), vec4(0.0), vec4(0.0), randomSeed, vec4(0.0), vec4(0.0), vec4(0.0), vec4(0.0), uvec4(0));
+}
+
+
+// rayDirection is the (world space) direction of the incoming ray, and hitT the distance along it to hitPoint (i.e. gl_WorldRayDirectionEXT and gl_HitTEXT)
+// sampleState is the incoming ray's sample state (see Sampler.glsl), already set to this bounce
+RayPayload Scatter(const vec3 rayDirection, const float hitT, const vec3 hitPoint, const vec3 normal, const vec2 texCoord, const uint materialIndex, const uvec4 sampleState, inout uint randomSeed) {
+   vec3 albedo;
+   RayPayload ray = ScatterMaterial(rayDirection, hitT, hitPoint, normal, texCoord, materials[materialIndex], sampleState, albedo, randomSeed);
+   ray.albedo = vec4(albedo, 0.0);
+   ray.normal = vec4(normal, 0.0);
+   ray.sampleState = sampleState;
+   return ray;
 }
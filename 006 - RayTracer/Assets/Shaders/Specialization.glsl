@@ -0,0 +1,12 @@
+//
+// Shared by C++ application code and glsl shader code.
+//
+
+// Specialization constant ids.  Values that pipelines are compiled for, so that the compiler can fold them (and leave out the code that
+// they turn off), unlike those in the uniform buffer object which can change from one frame to the next.  All are 32 bits.
+// Ray bounce counts are deliberately not here: quality presets change them, and a preset switch must neither re-record the command
+// buffers nor compile another variant, so they stay in the uniform buffer object (and bounce loops are not unrolled)
+
+#define SPECIALIZATION_MATERIALTYPE 0   // see Scatter.glsl
+#define SPECIALIZATION_USESKYBOX    1   // see RayTrace.rmiss and TraceRay.glsl
+#define SPECIALIZATION_COUNT        2
@@ -0,0 +1,33 @@
+//
+// Shared by the shaders that write the output image (RayTrace.rgen, RayTrace.comp, Denoise.comp, Reproject.comp and WavefrontAccumulate.comp)
+// UniformBufferObject.glsl must be included first (for TONEMAP_XXX)
+
+
+// Returns what goes into the output image for the given (linear, high dynamic range) color
+vec4 Tonemap(const vec3 color, const uint tonemapOperator) {
+   // tonemap
+   vec3 pixelColor;
+   switch (tonemapOperator) {
+      case TONEMAP_REINHARD: {
+         pixelColor = color / (vec3(1.0) + color);
+         break;
+      }
+      case TONEMAP_ACES: {
+         // Narkowicz "ACES Filmic Tone Mapping Curve" (2015).  The 0.6 exposure brings it into line with the actual ACES curve
+         const vec3 x = 0.6 * color;
+         pixelColor = clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+         break;
+      }
+      default: {
+         // TONEMAP_EXPONENTIAL
+         pixelColor = vec3(1.0) - exp(-color);
+         break;
+      }
+   }
+
+   // gamma correction
+   const float gamma = 1.0 / 2.2;
+   pixelColor = pow(pixelColor, vec3(gamma));
+
+   return vec4(pixelColor, 0);
+}
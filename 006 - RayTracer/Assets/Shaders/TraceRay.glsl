@@ -0,0 +1,418 @@
+// Software ray tracing: traversal of the BVHs that were built on the CPU (see BVH.glsl), and the equivalent of the ray tracing
+// pipeline's intersection, closest hit and miss shaders.
+// Shared by the one kernel per path (RayTrace.comp) and the wavefront kernels (see Wavefront.glsl).
+// Bindings.glsl and Scatter.glsl must be included first
+
+#include "BVH.glsl"
+#include "Offset.glsl"
+#include "Vertex.glsl"
+
+layout(set = 0, binding = BINDING_VERTEXBUFFER) readonly buffer VertexArray { float vertices[]; };  // not { Vertex Vertices[]; } because glsl structure padding makes it a bit tricky
+layout(set = 0, binding = BINDING_INDEXBUFFER) readonly buffer IndexArray { uint indices[]; };
+layout(set = 0, binding = BINDING_OFFSETBUFFER) readonly buffer OffsetArray { Offset offsets[]; };
+layout(set = 0, binding = BINDING_SPHEREBUFFER) readonly buffer SphereArray { vec4 spheres[]; };
+layout(set = 0, binding = BINDING_SKYBOX) uniform samplerCube skybox;
+layout(constant_id = SPECIALIZATION_USESKYBOX) const bool useSkybox = false;  // (see RayTracer::Specialization)
+
+// Top level BVH (over instances) first, then one BVH per model
+layout(set = 0, binding = BINDING_BVHNODES) readonly buffer BVHNodeArray { BVHNode nodes[]; };
+
+// In model BVH leaf order.  Triangles: (geometry index, primitive index within geometry), procedural: (0, primitive index)
+layout(set = 0, binding = BINDING_BVHPRIMITIVES) readonly buffer BVHPrimitiveArray { uvec2 primitives[]; };
+
+// In top level BVH leaf order
+layout(set = 0, binding = BINDING_BVHINSTANCES) readonly buffer BVHInstanceArray { BVHInstance instances[]; };
+
+const float infinity = uintBitsToFloat(0x7F800000);
+
+// Shared by top and bottom level traversal.  Bottom level pushes on top of where the top level is up to.
+uint stack[2 * BVH_MAX_DEPTH];
+
+
+struct Hit {
+   float t;
+   uint instance;      // index into instances[]
+   uint primitive;     // index into primitives[]
+   uint hitKind;       // box side, for boxes
+   vec2 barycentrics;  // for triangles
+};
+
+
+// Index into materials[] (and offsets[] or spheres[]) of what was hit
+uint HitSlot(const Hit hit) {
+   const BVHInstance instance = instances[hit.instance];
+   switch (instance.hitGroup) {
+      case HITGROUP_TRIANGLES:
+         return instance.customIndex + primitives[hit.primitive].x;
+      case HITGROUP_SPHERE:
+         return instance.customIndex + primitives[hit.primitive].y;
+   }
+   return instance.customIndex;
+}
+
+
+Vertex UnpackVertex(uint index) {
+   const uint vertexSize = 8;
+   const uint offset = index * vertexSize;
+
+   Vertex v;
+   v.pos = vec3(vertices[offset + 0], vertices[offset + 1], vertices[offset + 2]);
+   v.normal = vec3(vertices[offset + 3], vertices[offset + 4], vertices[offset + 5]);
+   v.uv = vec2(vertices[offset + 6], vertices[offset + 7]);
+
+   return v;
+}
+
+
+// Distance along ray to where it enters the box, or infinity if it misses
+float IntersectBounds(const vec3 boundsMin, const vec3 boundsMax, const vec3 origin, const vec3 inverseDirection, const float tMin, const float tMax) {
+   const vec3 t0 = (boundsMin - origin) * inverseDirection;
+   const vec3 t1 = (boundsMax - origin) * inverseDirection;
+   const vec3 tNear = min(t0, t1);
+   const vec3 tFar = max(t0, t1);
+   const float enter = max(max(tNear.x, tNear.y), max(tNear.z, tMin));
+   const float exit = min(min(tFar.x, tFar.y), min(tFar.z, tMax));
+   return (enter <= exit) ? enter : infinity;
+}
+
+
+// Smoke is given a random hit distance inside the volume, seeded by invocation (that is, pixel in RayTrace.comp), ray origin and frame
+// (same as Sphere.rint and Box.rint)
+float SmokeHitDistance(const vec3 worldOrigin, const float t1, const float tMin, const float density) {
+   uint seed = InitRandomSeed(
+      InitRandomSeed(
+         InitRandomSeed(
+            InitRandomSeed(
+               InitRandomSeed(gl_GlobalInvocationID.x, gl_GlobalInvocationID.y),
+               uint(worldOrigin.x)
+            ),
+            uint(worldOrigin.y)
+         ),
+         uint(worldOrigin.z)
+      ),
+      ubo.accumulatedFrameCount
+   );
+   return max(t1, tMin) + density * log(RandomFloat(seed));
+}
+
+
+// Moller-Trumbore.  No culling (same as the ray tracing pipeline, where instances are eTriangleCullDisable)
+// Returns hit distance, or infinity if missed
+float IntersectTriangle(const BVHInstance instance, const uvec2 primitive, const vec3 origin, const vec3 direction, out vec2 barycentrics) {
+   const Offset offset = offsets[instance.customIndex + primitive.x];
+   const uint first = offset.indexOffset + primitive.y * 3;
+   const vec3 p0 = UnpackVertex(offset.vertexOffset + indices[first + 0]).pos;
+   const vec3 e1 = UnpackVertex(offset.vertexOffset + indices[first + 1]).pos - p0;
+   const vec3 e2 = UnpackVertex(offset.vertexOffset + indices[first + 2]).pos - p0;
+   const vec3 p = cross(direction, e2);
+   const float determinant = dot(e1, p);
+   if (determinant == 0.0) {
+      return infinity;
+   }
+   const float inverseDeterminant = 1.0 / determinant;
+   const vec3 s = origin - p0;
+   barycentrics.x = dot(s, p) * inverseDeterminant;
+   if ((barycentrics.x < 0.0) || (barycentrics.x > 1.0)) {
+      return infinity;
+   }
+   const vec3 q = cross(s, e1);
+   barycentrics.y = dot(direction, q) * inverseDeterminant;
+   if ((barycentrics.y < 0.0) || (barycentrics.x + barycentrics.y > 1.0)) {
+      return infinity;
+   }
+   return dot(e2, q) * inverseDeterminant;
+}
+
+
+// Sphere.rint
+float IntersectSphere(const BVHInstance instance, const uvec2 primitive, const vec3 origin, const vec3 direction, const vec3 worldOrigin, const float tMin, const float tMax) {
+   const uint slot = instance.customIndex + primitive.y;
+   const vec4 sphere = spheres[slot];
+   const vec3 oc = origin - sphere.xyz;
+   const float a = dot(direction, direction);
+   const float b = dot(oc, direction);
+   const float c = dot(oc, oc) - sphere.w * sphere.w;
+   const float discriminant = b * b - a * c;
+
+   if (discriminant >= 0) {
+      const float t1 = (-b - sqrt(discriminant)) / a;
+      const float t2 = (-b + sqrt(discriminant)) / a;
+
+      if (materials[slot].type == MATERIAL_SMOKE) {
+         const float hitDistance = SmokeHitDistance(worldOrigin, t1, tMin, materials[slot].materialParameter1);
+         if ((hitDistance <= t2) && (t2 < tMax)) {
+            return hitDistance;
+         }
+      } else if ((tMin <= t1 && t1 < tMax) || (tMin <= t2 && t2 < tMax)) {
+         return (tMin <= t1 && t1 < tMax) ? t1 : t2;
+      }
+   }
+   return infinity;
+}
+
+
+// Box.rint
+void ReportBoxHit(const float t, inout float t1, inout float t2, inout uint hitSide, const uint side) {
+   if(t < t1) {
+      if(t1 < t2) {
+         t2 = t1;
+      }
+      t1 = t;
+      hitSide = side;
+   }
+   if((t < t2) && (t > t1)) {
+      t2 = t;
+   }
+}
+
+
+void IntersectBoxFace(const int axis, const float k, const vec3 origin, const vec3 direction, const float tMax, inout float t1, inout float t2, inout uint hitSide, const uint side) {
+   const int u = (axis == 0) ? 1 : 0;
+   const int v = (axis == 2) ? 1 : 2;
+   const float t = (k - origin[axis]) / direction[axis];
+   if (t < tMax) {
+      const vec3 p = origin + t * direction;
+      if ((p[u] >= -0.5) && (p[u] < 0.5) && (p[v] >= -0.5) && (p[v] < 0.5)) {
+         ReportBoxHit(t, t1, t2, hitSide, side);
+      }
+   }
+}
+
+
+float IntersectBox(const BVHInstance instance, const vec3 origin, const vec3 direction, const vec3 worldOrigin, const float tMin, const float tMax, out uint hitSide) {
+   const float k = 0.5; // box goes from -0.5 to +0.5 in each axis
+
+   float t1 = tMax;
+   float t2 = tMax;
+   hitSide = 0;
+
+   IntersectBoxFace(2, -k, origin, direction, tMax, t1, t2, hitSide, 0);
+   IntersectBoxFace(2, k, origin, direction, tMax, t1, t2, hitSide, 1);
+   IntersectBoxFace(1, -k, origin, direction, tMax, t1, t2, hitSide, 2);
+   IntersectBoxFace(1, k, origin, direction, tMax, t1, t2, hitSide, 3);
+   IntersectBoxFace(0, -k, origin, direction, tMax, t1, t2, hitSide, 4);
+   IntersectBoxFace(0, k, origin, direction, tMax, t1, t2, hitSide, 5);
+
+   const Material material = materials[instance.customIndex];
+   if(material.type == MATERIAL_SMOKE) {
+      const float hitDistance = SmokeHitDistance(worldOrigin, t1, tMin, material.materialParameter1);
+      if ((hitDistance <= t2) && (t2 < tMax)) {
+         return hitDistance;
+      }
+   } else if ((tMin <= t1 && t1 < tMax) || (tMin <= t2 && t2 < tMax)) {
+      return (tMin <= t1 && t1 < tMax) ? t1 : t2;
+   }
+   return infinity;
+}
+
+
+// Traverse one instance's model BVH.  Returns the new tMax (which is less than the one passed in only if there was a closer hit)
+// With terminateOnFirstHit, returns as soon as there is any hit (which is then not necessarily the closest)
+float IntersectInstance(const uint instanceIndex, const vec3 worldOrigin, const vec3 worldDirection, const float tMin, float tMax, const uint stackBase, const bool terminateOnFirstHit, inout Hit hit) {
+   const BVHInstance instance = instances[instanceIndex];
+   const vec3 origin = (instance.worldToObject * vec4(worldOrigin, 1.0)).xyz;
+   const vec3 direction = (instance.worldToObject * vec4(worldDirection, 0.0)).xyz;
+   const vec3 inverseDirection = 1.0 / direction;
+
+   uint stackSize = stackBase;
+   uint node = instance.firstNode;
+   if (IntersectBounds(nodes[node].boundsMin, nodes[node].boundsMax, origin, inverseDirection, tMin, tMax) == infinity) {
+      return tMax;
+   }
+   for (;;) {
+      const uint count = nodes[node].count;
+      if (count > 0) {
+         const uint first = instance.firstPrimitive + nodes[node].leftOrFirst;
+         for (uint i = first; i < first + count; ++i) {
+            float t = infinity;
+            vec2 barycentrics = vec2(0.0);
+            uint hitKind = 0;
+            switch (instance.hitGroup) {
+               case HITGROUP_TRIANGLES:
+                  t = IntersectTriangle(instance, primitives[i], origin, direction, barycentrics);
+                  break;
+               case HITGROUP_SPHERE:
+                  t = IntersectSphere(instance, primitives[i], origin, direction, worldOrigin, tMin, tMax);
+                  break;
+               case HITGROUP_BOX:
+                  t = IntersectBox(instance, origin, direction, worldOrigin, tMin, tMax, hitKind);
+                  break;
+            }
+            if ((t >= tMin) && (t <= tMax)) {
+               tMax = t;
+               hit = Hit(t, instanceIndex, i, hitKind, barycentrics);
+               if (terminateOnFirstHit) {
+                  return tMax;
+               }
+            }
+         }
+      } else {
+         uint left = instance.firstNode + nodes[node].leftOrFirst;
+         uint right = left + 1;
+         float tLeft = IntersectBounds(nodes[left].boundsMin, nodes[left].boundsMax, origin, inverseDirection, tMin, tMax);
+         float tRight = IntersectBounds(nodes[right].boundsMin, nodes[right].boundsMax, origin, inverseDirection, tMin, tMax);
+         if (tLeft > tRight) {
+            const float t = tLeft; tLeft = tRight; tRight = t;
+            const uint n = left; left = right; right = n;
+         }
+         if (tLeft != infinity) {
+            if (tRight != infinity) {
+               stack[stackSize++] = right;
+            }
+            node = left;
+            continue;
+         }
+      }
+      if (stackSize == stackBase) {
+         break;
+      }
+      node = stack[--stackSize];
+   }
+   return tMax;
+}
+
+
+// Same as traceRayEXT() with the ray tracing pipeline, except that instead of calling the closest hit shader this returns
+// the closest hit (if there was one).  terminateOnFirstHit is gl_RayFlagsTerminateOnFirstHitEXT: stop at any hit.
+bool TraceRay(const vec3 origin, const vec3 direction, const float tMin, float tMax, const bool terminateOnFirstHit, out Hit hit) {
+   hit.t = infinity;
+   const vec3 inverseDirection = 1.0 / direction;
+
+   uint stackSize = 0;
+   uint node = 0;
+   if (IntersectBounds(nodes[node].boundsMin, nodes[node].boundsMax, origin, inverseDirection, tMin, tMax) == infinity) {
+      return false;
+   }
+   for (;;) {
+      const uint count = nodes[node].count;
+      if (count > 0) {
+         const uint first = nodes[node].leftOrFirst;
+         for (uint i = first; i < first + count; ++i) {
+            tMax = IntersectInstance(i, origin, direction, tMin, tMax, stackSize, terminateOnFirstHit, hit);
+            if (terminateOnFirstHit && (hit.t != infinity)) {
+               return true;
+            }
+         }
+      } else {
+         uint left = nodes[node].leftOrFirst;
+         uint right = left + 1;
+         float tLeft = IntersectBounds(nodes[left].boundsMin, nodes[left].boundsMax, origin, inverseDirection, tMin, tMax);
+         float tRight = IntersectBounds(nodes[right].boundsMin, nodes[right].boundsMax, origin, inverseDirection, tMin, tMax);
+         if (tLeft > tRight) {
+            const float t = tLeft; tLeft = tRight; tRight = t;
+            const uint n = left; left = right; right = n;
+         }
+         if (tLeft != infinity) {
+            if (tRight != infinity) {
+               stack[stackSize++] = right;
+            }
+            node = left;
+            continue;
+         }
+      }
+      if (stackSize == 0) {
+         break;
+      }
+      node = stack[--stackSize];
+   }
+   return hit.t != infinity;
+}
+
+
+bool TraceRay(const vec3 origin, const vec3 direction, const float tMin, const float tMax, out Hit hit) {
+   return TraceRay(origin, direction, tMin, tMax, false, hit);
+}
+
+
+// Occlusion (shadow) rays: is there anything at all between tMin and tMax?
+// Same as the shadow ray in RayTrace.rgen (gl_RayFlagsTerminateOnFirstHitEXT | gl_RayFlagsSkipClosestHitShaderEXT)
+bool IsOccluded(const vec3 origin, const vec3 direction, const float tMin, const float tMax) {
+   Hit hit;
+   return TraceRay(origin, direction, tMin, tMax, true, hit);
+}
+
+
+// Triangles.rchit, Sphere.rchit, box.rchit
+RayPayload ClosestHit(const Hit hit, const vec3 worldOrigin, const vec3 worldDirection, const uvec4 sampleState, uint randomSeed) {
+   const BVHInstance instance = instances[hit.instance];
+   const uvec2 primitive = primitives[hit.primitive];
+   const vec3 origin = (instance.worldToObject * vec4(worldOrigin, 1.0)).xyz;
+   const vec3 direction = (instance.worldToObject * vec4(worldDirection, 0.0)).xyz;
+
+   vec3 hitPoint;
+   vec3 normal;
+   vec2 texCoord = vec2(0.0);
+   const uint slot = HitSlot(hit);
+
+   switch (instance.hitGroup) {
+      case HITGROUP_TRIANGLES: {
+         const Offset offset = offsets[slot];
+         const uint first = offset.indexOffset + primitive.y * 3;
+         const Vertex v0 = UnpackVertex(offset.vertexOffset + indices[first + 0]);
+         const Vertex v1 = UnpackVertex(offset.vertexOffset + indices[first + 1]);
+         const Vertex v2 = UnpackVertex(offset.vertexOffset + indices[first + 2]);
+
+         const vec3 barycentric = vec3(1.0f - hit.barycentrics.x - hit.barycentrics.y, hit.barycentrics.x, hit.barycentrics.y);
+
+         hitPoint = v0.pos * barycentric.x + v1.pos * barycentric.y + v2.pos * barycentric.z;
+         normal = normalize(v0.normal * barycentric.x + v1.normal * barycentric.y + v2.normal * barycentric.z);
+         texCoord = v0.uv * barycentric.x + v1.uv * barycentric.y + v2.uv * barycentric.z;
+         break;
+      }
+
+      case HITGROUP_SPHERE: {
+         const vec4 sphere = spheres[slot];
+         hitPoint = origin + hit.t * direction;
+         normal = normalize(hitPoint - sphere.xyz); // note. hitPoint is not necessarily on surface of sphere (e.g. if material is smoke)
+
+         const float phi = atan(normal.x, normal.z);
+         const float theta = asin(normal.y);
+
+         texCoord = vec2((phi + pi) / (2.0 * pi), 1 - (theta + pi / 2.0) / pi);
+         break;
+      }
+
+      case HITGROUP_BOX: {
+         const vec3 normals[6] = {vec3(0.0, 0.0, -1.0), vec3(0.0, 0.0, 1.0), vec3(0.0, -1.0, 0.0), vec3(0.0, 1.0, 0.0), vec3(-1.0, 0.0, 0.0), vec3(1.0, 0.0, 0.0)};
+         hitPoint = origin + hit.t * direction;
+         normal = normals[hit.hitKind];
+         switch(hit.hitKind) {
+            case 0:
+            case 1:
+               texCoord = hitPoint.xy;
+               break;
+            case 2:
+            case 3:
+               texCoord = hitPoint.xz;
+               break;
+            case 4:
+            case 5:
+               texCoord = hitPoint.yz;
+               break;
+         }
+         break;
+      }
+   }
+
+   // Transform hitPoint and normal to world coords for "scatter" function (texCoords should not be transformed)
+   const vec3 hitPointW = (instance.objectToWorld * vec4(hitPoint, 1.0)).xyz;
+   const vec3 normalW = normalize((instance.objectToWorld * vec4(normal, 0.0)).xyz);
+
+   return Scatter(worldDirection, hit.t, hitPointW, normalW, texCoord, slot, sampleState, randomSeed);
+}
+
+
+// RayTrace.rmiss
+void Miss(const vec3 direction, inout RayPayload ray) {
+   const float t = clamp(normalize(direction).y, 0.0, 1.0);
+   ray.attenuationAndDistance = vec4(vec3(1.0), -1.0);
+   if(useSkybox) {
+      ray.emission = vec4(texture(skybox, normalize(direction)).rgb, 0.0);
+   } else {
+      ray.emission = vec4(mix(ubo.horizonColor, ubo.zenithColor, t).rgb, 0.0);
+   }
+   ray.scatterDirection = vec4(0.0);
+   ray.lightDirection = vec4(0.0);
+   ray.albedo = vec4(1.0);
+   ray.normal = vec4(-normalize(direction), 0.0);
+}
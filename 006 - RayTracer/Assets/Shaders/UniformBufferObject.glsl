@@ -1,13 +1,34 @@
 //
 // Shared by C++ application code and glsl shader code.
 //
+// Tonemapping operators (UniformBufferObject::tonemapOperator, see Tonemap.glsl)
+#define TONEMAP_EXPONENTIAL 0
+#define TONEMAP_REINHARD    1
+#define TONEMAP_ACES        2
+
+// Everything here can change from one frame to the next without anything being re-recorded or recompiled.
+// (Things that the shaders are compiled for are specialization constants instead, see Specialization.glsl)
 // Data members of UniformBufferObject must be aligned per glsl rules
 // Here, means to 16 bytes (because mat4)
 struct UniformBufferObject {
    mat4 viewInverse;
    mat4 projInverse;
+   mat4 previousViewProjection;  // temporal reprojection: camera of the frame before this one
    vec4 horizonColor;
    vec4 zenithColor;
-   uint useSkybox;
    uint accumulatedFrameCount;
+   uint frameNumber;          // counts every frame (unlike accumulatedFrameCount, which restarts when the camera moves).  For random number seeds
+   uint lightCount;           // number of lights sampled by next event estimation.  0 = next event estimation is off
+   float totalLightPower;     // sum of power of all of those lights
+   float adaptiveThreshold;   // adaptive sampling: pixels stop being sampled once their relative error is below this.  0 = adaptive sampling is off
+   uint adaptiveMinSamples;   // adaptive sampling: every pixel gets at least this many samples
+   uint denoiseIterations;    // number of denoiser passes (see Denoise.comp).  0 = denoiser is off, and the first hit albedo, normal and depth are not written
+   uint temporalHistoryLength; // temporal reprojection: most samples per pixel that are carried over when the camera moves.  0 = temporal reprojection is off
+   uint isReprojecting;       // temporal reprojection: 1 if the camera has moved since the previous frame (so this frame's samples start again, with what was accumulated before reprojected onto them)
+   uint samplerType;          // SAMPLER_XXX (see SamplerTables.glsl)
+   uint minRayBounces;        // russian roulette can end paths after this many bounces.  This and maxRayBounces are set by the quality preset
+   uint maxRayBounces;
+   float lensAperture;        // (thin lens camera is disabled, see RayTrace.rgen)
+   float lensFocalLength;     //
+   uint tonemapOperator;      // TONEMAP_XXX
 };
@@ -0,0 +1,47 @@
+//
+// Shared by C++ application code and glsl shader code.
+//
+// Wavefront path tracing (Laine, Karras, Aila "Megakernels Considered Harmful: Wavefront Path Tracing on GPUs" (2013)).
+// Instead of each invocation following one path from start to finish (RayTrace.comp), paths are advanced a step at a time
+// by kernels that each do one kind of work:
+//    WavefrontGenerate.comp    camera ray for each pixel                       -> extend queue
+//    WavefrontExtend.comp      closest hit of each ray in an extend queue      -> shade queue of the material that was hit (misses finish here)
+//    WavefrontShade.comp       scatter at each hit in one material's queue     -> next extend queue, and the shadow queue (next event estimation)
+//    WavefrontShadow.comp      each shadow ray in the shadow queue: light's contribution counts if nothing is in the way
+//    WavefrontAccumulate.comp  each pixel's path into the accumulation and output images
+// so that the invocations of a workgroup are all doing the same thing (in particular, all shading the same material).
+// Queues hold path indices.  Each is dispatched indirectly, with as many workgroups as the kernels before it put in it
+
+#define WAVEFRONT_GROUPSIZE 64   // local size of the kernels that work from a queue
+#define WAVEFRONT_GROUPCOUNTX 65535u  // queue dispatches are 2D: rows of this many workgroups (minimum maxComputeWorkGroupCount[0] that Vulkan guarantees)
+
+#define QUEUE_EXTEND        0    // two extend queues: bounce b reads QUEUE_EXTEND + (b & 1), and shading writes the next bounce's to the other one
+#define QUEUE_SHADE         2    // one shade queue per material type: QUEUE_SHADE + MATERIAL_XXX
+#define QUEUE_SHADECOUNT    6    //
+#define QUEUE_SHADOW        8
+#define QUEUE_COUNT         9
+
+
+// Header of each queue.  First three are the VkDispatchIndirectCommand for the queue's kernel (groupCountX, then groupCountY, go up as paths
+// are added.  The last row of workgroups may be partly past the end of the queue)
+struct RayQueue {
+   uint groupCountX;
+   uint groupCountY;
+   uint groupCountZ;
+   uint count;
+};
+
+
+// Push constants of the wavefront kernels, which have a pipeline layout of their own
+struct WavefrontConstants {
+   uint bounce;
+   uint queue;      // QUEUE_XXX that the kernel takes its paths from
+   uint pathCount;  // one path per pixel.  Each queue has room for all of them
+};
+
+
+// Work done from each queue, summed over the frame (read, and reset, by the application along with the ray count)
+struct QueueStats {
+   uint items[QUEUE_COUNT];   // paths taken from the queue
+   uint groups[QUEUE_COUNT];  // workgroups dispatched to do that
+};
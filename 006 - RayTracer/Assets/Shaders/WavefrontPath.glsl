@@ -0,0 +1,122 @@
+#include "Wavefront.glsl"
+
+// Path state, queues and bindings shared by the wavefront path tracing kernels (see Wavefront.glsl).
+// Bindings.glsl and Scatter.glsl must be included first
+
+// Everything about a path that has to be kept from one kernel to the next.  One path per pixel (path index = y * width + x)
+struct PathState {
+   vec4 origin;             // xyz,scatterPdf     scatterPdf is density with which the previous bounce chose direction (see RayTrace.comp)
+   vec4 direction;          // xyz,t              t is distance to the closest hit (set by WavefrontExtend.comp)
+   vec4 attenuation;        // rgb,unused
+   vec4 radiance;           // rgb,unused         light gathered by the path so far
+   vec4 lightDirection;     // xyz,distance       next event estimation shadow ray, from origin (see WavefrontShadow.comp)
+   vec4 lightContribution;  // rgb,unused         what the shadow ray adds to radiance if nothing is in the way (attenuation already applied)
+   uvec4 sampleState;       // see Sampler.glsl
+   uvec4 hit;               // instance, primitive, barycentrics (as uint bits)    closest hit (see Hit in TraceRay.glsl)
+   uvec4 state;             // randomSeed, rays, hitKind, unused                   rays is the number traced for this path so far
+};
+
+layout(set = 0, binding = BINDING_ACCUMULATIONIMAGE, rgba32f) uniform image2D accumulationImage;
+layout(set = 0, binding = BINDING_OUTPUTIMAGE, rgba8) uniform image2D outputImage;
+layout(set = 0, binding = BINDING_MOMENTSIMAGE, rgba32f) uniform image2D momentsImage;
+layout(set = 0, binding = BINDING_SAMPLEMASKIMAGE, r32ui) uniform readonly uimage2D sampleMaskImage;
+layout(set = 0, binding = BINDING_ALBEDOIMAGE, rgba16f) uniform image2D albedoImage;
+layout(set = 0, binding = BINDING_NORMALDEPTHIMAGE, rgba16f) uniform image2D normalDepthImage;
+layout(set = 0, binding = BINDING_POSITIONIMAGE, rgba32f) uniform image2D positionImage;
+layout(set = 0, binding = BINDING_HISTORYIMAGE, rgba32f) uniform writeonly image2D historyImage;
+layout(set = 0, binding = BINDING_HISTORYPOSITIONIMAGE, rgba32f) uniform writeonly image2D historyPositionImage;
+
+// Same counters as RayTrace.comp
+layout(set = 0, binding = BINDING_RAYCOUNTER) buffer RayCounter {
+   uint rayCount;
+   uint activePixelCount;  // (see AdaptiveSampling.comp)
+};
+
+layout(set = 0, binding = BINDING_PATHSTATES) buffer PathStateArray { PathState paths[]; };
+
+// QUEUE_COUNT queue headers, then the queues' entries (path indices).  Queue q's entries start at q * pathCount
+layout(set = 0, binding = BINDING_RAYQUEUES) buffer RayQueueArray {
+   RayQueue queues[QUEUE_COUNT];
+   uint queueEntries[];
+};
+
+layout(set = 0, binding = BINDING_QUEUESTATS) buffer QueueStatsBuffer {
+   QueueStats queueStats;
+};
+
+layout(push_constant) uniform PC {
+   WavefrontConstants wavefront;
+};
+
+
+ivec2 PathPixel(const uint path) {
+   const uint width = imageSize(outputImage).x;
+   return ivec2(path % width, path / width);
+}
+
+
+// Adaptive sampling: pixels that have converged are not sampled (see AdaptiveSampling.comp)
+bool IsPixelActive(const ivec2 pixel) {
+   return (ubo.adaptiveThreshold <= 0.0) || (ubo.accumulatedFrameCount <= 1) || (imageLoad(sampleMaskImage, pixel).r != 0);
+}
+
+
+void Enqueue(const uint queue, const uint path) {
+   const uint index = atomicAdd(queues[queue].count, 1);
+   queueEntries[queue * wavefront.pathCount + index] = path;
+
+   // first path of each workgroup's worth adds the workgroup to the queue's dispatch.  One row of WAVEFRONT_GROUPCOUNTX workgroups is
+   // not enough for a big window (e.g. 3840x2160 is 129600 workgroups), so further workgroups go in more rows
+   if (index % WAVEFRONT_GROUPSIZE == 0) {
+      const uint group = index / WAVEFRONT_GROUPSIZE;
+      atomicMax(queues[queue].groupCountX, min(group + 1, WAVEFRONT_GROUPCOUNTX));
+      atomicMax(queues[queue].groupCountY, group / WAVEFRONT_GROUPCOUNTX + 1);
+   }
+}
+
+
+// Position of this invocation in the queue that it was dispatched for (workgroups are in rows, see Enqueue())
+uint QueueIndex() {
+   return (gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x) * WAVEFRONT_GROUPSIZE + gl_LocalInvocationID.x;
+}
+
+
+// Path that this invocation works on, from queue wavefront.queue.  False if the invocation is past the end of the queue
+bool Dequeue(out uint path) {
+   const uint index = QueueIndex();
+   if (index >= queues[wavefront.queue].count) {
+      return false;
+   }
+   path = queueEntries[wavefront.queue * wavefront.pathCount + index];
+   return true;
+}
+
+
+// Once per dispatch, for the application's queue occupancy report
+void CountQueueWork() {
+   if (QueueIndex() == 0) {
+      queueStats.items[wavefront.queue] += queues[wavefront.queue].count;
+      queueStats.groups[wavefront.queue] += queues[wavefront.queue].groupCountX * queues[wavefront.queue].groupCountY;
+   }
+}
+
+
+// First hit surface, for the denoiser (see Denoise.comp) and temporal reprojection (see Reproject.comp).  RayTrace.comp keeps these
+// until the path is finished, but here they go straight into the images.  Averaged over the same samples as the color: this sample
+// will be the (accumulated.w + 1)'th when WavefrontAccumulate.comp adds it in
+void RecordFirstHit(const ivec2 pixel, const vec4 albedo, const vec3 normal, const float depth, const vec3 origin, const vec3 direction) {
+   if ((ubo.temporalHistoryLength > 0) && (ubo.accumulatedFrameCount == 1)) {
+      imageStore(positionImage, pixel, vec4(origin + depth * direction, depth));
+   }
+   if (ubo.denoiseIterations > 0) {
+      const vec4 normalDepth = vec4(normal, depth);
+      if (ubo.accumulatedFrameCount == 1) {
+         imageStore(albedoImage, pixel, albedo);
+         imageStore(normalDepthImage, pixel, normalDepth);
+      } else {
+         const float weight = 1.0 / (imageLoad(accumulationImage, pixel).w + 1.0);
+         imageStore(albedoImage, pixel, mix(imageLoad(albedoImage, pixel), albedo, weight));
+         imageStore(normalDepthImage, pixel, mix(imageLoad(normalDepthImage, pixel), normalDepth, weight));
+      }
+   }
+}
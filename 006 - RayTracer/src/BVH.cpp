@@ -0,0 +1,168 @@
+#include "BVH.h"
+
+#include <algorithm>
+#include <numeric>
+
+static float SurfaceArea(const glm::vec3& min, const glm::vec3& max) {
+   const glm::vec3 size = glm::max(max - min, glm::vec3 {0.0f});
+   return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+
+void BVH::Build(const std::vector<Bounds>& primitiveBounds) {
+   m_Nodes.clear();
+   m_PrimitiveIndices.resize(primitiveBounds.size());
+   std::iota(m_PrimitiveIndices.begin(), m_PrimitiveIndices.end(), 0);
+   if (primitiveBounds.empty()) {
+      return;
+   }
+
+   std::vector<glm::vec3> centroids;
+   centroids.reserve(primitiveBounds.size());
+   for (const auto& bounds : primitiveBounds) {
+      centroids.emplace_back((bounds[0] + bounds[1]) * 0.5f);
+   }
+
+   // a binary tree with n leaves has 2n - 1 nodes
+   m_Nodes.reserve(2 * primitiveBounds.size());
+   m_Nodes.push_back({{}, 0, {}, static_cast<uint32_t>(primitiveBounds.size())});
+   Subdivide(0, 1, primitiveBounds, centroids);
+   m_Nodes.shrink_to_fit();
+}
+
+
+bool BVH::IsEmpty() const {
+   return m_Nodes.empty();
+}
+
+
+BVH::Bounds BVH::GetBounds() const {
+   if (m_Nodes.empty()) {
+      return {glm::vec3 {0.0f}, glm::vec3 {0.0f}};
+   }
+   return {m_Nodes[0].boundsMin, m_Nodes[0].boundsMax};
+}
+
+
+BVH::Bounds BVH::GetBounds(const glm::mat4& transform) const {
+   const Bounds bounds = GetBounds();
+   Bounds transformedBounds = {glm::vec3 {std::numeric_limits<float>::max()}, glm::vec3 {std::numeric_limits<float>::lowest()}};
+   for (int i = 0; i < 8; ++i) {
+      const glm::vec3 corner = glm::vec3(transform * glm::vec4 {bounds[i & 1].x, bounds[(i >> 1) & 1].y, bounds[(i >> 2) & 1].z, 1.0f});
+      transformedBounds = {glm::min(transformedBounds[0], corner), glm::max(transformedBounds[1], corner)};
+   }
+   return transformedBounds;
+}
+
+
+const std::vector<BVH::Node>& BVH::GetNodes() const {
+   return m_Nodes;
+}
+
+
+const std::vector<uint32_t>& BVH::GetPrimitiveIndices() const {
+   return m_PrimitiveIndices;
+}
+
+
+void BVH::Subdivide(const uint32_t nodeIndex, const uint32_t depth, const std::vector<Bounds>& primitiveBounds, const std::vector<glm::vec3>& centroids) {
+   const uint32_t first = m_Nodes[nodeIndex].leftOrFirst;
+   const uint32_t count = m_Nodes[nodeIndex].count;
+
+   glm::vec3 min {std::numeric_limits<float>::max()};
+   glm::vec3 max {std::numeric_limits<float>::lowest()};
+   glm::vec3 centroidMin {std::numeric_limits<float>::max()};
+   glm::vec3 centroidMax {std::numeric_limits<float>::lowest()};
+   for (uint32_t i = first; i < first + count; ++i) {
+      const uint32_t primitive = m_PrimitiveIndices[i];
+      min = glm::min(min, primitiveBounds[primitive][0]);
+      max = glm::max(max, primitiveBounds[primitive][1]);
+      centroidMin = glm::min(centroidMin, centroids[primitive]);
+      centroidMax = glm::max(centroidMax, centroids[primitive]);
+   }
+   m_Nodes[nodeIndex].boundsMin = min;
+   m_Nodes[nodeIndex].boundsMax = max;
+
+   if ((count <= sm_MaxLeafSize) || (depth >= sm_MaxDepth)) {
+      return;
+   }
+
+   // Bin primitive centroids along each axis, and pick the split (between bins) with lowest SAH cost
+   struct Bin {
+      glm::vec3 m_Min {std::numeric_limits<float>::max()};
+      glm::vec3 m_Max {std::numeric_limits<float>::lowest()};
+      uint32_t m_Count = 0;
+   };
+
+   float bestCost = std::numeric_limits<float>::max();
+   int bestAxis = -1;
+   uint32_t bestSplit = 0;
+   const glm::vec3 extent = centroidMax - centroidMin;
+   for (int axis = 0; axis < 3; ++axis) {
+      if (extent[axis] <= 0.0f) {
+         continue;
+      }
+      std::array<Bin, sm_BinCount> bins;
+      const float scale = sm_BinCount / extent[axis];
+      for (uint32_t i = first; i < first + count; ++i) {
+         const uint32_t primitive = m_PrimitiveIndices[i];
+         const uint32_t bin = std::min(sm_BinCount - 1, static_cast<uint32_t>((centroids[primitive][axis] - centroidMin[axis]) * scale));
+         bins[bin].m_Min = glm::min(bins[bin].m_Min, primitiveBounds[primitive][0]);
+         bins[bin].m_Max = glm::max(bins[bin].m_Max, primitiveBounds[primitive][1]);
+         ++bins[bin].m_Count;
+      }
+
+      // sweep from the left, then from the right, to get area x count on either side of each split
+      std::array<float, sm_BinCount - 1> leftCost;
+      Bin left;
+      for (uint32_t i = 0; i < sm_BinCount - 1; ++i) {
+         left.m_Min = glm::min(left.m_Min, bins[i].m_Min);
+         left.m_Max = glm::max(left.m_Max, bins[i].m_Max);
+         left.m_Count += bins[i].m_Count;
+         leftCost[i] = left.m_Count * SurfaceArea(left.m_Min, left.m_Max);
+      }
+      Bin right;
+      for (uint32_t i = sm_BinCount - 1; i > 0; --i) {
+         right.m_Min = glm::min(right.m_Min, bins[i].m_Min);
+         right.m_Max = glm::max(right.m_Max, bins[i].m_Max);
+         right.m_Count += bins[i].m_Count;
+         const float cost = leftCost[i - 1] + right.m_Count * SurfaceArea(right.m_Min, right.m_Max);
+         if (cost < bestCost) {
+            bestCost = cost;
+            bestAxis = axis;
+            bestSplit = i;
+         }
+      }
+   }
+
+   // Splitting must be cheaper than just intersecting every primitive in this node
+   if ((bestAxis < 0) || (bestCost >= count * SurfaceArea(min, max))) {
+      if (count <= 4 * sm_MaxLeafSize) {
+         return;
+      }
+      // ...but very large leaves are never a good idea.  Fall back to splitting in the middle of the longest axis
+      bestAxis = (extent.x > extent.y) ? ((extent.x > extent.z) ? 0 : 2) : ((extent.y > extent.z) ? 1 : 2);
+      bestSplit = sm_BinCount / 2;
+      if (extent[bestAxis] <= 0.0f) {
+         return;
+      }
+   }
+
+   const float scale = sm_BinCount / extent[bestAxis];
+   auto middle = std::partition(m_PrimitiveIndices.begin() + first, m_PrimitiveIndices.begin() + first + count, [&] (const uint32_t primitive) {
+      return std::min(sm_BinCount - 1, static_cast<uint32_t>((centroids[primitive][bestAxis] - centroidMin[bestAxis]) * scale)) < bestSplit;
+   });
+   const uint32_t leftCount = static_cast<uint32_t>(middle - (m_PrimitiveIndices.begin() + first));
+   if ((leftCount == 0) || (leftCount == count)) {
+      return;
+   }
+
+   const uint32_t leftIndex = static_cast<uint32_t>(m_Nodes.size());
+   m_Nodes.push_back({{}, first, {}, leftCount});
+   m_Nodes.push_back({{}, first + leftCount, {}, count - leftCount});
+   m_Nodes[nodeIndex].leftOrFirst = leftIndex;
+   m_Nodes[nodeIndex].count = 0;
+
+   Subdivide(leftIndex, depth + 1, primitiveBounds, centroids);
+   Subdivide(leftIndex + 1, depth + 1, primitiveBounds, centroids);
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+using mat4 = glm::mat4;
+using uint = uint32_t;
+using vec3 = glm::vec3;
+#include "BVH.glsl"
+
+#include <array>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// Bounding volume hierarchy over a set of axis aligned boxes.  Used by the CPU renderer and by software ray tracing on the GPU
+// (both for the "BLAS" of each model, and the "TLAS" over instances)
+//
+// Built top down, splitting on the surface area heuristic (binned).
+// Nodes are 32 bytes (BVHNode, shared with the shaders), stored depth first with the two children of a node next to each other.
+// Ray vs. box test is the branch free slab test on whole vectors, with the ray's inverse direction precomputed.
+class BVH {
+public:
+   using Bounds = std::array<glm::vec3, 2>;
+   using Node = BVHNode;
+
+   void Build(const std::vector<Bounds>& primitiveBounds);
+
+   bool IsEmpty() const;
+
+   // Bounds of everything in the BVH
+   Bounds GetBounds() const;
+
+   // Bounds of everything in the BVH, after it has been transformed (e.g. object to world)
+   Bounds GetBounds(const glm::mat4& transform) const;
+
+   // Flattened form, for uploading to the GPU.
+   // Leaf nodes refer to primitives by their position in GetPrimitiveIndices(), which in turn gives the index of the primitive in the primitiveBounds passed to Build()
+   const std::vector<Node>& GetNodes() const;
+   const std::vector<uint32_t>& GetPrimitiveIndices() const;
+
+   // Calls intersect(primitiveIndex, tMax) for each primitive whose bounds are hit by the ray within [tMin, tMax], nearest nodes first.
+   // intersect() returns the new tMax (i.e. the distance to the hit, if it found one closer than tMax, otherwise tMax unchanged).
+   // Returns the final tMax.
+   template<typename IntersectFn>
+   float Traverse(const glm::vec3& origin, const glm::vec3& direction, const float tMin, float tMax, IntersectFn&& intersect) const;
+
+private:
+   void Subdivide(const uint32_t nodeIndex, const uint32_t depth, const std::vector<Bounds>& primitiveBounds, const std::vector<glm::vec3>& centroids);
+
+   // distance along ray to where it enters the box, or infinity if it misses
+   static float IntersectBounds(const glm::vec3& min, const glm::vec3& max, const glm::vec3& origin, const glm::vec3& inverseDirection, const float tMin, const float tMax);
+
+private:
+   std::vector<Node> m_Nodes;
+   std::vector<uint32_t> m_PrimitiveIndices;
+
+   static constexpr uint32_t sm_MaxLeafSize = 4;
+   static constexpr uint32_t sm_BinCount = 16;
+   static constexpr uint32_t sm_MaxDepth = BVH_MAX_DEPTH;   // also the size of the traversal stack
+};
+
+static_assert(sizeof(BVH::Node) == 32, "BVHNode must match the shader's std430 layout");
+
+
+inline
+float BVH::IntersectBounds(const glm::vec3& min, const glm::vec3& max, const glm::vec3& origin, const glm::vec3& inverseDirection, const float tMin, const float tMax) {
+   const glm::vec3 t0 = (min - origin) * inverseDirection;
+   const glm::vec3 t1 = (max - origin) * inverseDirection;
+   const glm::vec3 tNear = glm::min(t0, t1);
+   const glm::vec3 tFar = glm::max(t0, t1);
+   const float enter = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, tMin));
+   const float exit = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, tMax));
+   return (enter <= exit) ? enter : std::numeric_limits<float>::infinity();
+}
+
+
+template<typename IntersectFn>
+float BVH::Traverse(const glm::vec3& origin, const glm::vec3& direction, const float tMin, float tMax, IntersectFn&& intersect) const {
+   if (m_Nodes.empty()) {
+      return tMax;
+   }
+
+   const glm::vec3 inverseDirection = 1.0f / direction;
+   std::array<uint32_t, sm_MaxDepth> stack;
+   uint32_t stackSize = 0;
+
+   const Node* node = &m_Nodes[0];
+   if (IntersectBounds(node->boundsMin, node->boundsMax, origin, inverseDirection, tMin, tMax) == std::numeric_limits<float>::infinity()) {
+      return tMax;
+   }
+   for (;;) {
+      if (node->count > 0) {
+         for (uint32_t i = 0; i < node->count; ++i) {
+            tMax = intersect(m_PrimitiveIndices[node->leftOrFirst + i], tMax);
+         }
+      } else {
+         const Node* left = &m_Nodes[node->leftOrFirst];
+         const Node* right = left + 1;
+         float tLeft = IntersectBounds(left->boundsMin, left->boundsMax, origin, inverseDirection, tMin, tMax);
+         float tRight = IntersectBounds(right->boundsMin, right->boundsMax, origin, inverseDirection, tMin, tMax);
+         if (tLeft > tRight) {
+            std::swap(tLeft, tRight);
+            std::swap(left, right);
+         }
+         if (tLeft != std::numeric_limits<float>::infinity()) {
+            if (tRight != std::numeric_limits<float>::infinity()) {
+               stack[stackSize++] = static_cast<uint32_t>(right - m_Nodes.data());
+            }
+            node = left;
+            continue;
+         }
+      }
+      if (stackSize == 0) {
+         break;
+      }
+      node = &m_Nodes[stack[--stackSize]];
+   }
+   return tMax;
+}
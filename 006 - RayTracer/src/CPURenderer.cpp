@@ -0,0 +1,797 @@
+#include "CPURenderer.h"
+
+#include "Box.h"
+#include "Core.h"
+#include "Sphere.h"
+
+using mat4 = glm::mat4;
+using uint = uint32_t;
+using uvec4 = glm::uvec4;
+using vec3 = glm::vec3;
+using vec4 = glm::vec4;
+#include "RayPayload.glsl"
+#include "UniformBufferObject.glsl"
+
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/noise.hpp>
+
+#include <stb_image.h>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <thread>
+
+//
+// Random.glsl
+// (The order in which random numbers are drawn matters, if results are to be the same as the GPU.
+//  Hence the seemingly unnecessary temporaries, C++ does not define the evaluation order of function arguments)
+//
+static uint32_t InitRandomSeed(const uint32_t val0, const uint32_t val1) {
+   uint32_t v0 = val0;
+   uint32_t v1 = val1;
+   uint32_t s0 = 0;
+   for (uint32_t n = 0; n < 16; n++) {
+      s0 += 0x9e3779b9;
+      v0 += ((v1 << 4) + 0xa341316c) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4);
+      v1 += ((v0 << 4) + 0xad90777d) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761e);
+   }
+   return v0;
+}
+
+
+static uint32_t RandomInt(uint32_t& seed) {
+   seed = 1664525 * seed + 1013904223;
+   return seed;
+}
+
+
+static float RandomFloat(uint32_t& seed) {
+   const uint32_t one = 0x3f800000;
+   const uint32_t msk = 0x007fffff;
+   const uint32_t bits = one | (msk & (RandomInt(seed) >> 9));
+   float f;
+   memcpy(&f, &bits, sizeof(f));
+   return f - 1.0f;
+}
+
+
+static float RandomFloat(const float minValue, const float maxValue, uint32_t& seed) {
+   return minValue + (maxValue - minValue) * RandomFloat(seed);
+}
+
+
+static glm::vec3 RandomInUnitSphere(uint32_t& seed) {
+   glm::vec3 p;
+   do {
+      const float x = RandomFloat(seed);
+      const float y = RandomFloat(seed);
+      const float z = RandomFloat(seed);
+      p = 2.0f * glm::vec3 {x, y, z} - 1.0f;
+   } while (glm::dot(p, p) >= 1.0f);
+   return p;
+}
+
+
+static glm::vec3 RandomUnitVector(uint32_t& seed) {
+   const float a = RandomFloat(0.0f, 2.0f * glm::pi<float>(), seed);
+   const float z = RandomFloat(-1.0f, 1.0f, seed);
+   const float r = std::sqrt(1.0f - z * z);
+   return {r * std::cos(a), r * std::sin(a), z};
+}
+
+
+static glm::mat3 GetOrthoNormalBasis(const glm::vec3& normal) {
+   glm::vec3 helper = {1.0f, 0.0f, 0.0f};
+   if (std::abs(normal.x) > 0.99f) {
+      helper = {0.0f, 0.0f, 1.0f};
+   }
+   const glm::vec3 tangent = glm::normalize(glm::cross(normal, helper));
+   const glm::vec3 bitangent = glm::normalize(glm::cross(normal, tangent));
+   return {tangent, bitangent, normal};
+}
+
+
+static glm::vec3 RandomOnUnitHemisphere(const glm::vec3& normal, const float alpha, uint32_t& seed) {
+   const float cosTheta = std::pow((1.0f - RandomFloat(0.0f, 1.0f, seed)), 1.0f / (alpha + 1.0f));
+   const float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+   const float phi = RandomFloat(0.0f, 2.0f * glm::pi<float>(), seed);
+   return GetOrthoNormalBasis(normal) * glm::vec3 {std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, cosTheta};
+}
+
+
+//
+// Scatter.glsl
+//
+static float Schlick(const float cosine, const float refractiveIndex) {
+   float r0 = (1.0f - refractiveIndex) / (1.0f + refractiveIndex);
+   r0 = r0 * r0;
+   return r0 + (1.0f - r0) * std::pow((1.0f - cosine), 5.0f);
+}
+
+
+// glm's simplex noise is the same (Ashima Arts) algorithm as SNoise.glsl
+static float Turbulence(const glm::vec3& p, const int depth) {
+   float accum = 0.0f;
+   glm::vec3 temp_p = p;
+   float weight = 1.0f;
+   for (int i = 0; i < depth; ++i) {
+      accum += weight * glm::simplex(temp_p);
+      weight *= 0.5f;
+      temp_p *= 2.0f;
+   }
+   return std::abs(accum);
+}
+
+
+//
+// Textures
+//
+static float SRGBToLinear(const float c) {
+   return (c <= 0.04045f) ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+
+static int Repeat(const int i, const int size) {
+   const int r = i % size;
+   return (r < 0) ? r + size : r;
+}
+
+
+// Bilinear filtering, same as the GPU sampler (which is linear filter, repeat address mode)
+// clampV is for the equirectangular skybox, which should not wrap at the poles
+static glm::vec4 Sample(const std::vector<glm::vec4>& texels, const int width, const int height, const glm::vec2& uv, const bool clampV) {
+   const float x = uv.x * width - 0.5f;
+   const float y = uv.y * height - 0.5f;
+   const float x0 = std::floor(x);
+   const float y0 = std::floor(y);
+   const float fx = x - x0;
+   const float fy = y - y0;
+   const int i0 = Repeat(static_cast<int>(x0), width);
+   const int i1 = Repeat(static_cast<int>(x0) + 1, width);
+   int j0 = static_cast<int>(y0);
+   int j1 = j0 + 1;
+   if (clampV) {
+      j0 = std::clamp(j0, 0, height - 1);
+      j1 = std::clamp(j1, 0, height - 1);
+   } else {
+      j0 = Repeat(j0, height);
+      j1 = Repeat(j1, height);
+   }
+   return glm::mix(
+      glm::mix(texels[j0 * width + i0], texels[j0 * width + i1], fx),
+      glm::mix(texels[j1 * width + i0], texels[j1 * width + i1], fx),
+      fy
+   );
+}
+
+
+//
+// Tonemap.glsl
+//
+static glm::vec3 Tonemap(const glm::vec3& color, const uint32_t tonemapOperator) {
+   glm::vec3 pixelColor;
+   switch (tonemapOperator) {
+      case TONEMAP_REINHARD: {
+         pixelColor = color / (glm::vec3 {1.0f} + color);
+         break;
+      }
+      case TONEMAP_ACES: {
+         const glm::vec3 x = 0.6f * color;
+         pixelColor = glm::clamp((x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f), 0.0f, 1.0f);
+         break;
+      }
+      default: {
+         pixelColor = glm::vec3 {1.0f} - glm::exp(-color);
+         break;
+      }
+   }
+
+   // gamma correction
+   const float gamma = 1.0f / 2.2f;
+   return glm::pow(pixelColor, glm::vec3 {gamma});
+}
+
+
+CPURenderer::CPURenderer(const Scene& scene, const uint32_t width, const uint32_t height)
+: m_Scene(scene)
+, m_Width(width)
+, m_Height(height)
+, m_AccumulationImage(static_cast<size_t>(width) * height)
+, m_OutputImage(static_cast<size_t>(width) * height * 4)
+{
+   CreateModels();
+   CreateInstances();
+   CreateTextures();
+}
+
+
+const std::vector<uint8_t>& CPURenderer::GetOutputImage() const {
+   return m_OutputImage;
+}
+
+
+void CPURenderer::WriteOutputImage(const std::string& fileName) const {
+   if (!stbi_write_png(fileName.c_str(), m_Width, m_Height, 4, m_OutputImage.data(), m_Width * 4)) {
+      LOG_ERROR("failed to write image '{0}'", fileName);
+      return;
+   }
+   LOG_INFO("Wrote {0}x{1} image to '{2}'", m_Width, m_Height, fileName);
+}
+
+
+uint64_t CPURenderer::GetRayCount() const {
+   return m_RayCount;
+}
+
+
+void CPURenderer::CreateModels() {
+   m_Models.reserve(m_Scene.GetModels().size());
+   for (const auto& model : m_Scene.GetModels()) {
+      ModelData& data = m_Models.emplace_back();
+      data.m_Model = model.get();
+      if (model->IsProcedural()) {
+         // Procedural models are either boxes, or (sets of) spheres.  Same as choice of intersection shader on the GPU
+         data.m_Type = dynamic_cast<const Box*>(model.get()) ? EPrimitiveType::eBoxes : EPrimitiveType::eSpheres;
+      } else {
+         data.m_Type = EPrimitiveType::eTriangles;
+         uint32_t geometryIndex = 0;
+         for (const auto& geometry : model->GetGeometries()) {
+            for (uint32_t i = geometry.m_FirstIndex; i + 2 < geometry.m_FirstIndex + geometry.m_IndexCount; i += 3) {
+               data.m_PrimitiveGeometries.push_back(geometryIndex);
+               data.m_PrimitiveIndices.push_back(i);
+            }
+            ++geometryIndex;
+         }
+      }
+      data.m_BVH.Build(model->GetPrimitiveBounds());
+   }
+}
+
+
+void CPURenderer::CreateInstances() {
+   std::vector<Bounds> instanceBounds;
+   instanceBounds.reserve(m_Scene.GetInstances().size());
+   m_Instances.reserve(m_Scene.GetInstances().size());
+   uint32_t slot = 0;
+   for (const auto& instance : m_Scene.GetInstances()) {
+      const ModelData& model = m_Models[instance->GetModelIndex()];
+
+      const glm::mat4 objectToWorld = instance->GetObjectToWorld();
+      m_Instances.push_back({instance->GetModelIndex(), slot, objectToWorld, glm::inverse(objectToWorld)});
+      instanceBounds.emplace_back(model.m_BVH.GetBounds(objectToWorld));
+
+      // Per slot data, same as RayTracer::CreateMaterialBuffer() and RayTracer::CreateSphereBuffer()
+      m_Materials.insert(m_Materials.end(), instance->GetMaterials().begin(), instance->GetMaterials().end());
+      const SphereSet* sphereSet = dynamic_cast<const SphereSet*>(model.m_Model);
+      if (sphereSet) {
+         m_Spheres.insert(m_Spheres.end(), sphereSet->GetSpheres().begin(), sphereSet->GetSpheres().end());
+      } else {
+         m_Spheres.insert(m_Spheres.end(), instance->GetMaterials().size(), glm::vec4 {0.0f, 0.0f, 0.0f, 1.0f});
+      }
+      slot += static_cast<uint32_t>(instance->GetMaterials().size());
+   }
+   m_InstanceBVH.Build(instanceBounds);
+}
+
+
+void CPURenderer::CreateTextures() {
+   for (const auto& textureFileName : m_Scene.GetTextureFileNames()) {
+      TextureData& texture = m_Textures.emplace_back();
+      int channels;
+      stbi_uc* pixels = stbi_load(textureFileName.c_str(), &texture.m_Width, &texture.m_Height, &channels, STBI_rgb_alpha);
+      if (!pixels) {
+         throw std::runtime_error("failed to load texture '" + textureFileName + "'");
+      }
+      // GPU textures are sRGB format, so are linear by the time the shader sees them
+      texture.m_Texels.reserve(static_cast<size_t>(texture.m_Width) * texture.m_Height);
+      for (size_t i = 0; i < static_cast<size_t>(texture.m_Width) * texture.m_Height; ++i) {
+         texture.m_Texels.emplace_back(SRGBToLinear(pixels[4 * i + 0] / 255.0f), SRGBToLinear(pixels[4 * i + 1] / 255.0f), SRGBToLinear(pixels[4 * i + 2] / 255.0f), pixels[4 * i + 3] / 255.0f);
+      }
+      stbi_image_free(pixels);
+   }
+
+   if (!m_Scene.GetSkyboxTextureFileName().empty()) {
+      int channels;
+      float* pixels = stbi_loadf(m_Scene.GetSkyboxTextureFileName().c_str(), &m_Skybox.m_Width, &m_Skybox.m_Height, &channels, STBI_rgb_alpha);
+      if (!pixels) {
+         throw std::runtime_error("failed to load texture '" + m_Scene.GetSkyboxTextureFileName() + "'");
+      }
+      // The GPU skybox is a cubemap made from the equirectangular image (by Equirectangular2Cubemap.comp).  Here we just sample the
+      // equirectangular image directly.  The cubemap is rgba16 unorm, which clamps to [0, 1], so do the same.
+      m_Skybox.m_Texels.reserve(static_cast<size_t>(m_Skybox.m_Width) * m_Skybox.m_Height);
+      for (size_t i = 0; i < static_cast<size_t>(m_Skybox.m_Width) * m_Skybox.m_Height; ++i) {
+         m_Skybox.m_Texels.emplace_back(glm::clamp(glm::vec4 {pixels[4 * i + 0], pixels[4 * i + 1], pixels[4 * i + 2], pixels[4 * i + 3]}, 0.0f, 1.0f));
+      }
+      stbi_image_free(pixels);
+   }
+}
+
+
+void CPURenderer::RenderFrame(const UniformBufferObject& ubo) {
+   const uint32_t tilesX = (m_Width + sm_TileSize - 1) / sm_TileSize;
+   const uint32_t tilesY = (m_Height + sm_TileSize - 1) / sm_TileSize;
+   const uint32_t tileCount = tilesX * tilesY;
+   std::atomic<uint32_t> nextTile = 0;
+
+   auto renderTiles = [&] () {
+      uint64_t rayCount = 0;
+      for (uint32_t tile = nextTile++; tile < tileCount; tile = nextTile++) {
+         const uint32_t x0 = (tile % tilesX) * sm_TileSize;
+         const uint32_t y0 = (tile / tilesX) * sm_TileSize;
+         for (uint32_t y = y0; y < std::min(y0 + sm_TileSize, m_Height); ++y) {
+            for (uint32_t x = x0; x < std::min(x0 + sm_TileSize, m_Width); ++x) {
+               const size_t pixel = static_cast<size_t>(y) * m_Width + x;
+               const glm::vec3 rayColor = TracePath(x, y, ubo, rayCount);
+               const glm::vec3 accumulatedColor = (ubo.accumulatedFrameCount == 1) ? rayColor : m_AccumulationImage[pixel] + rayColor;
+               m_AccumulationImage[pixel] = accumulatedColor;
+
+               const glm::vec3 pixelColor = Tonemap(accumulatedColor / static_cast<float>(ubo.accumulatedFrameCount), ubo.tonemapOperator);
+
+               // (the GPU writes zero alpha, but that is not much use in an image file)
+               const glm::vec4 rgba = glm::round(glm::clamp(glm::vec4 {pixelColor, 1.0f}, 0.0f, 1.0f) * 255.0f);
+               m_OutputImage[4 * pixel + 0] = static_cast<uint8_t>(rgba.r);
+               m_OutputImage[4 * pixel + 1] = static_cast<uint8_t>(rgba.g);
+               m_OutputImage[4 * pixel + 2] = static_cast<uint8_t>(rgba.b);
+               m_OutputImage[4 * pixel + 3] = static_cast<uint8_t>(rgba.a);
+            }
+         }
+      }
+      m_RayCount += rayCount;
+   };
+
+   // The calling thread is one of the workers
+   const uint32_t threadCount = std::max(1u, std::min(std::thread::hardware_concurrency(), tileCount));
+   std::vector<std::thread> threads;
+   threads.reserve(threadCount - 1);
+   for (uint32_t i = 1; i < threadCount; ++i) {
+      threads.emplace_back(renderTiles);
+   }
+   renderTiles();
+   for (auto& thread : threads) {
+      thread.join();
+   }
+}
+
+
+// RayTrace.rgen
+glm::vec3 CPURenderer::TracePath(const uint32_t x, const uint32_t y, const UniformBufferObject& ubo, uint64_t& rayCount) const {
+   const RayContext context = {x, y, ubo.accumulatedFrameCount};
+   uint32_t randomSeed = InitRandomSeed(InitRandomSeed(x, y), ubo.accumulatedFrameCount);
+
+   const float jitterX = RandomFloat(randomSeed);
+   const float jitterY = RandomFloat(randomSeed);
+   const glm::vec2 uv = (glm::vec2 {x, y} + glm::vec2 {jitterX, jitterY}) / glm::vec2 {m_Width, m_Height} * 2.0f - 1.0f;
+
+   glm::vec3 origin = glm::vec3(ubo.viewInverse * glm::vec4 {0.0f, 0.0f, 0.0f, 1.0f});
+   const glm::vec4 target = ubo.projInverse * glm::vec4 {uv, 1.0f, 1.0f};
+   glm::vec3 direction = glm::normalize(glm::vec3(ubo.viewInverse * glm::vec4 {glm::vec3(target), 0.0f}));
+
+   glm::vec3 rayColor = glm::vec3 {0.0f};
+   glm::vec3 attenuation = glm::vec3 {1.0f};
+
+   for (uint32_t b = 0; b <= ubo.maxRayBounces; ++b) {
+      RayPayload ray;
+      Hit hit;
+      ++rayCount;
+      if (TraceRay(origin, direction, 0.001f, 10000.0f, context, hit)) {
+         ray = Shade(hit, origin, direction, randomSeed);
+      } else {
+         // RayTrace.rmiss
+         ray = RayPayload {glm::vec4 {glm::vec3 {1.0f}, -1.0f}, glm::vec4 {Miss(direction, ubo), 0.0f}, glm::vec4 {0.0f}, randomSeed};
+      }
+      randomSeed = ray.randomSeed;
+
+      const float t = ray.attenuationAndDistance.w;
+
+      rayColor += attenuation * glm::vec3(ray.emission);
+
+      if (t < 0.0f) {
+         break;
+      }
+
+      const bool isScattered = ray.scatterDirection.w > 0.0f;
+      if (!isScattered) {
+         break;
+      }
+
+      attenuation *= glm::vec3(ray.attenuationAndDistance);
+
+      // Russian roulette ray termination
+      if (b > ubo.minRayBounces) {
+         const float p = std::max(std::max(attenuation.r, attenuation.g), attenuation.b);
+         if (RandomFloat(randomSeed) > p) {
+            break;
+         }
+         attenuation *= 1.0f / p;
+      }
+
+      origin = origin + t * direction;
+      direction = glm::vec3(ray.scatterDirection);
+   }
+   return rayColor;
+}
+
+
+glm::vec3 CPURenderer::Miss(const glm::vec3& direction, const UniformBufferObject& ubo) const {
+   const glm::vec3 d = glm::normalize(direction);
+   if (!m_Skybox.m_Texels.empty()) {
+      // same mapping as Equirectangular2Cubemap.comp
+      const glm::vec2 uv = {std::atan2(d.z, d.x) / (2.0f * glm::pi<float>()) + 0.5f, std::acos(std::clamp(d.y, -1.0f, 1.0f)) / glm::pi<float>()};
+      return glm::vec3(Sample(m_Skybox.m_Texels, m_Skybox.m_Width, m_Skybox.m_Height, uv, true));
+   }
+   const float t = std::clamp(d.y, 0.0f, 1.0f);
+   return glm::mix(glm::vec3(ubo.horizonColor), glm::vec3(ubo.zenithColor), t);
+}
+
+
+bool CPURenderer::TraceRay(const glm::vec3& origin, const glm::vec3& direction, const float tMin, const float tMax, const RayContext& context, Hit& hit) const {
+   hit.m_T = std::numeric_limits<float>::infinity();
+   m_InstanceBVH.Traverse(origin, direction, tMin, tMax, [&] (const uint32_t instanceIndex, const float tMaxInstance) {
+      const InstanceData& instance = m_Instances[instanceIndex];
+      const ModelData& model = m_Models[instance.m_ModelIndex];
+      const glm::vec3 objectOrigin = glm::vec3(instance.m_WorldToObject * glm::vec4 {origin, 1.0f});
+      const glm::vec3 objectDirection = glm::vec3(instance.m_WorldToObject * glm::vec4 {direction, 0.0f});
+      return model.m_BVH.Traverse(objectOrigin, objectDirection, tMin, tMaxInstance, [&] (const uint32_t primitive, const float tMaxPrimitive) {
+         return IntersectPrimitive(instanceIndex, model, primitive, objectOrigin, objectDirection, origin, tMin, tMaxPrimitive, context, hit);
+      });
+   });
+   return hit.m_T != std::numeric_limits<float>::infinity();
+}
+
+
+// Box.rint
+static void ReportBoxHit(const float t, float& t1, float& t2, uint32_t& hitSide, const uint32_t side) {
+   if (t < t1) {
+      if (t1 < t2) {
+         t2 = t1;
+      }
+      t1 = t;
+      hitSide = side;
+   }
+   if ((t < t2) && (t > t1)) {
+      t2 = t;
+   }
+}
+
+
+static void IntersectBoxFace(const int axis, const float k, const glm::vec3& origin, const glm::vec3& direction, const float tMax, float& t1, float& t2, uint32_t& hitSide, const uint32_t side) {
+   const int u = (axis == 0) ? 1 : 0;
+   const int v = (axis == 2) ? 1 : 2;
+   const float t = (k - origin[axis]) / direction[axis];
+   if (t < tMax) {
+      const glm::vec3 p = origin + t * direction;
+      if ((p[u] >= -0.5f) && (p[u] < 0.5f) && (p[v] >= -0.5f) && (p[v] < 0.5f)) {
+         ReportBoxHit(t, t1, t2, hitSide, side);
+      }
+   }
+}
+
+
+float CPURenderer::IntersectPrimitive(const uint32_t instanceIndex, const ModelData& model, const uint32_t primitive, const glm::vec3& origin, const glm::vec3& direction, const glm::vec3& worldOrigin, const float tMin, const float tMax, const RayContext& context, Hit& hit) const {
+   const InstanceData& instance = m_Instances[instanceIndex];
+
+   // reportIntersectionEXT()
+   auto report = [&] (const float t, const uint32_t hitKind, const glm::vec2& barycentrics) {
+      if ((t < tMin) || (t > tMax)) {
+         return tMax;
+      }
+      hit = {t, instanceIndex, primitive, hitKind, barycentrics};
+      return t;
+   };
+
+   // Smoke is given a random hit distance inside the volume, seeded by pixel, ray origin and frame
+   auto smokeSeed = [&] () {
+      return InitRandomSeed(
+         InitRandomSeed(
+            InitRandomSeed(
+               InitRandomSeed(
+                  InitRandomSeed(context.m_X, context.m_Y),
+                  static_cast<uint32_t>(static_cast<int32_t>(worldOrigin.x))
+               ),
+               static_cast<uint32_t>(static_cast<int32_t>(worldOrigin.y))
+            ),
+            static_cast<uint32_t>(static_cast<int32_t>(worldOrigin.z))
+         ),
+         context.m_Frame
+      );
+   };
+
+   switch (model.m_Type) {
+      case EPrimitiveType::eTriangles: {
+         // Moller-Trumbore.  No culling (instances are eTriangleCullDisable)
+         const auto& vertices = model.m_Model->GetVertices();
+         const auto& indices = model.m_Model->GetIndices();
+         const uint32_t first = model.m_PrimitiveIndices[primitive];
+         const glm::vec3& p0 = vertices[indices[first + 0]].pos;
+         const glm::vec3 e1 = vertices[indices[first + 1]].pos - p0;
+         const glm::vec3 e2 = vertices[indices[first + 2]].pos - p0;
+         const glm::vec3 p = glm::cross(direction, e2);
+         const float determinant = glm::dot(e1, p);
+         if (determinant == 0.0f) {
+            return tMax;
+         }
+         const float inverseDeterminant = 1.0f / determinant;
+         const glm::vec3 s = origin - p0;
+         const float u = glm::dot(s, p) * inverseDeterminant;
+         if ((u < 0.0f) || (u > 1.0f)) {
+            return tMax;
+         }
+         const glm::vec3 q = glm::cross(s, e1);
+         const float v = glm::dot(direction, q) * inverseDeterminant;
+         if ((v < 0.0f) || (u + v > 1.0f)) {
+            return tMax;
+         }
+         return report(glm::dot(e2, q) * inverseDeterminant, 0, {u, v});
+      }
+
+      case EPrimitiveType::eSpheres: {
+         // Sphere.rint
+         const uint32_t slot = instance.m_CustomIndex + primitive;
+         const glm::vec4& sphere = m_Spheres[slot];
+         const glm::vec3 oc = origin - glm::vec3(sphere);
+         const float a = glm::dot(direction, direction);
+         const float b = glm::dot(oc, direction);
+         const float c = glm::dot(oc, oc) - sphere.w * sphere.w;
+         const float discriminant = b * b - a * c;
+         if (discriminant < 0.0f) {
+            return tMax;
+         }
+         const float t1 = (-b - std::sqrt(discriminant)) / a;
+         const float t2 = (-b + std::sqrt(discriminant)) / a;
+         const Material& material = m_Materials[slot];
+         if (material.type == MATERIAL_SMOKE) {
+            uint32_t seed = smokeSeed();
+            const float hitDistance = std::max(t1, tMin) + material.materialParameter1 * std::log(RandomFloat(seed));
+            if ((hitDistance <= t2) && (t2 < tMax)) {
+               return report(hitDistance, 0, {});
+            }
+         } else if (((tMin <= t1) && (t1 < tMax)) || ((tMin <= t2) && (t2 < tMax))) {
+            return report(((tMin <= t1) && (t1 < tMax)) ? t1 : t2, 0, {});
+         }
+         return tMax;
+      }
+
+      case EPrimitiveType::eBoxes: {
+         // Box.rint.  Box goes from -0.5 to +0.5 in each axis
+         const float k = 0.5f;
+         float t1 = tMax;
+         float t2 = tMax;
+         uint32_t hitSide = 0;
+         IntersectBoxFace(2, -k, origin, direction, tMax, t1, t2, hitSide, 0);
+         IntersectBoxFace(2, k, origin, direction, tMax, t1, t2, hitSide, 1);
+         IntersectBoxFace(1, -k, origin, direction, tMax, t1, t2, hitSide, 2);
+         IntersectBoxFace(1, k, origin, direction, tMax, t1, t2, hitSide, 3);
+         IntersectBoxFace(0, -k, origin, direction, tMax, t1, t2, hitSide, 4);
+         IntersectBoxFace(0, k, origin, direction, tMax, t1, t2, hitSide, 5);
+
+         const Material& material = m_Materials[instance.m_CustomIndex];
+         if (material.type == MATERIAL_SMOKE) {
+            uint32_t seed = smokeSeed();
+            const float hitDistance = std::max(t1, tMin) + material.materialParameter1 * std::log(RandomFloat(seed));
+            if ((hitDistance <= t2) && (t2 < tMax)) {
+               return report(hitDistance, hitSide, {});
+            }
+         } else if (((tMin <= t1) && (t1 < tMax)) || ((tMin <= t2) && (t2 < tMax))) {
+            return report(((tMin <= t1) && (t1 < tMax)) ? t1 : t2, hitSide, {});
+         }
+         return tMax;
+      }
+   }
+   return tMax;
+}
+
+
+// Triangles.rchit, Sphere.rchit, box.rchit
+RayPayload CPURenderer::Shade(const Hit& hit, const glm::vec3& origin, const glm::vec3& direction, uint32_t randomSeed) const {
+   const InstanceData& instance = m_Instances[hit.m_Instance];
+   const ModelData& model = m_Models[instance.m_ModelIndex];
+   const glm::vec3 objectOrigin = glm::vec3(instance.m_WorldToObject * glm::vec4 {origin, 1.0f});
+   const glm::vec3 objectDirection = glm::vec3(instance.m_WorldToObject * glm::vec4 {direction, 0.0f});
+
+   glm::vec3 hitPoint;
+   glm::vec3 normal;
+   glm::vec2 texCoord;
+   uint32_t slot = instance.m_CustomIndex;
+
+   switch (model.m_Type) {
+      case EPrimitiveType::eTriangles: {
+         const auto& vertices = model.m_Model->GetVertices();
+         const auto& indices = model.m_Model->GetIndices();
+         const uint32_t first = model.m_PrimitiveIndices[hit.m_Primitive];
+         const Vertex& v0 = vertices[indices[first + 0]];
+         const Vertex& v1 = vertices[indices[first + 1]];
+         const Vertex& v2 = vertices[indices[first + 2]];
+         const glm::vec3 barycentric = {1.0f - hit.m_Barycentrics.x - hit.m_Barycentrics.y, hit.m_Barycentrics.x, hit.m_Barycentrics.y};
+         hitPoint = v0.pos * barycentric.x + v1.pos * barycentric.y + v2.pos * barycentric.z;
+         normal = glm::normalize(v0.normal * barycentric.x + v1.normal * barycentric.y + v2.normal * barycentric.z);
+         texCoord = v0.uv * barycentric.x + v1.uv * barycentric.y + v2.uv * barycentric.z;
+         slot += model.m_PrimitiveGeometries[hit.m_Primitive];
+         break;
+      }
+
+      case EPrimitiveType::eSpheres: {
+         slot += hit.m_Primitive;
+         const glm::vec4& sphere = m_Spheres[slot];
+         hitPoint = objectOrigin + hit.m_T * objectDirection;
+         normal = glm::normalize(hitPoint - glm::vec3(sphere));
+         const float phi = std::atan2(normal.x, normal.z);
+         const float theta = std::asin(std::clamp(normal.y, -1.0f, 1.0f));
+         const float pi = glm::pi<float>();
+         texCoord = {(phi + pi) / (2.0f * pi), 1.0f - (theta + pi / 2.0f) / pi};
+         break;
+      }
+
+      case EPrimitiveType::eBoxes: {
+         static const glm::vec3 normals[6] = {{0.0f, 0.0f, -1.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, -1.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {-1.0f, 0.0f, 0.0f}, {1.0f, 0.0f, 0.0f}};
+         hitPoint = objectOrigin + hit.m_T * objectDirection;
+         normal = normals[hit.m_HitKind];
+         switch (hit.m_HitKind) {
+            case 0:
+            case 1:
+               texCoord = {hitPoint.x, hitPoint.y};
+               break;
+            case 2:
+            case 3:
+               texCoord = {hitPoint.x, hitPoint.z};
+               break;
+            default:
+               texCoord = {hitPoint.y, hitPoint.z};
+               break;
+         }
+         break;
+      }
+   }
+
+   // Transform hitPoint and normal to world coords (texCoords should not be transformed)
+   const glm::vec3 hitPointW = glm::vec3(instance.m_ObjectToWorld * glm::vec4 {hitPoint, 1.0f});
+   const glm::vec3 normalW = glm::normalize(glm::vec3(instance.m_ObjectToWorld * glm::vec4 {normal, 0.0f}));
+
+   return Scatter(direction, hit.m_T, hitPointW, normalW, texCoord, slot, randomSeed);
+}
+
+
+glm::vec3 CPURenderer::Color(const glm::vec3& hitPoint, const glm::vec3& normal, const glm::vec2& texCoord, const int textureType, const glm::vec4& textureParam1, const glm::vec4& textureParam2) const {
+   switch (textureType) {
+      case TEXTURE_FLATCOLOR: {
+         return glm::vec3(textureParam1);
+      }
+
+      case TEXTURE_CHECKERBOARD: {
+         const glm::vec3 oddColor = glm::vec3(textureParam1);
+         const glm::vec3 evenColor = glm::vec3(textureParam2);
+         const float scale = textureParam1.w;
+         const float sineProduct = (std::sin(hitPoint.x * scale) >= 0.0f ? 1.0f : -1.0f) * (std::sin(hitPoint.y * scale) >= 0.0f ? 1.0f : -1.0f) * (std::sin(hitPoint.z * scale) >= 0.0f ? 1.0f : -1.0f);
+         return (sineProduct < 0.0f) ? oddColor : evenColor;
+      }
+
+      case TEXTURE_SIMPLEX3D: {
+         const glm::vec3 p = hitPoint * textureParam2.w;
+         return glm::mix(glm::vec3(textureParam1), glm::vec3 {glm::simplex(p)}, textureParam1.w);
+      }
+
+      case TEXTURE_TURBULENCE: {
+         const glm::vec3 p = hitPoint * textureParam2.w;
+         return glm::mix(glm::vec3(textureParam1), glm::vec3 {Turbulence(p, static_cast<int>(textureParam2.z))}, textureParam1.w);
+      }
+
+      case TEXTURE_MARBLE: {
+         const glm::vec3 p = hitPoint * textureParam2.w;
+         return glm::mix(glm::vec3(textureParam1), glm::vec3 {std::sin(p.z + 10.0f * Turbulence(p, static_cast<int>(textureParam2.z)))}, textureParam1.w);
+      }
+
+      case TEXTURE_NORMALS: {
+         return (glm::vec3 {1.0f} + normal) / 2.0f;
+      }
+
+      case TEXTURE_UV: {
+         return {texCoord, 0.0f};
+      }
+
+      case TEXTURE_RED: {
+         return {1.0f, 0.0f, 0.0f};
+      }
+
+      default: {
+         // param1 has texture offset in xy, and texture scale in zw
+         if ((textureType < 0) || (textureType >= static_cast<int>(m_Textures.size()))) {
+            return glm::vec3 {0.0f};
+         }
+         const TextureData& texture = m_Textures[textureType];
+         const glm::vec2 uv = glm::vec2 {textureParam1.x, textureParam1.y} + (texCoord * glm::vec2 {textureParam1.z, textureParam1.w});
+         return glm::vec3(Sample(texture.m_Texels, texture.m_Width, texture.m_Height, uv, false));
+      }
+   }
+}
+
+
+static RayPayload ScatterLambertian(const float hitT, const glm::vec3& normal, const glm::vec3& color, uint32_t& randomSeed) {
+   // cosine weighted sampling, so the attenuation is just the color.  See Scatter.glsl
+   const glm::vec3 scatterDirection = RandomOnUnitHemisphere(normal, 1.0f, randomSeed);
+   return {glm::vec4 {color, hitT}, glm::vec4 {0.0f}, glm::vec4 {scatterDirection, 1.0f}, randomSeed};
+}
+
+
+RayPayload CPURenderer::Scatter(const glm::vec3& worldRayDirection, const float hitT, const glm::vec3& hitPoint, const glm::vec3& normal, const glm::vec2& texCoord, const uint32_t materialIndex, uint32_t& randomSeed) const {
+   const Material& material = m_Materials[materialIndex];
+
+   switch (material.type) {
+      case MATERIAL_LAMBERTIAN: {
+         return ScatterLambertian(hitT, normal, Color(hitPoint, normal, texCoord, material.diffuseTextureType, material.diffuseTextureParam1, material.diffuseTextureParam2), randomSeed);
+      }
+
+      case MATERIAL_PHONG: {
+         const glm::vec3 specular = Color(hitPoint, normal, texCoord, material.specularTextureType, material.specularTextureParam1, material.specularTextureParam2);
+         const glm::vec3 diffuse = glm::min(1.0f - specular, Color(hitPoint, normal, texCoord, material.diffuseTextureType, material.diffuseTextureParam1, material.diffuseTextureParam2));
+
+         float specularChance = glm::dot(specular, glm::vec3 {1.0f / 3.0f});
+         float diffuseChance = glm::dot(diffuse, glm::vec3 {1.0f / 3.0f});
+         const float sum = specularChance + diffuseChance;
+         if (sum > 0.00001f) {
+            diffuseChance /= sum;
+            specularChance /= sum;
+         } else {
+            diffuseChance = 1.0f;
+            specularChance = 0.0f;
+         }
+
+         const float select = RandomFloat(randomSeed);
+         if (select < specularChance) {
+            const float alpha = std::pow(10000.0f, material.materialParameter1 * material.materialParameter1);
+            const glm::vec3 scatterDirection = RandomOnUnitHemisphere(glm::reflect(worldRayDirection, normal), alpha, randomSeed);
+            const float f = (alpha + 2.0f) / (alpha + 1.0f);
+            return {glm::vec4 {specular / specularChance * glm::clamp(glm::dot(normal, scatterDirection), 0.0f, 1.0f) * f, hitT}, glm::vec4 {0.0f}, glm::vec4 {scatterDirection, 1.0f}, randomSeed};
+         }
+         return ScatterLambertian(hitT, normal, diffuse / diffuseChance, randomSeed);
+      }
+
+      case MATERIAL_METALLIC: {
+         const glm::vec3 color = Color(hitPoint, normal, texCoord, material.specularTextureType, material.specularTextureParam1, material.specularTextureParam2);
+         const glm::vec3 scatterDirection = glm::normalize(glm::reflect(worldRayDirection, normal) + material.materialParameter1 * RandomInUnitSphere(randomSeed));
+         return {glm::vec4 {color, hitT}, glm::vec4 {0.0f}, glm::vec4 {scatterDirection, 1.0f}, randomSeed};
+      }
+
+      case MATERIAL_DIELECTRIC: {
+         glm::vec3 outwardNormal;
+         float niOverNt;
+         float cosine;
+         if (glm::dot(worldRayDirection, normal) > 0.0f) {
+            outwardNormal = -normal;
+            niOverNt = material.materialParameter1;
+            cosine = niOverNt * glm::dot(worldRayDirection, normal);
+         } else {
+            outwardNormal = normal;
+            niOverNt = 1.0f / material.materialParameter1;
+            cosine = -glm::dot(worldRayDirection, normal);
+         }
+         const glm::vec3 refracted = glm::refract(worldRayDirection, outwardNormal, niOverNt);
+         const glm::vec4 attenuationAndDistance = {Color(hitPoint, normal, texCoord, material.diffuseTextureType, material.diffuseTextureParam1, material.diffuseTextureParam2), hitT};
+         const float reflectProbability = (glm::dot(refracted, refracted) > 0.0f) ? Schlick(cosine, material.materialParameter1) : 1.0f;
+         if (RandomFloat(randomSeed) < reflectProbability) {
+            return {attenuationAndDistance, glm::vec4 {0.0f}, glm::vec4 {glm::reflect(worldRayDirection, normal), 1.0f}, randomSeed};
+         }
+         return {attenuationAndDistance, glm::vec4 {0.0f}, glm::vec4 {refracted, 1.0f}, randomSeed};
+      }
+
+      case MATERIAL_LIGHT: {
+         float emit = 1.0f;
+         if (material.materialParameter1 > 0.0f) {
+            emit = std::pow(std::max(0.0f, -glm::dot(worldRayDirection, normal)), material.materialParameter1);
+         }
+         const glm::vec3 color = Color(hitPoint, normal, texCoord, material.diffuseTextureType, material.diffuseTextureParam1, material.diffuseTextureParam2);
+         return {glm::vec4 {0.0f, 0.0f, 0.0f, hitT}, emit * glm::vec4 {color, 0.0f}, glm::vec4 {0.0f}, randomSeed};
+      }
+
+      case MATERIAL_SMOKE: {
+         const glm::vec4 attenuationAndDistance = {Color(hitPoint, normal, texCoord, material.diffuseTextureType, material.diffuseTextureParam1, material.diffuseTextureParam2), hitT};
+         const glm::vec3 scatterDirection = RandomUnitVector(randomSeed);
+         return {attenuationAndDistance, glm::vec4 {0.0f}, glm::vec4 {scatterDirection, 1.0f}, randomSeed};
+      }
+   }
+   // (the GPU returns an undefined payload for unknown material types)
+   return {glm::vec4 {0.0f, 0.0f, 0.0f, hitT}, glm::vec4 {0.0f}, glm::vec4 {0.0f}, randomSeed};
+}
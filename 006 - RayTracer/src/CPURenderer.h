@@ -0,0 +1,137 @@
+#pragma once
+
+#include "BVH.h"
+#include "Scene.h"
+#include "Utility.h"
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Shared with the shaders (see the .glsl of the same name)
+struct RayPayload;
+struct UniformBufferObject;
+
+// Reference path tracer that runs entirely on the CPU.
+//
+// Renders the same Scene as the GPU ray tracing pipeline, and mirrors what the shaders do:
+//    RayTrace.rgen / RayTrace.rmiss    camera rays, russian roulette, accumulation, tonemapping
+//    Scatter.glsl                      materials and procedural textures
+//    Sphere.rint / Box.rint            procedural geometry (including smoke)
+//    *.rchit                           hit point, normal and texture coordinates
+// with the same random number generator, seeded the same way, so it can be used as a fallback where there is no
+// ray tracing capable GPU, and as the reference that GPU output is compared against.
+// Next event estimation is deliberately not mirrored: this stays a plain (BSDF sampling only) path tracer, so that it is an
+// independent reference for what the GPU converges to with and without light sampling.
+//
+// Acceleration structures are two level (like the GPU's): one BVH per model, plus one over the instances.
+// Each frame is split into tiles that are handed out to one worker thread per core.
+class CPURenderer {
+public:
+   // scene must outlive the renderer
+   CPURenderer(const Scene& scene, const uint32_t width, const uint32_t height);
+   NON_COPYABLE(CPURenderer);
+
+   // Traces one sample per pixel and adds it into the accumulation buffer (which is reset if ubo.accumulatedFrameCount is 1).
+   // Output image is then updated from the accumulation buffer.
+   void RenderFrame(const UniformBufferObject& ubo);
+
+   // RGBA8, tonemapped and gamma corrected (i.e. same as the GPU output image)
+   const std::vector<uint8_t>& GetOutputImage() const;
+
+   // PNG
+   void WriteOutputImage(const std::string& fileName) const;
+
+   // Total number of rays traced (by all RenderFrame() calls so far)
+   uint64_t GetRayCount() const;
+
+private:
+   using Bounds = BVH::Bounds;
+
+   enum class EPrimitiveType {
+      eTriangles,
+      eSpheres,
+      eBoxes
+   };
+
+   struct ModelData {
+      const Model* m_Model;
+      EPrimitiveType m_Type;
+      BVH m_BVH;
+      std::vector<uint32_t> m_PrimitiveGeometries;  // triangles: which geometry each primitive (triangle) is in
+      std::vector<uint32_t> m_PrimitiveIndices;     // triangles: index (in model's indices) of first vertex of each triangle
+   };
+
+   struct InstanceData {
+      uint32_t m_ModelIndex;
+      uint32_t m_CustomIndex;        // first "slot", same as the GPU instance custom index.  See Instance::GetMaterials()
+      glm::mat4 m_ObjectToWorld;
+      glm::mat4 m_WorldToObject;
+   };
+
+   struct Hit {
+      float m_T;
+      uint32_t m_Instance;
+      uint32_t m_Primitive;
+      uint32_t m_HitKind;
+      glm::vec2 m_Barycentrics;
+   };
+
+   // What the shaders get from gl_LaunchIDEXT and the uniform buffer.  Needed for seeding the smoke random numbers
+   struct RayContext {
+      uint32_t m_X;
+      uint32_t m_Y;
+      uint32_t m_Frame;
+   };
+
+   struct TextureData {
+      int m_Width = 0;
+      int m_Height = 0;
+      std::vector<glm::vec4> m_Texels;   // linear color
+   };
+
+   void CreateModels();
+   void CreateInstances();
+   void CreateTextures();
+
+   // rayCount is incremented for each ray traced
+   glm::vec3 TracePath(const uint32_t x, const uint32_t y, const UniformBufferObject& ubo, uint64_t& rayCount) const;
+
+   bool TraceRay(const glm::vec3& origin, const glm::vec3& direction, const float tMin, const float tMax, const RayContext& context, Hit& hit) const;
+
+   float IntersectPrimitive(const uint32_t instanceIndex, const ModelData& model, const uint32_t primitive, const glm::vec3& origin, const glm::vec3& direction, const glm::vec3& worldOrigin, const float tMin, const float tMax, const RayContext& context, Hit& hit) const;
+
+   // closest hit shaders
+   RayPayload Shade(const Hit& hit, const glm::vec3& origin, const glm::vec3& direction, uint32_t randomSeed) const;
+
+   RayPayload Scatter(const glm::vec3& worldRayDirection, const float hitT, const glm::vec3& hitPoint, const glm::vec3& normal, const glm::vec2& texCoord, const uint32_t materialIndex, uint32_t& randomSeed) const;
+
+   glm::vec3 Color(const glm::vec3& hitPoint, const glm::vec3& normal, const glm::vec2& texCoord, const int textureType, const glm::vec4& textureParam1, const glm::vec4& textureParam2) const;
+
+   glm::vec3 Miss(const glm::vec3& direction, const UniformBufferObject& ubo) const;
+
+private:
+   const Scene& m_Scene;
+   uint32_t m_Width;
+   uint32_t m_Height;
+
+   std::vector<ModelData> m_Models;
+   std::vector<InstanceData> m_Instances;
+   BVH m_InstanceBVH;
+
+   // per slot, same as the GPU's material and sphere buffers
+   std::vector<Material> m_Materials;
+   std::vector<glm::vec4> m_Spheres;
+
+   std::vector<TextureData> m_Textures;
+   TextureData m_Skybox;
+
+   std::vector<glm::vec3> m_AccumulationImage;
+   std::vector<uint8_t> m_OutputImage;
+
+   std::atomic<uint64_t> m_RayCount = 0;
+
+   static constexpr uint32_t sm_TileSize = 16;
+};
@@ -3,7 +3,14 @@
 Instance::Instance(const uint32_t modelIndex, const glm::mat3x4& transform, const Material& material)
 : m_ModelIndex(modelIndex)
 , m_Transform(transform)
-, m_Material(material)
+, m_Materials {material}
+{}
+
+
+Instance::Instance(const uint32_t modelIndex, const glm::mat3x4& transform, const std::vector<Material>& materials)
+: m_ModelIndex(modelIndex)
+, m_Transform(transform)
+, m_Materials(materials)
 {}
 
 
@@ -17,6 +24,22 @@ const glm::mat3x4& Instance::GetTransform() const {
 }
 
 
+glm::mat4 Instance::GetObjectToWorld() const {
+   glm::mat4 objectToWorld {1.0f};
+   for (int row = 0; row < 3; ++row) {
+      for (int column = 0; column < 4; ++column) {
+         objectToWorld[column][row] = m_Transform[row][column];
+      }
+   }
+   return objectToWorld;
+}
+
+
 const Material& Instance::GetMaterial() const {
-   return m_Material;
+   return m_Materials.front();
+}
+
+
+const std::vector<Material>& Instance::GetMaterials() const {
+   return m_Materials;
 }
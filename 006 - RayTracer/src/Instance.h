@@ -2,18 +2,31 @@
 
 #include "Material.h"
 
+#include <vector>
+
 class Instance {
 public:
    Instance(const uint32_t modelIndex, const glm::mat3x4& transform, const Material& material);
 
+   // For models with more than one procedural primitive, each of which has its own material (e.g. SphereSet)
+   Instance(const uint32_t modelIndex, const glm::mat3x4& transform, const std::vector<Material>& materials);
+
    uint32_t GetModelIndex() const;
 
    const glm::mat3x4& GetTransform() const;
 
+   // GetTransform() is row major 3x4 (same as vk::TransformMatrixKHR).  This is the same transform as a (column major) glm 4x4
+   glm::mat4 GetObjectToWorld() const;
+
    const Material& GetMaterial() const;
 
+   // Usually one, but one per primitive for models like SphereSet.
+   // Materials (and other per instance shader data) are indexed by instance custom index + primitive index, so
+   // each instance takes up this many consecutive indices.
+   const std::vector<Material>& GetMaterials() const;
+
 private:
    uint32_t m_ModelIndex;
    glm::mat3x4 m_Transform;
-   Material m_Material;
+   std::vector<Material> m_Materials;
 };
@@ -1,6 +1,9 @@
 #include "Model.h"
 
 #include "Core.h"
+#include "Utility.h"
+
+#include <cstring>
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
@@ -9,6 +12,19 @@
 uint32_t Model::sm_ShaderHitGroupIndex = ~0;
 
 
+Model::Model(const uint32_t shaderHitGroupIndex)
+: m_ShaderHitGroupIndex(shaderHitGroupIndex)
+{}
+
+
+Model::Model(std::vector<Vertex> vertices, std::vector<uint32_t> indices, std::vector<ModelGeometry> geometries, const uint32_t shaderHitGroupIndex)
+: m_Vertices(std::move(vertices))
+, m_Indices(std::move(indices))
+, m_Geometries(std::move(geometries))
+, m_ShaderHitGroupIndex(shaderHitGroupIndex)
+{}
+
+
 Model::Model(const char* filename, const uint32_t shaderHitGroupIndex)
 : m_ShaderHitGroupIndex(shaderHitGroupIndex)
 {
@@ -75,6 +91,14 @@ const std::vector<uint32_t>& Model::GetIndices() const {
 }
 
 
+std::vector<ModelGeometry> Model::GetGeometries() const {
+   if (m_Geometries.empty()) {
+      return {{0, static_cast<uint32_t>(GetIndices().size())}};
+   }
+   return m_Geometries;
+}
+
+
 bool Model::IsProcedural() const {
    return false;
 }
@@ -92,6 +116,76 @@ std::array<glm::vec3, 2> Model::GetBoundingBox() const {
 };
 
 
+std::vector<std::array<glm::vec3, 2>> Model::GetBoundingBoxes() const {
+   return {GetBoundingBox()};
+}
+
+
+std::vector<std::array<glm::vec3, 2>> Model::GetPrimitiveBounds() const {
+   if (IsProcedural()) {
+      return GetBoundingBoxes();
+   }
+   std::vector<std::array<glm::vec3, 2>> triangleBounds;
+   triangleBounds.reserve(m_Indices.size() / 3);
+   for (const auto& geometry : GetGeometries()) {
+      for (uint32_t i = geometry.m_FirstIndex; i + 2 < geometry.m_FirstIndex + geometry.m_IndexCount; i += 3) {
+         const glm::vec3& p0 = m_Vertices[m_Indices[i + 0]].pos;
+         const glm::vec3& p1 = m_Vertices[m_Indices[i + 1]].pos;
+         const glm::vec3& p2 = m_Vertices[m_Indices[i + 2]].pos;
+         triangleBounds.push_back({glm::min(p0, glm::min(p1, p2)), glm::max(p0, glm::max(p1, p2))});
+      }
+   }
+   return triangleBounds;
+}
+
+
+uint64_t Model::GetContentHash() const {
+   uint64_t hash = Vulkan::HashBytes(&m_ShaderHitGroupIndex, sizeof(m_ShaderHitGroupIndex));
+   if (IsProcedural()) {
+      const std::vector<std::array<glm::vec3, 2>> boundingBoxes = GetBoundingBoxes();
+      hash = Vulkan::HashBytes("AABBs", 5, hash);
+      return Vulkan::HashBytes(boundingBoxes.data(), boundingBoxes.size() * sizeof(std::array<glm::vec3, 2>), hash);
+   }
+   const std::vector<ModelGeometry> geometries = GetGeometries();
+   hash = Vulkan::HashBytes("Triangles", 9, hash);
+   hash = Vulkan::HashBytes(m_Vertices.data(), m_Vertices.size() * sizeof(Vertex), hash);
+   hash = Vulkan::HashBytes(m_Indices.data(), m_Indices.size() * sizeof(uint32_t), hash);
+   return Vulkan::HashBytes(geometries.data(), geometries.size() * sizeof(ModelGeometry), hash);
+}
+
+
+bool Model::HasSameContent(const Model& other) const {
+   if ((IsProcedural() != other.IsProcedural()) || (m_ShaderHitGroupIndex != other.m_ShaderHitGroupIndex)) {
+      return false;
+   }
+   if (IsProcedural()) {
+      const std::vector<std::array<glm::vec3, 2>> boundingBoxes = GetBoundingBoxes();
+      const std::vector<std::array<glm::vec3, 2>> otherBoundingBoxes = other.GetBoundingBoxes();
+      return
+         (boundingBoxes.size() == otherBoundingBoxes.size()) &&
+         (memcmp(boundingBoxes.data(), otherBoundingBoxes.data(), boundingBoxes.size() * sizeof(std::array<glm::vec3, 2>)) == 0)
+      ;
+   }
+   const std::vector<ModelGeometry> geometries = GetGeometries();
+   const std::vector<ModelGeometry> otherGeometries = other.GetGeometries();
+   return
+      (m_Vertices.size() == other.m_Vertices.size()) &&
+      (m_Indices == other.m_Indices) &&
+      (geometries.size() == otherGeometries.size()) &&
+      (memcmp(m_Vertices.data(), other.m_Vertices.data(), m_Vertices.size() * sizeof(Vertex)) == 0) &&
+      (memcmp(geometries.data(), otherGeometries.data(), geometries.size() * sizeof(ModelGeometry)) == 0)
+   ;
+}
+
+
+size_t Model::GetContentSize() const {
+   if (IsProcedural()) {
+      return GetBoundingBoxes().size() * sizeof(std::array<glm::vec3, 2>);
+   }
+   return (m_Vertices.size() * sizeof(Vertex)) + (m_Indices.size() * sizeof(uint32_t));
+}
+
+
 void Model::SetDefaultShaderHitGroupIndex(const uint32_t shaderHitGroupIndex) {
    sm_ShaderHitGroupIndex = shaderHitGroupIndex;
 }
@@ -4,10 +4,20 @@
 
 #include <array>
 
+// A range of a model's indices that is a separate geometry in the model's BLAS (and so can have its own material)
+struct ModelGeometry {
+   uint32_t m_FirstIndex;
+   uint32_t m_IndexCount;
+};
+
+
 class Model {
 public:
    Model(const char* filename, const uint32_t shaderHitGroupIndex = sm_ShaderHitGroupIndex);
 
+   // Model made from already existing mesh data (e.g. by Scene::FlattenInstances())
+   Model(std::vector<Vertex> vertices, std::vector<uint32_t> indices, std::vector<ModelGeometry> geometries, const uint32_t shaderHitGroupIndex = sm_ShaderHitGroupIndex);
+
    // For now all "Models" have vertices and indices, even though procedural geometries
    // do not strictly need these.
    // It's convenient, however, for debugging to be able to switch procedural geometries
@@ -19,6 +29,10 @@ public:
 
    const std::vector<uint32_t>& GetIndices() const;
 
+   // Geometries for non-procedural models.  Usually this is just one geometry covering all of the indices.
+   // Instances of the model must have one material per geometry.
+   std::vector<ModelGeometry> GetGeometries() const;
+
    // If true, then model intersections will be determined via AABBs + procedural shader
    virtual bool IsProcedural() const;
 
@@ -28,13 +42,36 @@ public:
    // only returns sensible result if IsProcedural() = true
    virtual std::array<glm::vec3, 2> GetBoundingBox() const;
 
+   // One bounding box per procedural primitive (i.e. per AABB in the BLAS).
+   // Default is just GetBoundingBox()
+   virtual std::vector<std::array<glm::vec3, 2>> GetBoundingBoxes() const;
+
+   // One bounding box per primitive in the model's BLAS: GetBoundingBoxes() for procedural models, otherwise
+   // one per triangle (in geometry order, i.e. primitive index within a geometry is gl_PrimitiveID)
+   std::vector<std::array<glm::vec3, 2>> GetPrimitiveBounds() const;
+
+   // Hash of everything that determines the model's GPU resources (vertices, indices, geometries, AABBs, shader hit group).
+   // Models with the same content can share one vertex/index range and one BLAS (see Scene::AddModel())
+   uint64_t GetContentHash() const;
+
+   // Full comparison, for when content hashes match
+   bool HasSameContent(const Model& other) const;
+
+   // Size of the model's vertex/index (or AABB) data on the GPU
+   size_t GetContentSize() const;
+
 public:
    static void SetDefaultShaderHitGroupIndex(const uint32_t shaderHitGroupIndex);
    static uint32_t GetDefaultShaderHitGroupIndex();
 
+protected:
+   // For procedural models that have no mesh
+   Model(const uint32_t shaderHitGroupIndex);
+
 private:
    std::vector<Vertex> m_Vertices;
    std::vector<uint32_t> m_Indices;
+   std::vector<ModelGeometry> m_Geometries;   // empty = one geometry covering all of m_Indices
    uint32_t m_ShaderHitGroupIndex;
 
    static uint32_t sm_ShaderHitGroupIndex;
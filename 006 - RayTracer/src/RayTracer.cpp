@@ -5,6 +5,8 @@
 
 using uint = uint32_t;
 #include "Constants.glsl"
+#include "Wavefront.glsl"
+#include "BVH.h"
 #include "Box.h"
 #include "GeometryInstance.h"
 #include "Offset.h"
@@ -14,6 +16,7 @@ using uint = uint32_t;
 using mat4 = glm::mat4;
 using uint = uint32_t;
 using vec3 = glm::vec3;
+#include "Light.glsl"
 #include "UniformBufferObject.glsl"
 
 #include "Utility.h"
@@ -23,7 +26,13 @@ using vec3 = glm::vec3;
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
 #include <random>
+#include <string>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
@@ -58,6 +67,7 @@ RayTracer::RayTracer(int argc, const char* argv[])
 #endif
 }
 {
+   ParseCommandLine(argc, argv);
    Init();
 }
 
@@ -65,13 +75,23 @@ RayTracer::RayTracer(int argc, const char* argv[])
 RayTracer::~RayTracer() {
    DestroyDescriptorSets();
    DestroyDescriptorPool();
+   DestroyReprojectPipeline();
+   DestroyDenoisePipeline();
+   DestroyAdaptiveSamplingPipeline();
    DestroyPipeline();
+   DestroyWavefrontPipelineLayout();
    DestroyPipelineLayout();
    DestroyDescriptorSetLayout();
+   DestroyWavefrontBuffers();
+   DestroyRayCountBuffer();
    DestroyUniformBuffers();
    DestroyStorageImages();
    DestroyAccelerationStructures();
+   DestroyBVHBuffers();
    DestroyTextureResources();
+   DestroySamplerBuffers();
+   DestroyLightBuffer();
+   DestroySphereBuffer();
    DestroyMaterialBuffer();
    DestroyAABBBuffer();
    DestroyOffsetBuffer();
@@ -80,31 +100,120 @@ RayTracer::~RayTracer() {
 }
 
 
+bool RayTracer::ParseCommandLineOption(const int argc, const char* argv[], int& i) {
+   if (strcmp(argv[i], "--cpu") == 0) {
+      m_RayTracerSettings.IsCPURender = true;
+   } else if ((strcmp(argv[i], "--output") == 0) && (i + 1 < argc)) {
+      m_RayTracerSettings.OutputImageFileName = argv[++i];
+   } else if (strcmp(argv[i], "--no-flatten") == 0) {
+      m_RayTracerSettings.IsInstanceFlatteningEnabled = false;
+   } else if (strcmp(argv[i], "--compute") == 0) {
+      m_RayTracerSettings.IsComputeRayTracing = true;
+   } else if (strcmp(argv[i], "--no-nee") == 0) {
+      m_RayTracerSettings.IsNextEventEstimationEnabled = false;
+   } else if ((strcmp(argv[i], "--time") == 0) && (i + 1 < argc)) {
+      m_RayTracerSettings.TimeLimit = std::stod(argv[++i]);
+   } else if ((strcmp(argv[i], "--reference") == 0) && (i + 1 < argc)) {
+      m_RayTracerSettings.ReferenceImageFileName = argv[++i];
+   } else if ((strcmp(argv[i], "--adaptive") == 0) && (i + 1 < argc)) {
+      m_RayTracerSettings.AdaptiveSamplingThreshold = std::stof(argv[++i]);
+   } else if ((strcmp(argv[i], "--denoise") == 0) && (i + 1 < argc)) {
+      m_RayTracerSettings.DenoiseIterations = static_cast<uint32_t>(std::stoul(argv[++i]));
+   } else if ((strcmp(argv[i], "--temporal") == 0) && (i + 1 < argc)) {
+      m_RayTracerSettings.TemporalHistoryLength = static_cast<uint32_t>(std::stoul(argv[++i]));
+   } else if ((strcmp(argv[i], "--sampler") == 0) && (i + 1 < argc)) {
+      m_RayTracerSettings.SamplerName = argv[++i];
+   } else if (strcmp(argv[i], "--compare-samplers") == 0) {
+      m_RayTracerSettings.IsSamplerComparison = true;
+   } else if (strcmp(argv[i], "--wavefront") == 0) {
+      m_RayTracerSettings.IsWavefrontPathTracing = true;
+      m_RayTracerSettings.IsComputeRayTracing = true;
+   } else if ((strcmp(argv[i], "--quality") == 0) && (i + 1 < argc)) {
+      m_RayTracerSettings.QualityPresetName = argv[++i];
+   } else if ((strcmp(argv[i], "--tonemap") == 0) && (i + 1 < argc)) {
+      m_RayTracerSettings.TonemapOperatorName = argv[++i];
+   } else if (strcmp(argv[i], "--animate") == 0) {
+      m_RayTracerSettings.IsAnimationEnabled = true;
+   } else {
+      return false;
+   }
+   return true;
+}
+
+
 void RayTracer::Init() {
+   // (before anything else, the CPU renderer goes by these too)
+   const std::string qualityPresetName = m_RayTracerSettings.QualityPresetName ? m_RayTracerSettings.QualityPresetName : "final";
+   auto qualityPreset = std::find_if(sm_QualityPresets.begin(), sm_QualityPresets.end(), [&qualityPresetName](const QualityPreset& preset) { return qualityPresetName == preset.m_Name; });
+   if (qualityPreset == sm_QualityPresets.end()) {
+      throw std::runtime_error("unknown quality preset '" + qualityPresetName + "'.  Presets are: draft preview final");
+   }
+   m_QualityPreset = static_cast<uint32_t>(qualityPreset - sm_QualityPresets.begin());
+
+   const std::string tonemapOperatorName = m_RayTracerSettings.TonemapOperatorName ? m_RayTracerSettings.TonemapOperatorName : "exponential";
+   auto tonemapOperator = std::find(sm_TonemapOperatorNames.begin(), sm_TonemapOperatorNames.end(), tonemapOperatorName);
+   if (tonemapOperator == sm_TonemapOperatorNames.end()) {
+      throw std::runtime_error("unknown tonemap operator '" + tonemapOperatorName + "'.  Operators are: exponential reinhard aces");
+   }
+   m_TonemapOperator = static_cast<uint32_t>(tonemapOperator - sm_TonemapOperatorNames.begin());
+
+   LOG_INFO("Quality preset: {0} ({1} to {2} bounces)", sm_QualityPresets[m_QualityPreset].m_Name, sm_QualityPresets[m_QualityPreset].m_MinRayBounces, sm_QualityPresets[m_QualityPreset].m_MaxRayBounces);
+   LOG_INFO("Tonemap operator: {0}", sm_TonemapOperatorNames[m_TonemapOperator]);
+
+   if (m_RayTracerSettings.IsCPURender) {
+      // No Vulkan at all, just the scene and the CPU renderer.  See Run()
+      CreateScene();
+      m_CPURenderer = std::make_unique<CPURenderer>(m_Scene, m_Settings.WindowWidth, m_Settings.WindowHeight);
+      return;
+   }
+
    Vulkan::Application::Init();
 
-   auto properties = m_PhysicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceRayTracingPipelinePropertiesKHR>();
-   m_RayTracingPipelineProperties = properties.get<vk::PhysicalDeviceRayTracingPipelinePropertiesKHR>();
+   if (!m_RayTracerSettings.IsComputeRayTracing) {
+      auto properties = m_PhysicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceRayTracingPipelinePropertiesKHR>();
+      m_RayTracingPipelineProperties = properties.get<vk::PhysicalDeviceRayTracingPipelinePropertiesKHR>();
+   }
 
    // Check requested push constant size against hardware limit
    // Specs require 128 bytes, so if the device complies our push constant buffer should always fit into memory
-   if (properties.get<vk::PhysicalDeviceProperties2>().properties.limits.maxPushConstantsSize < sizeof(Constants)) {
+   if (m_PhysicalDeviceProperties.limits.maxPushConstantsSize < sizeof(WavefrontConstants)) {
       throw std::runtime_error("(Push)Constants too large");
    }
 
+   const std::string samplerName = m_RayTracerSettings.SamplerName ? m_RayTracerSettings.SamplerName : "sobol";
+   auto sampler = std::find(sm_SamplerNames.begin(), sm_SamplerNames.end(), samplerName);
+   if (sampler == sm_SamplerNames.end()) {
+      throw std::runtime_error("unknown sampler '" + samplerName + "'.  Samplers are: random sobol bluenoise");
+   }
+   m_SamplerType = static_cast<uint32_t>(sampler - sm_SamplerNames.begin());
+
    CreateScene();
    CreateVertexBuffer();
    CreateIndexBuffer();
    CreateOffsetBuffer();
-   CreateAABBBuffer();
    CreateMaterialBuffer();
+   CreateSphereBuffer();
+   CreateLightBuffer();
+   CreateSamplerBuffers();
    CreateTextureResources();
-   CreateAccelerationStructures();
+   if (m_RayTracerSettings.IsComputeRayTracing) {
+      CreateBVHBuffers();
+   } else {
+      CreateHitRecords();
+      CreateAABBBuffer();
+      CreateAccelerationStructures();
+   }
    CreateStorageImages();
    CreateUniformBuffers();
+   CreateRayCountBuffer();
+   CreateWavefrontBuffers();
    CreateDescriptorSetLayout();
    CreatePipelineLayout();
+   CreateWavefrontPipelineLayout();
    CreatePipeline();
+   CreateAdaptiveSamplingPipeline();
+   CreateDenoisePipeline();
+   CreateReprojectPipeline();
    CreateDescriptorPool();
    CreateDescriptorSets();
    RecordCommandBuffers();
@@ -117,6 +226,10 @@ std::vector<const char*> RayTracer::GetRequiredInstanceExtensions() {
 
 
 std::vector<const char*> RayTracer::GetRequiredDeviceExtensions() {
+   if (m_RayTracerSettings.IsComputeRayTracing) {
+      // Software ray tracing in a compute shader.  Runs on devices without ray tracing support
+      return {};
+   }
    return {
       VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME,
       VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
@@ -127,6 +240,14 @@ std::vector<const char*> RayTracer::GetRequiredDeviceExtensions() {
 
 vk::PhysicalDeviceFeatures RayTracer::GetRequiredPhysicalDeviceFeatures(vk::PhysicalDeviceFeatures availableFeatures) {
    vk::PhysicalDeviceFeatures features;
+   if (m_RayTracerSettings.IsComputeRayTracing) {
+      // Compute ray tracing is meant to run on whatever device there is, so these are only nice to have (the texture sampler does
+      // without anisotropic filtering if it has to, see CreateTextureResources())
+      features.setSamplerAnisotropy(availableFeatures.samplerAnisotropy);
+      features.setFillModeNonSolid(availableFeatures.fillModeNonSolid);
+      features.setShaderInt64(availableFeatures.shaderInt64);
+      return features;
+   }
    if (availableFeatures.samplerAnisotropy) {
       features.setSamplerAnisotropy(true);
    } else {
@@ -148,16 +269,22 @@ vk::PhysicalDeviceFeatures RayTracer::GetRequiredPhysicalDeviceFeatures(vk::Phys
 
 void* RayTracer::GetRequiredPhysicalDeviceFeaturesEXT() {
 
-   static vk::PhysicalDeviceBufferDeviceAddressFeatures bufferDeviceAddressFeatures;
-   bufferDeviceAddressFeatures.bufferDeviceAddress = true;
-
    static vk::PhysicalDeviceDescriptorIndexingFeatures indexingFeatures;
    indexingFeatures.runtimeDescriptorArray = true;
-   indexingFeatures.pNext = &bufferDeviceAddressFeatures;
+
+   if (m_RayTracerSettings.IsComputeRayTracing) {
+      // (no buffer device addresses either, see GetGeometryBufferUsage())
+      return &indexingFeatures;
+   }
+
+   static vk::PhysicalDeviceBufferDeviceAddressFeatures bufferDeviceAddressFeatures;
+   bufferDeviceAddressFeatures.bufferDeviceAddress = true;
+   bufferDeviceAddressFeatures.pNext = &indexingFeatures;
 
    static vk::PhysicalDeviceAccelerationStructureFeaturesKHR accelerationStructureFeatures;
    accelerationStructureFeatures.accelerationStructure = true;
-   accelerationStructureFeatures.pNext = &indexingFeatures;
+   accelerationStructureFeatures.accelerationStructureHostCommands = IsHostAccelerationStructureBuild();
+   accelerationStructureFeatures.pNext = &bufferDeviceAddressFeatures;
 
    static vk::PhysicalDeviceRayTracingPipelineFeaturesKHR rayTracingFeatures;
    rayTracingFeatures.rayTracingPipeline = true;
@@ -169,9 +296,11 @@ void* RayTracer::GetRequiredPhysicalDeviceFeaturesEXT() {
 
 void RayTracer::CreateScene() {
 
-   Model::SetDefaultShaderHitGroupIndex(eTrianglesHitGroup - eFirstHitGroup);
-   Sphere::SetDefaultShaderHitGroupIndex(eSphereHitGroup - eFirstHitGroup);
-   Box::SetDefaultShaderHitGroupIndex(eBoxHitGroup - eFirstHitGroup);
+   // A model's "shader hit group index" is its type of geometry.  The hit group that an instance's rays actually use also depends on
+   // the instance's materials (see CreateHitRecords())
+   Model::SetDefaultShaderHitGroupIndex(HITGROUP_TRIANGLES);
+   Sphere::SetDefaultShaderHitGroupIndex(HITGROUP_SPHERE);
+   Box::SetDefaultShaderHitGroupIndex(HITGROUP_BOX);
 
    m_Scene.AddTextureResource("Earth", "Assets/Textures/earthmap.jpg");
 
@@ -180,18 +309,75 @@ void RayTracer::CreateScene() {
    ProceduralBoxInstance::SetModelIndex(m_Scene.AddModel(std::make_unique<Box>(true)));
    Rectangle2DInstance::SetModelIndex(m_Scene.AddModel(std::make_unique<Rectangle2D>()));
 
-   //CreateSceneFurnaceTest();
-   //CreateSceneNormalsTest();
-   //CreateSceneSimple();
-   //CreateSceneRayTracingInOneWeekend();
-   //CreateSceneRayTracingTheNextWeekTexturesAndLight();
-   //CreateSceneCornellBoxWithBoxes();
-   //CreateSceneCornellBoxWithSmokeBoxes();
-   //CreateSceneCornellBoxWithEarth();
-   //CreateSceneRayTracingTheNextWeekFinal();
-   //CreateSceneWineGlass();
-   CreateSceneShaderBall();
+   // Scene can be chosen on the command line (--scene <name>).  Default is ShaderBall
+   static const std::vector<std::pair<std::string, void (RayTracer::*)()>> scenes = {
+      {"FurnaceTest",                            &RayTracer::CreateSceneFurnaceTest},
+      {"NormalsTest",                            &RayTracer::CreateSceneNormalsTest},
+      {"Simple",                                 &RayTracer::CreateSceneSimple},
+      {"RayTracingInOneWeekend",                 &RayTracer::CreateSceneRayTracingInOneWeekend},
+      {"RayTracingTheNextWeekTexturesAndLight",  &RayTracer::CreateSceneRayTracingTheNextWeekTexturesAndLight},
+      {"CornellBoxWithBoxes",                    &RayTracer::CreateSceneCornellBoxWithBoxes},
+      {"CornellBoxWithSmokeBoxes",               &RayTracer::CreateSceneCornellBoxWithSmokeBoxes},
+      {"CornellBoxWithEarth",                    &RayTracer::CreateSceneCornellBoxWithEarth},
+      {"RayTracingTheNextWeekFinal",             &RayTracer::CreateSceneRayTracingTheNextWeekFinal},
+      {"WineGlass",                              &RayTracer::CreateSceneWineGlass},
+      {"ShaderBall",                             &RayTracer::CreateSceneShaderBall}
+   };
+   const std::string sceneName = m_Settings.SceneName ? m_Settings.SceneName : "ShaderBall";
+   auto scene = std::find_if(scenes.begin(), scenes.end(), [&sceneName] (const auto& entry) { return entry.first == sceneName; });
+   if (scene == scenes.end()) {
+      std::string names;
+      for (const auto& entry : scenes) {
+         names += " " + entry.first;
+      }
+      throw std::runtime_error("unknown scene '" + sceneName + "'.  Scenes are:" + names);
+   }
+   LOG_INFO("Creating scene '{0}'", sceneName);
+   (this->*(scene->second))();
+
+   if (m_RayTracerSettings.IsInstanceFlatteningEnabled) {
+      m_Scene.FlattenInstances();
+   }
+
+   if (m_RayTracerSettings.IsAnimationEnabled) {
+      if (m_RayTracerSettings.IsComputeRayTracing || m_RayTracerSettings.IsCPURender) {
+         // (instances are only moved in the TLAS, see Application::SetInstanceTransform())
+         LOG_WARN("--animate is only supported with the ray tracing pipeline.  Nothing will move");
+      } else {
+         // Smallest instance that is not a light (moving a light would leave the light buffer behind, see CreateLightBuffer())
+         float smallestSize = std::numeric_limits<float>::max();
+         const auto& instances = m_Scene.GetInstances();
+         for (uint32_t i = 0; i < instances.size(); ++i) {
+            const auto& materials = instances[i]->GetMaterials();
+            if (std::any_of(materials.begin(), materials.end(), [](const Material& material) { return material.type == MATERIAL_LIGHT; })) {
+               continue;
+            }
+            const std::array<glm::vec3, 2> bounds = m_Scene.GetInstanceBounds(i);
+            const float size = glm::length(bounds[1] - bounds[0]);
+            if ((size > 0.0f) && (size < smallestSize)) {
+               smallestSize = size;
+               m_AnimatedInstance = i;
+            }
+         }
+         if (m_AnimatedInstance != sm_NoInstance) {
+            m_AnimatedInstanceTransform = instances[m_AnimatedInstance]->GetTransform();
+            m_AnimationRadius = smallestSize;
+            LOG_INFO("Animating instance {0}", m_AnimatedInstance);
+         }
+      }
+   }
+
+   if (m_Scene.GetDuplicateModelCount() > 0) {
+      LOG_INFO("{0} duplicate models share geometry with existing ones.  Saved {1} BLAS builds and {2:.1f} KB of geometry data", m_Scene.GetDuplicateModelCount(), m_Scene.GetDuplicateModelCount(), m_Scene.GetDuplicateModelSize() / 1024.0);
+   }
+
+}
+
 
+void RayTracer::AddSphereSet(std::unique_ptr<SphereSet> sphereSet) {
+   const std::vector<Material> materials = sphereSet->GetMaterials();
+   const uint32_t modelIndex = m_Scene.AddModel(std::move(sphereSet));
+   m_Scene.AddInstance(std::make_unique<SphereSetInstance>(modelIndex, materials));
 }
 
 
@@ -321,7 +507,8 @@ void RayTracer::CreateSceneRayTracingInOneWeekend() {
       )
    ));
 
-   // small random spheres
+   // small random spheres (all in one sphere set, so that they are a single TLAS instance)
+   auto smallSpheres = std::make_unique<SphereSet>();
    for (int a = -11; a < 11; a++) {
       for (int b = -11; b < 11; b++) {
          float chooseMaterial = RandomFloat();
@@ -346,10 +533,11 @@ void RayTracer::CreateSceneRayTracingInOneWeekend() {
             } else {
                material = Dielectric(FlatColor({1.0f, 1.0f, 1.0f}), 1.5f);
             }
-            m_Scene.AddInstance(std::make_unique<SphereInstance>(centre, 0.2f, material));
+            smallSpheres->AddSphere(centre, 0.2f, material);
          }
       }
    }
+   AddSphereSet(std::move(smallSpheres));
 
    // the three main spheres...
    m_Scene.AddInstance(std::make_unique<SphereInstance>(
@@ -404,7 +592,8 @@ void RayTracer::CreateSceneRayTracingTheNextWeekTexturesAndLight() {
       )
    ));
 
-   // small random spheres
+   // small random spheres (all in one sphere set, so that they are a single TLAS instance)
+   auto smallSpheres = std::make_unique<SphereSet>();
    for (int a = -11; a < 11; a++) {
       for (int b = -11; b < 11; b++) {
          const float chooseMaterial = RandomFloat();
@@ -451,10 +640,11 @@ void RayTracer::CreateSceneRayTracingTheNextWeekTexturesAndLight() {
             } else {
                material = Light(FlatColor({10.0f, 10.0f, 10.0f}), 0.0f);
             }
-            m_Scene.AddInstance(std::make_unique<SphereInstance>(centre, 0.2f, material));
+            smallSpheres->AddSphere(centre, 0.2f, material);
          }
       }
    }
+   AddSphereSet(std::move(smallSpheres));
 
    // the three main spheres...
    m_Scene.AddInstance(std::make_unique<SphereInstance>(
@@ -645,11 +835,13 @@ void RayTracer::CreateSceneRayTracingTheNextWeekFinal() {
 
    // polystyrene cube
    glm::mat4x4 transform = glm::rotate(glm::translate(glm::identity<glm::mat4x4>(), {213.0f, -8.0f, -560.0f}), glm::radians(15.0f), {0.0f, 1.0f, 0.0f});
+   auto polystyrene = std::make_unique<SphereSet>();
    for (int i = 0; i < 1000; ++i) {
       const glm::vec4 centre = {RandomFloat(0.0f, 165.0f), RandomFloat(0.0f, 165.0f), RandomFloat(0.0f, 165.0f), 1.0f};
       const glm::vec4 centreTransformed = transform * centre;
-      m_Scene.AddInstance(std::make_unique<SphereInstance>(centreTransformed, 10.0f, white));
+      polystyrene->AddSphere(centreTransformed, 10.0f, white);
    }
+   AddSphereSet(std::move(polystyrene));
 
    // marble ball
    m_Scene.AddInstance(std::make_unique<SphereInstance>(glm::vec3{58.0f, 2.0f, -300.0f}, 80.0f, Lambertian(Marble({1.0f, 1.0f, 1.0f}, 0.01f, 0.5f, 7))));
@@ -729,6 +921,15 @@ void RayTracer::CreateSceneShaderBall() {
 }
 
 
+vk::BufferUsageFlags RayTracer::GetGeometryBufferUsage() const {
+   vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer;
+   if (!m_RayTracerSettings.IsComputeRayTracing) {
+      usage |= vk::BufferUsageFlagBits::eShaderDeviceAddress;
+   }
+   return usage;
+}
+
+
 void RayTracer::CreateVertexBuffer() {
    std::vector<Vertex> vertices;
    size_t vertexCount = 0;
@@ -743,11 +944,8 @@ void RayTracer::CreateVertexBuffer() {
    }
 
    vk::DeviceSize size = vertices.size() * sizeof(Vertex);
-   Vulkan::Buffer stagingBuffer(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-   stagingBuffer.CopyFromHost(0, size, vertices.data());
-
-   m_VertexBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal);
-   CopyBuffer(stagingBuffer.m_Buffer, m_VertexBuffer->m_Buffer, 0, 0, size);
+   m_VertexBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, size, GetGeometryBufferUsage(), vk::MemoryPropertyFlagBits::eDeviceLocal);
+   UploadToBuffer(vertices.data(), size, m_VertexBuffer->m_Buffer);
 }
 
 
@@ -772,17 +970,8 @@ void RayTracer::CreateIndexBuffer() {
    uint32_t count = static_cast<uint32_t>(indices.size());
    vk::DeviceSize size = count * sizeof(uint32_t);
 
-   Vulkan::Buffer stagingBuffer = {
-      m_Device,
-      m_PhysicalDevice,
-      size,
-      vk::BufferUsageFlagBits::eTransferSrc,
-      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
-   };
-   stagingBuffer.CopyFromHost(0, size, indices.data());
-
-   m_IndexBuffer = std::make_unique<Vulkan::IndexBuffer>(m_Device, m_PhysicalDevice, size, count, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal);
-   CopyBuffer(stagingBuffer.m_Buffer, m_IndexBuffer->m_Buffer, 0, 0, size);
+   m_IndexBuffer = std::make_unique<Vulkan::IndexBuffer>(m_Device, m_PhysicalDevice, size, count, GetGeometryBufferUsage(), vk::MemoryPropertyFlagBits::eDeviceLocal);
+   UploadToBuffer(indices.data(), size, m_IndexBuffer->m_Buffer);
 }
 
 
@@ -798,18 +987,27 @@ void RayTracer::CreateOffsetBuffer() {
       indexOffset += static_cast<uint32_t>(model->GetIndices().size());
    }
 
+   // One offset per instance slot (see Instance::GetMaterials()).
+   // Triangle models have one slot per geometry (with index offset to the start of that geometry), procedural models one per primitive.
    instanceOffsets.reserve(m_Scene.GetInstances().size());
    for (const auto& instance : m_Scene.GetInstances()) {
-      instanceOffsets.push_back(modelOffsets[instance->GetModelIndex()]);
+      const Model& model = *m_Scene.GetModels()[instance->GetModelIndex()];
+      const Offset& modelOffset = modelOffsets[instance->GetModelIndex()];
+      if (model.IsProcedural()) {
+         instanceOffsets.insert(instanceOffsets.end(), instance->GetMaterials().size(), modelOffset);
+      } else {
+         const std::vector<ModelGeometry> geometries = model.GetGeometries();
+         ASSERT(geometries.size() == instance->GetMaterials().size(), "ERROR: instance must have one material per model geometry");
+         for (const auto& geometry : geometries) {
+            instanceOffsets.push_back({modelOffset.vertexOffset, modelOffset.indexOffset + geometry.m_FirstIndex});
+         }
+      }
    };
 
    vk::DeviceSize size = instanceOffsets.size() * sizeof(Offset);
 
-   Vulkan::Buffer stagingBuffer(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-   stagingBuffer.CopyFromHost(0, size, instanceOffsets.data());
-
    m_OffsetBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
-   CopyBuffer(stagingBuffer.m_Buffer, m_OffsetBuffer->m_Buffer, 0, 0, size);
+   UploadToBuffer(instanceOffsets.data(), size, m_OffsetBuffer->m_Buffer);
 }
 
 
@@ -823,18 +1021,16 @@ void RayTracer::CreateAABBBuffer() {
    aabbs.reserve(m_Scene.GetModels().size());
    for (const auto& model : m_Scene.GetModels()) {
       if (model->IsProcedural()) {
-         aabbs.emplace_back(model->GetBoundingBox());
+         std::vector<std::array<glm::vec3, 2>> boundingBoxes = model->GetBoundingBoxes();
+         aabbs.insert(aabbs.end(), boundingBoxes.begin(), boundingBoxes.end());
       }
    }
 
    vk::DeviceSize size = aabbs.size() * sizeof(std::array<glm::vec3, 2>);
 
    if (size > 0) {
-      Vulkan::Buffer stagingBuffer(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-      stagingBuffer.CopyFromHost(0, size, aabbs.data());
-
-      m_AABBBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal);
-      CopyBuffer(stagingBuffer.m_Buffer, m_AABBBuffer->m_Buffer, 0, 0, size);
+      m_AABBBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, size, GetGeometryBufferUsage(), vk::MemoryPropertyFlagBits::eDeviceLocal);
+      UploadToBuffer(aabbs.data(), size, m_AABBBuffer->m_Buffer);
    }
 }
 
@@ -848,16 +1044,13 @@ void RayTracer::CreateMaterialBuffer() {
    std::vector<Material> materials;
    materials.reserve(m_Scene.GetInstances().size());
    for (const auto& instance : m_Scene.GetInstances()) {
-      materials.emplace_back(instance->GetMaterial());
+      materials.insert(materials.end(), instance->GetMaterials().begin(), instance->GetMaterials().end());
    };
 
    vk::DeviceSize size = materials.size() * sizeof(Material);
 
-   Vulkan::Buffer stagingBuffer(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-   stagingBuffer.CopyFromHost(0, size, materials.data());
-
    m_MaterialBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
-   CopyBuffer(stagingBuffer.m_Buffer, m_MaterialBuffer->m_Buffer, 0, 0, size);
+   UploadToBuffer(materials.data(), size, m_MaterialBuffer->m_Buffer);
 }
 
 
@@ -866,6 +1059,149 @@ void RayTracer::DestroyMaterialBuffer() {
 }
 
 
+void RayTracer::CreateSphereBuffer() {
+   // Object space centre and radius of sphere, indexed the same way as materials.
+   // Plain sphere instances are the unit sphere (the instance transform does the rest).
+   std::vector<glm::vec4> spheres;
+   spheres.reserve(m_Scene.GetInstances().size());
+   for (const auto& instance : m_Scene.GetInstances()) {
+      const SphereSet* sphereSet = dynamic_cast<const SphereSet*>(m_Scene.GetModels().at(instance->GetModelIndex()).get());
+      if (sphereSet) {
+         spheres.insert(spheres.end(), sphereSet->GetSpheres().begin(), sphereSet->GetSpheres().end());
+      } else {
+         spheres.insert(spheres.end(), instance->GetMaterials().size(), glm::vec4 {0.0f, 0.0f, 0.0f, 1.0f});
+      }
+   };
+
+   vk::DeviceSize size = spheres.size() * sizeof(glm::vec4);
+
+   m_SphereBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
+   UploadToBuffer(spheres.data(), size, m_SphereBuffer->m_Buffer);
+}
+
+
+void RayTracer::DestroySphereBuffer() {
+   m_SphereBuffer.reset(nullptr);
+}
+
+
+// Same as Luminance() in Scatter.glsl
+static float Luminance(const glm::vec3 color) {
+   return glm::dot(color, glm::vec3 {0.2126f, 0.7152f, 0.0722f});
+}
+
+
+void RayTracer::CreateLightBuffer() {
+   // World space list of the emitting surfaces that next event estimation samples (see SampleLight() in Scatter.glsl).
+   // Only light materials with flat color are sampled (so that emission is the same all over the light).  Others are still found by chance.
+   // Each light has power = luminance * area, and cumulative power is stored so that shaders can choose lights in proportion to power.
+   auto isSampledLight = [](const Material& material) {
+      return (material.type == MATERIAL_LIGHT) && (material.diffuseTextureType == TEXTURE_FLATCOLOR) && (Luminance(glm::vec3 {material.diffuseTextureParam1}) > 0.0f);
+   };
+
+   std::vector<Light> lights;
+   float totalPower = 0.0f;
+   auto addLight = [&lights, &totalPower](Light light, const float luminance, const float area) {
+      if (area > 0.0f) {
+         totalPower += luminance * area;
+         light.cumulativePower = totalPower;
+         lights.push_back(light);
+      }
+   };
+
+   if (m_RayTracerSettings.IsNextEventEstimationEnabled) {
+      uint32_t slot = 0;
+      for (const auto& instance : m_Scene.GetInstances()) {
+         const Model& model = *m_Scene.GetModels().at(instance->GetModelIndex());
+         const std::vector<Material>& materials = instance->GetMaterials();
+         const glm::mat4 objectToWorld = instance->GetObjectToWorld();
+
+         if (model.GetShaderHitGroupIndex() == HITGROUP_SPHERE) {
+            // one sphere per slot.  Instance transforms of spheres are uniform scales, so a sphere stays a sphere
+            const SphereSet* sphereSet = dynamic_cast<const SphereSet*>(&model);
+            const float scale = glm::length(glm::vec3 {objectToWorld[0]});
+            for (uint32_t i = 0; i < materials.size(); ++i) {
+               if (isSampledLight(materials[i])) {
+                  const glm::vec4 sphere = sphereSet ? sphereSet->GetSpheres().at(i) : glm::vec4 {0.0f, 0.0f, 0.0f, 1.0f};
+                  const float radius = sphere.w * scale;
+                  addLight({glm::vec3 {objectToWorld * glm::vec4 {glm::vec3 {sphere}, 1.0f}}, LIGHT_SPHERE, {radius, 0.0f, 0.0f}, slot + i, {}, 0.0f}, Luminance(glm::vec3 {materials[i].diffuseTextureParam1}), 4.0f * M_PI * radius * radius);
+               }
+            }
+         } else {
+            // triangles (procedural boxes too: they still have their triangles, and just the one material)
+            const std::vector<ModelGeometry> geometries = model.GetGeometries();
+            for (uint32_t g = 0; g < geometries.size(); ++g) {
+               const uint32_t materialIndex = model.IsProcedural() ? 0 : g;
+               if ((materialIndex >= materials.size()) || !isSampledLight(materials[materialIndex])) {
+                  continue;
+               }
+               const float luminance = Luminance(glm::vec3 {materials[materialIndex].diffuseTextureParam1});
+               for (uint32_t i = geometries[g].m_FirstIndex; i + 2 < geometries[g].m_FirstIndex + geometries[g].m_IndexCount; i += 3) {
+                  const Vertex& v0 = model.GetVertices()[model.GetIndices()[i + 0]];
+                  const Vertex& v1 = model.GetVertices()[model.GetIndices()[i + 1]];
+                  const Vertex& v2 = model.GetVertices()[model.GetIndices()[i + 2]];
+                  const glm::vec3 p0 = glm::vec3 {objectToWorld * glm::vec4 {v0.pos, 1.0f}};
+                  glm::vec3 edge1 = glm::vec3 {objectToWorld * glm::vec4 {v1.pos, 1.0f}} - p0;
+                  glm::vec3 edge2 = glm::vec3 {objectToWorld * glm::vec4 {v2.pos, 1.0f}} - p0;
+
+                  // edges ordered so that their cross product is on the same side as the normal that the closest hit shader would use
+                  const glm::vec3 normal = glm::vec3 {objectToWorld * glm::vec4 {v0.normal + v1.normal + v2.normal, 0.0f}};
+                  const glm::vec3 cross = glm::cross(edge1, edge2);
+                  if (glm::dot(cross, normal) < 0.0f) {
+                     std::swap(edge1, edge2);
+                  }
+                  addLight({p0, LIGHT_TRIANGLE, edge1, slot + materialIndex, edge2, 0.0f}, luminance, 0.5f * glm::length(cross));
+               }
+            }
+         }
+         slot += static_cast<uint32_t>(materials.size());
+      }
+   }
+
+   m_LightCount = static_cast<uint32_t>(lights.size());
+   m_TotalLightPower = totalPower;
+   if (m_RayTracerSettings.IsNextEventEstimationEnabled) {
+      LOG_INFO("Next event estimation: {0} light(s), total power {1:.1f}", m_LightCount, m_TotalLightPower);
+   }
+
+   // storage buffers cannot be empty
+   if (lights.empty()) {
+      lights.push_back({});
+   }
+
+   vk::DeviceSize size = lights.size() * sizeof(Light);
+   m_LightBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
+   UploadToBuffer(lights.data(), size, m_LightBuffer->m_Buffer);
+}
+
+
+void RayTracer::DestroyLightBuffer() {
+   m_LightBuffer.reset(nullptr);
+}
+
+
+void RayTracer::CreateSamplerBuffers() {
+   // (all samplers' tables are uploaded whichever one is in use, so that the sampler comparison can switch between them)
+   const std::vector<uint32_t> sobolMatrices = GenerateSobolMatrices();
+   vk::DeviceSize size = sobolMatrices.size() * sizeof(uint32_t);
+   m_SobolBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
+   UploadToBuffer(sobolMatrices.data(), size, m_SobolBuffer->m_Buffer);
+
+   const std::vector<float> blueNoise = GenerateBlueNoise();
+   size = blueNoise.size() * sizeof(float);
+   m_BlueNoiseBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
+   UploadToBuffer(blueNoise.data(), size, m_BlueNoiseBuffer->m_Buffer);
+
+   LOG_INFO("Sampler: {0}", sm_SamplerNames[m_SamplerType]);
+}
+
+
+void RayTracer::DestroySamplerBuffers() {
+   m_BlueNoiseBuffer.reset(nullptr);
+   m_SobolBuffer.reset(nullptr);
+}
+
+
 void RayTracer::CreateTextureResources() {
 
    // sampler (we use the same one for all textures)
@@ -878,7 +1214,7 @@ void RayTracer::CreateTextureResources() {
       vk::SamplerAddressMode::eRepeat     /*addressModeV*/,
       vk::SamplerAddressMode::eRepeat     /*addressModeW*/,
       0.0f                                /*mipLodBias*/,
-      true                                /*anisotropyEnable*/,
+      m_EnabledPhysicalDeviceFeatures.samplerAnisotropy  /*anisotropyEnable*/,
       16                                  /*maxAnisotropy*/,
       false                               /*compareEnable*/,
       vk::CompareOp::eAlways              /*compareOp*/,
@@ -902,11 +1238,6 @@ void RayTracer::CreateTextureResources() {
          ASSERT(false, "ERROR: failed to load texture '{}'", textureFileName);
       }
 
-      Vulkan::Buffer stagingBuffer(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-      stagingBuffer.CopyFromHost(0, size, pixels);
-
-      stbi_image_free(pixels);
-
       auto texture = std::make_unique<Vulkan::Image>(
          m_Device,
          m_PhysicalDevice,
@@ -920,8 +1251,8 @@ void RayTracer::CreateTextureResources() {
          vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
          vk::MemoryPropertyFlagBits::eDeviceLocal
       );
-      TransitionImageLayout(texture->m_Image, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, mipLevels);
-      CopyBufferToImage(stagingBuffer.m_Buffer, texture->m_Image, texWidth, texHeight);
+      UploadToImage(pixels, size, texture->m_Image, texWidth, texHeight, mipLevels);
+      stbi_image_free(pixels);
       GenerateMIPMaps(texture->m_Image, vk::Format::eR8G8B8A8Srgb, texWidth, texHeight, mipLevels);
 
       texture->CreateImageView(vk::Format::eR8G8B8A8Srgb, vk::ImageAspectFlagBits::eColor, mipLevels);
@@ -942,11 +1273,6 @@ void RayTracer::CreateTextureResources() {
          ASSERT(false, "ERROR: failed to load texture '{}'", m_Scene.GetSkyboxTextureFileName());
       }
 
-      Vulkan::Buffer stagingBuffer(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-      stagingBuffer.CopyFromHost(0, size, pixels);
-
-      stbi_image_free(pixels);
-
       auto srcTexture = std::make_unique<Vulkan::Image>(
          m_Device,
          m_PhysicalDevice,
@@ -960,8 +1286,8 @@ void RayTracer::CreateTextureResources() {
          vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
          vk::MemoryPropertyFlagBits::eDeviceLocal
       );
-      TransitionImageLayout(srcTexture->m_Image, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, mipLevels);
-      CopyBufferToImage(stagingBuffer.m_Buffer, srcTexture->m_Image, texWidth, texHeight);
+      UploadToImage(pixels, size, srcTexture->m_Image, texWidth, texHeight, mipLevels);
+      stbi_image_free(pixels);
       GenerateMIPMaps(srcTexture->m_Image, vk::Format::eR32G32B32A32Sfloat, texWidth, texHeight, mipLevels);
       srcTexture->CreateImageView(vk::Format::eR32G32B32A32Sfloat, vk::ImageAspectFlagBits::eColor, mipLevels);
 
@@ -1154,25 +1480,96 @@ void RayTracer::DestroyTextureResources() {
 }
 
 
+void RayTracer::CreateHitRecords() {
+   // A ray's hit record is its instance's record offset plus the geometry index (sbt record stride is 1, see RayTrace.rgen).
+   // Each geometry of a triangle model has a material of its own, so its record is for that material's hit group.
+   // A procedural model is one geometry of many primitives (e.g. a SphereSet), and its record can only be for one material if all of its primitives have the same type.
+   m_HitGroups.clear();
+   m_HitRecords.clear();
+   m_InstanceHitRecordOffsets.clear();
+   m_InstanceHitRecordOffsets.reserve(m_Scene.GetInstances().size());
+
+   auto hitGroupIndex = [this](const HitGroup& hitGroup) {
+      auto existing = std::find(m_HitGroups.begin(), m_HitGroups.end(), hitGroup);
+      if (existing == m_HitGroups.end()) {
+         existing = m_HitGroups.insert(m_HitGroups.end(), hitGroup);
+      }
+      return static_cast<uint32_t>(existing - m_HitGroups.begin());
+   };
+
+   std::vector<uint32_t> records;
+   for (const auto& instance : m_Scene.GetInstances()) {
+      const Model& model = *m_Scene.GetModels().at(instance->GetModelIndex());
+      const std::vector<Material>& materials = instance->GetMaterials();
+      records.clear();
+      if (model.IsProcedural()) {
+         const bool isOneMaterialType = !materials.empty() && std::all_of(materials.begin(), materials.end(), [&materials](const Material& material) { return material.type == materials.front().type; });
+         records.push_back(hitGroupIndex({model.GetShaderHitGroupIndex(), isOneMaterialType ? materials.front().type : MATERIAL_ANY}));
+      } else {
+         for (const auto& material : materials) {
+            records.push_back(hitGroupIndex({model.GetShaderHitGroupIndex(), material.type}));
+         }
+      }
+
+      // Most instances need the same records as some earlier instance (e.g. all the lambertian spheres), and can share them
+      auto sameRecords = std::search(m_HitRecords.begin(), m_HitRecords.end(), records.begin(), records.end());
+      m_InstanceHitRecordOffsets.push_back(static_cast<uint32_t>(sameRecords - m_HitRecords.begin()));
+      if (sameRecords == m_HitRecords.end()) {
+         m_HitRecords.insert(m_HitRecords.end(), records.begin(), records.end());
+      }
+   }
+
+   LOG_INFO("Ray tracing pipeline: {0} hit group(s), {1} hit record(s) for {2} instance(s)", m_HitGroups.size(), m_HitRecords.size(), m_InstanceHitRecordOffsets.size());
+}
+
+
 void RayTracer::CreateAccelerationStructures() {
 
    // BOTTOM LEVEL...
    std::vector<Vulkan::GeometryGroup> geometryGroups;
 
+   // A host build (see Vulkan::Application::IsHostAccelerationStructureBuild()) reads its inputs from host memory, so gets its own copy
+   // of what went into the vertex, index and AABB buffers.  (only needed until the BLAS are built)
+   const bool isHostBuild = IsHostAccelerationStructureBuild();
+   std::vector<Vertex> hostVertices;
+   std::vector<uint32_t> hostIndices;
+   std::vector<std::array<glm::vec3, 2>> hostAABBs;
+   if (isHostBuild) {
+      for (const auto& model : m_Scene.GetModels()) {
+         if (model->IsProcedural()) {
+            std::vector<std::array<glm::vec3, 2>> boundingBoxes = model->GetBoundingBoxes();
+            hostAABBs.insert(hostAABBs.end(), boundingBoxes.begin(), boundingBoxes.end());
+         }
+         hostVertices.insert(hostVertices.end(), model->GetVertices().begin(), model->GetVertices().end());
+         hostIndices.insert(hostIndices.end(), model->GetIndices().begin(), model->GetIndices().end());
+      }
+   }
+   const vk::DeviceOrHostAddressConstKHR vertexData = isHostBuild ? vk::DeviceOrHostAddressConstKHR {hostVertices.data()} : vk::DeviceOrHostAddressConstKHR {m_VertexBuffer->GetBufferDeviceAddress()};
+   const vk::DeviceOrHostAddressConstKHR indexData = isHostBuild ? vk::DeviceOrHostAddressConstKHR {hostIndices.data()} : vk::DeviceOrHostAddressConstKHR {m_IndexBuffer->GetBufferDeviceAddress()};
+   const vk::DeviceOrHostAddressConstKHR aabbData = isHostBuild ? vk::DeviceOrHostAddressConstKHR {hostAABBs.data()} : vk::DeviceOrHostAddressConstKHR {m_AABBBuffer ? m_AABBBuffer->GetBufferDeviceAddress() : 0};
+
    // One model in the scene => one geometry group => one BLAS
    vk::DeviceSize aabbOffset = 0;
    vk::DeviceSize vertexOffset = 0;
    vk::DeviceSize indexOffset = 0;
    size_t runningTotalVertices = 0;
    size_t maxVertex = m_VertexBuffer->m_Size / sizeof(Vertex);
+   std::vector<uint64_t> cacheKeys;
    for (const auto& model : m_Scene.GetModels()) {
       // for now we only have one object in each geometry group (aka BLAS).  However, the data structure allows for more so that each "model" could consist of multiple meshes, for example.
       Vulkan::GeometryGroup geometryGroup;
+      geometryGroup.m_IsOnHost = isHostBuild;
+      // BLAS content depends only on the geometry, so that is what the acceleration structure cache is keyed on
+      cacheKeys.emplace_back(model->GetContentHash());
       if (model->IsProcedural()) {
-         geometryGroup.AddAABBs(m_AABBBuffer->GetBufferDeviceAddress(), aabbOffset, 2 * sizeof(glm::vec3), 1);
-         aabbOffset += 2 * sizeof(glm::vec3);
+         std::vector<std::array<glm::vec3, 2>> boundingBoxes = model->GetBoundingBoxes();
+         geometryGroup.AddAABBs(aabbData, aabbOffset, 2 * sizeof(glm::vec3), boundingBoxes.size());
+         aabbOffset += boundingBoxes.size() * 2 * sizeof(glm::vec3);
       } else {
-         geometryGroup.AddTrianglesIndexed(m_VertexBuffer->GetBufferDeviceAddress(), vertexOffset, sizeof(Vertex), model->GetVertices().size(), m_IndexBuffer->GetBufferDeviceAddress(), indexOffset, model->GetIndices().size(), runningTotalVertices, maxVertex);
+         const std::vector<ModelGeometry> geometries = model->GetGeometries();
+         for (const auto& geometry : geometries) {
+            geometryGroup.AddTrianglesIndexed(vertexData, vertexOffset, sizeof(Vertex), model->GetVertices().size(), indexData, indexOffset + geometry.m_FirstIndex * sizeof(uint32_t), geometry.m_IndexCount, runningTotalVertices, maxVertex);
+         }
          vertexOffset += model->GetVertices().size() * sizeof(Vertex);
          indexOffset += model->GetIndices().size() * sizeof(uint32_t);
          runningTotalVertices += model->GetVertices().size();
@@ -1180,14 +1577,17 @@ void RayTracer::CreateAccelerationStructures() {
       geometryGroups.emplace_back(std::move(geometryGroup));
    }
 
-   CreateBottomLevelAccelerationStructures(geometryGroups);
+   CreateBottomLevelAccelerationStructures(geometryGroups, cacheKeys);
 
    // TOP LEVEL...
+   // Each instance's custom index is where its materials (etc.) start (see Instance::GetMaterials()),
+   // and its shader binding table record offset is where its hit records start (see CreateHitRecords())
    uint32_t i = 0;
    std::vector<vk::AccelerationStructureInstanceKHR> instances;
    instances.reserve(m_Scene.GetInstances().size());
    for (const auto& instance : m_Scene.GetInstances()) {
       ASSERT(m_BLAS.at(instance->GetModelIndex()).m_AccelerationStructure, "ERROR: BLAS is null");
+      const uint32_t hitRecordOffset = m_InstanceHitRecordOffsets.at(instances.size());
 
       // surely there is an easier way to do this...?
       std::array<std::array<float, 4>, 3> matrix;
@@ -1195,29 +1595,17 @@ void RayTracer::CreateAccelerationStructures() {
 
       instances.emplace_back(
          matrix                                                                        /*transform*/,
-         i++                                                                           /*instanceCustomIndex*/,
+         i                                                                             /*instanceCustomIndex*/,
          0xff                                                                          /*mask*/,
-         m_Scene.GetModels().at(instance->GetModelIndex())->GetShaderHitGroupIndex()   /*instanceShaderBindingTableRecordOffset*/,
+         hitRecordOffset                                                               /*instanceShaderBindingTableRecordOffset*/,
          vk::GeometryInstanceFlagBitsKHR::eTriangleCullDisable                         /*flags*/,
          m_BLAS.at(instance->GetModelIndex()).m_DeviceAddress                          /*accelerationStructureReference*/
       );
+      i += static_cast<uint32_t>(instance->GetMaterials().size());
    };
 
-   Vulkan::Buffer instanceBuffer {
-      m_Device,
-      m_PhysicalDevice,
-      sizeof(vk::AccelerationStructureInstanceKHR) * instances.size(),
-      vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
-      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
-   };
-   instanceBuffer.CopyFromHost(0, VK_WHOLE_SIZE, instances.data());
-
-   Vulkan::GeometryGroup group;
-   group.AddInstances(instanceBuffer.GetBufferDeviceAddress(), 0, false, instances.size());
-
-   // It seems wrong to create acceleration structure that refers to a buffer (instanceBuffer) that will be destroyed when this function exits.
-   // However, this is same behaviour as other online examples (e.g Sacha Willems), and nothing seems to crash.
-   CreateTopLevelAccelerationStructure(group);
+   // The instances are kept (in a persistent buffer) by the TLAS, so that they can be moved later with SetInstanceTransform()
+   CreateTopLevelAccelerationStructure(instances);
 
 }
 
@@ -1228,6 +1616,128 @@ void RayTracer::DestroyAccelerationStructures() {
 }
 
 
+void RayTracer::CreateBVHBuffers() {
+   // Software ray tracing equivalent of CreateAccelerationStructures().  Same two levels: one BVH per model, and one over the instances.
+   // All of the nodes go in one buffer (the instances' BVH first, so that its root is node 0), and the primitives and instances
+   // are stored in BVH leaf order so that leaves can refer to them directly.  See BVH.glsl
+   auto startTime = std::chrono::steady_clock::now();
+
+   // BOTTOM LEVEL...
+   std::vector<BVH> modelBVHs(m_Scene.GetModels().size());
+   for (size_t i = 0; i < modelBVHs.size(); ++i) {
+      modelBVHs[i].Build(m_Scene.GetModels()[i]->GetPrimitiveBounds());
+   }
+
+   // TOP LEVEL...
+   // Each instance's custom index is where its materials (etc.) start, same as CreateAccelerationStructures().
+   // Instances of models that have no primitives are left out (there is nothing to hit)
+   std::vector<BVHInstance> sceneInstances;
+   std::vector<uint32_t> sceneInstanceModels;
+   std::vector<BVH::Bounds> instanceBounds;
+   sceneInstances.reserve(m_Scene.GetInstances().size());
+   sceneInstanceModels.reserve(m_Scene.GetInstances().size());
+   instanceBounds.reserve(m_Scene.GetInstances().size());
+   uint32_t slot = 0;
+   for (const auto& instance : m_Scene.GetInstances()) {
+      const BVH& modelBVH = modelBVHs.at(instance->GetModelIndex());
+      if (!modelBVH.IsEmpty()) {
+         const glm::mat4 objectToWorld = instance->GetObjectToWorld();
+         sceneInstances.push_back({
+            objectToWorld                                                                 /*objectToWorld*/,
+            glm::inverse(objectToWorld)                                                   /*worldToObject*/,
+            0                                                                             /*firstNode (filled in below)*/,
+            0                                                                             /*firstPrimitive (filled in below)*/,
+            slot                                                                          /*customIndex*/,
+            m_Scene.GetModels().at(instance->GetModelIndex())->GetShaderHitGroupIndex()   /*hitGroup*/
+         });
+         sceneInstanceModels.push_back(instance->GetModelIndex());
+         instanceBounds.emplace_back(modelBVH.GetBounds(objectToWorld));
+      }
+      slot += static_cast<uint32_t>(instance->GetMaterials().size());
+   }
+   BVH sceneBVH;
+   sceneBVH.Build(instanceBounds);
+
+   std::vector<BVH::Node> nodes = sceneBVH.GetNodes();
+   if (nodes.empty()) {
+      // Nothing in the scene.  Root is then a single point so far away that no ray can reach it
+      nodes.push_back({glm::vec3 {std::numeric_limits<float>::max()}, 0, glm::vec3 {std::numeric_limits<float>::max()}, 0});
+   }
+
+   // Model BVHs go after the top level one.  Each model's primitives are identified by (geometry index, primitive index within geometry),
+   // (which is what gl_GeometryIndexEXT and gl_PrimitiveID would be).  Procedural models have just the one geometry.
+   std::vector<uint32_t> modelFirstNodes;
+   std::vector<uint32_t> modelFirstPrimitives;
+   std::vector<glm::uvec2> primitives;
+   modelFirstNodes.reserve(modelBVHs.size());
+   modelFirstPrimitives.reserve(modelBVHs.size());
+   for (size_t i = 0; i < modelBVHs.size(); ++i) {
+      const Model& model = *m_Scene.GetModels()[i];
+      const BVH& modelBVH = modelBVHs[i];
+      modelFirstNodes.push_back(static_cast<uint32_t>(nodes.size()));
+      modelFirstPrimitives.push_back(static_cast<uint32_t>(primitives.size()));
+      nodes.insert(nodes.end(), modelBVH.GetNodes().begin(), modelBVH.GetNodes().end());
+
+      // in the same order as Model::GetPrimitiveBounds()
+      std::vector<glm::uvec2> modelPrimitives;
+      if (model.IsProcedural()) {
+         for (uint32_t primitive = 0; primitive < modelBVH.GetPrimitiveIndices().size(); ++primitive) {
+            modelPrimitives.emplace_back(0, primitive);
+         }
+      } else {
+         const std::vector<ModelGeometry> geometries = model.GetGeometries();
+         for (uint32_t geometry = 0; geometry < geometries.size(); ++geometry) {
+            for (uint32_t primitive = 0; primitive < geometries[geometry].m_IndexCount / 3; ++primitive) {
+               modelPrimitives.emplace_back(geometry, primitive);
+            }
+         }
+      }
+      for (const uint32_t primitive : modelBVH.GetPrimitiveIndices()) {
+         primitives.push_back(modelPrimitives.at(primitive));
+      }
+   }
+
+   std::vector<BVHInstance> instances;
+   instances.reserve(sceneInstances.size());
+   for (const uint32_t i : sceneBVH.GetPrimitiveIndices()) {
+      BVHInstance instance = sceneInstances[i];
+      instance.firstNode = modelFirstNodes[sceneInstanceModels[i]];
+      instance.firstPrimitive = modelFirstPrimitives[sceneInstanceModels[i]];
+      instances.push_back(instance);
+   }
+
+   // storage buffers cannot be empty
+   if (primitives.empty()) {
+      primitives.emplace_back(0, 0);
+   }
+   if (instances.empty()) {
+      instances.push_back({});
+   }
+
+   vk::DeviceSize size = nodes.size() * sizeof(BVH::Node);
+   m_BVHNodeBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
+   UploadToBuffer(nodes.data(), size, m_BVHNodeBuffer->m_Buffer);
+
+   size = primitives.size() * sizeof(glm::uvec2);
+   m_BVHPrimitiveBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
+   UploadToBuffer(primitives.data(), size, m_BVHPrimitiveBuffer->m_Buffer);
+
+   size = instances.size() * sizeof(BVHInstance);
+   m_BVHInstanceBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
+   UploadToBuffer(instances.data(), size, m_BVHInstanceBuffer->m_Buffer);
+
+   std::chrono::duration<double, std::milli> buildTime = std::chrono::steady_clock::now() - startTime;
+   LOG_INFO("Built BVHs for compute ray tracing in {0:.1f}ms: {1} nodes ({2:.1f} KB), {3} primitives, {4} instances", buildTime.count(), nodes.size(), nodes.size() * sizeof(BVH::Node) / 1024.0, primitives.size(), instances.size());
+}
+
+
+void RayTracer::DestroyBVHBuffers() {
+   m_BVHInstanceBuffer.reset(nullptr);
+   m_BVHPrimitiveBuffer.reset(nullptr);
+   m_BVHNodeBuffer.reset(nullptr);
+}
+
+
 void RayTracer::DestroyIndexBuffer() {
    m_IndexBuffer.reset(nullptr);
 }
@@ -1241,10 +1751,51 @@ void RayTracer::CreateStorageImages() {
    m_AccumumlationImage = std::make_unique<Vulkan::Image>(m_Device, m_PhysicalDevice, vk::ImageViewType::e2D, m_Extent.width, m_Extent.height, 1, vk::SampleCountFlagBits::e1, vk::Format::eR32G32B32A32Sfloat, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eStorage, vk::MemoryPropertyFlagBits::eDeviceLocal);
    m_AccumumlationImage->CreateImageView(vk::Format::eR32G32B32A32Sfloat, vk::ImageAspectFlagBits::eColor, 1);
    TransitionImageLayout(m_AccumumlationImage->m_Image, vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral, 1);
+
+   // (needed even if adaptive sampling is off, the ray tracing shaders have them bound regardless)
+   m_MomentsImage = std::make_unique<Vulkan::Image>(m_Device, m_PhysicalDevice, vk::ImageViewType::e2D, m_Extent.width, m_Extent.height, 1, vk::SampleCountFlagBits::e1, vk::Format::eR32G32B32A32Sfloat, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eStorage, vk::MemoryPropertyFlagBits::eDeviceLocal);
+   m_MomentsImage->CreateImageView(vk::Format::eR32G32B32A32Sfloat, vk::ImageAspectFlagBits::eColor, 1);
+   TransitionImageLayout(m_MomentsImage->m_Image, vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral, 1);
+
+   m_SampleMaskImage = std::make_unique<Vulkan::Image>(m_Device, m_PhysicalDevice, vk::ImageViewType::e2D, m_Extent.width, m_Extent.height, 1, vk::SampleCountFlagBits::e1, vk::Format::eR32Uint, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eStorage, vk::MemoryPropertyFlagBits::eDeviceLocal);
+   m_SampleMaskImage->CreateImageView(vk::Format::eR32Uint, vk::ImageAspectFlagBits::eColor, 1);
+   TransitionImageLayout(m_SampleMaskImage->m_Image, vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral, 1);
+
+   // (likewise needed even if the denoiser is off)
+   m_AlbedoImage = std::make_unique<Vulkan::Image>(m_Device, m_PhysicalDevice, vk::ImageViewType::e2D, m_Extent.width, m_Extent.height, 1, vk::SampleCountFlagBits::e1, vk::Format::eR16G16B16A16Sfloat, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eStorage, vk::MemoryPropertyFlagBits::eDeviceLocal);
+   m_AlbedoImage->CreateImageView(vk::Format::eR16G16B16A16Sfloat, vk::ImageAspectFlagBits::eColor, 1);
+   TransitionImageLayout(m_AlbedoImage->m_Image, vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral, 1);
+
+   m_NormalDepthImage = std::make_unique<Vulkan::Image>(m_Device, m_PhysicalDevice, vk::ImageViewType::e2D, m_Extent.width, m_Extent.height, 1, vk::SampleCountFlagBits::e1, vk::Format::eR16G16B16A16Sfloat, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eStorage, vk::MemoryPropertyFlagBits::eDeviceLocal);
+   m_NormalDepthImage->CreateImageView(vk::Format::eR16G16B16A16Sfloat, vk::ImageAspectFlagBits::eColor, 1);
+   TransitionImageLayout(m_NormalDepthImage->m_Image, vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral, 1);
+
+   for (auto& denoiseImage : m_DenoiseImages) {
+      denoiseImage = std::make_unique<Vulkan::Image>(m_Device, m_PhysicalDevice, vk::ImageViewType::e2D, m_Extent.width, m_Extent.height, 1, vk::SampleCountFlagBits::e1, vk::Format::eR16G16B16A16Sfloat, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eStorage, vk::MemoryPropertyFlagBits::eDeviceLocal);
+      denoiseImage->CreateImageView(vk::Format::eR16G16B16A16Sfloat, vk::ImageAspectFlagBits::eColor, 1);
+      TransitionImageLayout(denoiseImage->m_Image, vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral, 1);
+   }
+
+   // (and if temporal reprojection is off)
+   for (auto image : {&m_PositionImage, &m_HistoryImage, &m_HistoryPositionImage}) {
+      *image = std::make_unique<Vulkan::Image>(m_Device, m_PhysicalDevice, vk::ImageViewType::e2D, m_Extent.width, m_Extent.height, 1, vk::SampleCountFlagBits::e1, vk::Format::eR32G32B32A32Sfloat, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eStorage, vk::MemoryPropertyFlagBits::eDeviceLocal);
+      (*image)->CreateImageView(vk::Format::eR32G32B32A32Sfloat, vk::ImageAspectFlagBits::eColor, 1);
+      TransitionImageLayout((*image)->m_Image, vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral, 1);
+   }
 }
 
 
 void RayTracer::DestroyStorageImages() {
+   m_HistoryPositionImage.reset(nullptr);
+   m_HistoryImage.reset(nullptr);
+   m_PositionImage.reset(nullptr);
+   for (auto& denoiseImage : m_DenoiseImages) {
+      denoiseImage.reset(nullptr);
+   }
+   m_NormalDepthImage.reset(nullptr);
+   m_AlbedoImage.reset(nullptr);
+   m_SampleMaskImage.reset(nullptr);
+   m_MomentsImage.reset(nullptr);
    m_AccumumlationImage.reset(nullptr);
    m_OutputImage.reset(nullptr);
 }
@@ -1255,25 +1806,75 @@ void RayTracer::CreateUniformBuffers() {
 
    // We are potentially queuing up more than one command buffer for rendering at once.
    // (see m_Settings.MaxFramesInFlight).
-   // This means that each command buffer needs its own uniform buffer.
-   // (if they all shared one uniform buffer, then we might start updating the uniform buffer
+   // This means that each command buffer needs its own uniform data.
+   // (if they all shared the same data, then we might start updating it
    // when a previously queued command buffer hasn't yet finished rendering).
    //
-   // If we had instead made sure that only one command buffer is ever rendering at once,
-   // then we could get away with just one uniform buffer.
-
+   // So we have one (persistently mapped) ring buffer with a slice for each command buffer,
+   // and each command buffer binds its own slice via a dynamic offset.
    //
-   // TODO: experiment: We are creating the uniform buffers as hostVisible and hostCoherent
-   //                   Would it be better to have them as device-local  (and copy after each update)?
-   m_UniformBuffers.reserve(m_CommandBuffers.size());
-   for (const auto& commandBuffer : m_CommandBuffers) {
-      m_UniformBuffers.emplace_back(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eUniformBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-   }
+   // TODO: experiment: We are creating the uniform buffer as hostVisible and hostCoherent
+   //                   Would it be better to have it as device-local  (and copy after each update)?
+   m_UniformBuffer = std::make_unique<Vulkan::RingBuffer>(m_Device, m_PhysicalDevice, size, size, static_cast<uint32_t>(m_CommandBuffers.size()));
 }
 
 
 void RayTracer::DestroyUniformBuffers() {
-   m_UniformBuffers.clear();
+   m_UniformBuffer.reset(nullptr);
+}
+
+
+void RayTracer::CreateRayCountBuffer() {
+   // Rays traced are counted in the shader, with a separate counter for each command buffer (so that a command buffer's count can be
+   // read back and reset once it has completed, while others are still in flight).  See CollectRayCount()
+   // Host visible and coherent, so reading back is just a memory read.
+   // Each command buffer's counters are rayCount and activePixelCount (see RayTrace.rgen and AdaptiveSampling.comp), then for wavefront
+   // path tracing its QueueStats (see Wavefront.glsl)
+   const uint32_t alignment = static_cast<uint32_t>(m_PhysicalDeviceProperties.limits.minStorageBufferOffsetAlignment);
+   m_QueueStatsOffset = Vulkan::AlignedSize(static_cast<uint32_t>(2 * sizeof(uint32_t)), alignment);
+   m_RayCountStride = m_QueueStatsOffset + (m_RayTracerSettings.IsWavefrontPathTracing ? Vulkan::AlignedSize(static_cast<uint32_t>(sizeof(QueueStats)), alignment) : 0);
+   const vk::DeviceSize size = m_RayCountStride * m_CommandBuffers.size();
+   m_RayCountBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+
+   std::vector<uint8_t> zeros(size, 0);
+   m_RayCountBuffer->CopyFromHost(0, size, zeros.data());
+}
+
+
+void RayTracer::DestroyRayCountBuffer() {
+   m_RayCountBuffer.reset(nullptr);
+}
+
+
+void RayTracer::CreateWavefrontBuffers() {
+   if (!m_RayTracerSettings.IsWavefrontPathTracing) {
+      return;
+   }
+
+   // One path per pixel, and room in every queue for all of them.  Device local: only the shaders ever touch these
+   // (queue headers are reset with vkCmdUpdateBuffer, and are the indirect dispatch arguments of the kernels that take from them)
+   const vk::DeviceSize pathCount = static_cast<vk::DeviceSize>(m_Extent.width) * m_Extent.height;
+   const vk::DeviceSize pathStateSize = 9 * 4 * sizeof(uint32_t);   // PathState (see WavefrontPath.glsl)
+   const vk::DeviceSize pathStatesSize = pathCount * pathStateSize;
+   const vk::DeviceSize rayQueuesSize = QUEUE_COUNT * (sizeof(RayQueue) + pathCount * sizeof(uint32_t));
+   if (std::max(pathStatesSize, rayQueuesSize) > m_PhysicalDeviceProperties.limits.maxStorageBufferRange) {
+      throw std::runtime_error("window is too big for wavefront path tracing on this device (path states or ray queues exceed maxStorageBufferRange)");
+   }
+   const vk::DeviceSize groupCount = (pathCount + WAVEFRONT_GROUPSIZE - 1) / WAVEFRONT_GROUPSIZE;
+   if ((groupCount + WAVEFRONT_GROUPCOUNTX - 1) / WAVEFRONT_GROUPCOUNTX > m_PhysicalDeviceProperties.limits.maxComputeWorkGroupCount[1]) {
+      throw std::runtime_error("window is too big for wavefront path tracing on this device (queue dispatches exceed maxComputeWorkGroupCount)");
+   }
+   m_PathStateBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, pathStatesSize, vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
+   m_RayQueueBuffer = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, rayQueuesSize, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+   m_QueueItems.resize(QUEUE_COUNT, 0);
+   m_QueueGroups.resize(QUEUE_COUNT, 0);
+}
+
+
+void RayTracer::DestroyWavefrontBuffers() {
+   m_RayQueueBuffer.reset(nullptr);
+   m_PathStateBuffer.reset(nullptr);
 }
 
 
@@ -1282,35 +1883,107 @@ void RayTracer::CreateDescriptorSetLayout() {
    // Basically connects the different shader stages to descriptors for binding uniform buffers, image samplers, etc.
    // So every shader binding should map to one descriptor set layout binding
 
+   // With compute ray tracing (m_RayTracerSettings.IsComputeRayTracing), all of the bindings are used by the one compute shader
+   auto stages = [this] (const vk::ShaderStageFlags rayTracingStages) {
+      return m_RayTracerSettings.IsComputeRayTracing ? vk::ShaderStageFlags {vk::ShaderStageFlagBits::eCompute} : rayTracingStages;
+   };
+
    vk::DescriptorSetLayoutBinding accelerationStructureLB = {
       BINDING_TLAS                                                                   /*binding*/,
       vk::DescriptorType::eAccelerationStructureKHR                                  /*descriptorType*/,
       1                                                                              /*descriptorCount*/,
-      vk::ShaderStageFlagBits::eRaygenKHR | vk::ShaderStageFlagBits::eClosestHitKHR  /*stageFlags*/,
+      stages(vk::ShaderStageFlagBits::eRaygenKHR | vk::ShaderStageFlagBits::eClosestHitKHR)  /*stageFlags*/,
       nullptr                                                                        /*pImmutableSamplers*/
    };
 
+   // (compute stage as well for the adaptive sampling pass, see AdaptiveSampling.comp)
    vk::DescriptorSetLayoutBinding accumulationImageLB = {
       BINDING_ACCUMULATIONIMAGE             /*binding*/,
       vk::DescriptorType::eStorageImage     /*descriptorType*/,
       1                                     /*descriptorCount*/,
-      vk::ShaderStageFlagBits::eRaygenKHR   /*stageFlags*/,
+      stages(vk::ShaderStageFlagBits::eRaygenKHR) | vk::ShaderStageFlagBits::eCompute  /*stageFlags*/,
+      nullptr                               /*pImmutableSamplers*/
+   };
+
+   vk::DescriptorSetLayoutBinding momentsImageLB = {
+      BINDING_MOMENTSIMAGE                  /*binding*/,
+      vk::DescriptorType::eStorageImage     /*descriptorType*/,
+      1                                     /*descriptorCount*/,
+      stages(vk::ShaderStageFlagBits::eRaygenKHR) | vk::ShaderStageFlagBits::eCompute  /*stageFlags*/,
+      nullptr                               /*pImmutableSamplers*/
+   };
+
+   vk::DescriptorSetLayoutBinding sampleMaskImageLB = {
+      BINDING_SAMPLEMASKIMAGE               /*binding*/,
+      vk::DescriptorType::eStorageImage     /*descriptorType*/,
+      1                                     /*descriptorCount*/,
+      stages(vk::ShaderStageFlagBits::eRaygenKHR) | vk::ShaderStageFlagBits::eCompute  /*stageFlags*/,
+      nullptr                               /*pImmutableSamplers*/
+   };
+
+   vk::DescriptorSetLayoutBinding albedoImageLB = {
+      BINDING_ALBEDOIMAGE                   /*binding*/,
+      vk::DescriptorType::eStorageImage     /*descriptorType*/,
+      1                                     /*descriptorCount*/,
+      stages(vk::ShaderStageFlagBits::eRaygenKHR) | vk::ShaderStageFlagBits::eCompute  /*stageFlags*/,
+      nullptr                               /*pImmutableSamplers*/
+   };
+
+   vk::DescriptorSetLayoutBinding normalDepthImageLB = {
+      BINDING_NORMALDEPTHIMAGE              /*binding*/,
+      vk::DescriptorType::eStorageImage     /*descriptorType*/,
+      1                                     /*descriptorCount*/,
+      stages(vk::ShaderStageFlagBits::eRaygenKHR) | vk::ShaderStageFlagBits::eCompute  /*stageFlags*/,
+      nullptr                               /*pImmutableSamplers*/
+   };
+
+   vk::DescriptorSetLayoutBinding positionImageLB = {
+      BINDING_POSITIONIMAGE                 /*binding*/,
+      vk::DescriptorType::eStorageImage     /*descriptorType*/,
+      1                                     /*descriptorCount*/,
+      stages(vk::ShaderStageFlagBits::eRaygenKHR) | vk::ShaderStageFlagBits::eCompute  /*stageFlags*/,
       nullptr                               /*pImmutableSamplers*/
    };
 
+   vk::DescriptorSetLayoutBinding historyImageLB = {
+      BINDING_HISTORYIMAGE                  /*binding*/,
+      vk::DescriptorType::eStorageImage     /*descriptorType*/,
+      1                                     /*descriptorCount*/,
+      stages(vk::ShaderStageFlagBits::eRaygenKHR) | vk::ShaderStageFlagBits::eCompute  /*stageFlags*/,
+      nullptr                               /*pImmutableSamplers*/
+   };
+
+   vk::DescriptorSetLayoutBinding historyPositionImageLB = {
+      BINDING_HISTORYPOSITIONIMAGE          /*binding*/,
+      vk::DescriptorType::eStorageImage     /*descriptorType*/,
+      1                                     /*descriptorCount*/,
+      stages(vk::ShaderStageFlagBits::eRaygenKHR) | vk::ShaderStageFlagBits::eCompute  /*stageFlags*/,
+      nullptr                               /*pImmutableSamplers*/
+   };
+
+   // (only the denoiser uses these, see Denoise.comp)
+   vk::DescriptorSetLayoutBinding denoiseImagesLB = {
+      BINDING_DENOISEIMAGES                                    /*binding*/,
+      vk::DescriptorType::eStorageImage                        /*descriptorType*/,
+      static_cast<uint32_t>(m_DenoiseImages.size())           /*descriptorCount*/,
+      vk::ShaderStageFlagBits::eCompute                        /*stageFlags*/,
+      nullptr                                                  /*pImmutableSamplers*/
+   };
+
+   // (compute stage as well for the denoiser and temporal reprojection)
    vk::DescriptorSetLayoutBinding outputImageLB = {
       BINDING_OUTPUTIMAGE                   /*binding*/,
       vk::DescriptorType::eStorageImage     /*descriptorType*/,
       1                                     /*descriptorCount*/,
-      vk::ShaderStageFlagBits::eRaygenKHR   /*stageFlags*/,
+      stages(vk::ShaderStageFlagBits::eRaygenKHR) | vk::ShaderStageFlagBits::eCompute  /*stageFlags*/,
       nullptr                               /*pImmutableSamplers*/
    };
 
    vk::DescriptorSetLayoutBinding uniformBufferLB = {
       BINDING_UNIFORMBUFFER                                                                                           /*binding*/,
-      vk::DescriptorType::eUniformBuffer                                                                              /*descriptorType*/,
+      vk::DescriptorType::eUniformBufferDynamic                                                                       /*descriptorType*/,
       1                                                                                                               /*descriptorCount*/,
-      vk::ShaderStageFlagBits::eRaygenKHR | vk::ShaderStageFlagBits::eIntersectionKHR | vk::ShaderStageFlagBits::eClosestHitKHR | vk::ShaderStageFlagBits::eMissKHR  /*stageFlags*/,
+      stages(vk::ShaderStageFlagBits::eRaygenKHR | vk::ShaderStageFlagBits::eIntersectionKHR | vk::ShaderStageFlagBits::eClosestHitKHR | vk::ShaderStageFlagBits::eMissKHR) | vk::ShaderStageFlagBits::eCompute  /*stageFlags*/,
       nullptr                                                                                                         /*pImmutableSamplers*/
    };
 
@@ -1318,7 +1991,7 @@ void RayTracer::CreateDescriptorSetLayout() {
       BINDING_VERTEXBUFFER                      /*binding*/,
       vk::DescriptorType::eStorageBuffer        /*descriptorType*/,
       1                                         /*descriptorCount*/,
-      vk::ShaderStageFlagBits::eClosestHitKHR   /*stageFlags*/,
+      stages(vk::ShaderStageFlagBits::eClosestHitKHR)  /*stageFlags*/,
       nullptr                                   /*pImmutableSamplers*/
    };
    
@@ -1326,7 +1999,7 @@ void RayTracer::CreateDescriptorSetLayout() {
       BINDING_INDEXBUFFER                       /*binding*/,
       vk::DescriptorType::eStorageBuffer        /*descriptorType*/,
       1                                         /*descriptorCount*/,
-      vk::ShaderStageFlagBits::eClosestHitKHR   /*stageFlags*/,
+      stages(vk::ShaderStageFlagBits::eClosestHitKHR)  /*stageFlags*/,
       nullptr                                   /*pImmutableSamplers*/
    };
 
@@ -1334,7 +2007,7 @@ void RayTracer::CreateDescriptorSetLayout() {
       BINDING_OFFSETBUFFER                      /*binding*/,
       vk::DescriptorType::eStorageBuffer        /*descriptorType*/,
       1                                         /*descriptorCount*/,
-      vk::ShaderStageFlagBits::eClosestHitKHR   /*stageFlags*/,
+      stages(vk::ShaderStageFlagBits::eClosestHitKHR)  /*stageFlags*/,
       nullptr                                   /*pImmutableSamplers*/
    };
 
@@ -1342,7 +2015,23 @@ void RayTracer::CreateDescriptorSetLayout() {
       BINDING_MATERIALBUFFER                    /*binding*/,
       vk::DescriptorType::eStorageBuffer        /*descriptorType*/,
       1                                         /*descriptorCount*/,
-      vk::ShaderStageFlagBits::eIntersectionKHR | vk::ShaderStageFlagBits::eClosestHitKHR  /*stageFlags*/,
+      stages(vk::ShaderStageFlagBits::eIntersectionKHR | vk::ShaderStageFlagBits::eClosestHitKHR)  /*stageFlags*/,
+      nullptr                                   /*pImmutableSamplers*/
+   };
+
+   vk::DescriptorSetLayoutBinding sphereBufferLB = {
+      BINDING_SPHEREBUFFER                      /*binding*/,
+      vk::DescriptorType::eStorageBuffer        /*descriptorType*/,
+      1                                         /*descriptorCount*/,
+      stages(vk::ShaderStageFlagBits::eIntersectionKHR | vk::ShaderStageFlagBits::eClosestHitKHR)  /*stageFlags*/,
+      nullptr                                   /*pImmutableSamplers*/
+   };
+
+   vk::DescriptorSetLayoutBinding lightBufferLB = {
+      BINDING_LIGHTBUFFER                       /*binding*/,
+      vk::DescriptorType::eStorageBuffer        /*descriptorType*/,
+      1                                         /*descriptorCount*/,
+      stages(vk::ShaderStageFlagBits::eClosestHitKHR)  /*stageFlags*/,
       nullptr                                   /*pImmutableSamplers*/
    };
 
@@ -1350,7 +2039,7 @@ void RayTracer::CreateDescriptorSetLayout() {
       BINDING_TEXTURESAMPLERS                     /*binding*/,
       vk::DescriptorType::eCombinedImageSampler   /*descriptorType*/,
       static_cast<uint32_t>(m_Textures.size())    /*descriptorCount*/,
-      vk::ShaderStageFlagBits::eClosestHitKHR     /*stageFlags*/,
+      stages(vk::ShaderStageFlagBits::eClosestHitKHR)  /*stageFlags*/,
       nullptr                                     /*pImmutableSamplers*/
    };
 
@@ -1358,29 +2047,84 @@ void RayTracer::CreateDescriptorSetLayout() {
       BINDING_SKYBOX                              /*binding*/,
       vk::DescriptorType::eCombinedImageSampler   /*descriptorType*/,
       1                                           /*descriptorCount*/,
-      vk::ShaderStageFlagBits::eMissKHR           /*stageFlags*/,
+      stages(vk::ShaderStageFlagBits::eMissKHR)   /*stageFlags*/,
       nullptr                                     /*pImmutableSamplers*/
    };
 
-   std::array<vk::DescriptorSetLayoutBinding, BINDING_NUMBINDINGS> layoutBindings = {
-      accelerationStructureLB,
+   vk::DescriptorSetLayoutBinding rayCounterLB = {
+      BINDING_RAYCOUNTER                                  /*binding*/,
+      vk::DescriptorType::eStorageBuffer                  /*descriptorType*/,
+      1                                                   /*descriptorCount*/,
+      stages(vk::ShaderStageFlagBits::eRaygenKHR) | vk::ShaderStageFlagBits::eCompute  /*stageFlags*/,
+      nullptr                                             /*pImmutableSamplers*/
+   };
+
+   std::vector<vk::DescriptorSetLayoutBinding> layoutBindings = {
       accumulationImageLB,
       outputImageLB,
+      momentsImageLB,
+      sampleMaskImageLB,
+      albedoImageLB,
+      normalDepthImageLB,
+      denoiseImagesLB,
+      positionImageLB,
+      historyImageLB,
+      historyPositionImageLB,
       uniformBufferLB,
       vertexBufferLB,
       indexBufferLB,
       offsetBufferLB,
       materialBufferLB,
       textureSamplerLB,
-      skyboxLB
+      skyboxLB,
+      sphereBufferLB,
+      lightBufferLB,
+      rayCounterLB
    };
 
-   m_DescriptorSetLayout = m_Device.createDescriptorSetLayout({
-      {}                                           /*flags*/,
-      static_cast<uint32_t>(layoutBindings.size()) /*bindingCount*/,
-      layoutBindings.data()                        /*pBindings*/
-   });
-}
+   // sampler tables are read where the camera ray is generated, and where scatter directions and lights are sampled
+   for (const uint32_t binding : {BINDING_SOBOLBUFFER, BINDING_BLUENOISEBUFFER}) {
+      layoutBindings.emplace_back(
+         binding                                  /*binding*/,
+         vk::DescriptorType::eStorageBuffer       /*descriptorType*/,
+         1                                        /*descriptorCount*/,
+         stages(vk::ShaderStageFlagBits::eRaygenKHR | vk::ShaderStageFlagBits::eClosestHitKHR)  /*stageFlags*/,
+         nullptr                                  /*pImmutableSamplers*/
+      );
+   }
+
+   if (m_RayTracerSettings.IsComputeRayTracing) {
+      for (const uint32_t binding : {BINDING_BVHNODES, BINDING_BVHPRIMITIVES, BINDING_BVHINSTANCES}) {
+         layoutBindings.emplace_back(
+            binding                                  /*binding*/,
+            vk::DescriptorType::eStorageBuffer       /*descriptorType*/,
+            1                                        /*descriptorCount*/,
+            vk::ShaderStageFlagBits::eCompute        /*stageFlags*/,
+            nullptr                                  /*pImmutableSamplers*/
+         );
+      }
+   } else {
+      layoutBindings.push_back(accelerationStructureLB);
+   }
+
+   if (m_RayTracerSettings.IsWavefrontPathTracing) {
+      for (const uint32_t binding : {BINDING_PATHSTATES, BINDING_RAYQUEUES, BINDING_QUEUESTATS}) {
+         layoutBindings.emplace_back(
+            binding                                  /*binding*/,
+            vk::DescriptorType::eStorageBuffer       /*descriptorType*/,
+            1                                        /*descriptorCount*/,
+            vk::ShaderStageFlagBits::eCompute        /*stageFlags*/,
+            nullptr                                  /*pImmutableSamplers*/
+         );
+      }
+   }
+
+   m_DescriptorSetLayout = m_Device.createDescriptorSetLayout({
+      {}                                           /*flags*/,
+      static_cast<uint32_t>(layoutBindings.size()) /*bindingCount*/,
+      layoutBindings.data()                        /*pBindings*/
+   });
+}
 
 
 void RayTracer::DestroyDescriptorSetLayout() {
@@ -1395,18 +2139,13 @@ void RayTracer::CreatePipelineLayout() {
    // Create the pipeline layout that is used to generate the rendering pipelines that are based on the descriptor set layout
    // In a more complex scenario you would have different pipeline layouts for different descriptor set layouts that could be reused
 
-   vk::PushConstantRange pushConstantRange = {
-      vk::ShaderStageFlagBits::eRaygenKHR        /*stageFlags*/,
-      0                                          /*offset*/,
-      static_cast<uint32_t>(sizeof(Constants))   /*size*/
-   };
-
+   // (no push constants.  Everything that changes from frame to frame is in the uniform buffer, see UniformBufferObject.glsl)
    m_PipelineLayout = m_Device.createPipelineLayout({
       {}                       /*flags*/,
       1                        /*setLayoutCount*/,
       &m_DescriptorSetLayout   /*pSetLayouts*/,
-      1                        /*pushConstantRangeCount*/,
-      &pushConstantRange       /*pPushConstantRanges*/
+      0                        /*pushConstantRangeCount*/,
+      nullptr                  /*pPushConstantRanges*/
    });
 }
 
@@ -1418,124 +2157,177 @@ void RayTracer::DestroyPipelineLayout() {
    }
 }
 
+
+// Specialization constants are all 32 bits, and are given to each pipeline stage as an array indexed by SPECIALIZATION_XXX
+// (see RayTracer::Specialization::GetValues()).  The array must stay put until the pipeline has been created
+static vk::SpecializationInfo GetSpecializationInfo(const std::array<uint32_t, SPECIALIZATION_COUNT>& values) {
+   static const std::array<vk::SpecializationMapEntry, SPECIALIZATION_COUNT> mapEntries = [] {
+      std::array<vk::SpecializationMapEntry, SPECIALIZATION_COUNT> entries;
+      for (uint32_t id = 0; id < SPECIALIZATION_COUNT; ++id) {
+         entries[id] = vk::SpecializationMapEntry {id /*constantID*/, id * static_cast<uint32_t>(sizeof(uint32_t)) /*offset*/, sizeof(uint32_t) /*size*/};
+      }
+      return entries;
+   }();
+
+   return vk::SpecializationInfo {
+      static_cast<uint32_t>(mapEntries.size())   /*mapEntryCount*/,
+      mapEntries.data()                          /*pMapEntries*/,
+      sizeof(values)                             /*dataSize*/,
+      values.data()                              /*pData*/
+   };
+}
+
+
+std::array<uint32_t, SPECIALIZATION_COUNT> RayTracer::Specialization::GetValues(const uint32_t materialType) const {
+   std::array<uint32_t, SPECIALIZATION_COUNT> values;
+   values[SPECIALIZATION_MATERIALTYPE] = materialType;
+   values[SPECIALIZATION_USESKYBOX] = m_UseSkybox;
+   return values;
+}
+
+
 void RayTracer::CreatePipeline() {
+   // Skybox to start with is the scene's (B turns it off and on again, see OnKey()).  Other variants are only compiled if they are switched to
+   m_Specialization = {m_Scene.GetSkyboxTextureFileName().empty() ? 0u : 1u};
+   m_PipelineVariant = &GetPipelineVariant(m_Specialization);
+}
+
+
+void RayTracer::DestroyPipeline() {
+   for (auto& [specialization, variant] : m_PipelineVariants) {
+      DestroyPipelineVariant(variant);
+   }
+   m_PipelineVariants.clear();
+   m_PipelineVariant = nullptr;
+}
+
+
+RayTracer::PipelineVariant& RayTracer::GetPipelineVariant(const Specialization& specialization) {
+   auto variant = m_PipelineVariants.find(specialization);
+   if (variant == m_PipelineVariants.end()) {
+      // (biggest single startup cost.  Much reduced by a warm pipeline cache)
+      Vulkan::Profiler::CPUScope scope(m_Profiler.get(), "CreatePipeline");
+      variant = m_PipelineVariants.emplace(specialization, PipelineVariant {}).first;
+      if (m_RayTracerSettings.IsWavefrontPathTracing) {
+         CreateWavefrontPipelines(variant->second, specialization);
+      } else if (m_RayTracerSettings.IsComputeRayTracing) {
+         CreateComputePipeline(variant->second, specialization);
+      } else {
+         CreateRayTracingPipeline(variant->second, specialization);
+      }
+   }
+   return variant->second;
+}
+
+
+void RayTracer::DestroyPipelineVariant(PipelineVariant& variant) {
+   variant.m_ShaderBindingTable.reset(nullptr);
+   for (vk::Pipeline* pipeline : {&variant.m_Pipeline, &variant.m_WavefrontGeneratePipeline, &variant.m_WavefrontExtendPipeline, &variant.m_WavefrontShadowPipeline, &variant.m_WavefrontAccumulatePipeline}) {
+      if (m_Device && *pipeline) {
+         m_Device.destroy(*pipeline);
+         *pipeline = nullptr;
+      }
+   }
+   for (auto& pipeline : variant.m_WavefrontShadePipelines) {
+      if (m_Device && pipeline) {
+         m_Device.destroy(pipeline);
+      }
+   }
+   variant.m_WavefrontShadePipelines.clear();
+}
+
+
+void RayTracer::SetSpecialization(const Specialization& specialization) {
+   // (command buffers that are re-recorded must not be in use)
+   m_Device.waitIdle();
+   m_Specialization = specialization;
+   m_PipelineVariant = &GetPipelineVariant(specialization);
+   RecordCommandBuffers();
+   m_AccumulatedImageCount = 0;
+}
+
+
+void RayTracer::CreateRayTracingPipeline(PipelineVariant& variant, const Specialization& specialization) {
    // Create the graphics pipeline used in this example
    // Vulkan uses the concept of rendering pipelines to encapsulate fixed states, replacing OpenGL's complex state machine
    // A pipeline is then stored and hashed on the GPU making pipeline changes very fast
    // Note: There are still a few dynamic states that are not directly part of the pipeline (but the info that they are used is)
 
+   // General shaders and intersection shaders first.  Then closest hit shaders, one for each hit group that the scene uses (see CreateHitRecords())
    enum {
       eRayGen,
       eMiss,
-      eTrianglesClosestHit,
+      eShadowMiss,
       eSphereIntersection,
-      eSphereClosestHit,
       eBoxIntersection,
-      eBoxClosestHit,
 
-      eNumShaders
+      eFirstClosestHit
    };
 
-   std::array<vk::PipelineShaderStageCreateInfo, eNumShaders> shaderStages;
-
-   shaderStages[eRayGen] = vk::PipelineShaderStageCreateInfo {
-      {}                                                                           /*flags*/,
-      vk::ShaderStageFlagBits::eRaygenKHR                                          /*stage*/,
-      CreateShaderModule(Vulkan::ReadFile("Assets/Shaders/RayTrace.rgen.spv"))     /*module*/,
-      "main"                                                                       /*name*/,
-      nullptr                                                                      /*pSpecializationInfo*/
-   };
-
-   shaderStages[eMiss] = vk::PipelineShaderStageCreateInfo {
-      {}                                                                           /*flags*/,
-      vk::ShaderStageFlagBits::eMissKHR                                            /*stage*/,
-      CreateShaderModule(Vulkan::ReadFile("Assets/Shaders/RayTrace.rmiss.spv"))    /*module*/,
-      "main"                                                                       /*name*/,
-      nullptr                                                                      /*pSpecializationInfo*/
-   };
-
-   shaderStages[eTrianglesClosestHit] = vk::PipelineShaderStageCreateInfo {
-      {}                                                                           /*flags*/,
-      vk::ShaderStageFlagBits::eClosestHitKHR                                      /*stage*/,
-      CreateShaderModule(Vulkan::ReadFile("Assets/Shaders/Triangles.rchit.spv"))   /*module*/,
-      "main"                                                                       /*name*/,
-      nullptr                                                                      /*pSpecializationInfo*/
-   };
-
-   shaderStages[eSphereIntersection] = vk::PipelineShaderStageCreateInfo {
-      {}                                                                           /*flags*/,
-      vk::ShaderStageFlagBits::eIntersectionKHR                                    /*stage*/,
-      CreateShaderModule(Vulkan::ReadFile("Assets/Shaders/Sphere.rint.spv"))       /*module*/,
-      "main"                                                                       /*name*/,
-      nullptr                                                                      /*pSpecializationInfo*/
-   };
-
-   shaderStages[eSphereClosestHit] = vk::PipelineShaderStageCreateInfo {
-      {}                                                                           /*flags*/,
-      vk::ShaderStageFlagBits::eClosestHitKHR                                      /*stage*/,
-      CreateShaderModule(Vulkan::ReadFile("Assets/Shaders/Sphere.rchit.spv"))      /*module*/,
-      "main"                                                                       /*name*/,
-      nullptr                                                                      /*pSpecializationInfo*/
-   };
-
-   shaderStages[eBoxIntersection] = vk::PipelineShaderStageCreateInfo {
-      {}                                                                           /*flags*/,
-      vk::ShaderStageFlagBits::eIntersectionKHR                                    /*stage*/,
-      CreateShaderModule(Vulkan::ReadFile("Assets/Shaders/Box.rint.spv"))          /*module*/,
-      "main"                                                                       /*name*/,
-      nullptr                                                                      /*pSpecializationInfo*/
-   };
-
-   shaderStages[eBoxClosestHit] = vk::PipelineShaderStageCreateInfo {
-      {}                                                                           /*flags*/,
-      vk::ShaderStageFlagBits::eClosestHitKHR                                      /*stage*/,
-      CreateShaderModule(Vulkan::ReadFile("Assets/Shaders/Box.rchit.spv"))         /*module*/,
-      "main"                                                                       /*name*/,
-      nullptr                                                                      /*pSpecializationInfo*/
+   auto shaderStage = [](const vk::ShaderStageFlagBits stage, const vk::ShaderModule module, const vk::SpecializationInfo* specializationInfo) {
+      return vk::PipelineShaderStageCreateInfo {
+         {}                   /*flags*/,
+         stage                /*stage*/,
+         module               /*module*/,
+         "main"               /*name*/,
+         specializationInfo   /*pSpecializationInfo*/
+      };
    };
 
-
-   std::array<vk::RayTracingShaderGroupCreateInfoKHR, eNumShaderGroups> groups;
-
-   groups[eRayGenGroup] = vk::RayTracingShaderGroupCreateInfoKHR {
-      vk::RayTracingShaderGroupTypeKHR::eGeneral /*type*/,
-      eRayGen                                    /*generalShader*/,
-      VK_SHADER_UNUSED_KHR                       /*closestHitShader*/,
-      VK_SHADER_UNUSED_KHR                       /*anyHitShader*/,
-      VK_SHADER_UNUSED_KHR                       /*intersectionShader*/
+   // Indexed by HITGROUP_XXX.  Each closest hit shader module can be in several stages (one for each material type it is specialized for)
+   std::array<vk::ShaderModule, 3> closestHitModules = {
+      CreateShaderModule(Vulkan::ReadFile("Assets/Shaders/Triangles.rchit.spv")),
+      CreateShaderModule(Vulkan::ReadFile("Assets/Shaders/Sphere.rchit.spv")),
+      CreateShaderModule(Vulkan::ReadFile("Assets/Shaders/Box.rchit.spv"))
    };
 
-   groups[eMissGroup] = vk::RayTracingShaderGroupCreateInfoKHR{
-      vk::RayTracingShaderGroupTypeKHR::eGeneral /*type*/,
-      eMiss                                      /*generalShader*/,
-      VK_SHADER_UNUSED_KHR                       /*closestHitShader*/,
-      VK_SHADER_UNUSED_KHR                       /*anyHitShader*/,
-      VK_SHADER_UNUSED_KHR                       /*intersectionShader*/
-   };
+   const std::array<uint32_t, SPECIALIZATION_COUNT> values = specialization.GetValues();
+   const vk::SpecializationInfo specializationInfo = GetSpecializationInfo(values);
+
+   std::vector<vk::PipelineShaderStageCreateInfo> shaderStages;
+   shaderStages.reserve(eFirstClosestHit + m_HitGroups.size());
+   shaderStages.emplace_back(shaderStage(vk::ShaderStageFlagBits::eRaygenKHR, CreateShaderModule(Vulkan::ReadFile("Assets/Shaders/RayTrace.rgen.spv")), &specializationInfo));
+   shaderStages.emplace_back(shaderStage(vk::ShaderStageFlagBits::eMissKHR, CreateShaderModule(Vulkan::ReadFile("Assets/Shaders/RayTrace.rmiss.spv")), &specializationInfo));
+   shaderStages.emplace_back(shaderStage(vk::ShaderStageFlagBits::eMissKHR, CreateShaderModule(Vulkan::ReadFile("Assets/Shaders/Shadow.rmiss.spv")), &specializationInfo));
+   shaderStages.emplace_back(shaderStage(vk::ShaderStageFlagBits::eIntersectionKHR, CreateShaderModule(Vulkan::ReadFile("Assets/Shaders/Sphere.rint.spv")), &specializationInfo));
+   shaderStages.emplace_back(shaderStage(vk::ShaderStageFlagBits::eIntersectionKHR, CreateShaderModule(Vulkan::ReadFile("Assets/Shaders/Box.rint.spv")), &specializationInfo));
+
+   // Closest hit shaders compiled for just their hit group's material as well (see Scatter.glsl).
+   // Specialization values and info have to stay put until the pipeline is created, hence reserve()
+   std::vector<std::array<uint32_t, SPECIALIZATION_COUNT>> closestHitValues;
+   std::vector<vk::SpecializationInfo> closestHitSpecializationInfos;
+   closestHitValues.reserve(m_HitGroups.size());
+   closestHitSpecializationInfos.reserve(m_HitGroups.size());
+   for (const auto& hitGroup : m_HitGroups) {
+      closestHitValues.push_back(specialization.GetValues(hitGroup.m_MaterialType));
+      closestHitSpecializationInfos.push_back(GetSpecializationInfo(closestHitValues.back()));
+      shaderStages.emplace_back(shaderStage(vk::ShaderStageFlagBits::eClosestHitKHR, closestHitModules.at(hitGroup.m_GeometryType), &closestHitSpecializationInfos.back()));
+   }
 
-   groups[eTrianglesHitGroup] = vk::RayTracingShaderGroupCreateInfoKHR{
-      vk::RayTracingShaderGroupTypeKHR::eTrianglesHitGroup /*type*/,
-      VK_SHADER_UNUSED_KHR                      /*generalShader*/,
-      eTrianglesClosestHit                      /*closestHitShader*/,
-      VK_SHADER_UNUSED_KHR                      /*anyHitShader*/,
-      VK_SHADER_UNUSED_KHR                      /*intersectionShader*/
-   };
+   std::vector<vk::RayTracingShaderGroupCreateInfoKHR> groups;
+   groups.reserve(eFirstHitGroup + m_HitGroups.size());
 
-   groups[eSphereHitGroup] = vk::RayTracingShaderGroupCreateInfoKHR{
-      vk::RayTracingShaderGroupTypeKHR::eProceduralHitGroup /*type*/,
-      VK_SHADER_UNUSED_KHR                       /*generalShader*/,
-      eSphereClosestHit                          /*closestHitShader*/,
-      VK_SHADER_UNUSED_KHR                       /*anyHitShader*/,
-      eSphereIntersection                        /*intersectionShader*/
-   };
+   for (const uint32_t generalShader : {eRayGen, eMiss, eShadowMiss}) {   // in EShaderGroup order
+      groups.push_back({
+         vk::RayTracingShaderGroupTypeKHR::eGeneral /*type*/,
+         generalShader                              /*generalShader*/,
+         VK_SHADER_UNUSED_KHR                       /*closestHitShader*/,
+         VK_SHADER_UNUSED_KHR                       /*anyHitShader*/,
+         VK_SHADER_UNUSED_KHR                       /*intersectionShader*/
+      });
+   }
 
-   groups[eBoxHitGroup] = vk::RayTracingShaderGroupCreateInfoKHR{
-      vk::RayTracingShaderGroupTypeKHR::eProceduralHitGroup /*type*/,
-      VK_SHADER_UNUSED_KHR                       /*generalShader*/,
-      eBoxClosestHit                             /*closestHitShader*/,
-      VK_SHADER_UNUSED_KHR                       /*anyHitShader*/,
-      eBoxIntersection                           /*intersectionShader*/
-   };
+   for (size_t i = 0; i < m_HitGroups.size(); ++i) {
+      const uint32_t geometryType = m_HitGroups[i].m_GeometryType;
+      const uint32_t intersectionShader = (geometryType == HITGROUP_SPHERE) ? eSphereIntersection : (geometryType == HITGROUP_BOX) ? eBoxIntersection : VK_SHADER_UNUSED_KHR;
+      groups.push_back({
+         (geometryType == HITGROUP_TRIANGLES) ? vk::RayTracingShaderGroupTypeKHR::eTrianglesHitGroup : vk::RayTracingShaderGroupTypeKHR::eProceduralHitGroup /*type*/,
+         VK_SHADER_UNUSED_KHR                              /*generalShader*/,
+         static_cast<uint32_t>(eFirstClosestHit + i)       /*closestHitShader*/,
+         VK_SHADER_UNUSED_KHR                              /*anyHitShader*/,
+         intersectionShader                                /*intersectionShader*/
+      });
+   }
 
    vk::RayTracingPipelineCreateInfoKHR pipelineCI = {
       {}                                         /*flags*/,
@@ -1553,66 +2345,303 @@ void RayTracer::CreatePipeline() {
    };
 
    // .value works around issue with implicit cast of ResultValue<T> (refer https://github.com/KhronosGroup/Vulkan-Hpp/issues/680)
-   m_Pipeline = m_Device.createRayTracingPipelineKHR(nullptr, m_PipelineCache, pipelineCI).value;
+   variant.m_Pipeline = m_Device.createRayTracingPipelineKHR(nullptr, m_PipelineCache, pipelineCI).value;
 
    // Create buffer for the shader binding table.
    // Note that regardless of the shaderGroupHandleSize, the entries in the shader binding table must be aligned on multiples of m_RayTracingProperties.shaderGroupBaseAlignment
 
    const uint32_t handleSize = m_RayTracingPipelineProperties.shaderGroupHandleSize;
    const uint32_t handleSizeAligned = Vulkan::AlignedSize(m_RayTracingPipelineProperties.shaderGroupHandleSize, m_RayTracingPipelineProperties.shaderGroupBaseAlignment);
-   const vk::DeviceSize tableSize = static_cast<vk::DeviceSize>(handleSizeAligned) * eNumShaderGroups;
-   const vk::DeviceSize handlesSize = static_cast<vk::DeviceSize>(handleSize) * eNumShaderGroups;
+   const uint32_t groupCount = static_cast<uint32_t>(groups.size());
+   const vk::DeviceSize handlesSize = static_cast<vk::DeviceSize>(handleSize) * groupCount;
 
-   // First, get all the handles from the device,  and then copy them to the shader binding table with the correct alignment
-   std::vector<uint8_t> shaderHandleStorage = m_Device.getRayTracingShaderGroupHandlesKHR<uint8_t>(m_Pipeline, 0, eNumShaderGroups, handlesSize);
+   // First, get all the handles from the device,  and then copy them to the shader binding table with the correct alignment.
+   // The general groups' records, then the hit records (several of which can be for the same hit group)
+   std::vector<uint8_t> shaderHandleStorage = m_Device.getRayTracingShaderGroupHandlesKHR<uint8_t>(variant.m_Pipeline, 0, groupCount, handlesSize);
+
+   std::vector<uint32_t> records = {eRayGenGroup, eMissGroup, eShadowMissGroup};
+   for (const uint32_t hitGroup : m_HitRecords) {
+      records.push_back(eFirstHitGroup + hitGroup);
+   }
+   const vk::DeviceSize tableSize = static_cast<vk::DeviceSize>(handleSizeAligned) * records.size();
 
    std::vector<uint8_t> shaderBindingTable;
    shaderBindingTable.resize(tableSize);
-   for (size_t i = 0; i < eNumShaderGroups; ++i) {
-      std::memcpy(shaderBindingTable.data() + (i * static_cast<size_t>(handleSizeAligned)), shaderHandleStorage.data() + (i * static_cast<size_t>(handleSize)), static_cast<size_t>(handleSize));
+   for (size_t i = 0; i < records.size(); ++i) {
+      std::memcpy(shaderBindingTable.data() + (i * static_cast<size_t>(handleSizeAligned)), shaderHandleStorage.data() + (records[i] * static_cast<size_t>(handleSize)), static_cast<size_t>(handleSize));
    }
 
-   m_ShaderBindingTable = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, tableSize, vk::BufferUsageFlagBits::eShaderBindingTableKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eHostVisible);
-   m_ShaderBindingTable->CopyFromHost(0, tableSize, shaderBindingTable.data());
+   variant.m_ShaderBindingTable = std::make_unique<Vulkan::Buffer>(m_Device, m_PhysicalDevice, tableSize, vk::BufferUsageFlagBits::eShaderBindingTableKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eHostVisible);
+   variant.m_ShaderBindingTable->CopyFromHost(0, tableSize, shaderBindingTable.data());
 
    // Shader modules are no longer needed once the graphics pipeline has been created
-   for (auto& shaderStage : shaderStages) {
-      DestroyShaderModule(shaderStage.module);
+   for (size_t i = 0; i < eFirstClosestHit; ++i) {
+      DestroyShaderModule(shaderStages[i].module);
+   }
+   for (auto& module : closestHitModules) {
+      DestroyShaderModule(module);
    }
 }
 
 
-void RayTracer::DestroyPipeline() {
-   m_ShaderBindingTable.reset(nullptr);
-   if (m_Device && m_Pipeline) {
-      m_Device.destroy(m_Pipeline);
+void RayTracer::CreateComputePipeline(PipelineVariant& variant, const Specialization& specialization) {
+   // Software ray tracing.  The one compute shader does the work of all of the ray tracing pipeline's shaders (see RayTrace.comp)
+   const std::array<uint32_t, SPECIALIZATION_COUNT> values = specialization.GetValues();
+   const vk::SpecializationInfo specializationInfo = GetSpecializationInfo(values);
+   vk::PipelineShaderStageCreateInfo shaderStage = {
+      {}                                                                           /*flags*/,
+      vk::ShaderStageFlagBits::eCompute                                            /*stage*/,
+      CreateShaderModule(Vulkan::ReadFile("Assets/Shaders/RayTrace.comp.spv"))     /*module*/,
+      "main"                                                                       /*name*/,
+      &specializationInfo                                                          /*pSpecializationInfo*/
+   };
+
+   vk::ComputePipelineCreateInfo pipelineCI = {
+      {}                 /*flags*/,
+      shaderStage        /*stage*/,
+      m_PipelineLayout   /*layout*/,
+      nullptr            /*basePipelineHandle*/,
+      0                  /*basePipelineIndex*/
+   };
+
+   // .value works around issue with implicit cast of ResultValue<T> (refer https://github.com/KhronosGroup/Vulkan-Hpp/issues/680)
+   variant.m_Pipeline = m_Device.createComputePipeline(m_PipelineCache, pipelineCI).value;
+
+   DestroyShaderModule(shaderStage.module);
+}
+
+
+void RayTracer::CreateAdaptiveSamplingPipeline() {
+   if (m_RayTracerSettings.AdaptiveSamplingThreshold <= 0.0f) {
+      return;
+   }
+
+   // Same layout (and descriptor sets) as the ray tracing pipeline.  AdaptiveSampling.comp only uses the bindings that it shares with RayTrace.rgen
+   vk::PipelineShaderStageCreateInfo shaderStage = {
+      {}                                                                                 /*flags*/,
+      vk::ShaderStageFlagBits::eCompute                                                  /*stage*/,
+      CreateShaderModule(Vulkan::ReadFile("Assets/Shaders/AdaptiveSampling.comp.spv"))   /*module*/,
+      "main"                                                                             /*name*/,
+      nullptr                                                                            /*pSpecializationInfo*/
+   };
+
+   vk::ComputePipelineCreateInfo pipelineCI = {
+      {}                 /*flags*/,
+      shaderStage        /*stage*/,
+      m_PipelineLayout   /*layout*/,
+      nullptr            /*basePipelineHandle*/,
+      0                  /*basePipelineIndex*/
+   };
+
+   // .value works around issue with implicit cast of ResultValue<T> (refer https://github.com/KhronosGroup/Vulkan-Hpp/issues/680)
+   m_AdaptiveSamplingPipeline = m_Device.createComputePipeline(m_PipelineCache, pipelineCI).value;
+
+   DestroyShaderModule(shaderStage.module);
+}
+
+
+void RayTracer::DestroyAdaptiveSamplingPipeline() {
+   if (m_Device && m_AdaptiveSamplingPipeline) {
+      m_Device.destroy(m_AdaptiveSamplingPipeline);
+      m_AdaptiveSamplingPipeline = nullptr;
    }
 }
 
 
+void RayTracer::CreateDenoisePipeline() {
+   if (m_RayTracerSettings.DenoiseIterations == 0) {
+      return;
+   }
+
+   // Same descriptor sets as the ray tracing pipeline, but its own push constants (which pass it is)
+   vk::PushConstantRange pushConstantRange = {
+      vk::ShaderStageFlagBits::eCompute                 /*stageFlags*/,
+      0                                                 /*offset*/,
+      static_cast<uint32_t>(sizeof(DenoiseConstants))   /*size*/
+   };
+
+   m_DenoisePipelineLayout = m_Device.createPipelineLayout({
+      {}                       /*flags*/,
+      1                        /*setLayoutCount*/,
+      &m_DescriptorSetLayout   /*pSetLayouts*/,
+      1                        /*pushConstantRangeCount*/,
+      &pushConstantRange       /*pPushConstantRanges*/
+   });
+
+   vk::PipelineShaderStageCreateInfo shaderStage = {
+      {}                                                                        /*flags*/,
+      vk::ShaderStageFlagBits::eCompute                                         /*stage*/,
+      CreateShaderModule(Vulkan::ReadFile("Assets/Shaders/Denoise.comp.spv"))   /*module*/,
+      "main"                                                                    /*name*/,
+      nullptr                                                                   /*pSpecializationInfo*/
+   };
+
+   vk::ComputePipelineCreateInfo pipelineCI = {
+      {}                        /*flags*/,
+      shaderStage               /*stage*/,
+      m_DenoisePipelineLayout   /*layout*/,
+      nullptr                   /*basePipelineHandle*/,
+      0                         /*basePipelineIndex*/
+   };
+
+   // .value works around issue with implicit cast of ResultValue<T> (refer https://github.com/KhronosGroup/Vulkan-Hpp/issues/680)
+   m_DenoisePipeline = m_Device.createComputePipeline(m_PipelineCache, pipelineCI).value;
+
+   DestroyShaderModule(shaderStage.module);
+}
+
+
+void RayTracer::CreateReprojectPipeline() {
+   if (m_RayTracerSettings.TemporalHistoryLength == 0) {
+      return;
+   }
+
+   // Same layout (and descriptor sets) as the ray tracing pipeline.  Reproject.comp only uses the bindings that it shares with RayTrace.rgen
+   vk::PipelineShaderStageCreateInfo shaderStage = {
+      {}                                                                          /*flags*/,
+      vk::ShaderStageFlagBits::eCompute                                           /*stage*/,
+      CreateShaderModule(Vulkan::ReadFile("Assets/Shaders/Reproject.comp.spv"))   /*module*/,
+      "main"                                                                      /*name*/,
+      nullptr                                                                     /*pSpecializationInfo*/
+   };
+
+   vk::ComputePipelineCreateInfo pipelineCI = {
+      {}                 /*flags*/,
+      shaderStage        /*stage*/,
+      m_PipelineLayout   /*layout*/,
+      nullptr            /*basePipelineHandle*/,
+      0                  /*basePipelineIndex*/
+   };
+
+   // .value works around issue with implicit cast of ResultValue<T> (refer https://github.com/KhronosGroup/Vulkan-Hpp/issues/680)
+   m_ReprojectPipeline = m_Device.createComputePipeline(m_PipelineCache, pipelineCI).value;
+
+   DestroyShaderModule(shaderStage.module);
+}
+
+
+void RayTracer::DestroyReprojectPipeline() {
+   if (m_Device && m_ReprojectPipeline) {
+      m_Device.destroy(m_ReprojectPipeline);
+      m_ReprojectPipeline = nullptr;
+   }
+}
+
+
+void RayTracer::DestroyDenoisePipeline() {
+   if (m_Device && m_DenoisePipeline) {
+      m_Device.destroy(m_DenoisePipeline);
+      m_DenoisePipeline = nullptr;
+   }
+   if (m_Device && m_DenoisePipelineLayout) {
+      m_Device.destroy(m_DenoisePipelineLayout);
+      m_DenoisePipelineLayout = nullptr;
+   }
+}
+
+
+void RayTracer::CreateWavefrontPipelineLayout() {
+   if (!m_RayTracerSettings.IsWavefrontPathTracing) {
+      return;
+   }
+
+   // Same descriptor sets as the ray tracing pipeline.  Push constants are which bounce and queue a kernel is working on
+   vk::PushConstantRange pushConstantRange = {
+      vk::ShaderStageFlagBits::eCompute                          /*stageFlags*/,
+      0                                                          /*offset*/,
+      static_cast<uint32_t>(sizeof(WavefrontConstants))          /*size*/
+   };
+
+   m_WavefrontPipelineLayout = m_Device.createPipelineLayout({
+      {}                       /*flags*/,
+      1                        /*setLayoutCount*/,
+      &m_DescriptorSetLayout   /*pSetLayouts*/,
+      1                        /*pushConstantRangeCount*/,
+      &pushConstantRange       /*pPushConstantRanges*/
+   });
+}
+
+
+void RayTracer::DestroyWavefrontPipelineLayout() {
+   if (m_Device && m_WavefrontPipelineLayout) {
+      m_Device.destroy(m_WavefrontPipelineLayout);
+      m_WavefrontPipelineLayout = nullptr;
+   }
+}
+
+
+void RayTracer::CreateWavefrontPipelines(PipelineVariant& variant, const Specialization& specialization) {
+   auto createKernel = [this](const vk::ShaderModule module, const vk::SpecializationInfo* specializationInfo) {
+      vk::ComputePipelineCreateInfo pipelineCI = {
+         {}                                                     /*flags*/,
+         {
+            {}                                  /*flags*/,
+            vk::ShaderStageFlagBits::eCompute   /*stage*/,
+            module                              /*module*/,
+            "main"                              /*name*/,
+            specializationInfo                  /*pSpecializationInfo*/
+         }                                                      /*stage*/,
+         m_WavefrontPipelineLayout                              /*layout*/,
+         nullptr                                                /*basePipelineHandle*/,
+         0                                                      /*basePipelineIndex*/
+      };
+
+      // .value works around issue with implicit cast of ResultValue<T> (refer https://github.com/KhronosGroup/Vulkan-Hpp/issues/680)
+      return m_Device.createComputePipeline(m_PipelineCache, pipelineCI).value;
+   };
+
+   const std::array<uint32_t, SPECIALIZATION_COUNT> values = specialization.GetValues();
+   const vk::SpecializationInfo specializationInfo = GetSpecializationInfo(values);
+   const std::array<std::pair<vk::Pipeline*, const char*>, 4> kernels = {{
+      {&variant.m_WavefrontGeneratePipeline,   "Assets/Shaders/WavefrontGenerate.comp.spv"},
+      {&variant.m_WavefrontExtendPipeline,     "Assets/Shaders/WavefrontExtend.comp.spv"},
+      {&variant.m_WavefrontShadowPipeline,     "Assets/Shaders/WavefrontShadow.comp.spv"},
+      {&variant.m_WavefrontAccumulatePipeline, "Assets/Shaders/WavefrontAccumulate.comp.spv"}
+   }};
+   for (const auto& [pipeline, fileName] : kernels) {
+      vk::ShaderModule module = CreateShaderModule(Vulkan::ReadFile(fileName));
+      *pipeline = createKernel(module, &specializationInfo);
+      DestroyShaderModule(module);
+   }
+
+   // Shade kernel for each shade queue, compiled for just that queue's material (see Scatter.glsl)
+   vk::ShaderModule shadeModule = CreateShaderModule(Vulkan::ReadFile("Assets/Shaders/WavefrontShade.comp.spv"));
+   variant.m_WavefrontShadePipelines.resize(QUEUE_SHADECOUNT);
+   for (uint32_t material = 0; material < QUEUE_SHADECOUNT; ++material) {
+      const std::array<uint32_t, SPECIALIZATION_COUNT> shadeValues = specialization.GetValues(material);
+      const vk::SpecializationInfo shadeSpecializationInfo = GetSpecializationInfo(shadeValues);
+      variant.m_WavefrontShadePipelines[material] = createKernel(shadeModule, &shadeSpecializationInfo);
+   }
+   DestroyShaderModule(shadeModule);
+}
+
+
 void RayTracer::CreateDescriptorPool() {
-   std::array<vk::DescriptorPoolSize, 5> typeCounts = {
-      vk::DescriptorPoolSize {
-         vk::DescriptorType::eAccelerationStructureKHR,
-         static_cast<uint32_t>(m_SwapChainFrameBuffers.size())
-      },
+   // Storage images: Accumulation, Output, Moments, SampleMask, Albedo, NormalDepth, two Denoise, Position, History, and HistoryPosition
+   // Storage buffers: Vertex, Index, Offset, Material, Sphere, Light, RayCounter, Sobol, BlueNoise.  Plus BVH nodes, primitives and instances for compute ray tracing,
+   // and path states, ray queues and queue stats for wavefront path tracing
+   const uint32_t storageBufferCount = (m_RayTracerSettings.IsComputeRayTracing ? 12 : 9) + (m_RayTracerSettings.IsWavefrontPathTracing ? 3 : 0);
+   std::vector<vk::DescriptorPoolSize> typeCounts = {
       vk::DescriptorPoolSize {
          vk::DescriptorType::eStorageImage,
-         static_cast<uint32_t>(2 * m_SwapChainFrameBuffers.size())
+         static_cast<uint32_t>(11 * m_SwapChainFrameBuffers.size())
       },
       vk::DescriptorPoolSize {
-         vk::DescriptorType::eUniformBuffer,
+         vk::DescriptorType::eUniformBufferDynamic,
          static_cast<uint32_t>(m_SwapChainFrameBuffers.size())
       },
       vk::DescriptorPoolSize {
          vk::DescriptorType::eStorageBuffer,
-         static_cast<uint32_t>(4 * m_SwapChainFrameBuffers.size()) // 4 storage buffers:  Vertex, Index, Offset, Material
+         static_cast<uint32_t>(storageBufferCount * m_SwapChainFrameBuffers.size())
       },
       vk::DescriptorPoolSize {
          vk::DescriptorType::eCombinedImageSampler,
          static_cast<uint32_t>((m_Textures.size() + 1) * m_SwapChainFrameBuffers.size())
       }
    };
+   if (!m_RayTracerSettings.IsComputeRayTracing) {
+      typeCounts.emplace_back(vk::DescriptorType::eAccelerationStructureKHR, static_cast<uint32_t>(m_SwapChainFrameBuffers.size()));
+   }
 
    vk::DescriptorPoolCreateInfo descriptorPoolCI = {
       vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet       /*flags*/,
@@ -1679,6 +2708,96 @@ void RayTracer::CreateDescriptorSets() {
          nullptr                                      /*pTexelBufferView*/
       };
 
+      vk::DescriptorImageInfo momentsImageDescriptor = {
+         nullptr                       /*sampler*/,
+         m_MomentsImage->m_ImageView   /*imageView*/,
+         vk::ImageLayout::eGeneral     /*imageLayout*/
+      };
+      vk::WriteDescriptorSet momentsImageWrite = {
+         m_DescriptorSets[i]                          /*dstSet*/,
+         BINDING_MOMENTSIMAGE                         /*dstBinding*/,
+         0                                            /*dstArrayElement*/,
+         1                                            /*descriptorCount*/,
+         vk::DescriptorType::eStorageImage            /*descriptorType*/,
+         &momentsImageDescriptor                      /*pImageInfo*/,
+         nullptr                                      /*pBufferInfo*/,
+         nullptr                                      /*pTexelBufferView*/
+      };
+
+      vk::DescriptorImageInfo sampleMaskImageDescriptor = {
+         nullptr                          /*sampler*/,
+         m_SampleMaskImage->m_ImageView   /*imageView*/,
+         vk::ImageLayout::eGeneral        /*imageLayout*/
+      };
+      vk::WriteDescriptorSet sampleMaskImageWrite = {
+         m_DescriptorSets[i]                          /*dstSet*/,
+         BINDING_SAMPLEMASKIMAGE                      /*dstBinding*/,
+         0                                            /*dstArrayElement*/,
+         1                                            /*descriptorCount*/,
+         vk::DescriptorType::eStorageImage            /*descriptorType*/,
+         &sampleMaskImageDescriptor                   /*pImageInfo*/,
+         nullptr                                      /*pBufferInfo*/,
+         nullptr                                      /*pTexelBufferView*/
+      };
+
+      vk::DescriptorImageInfo albedoImageDescriptor = {
+         nullptr                       /*sampler*/,
+         m_AlbedoImage->m_ImageView    /*imageView*/,
+         vk::ImageLayout::eGeneral     /*imageLayout*/
+      };
+      vk::WriteDescriptorSet albedoImageWrite = {
+         m_DescriptorSets[i]                          /*dstSet*/,
+         BINDING_ALBEDOIMAGE                          /*dstBinding*/,
+         0                                            /*dstArrayElement*/,
+         1                                            /*descriptorCount*/,
+         vk::DescriptorType::eStorageImage            /*descriptorType*/,
+         &albedoImageDescriptor                       /*pImageInfo*/,
+         nullptr                                      /*pBufferInfo*/,
+         nullptr                                      /*pTexelBufferView*/
+      };
+
+      vk::DescriptorImageInfo normalDepthImageDescriptor = {
+         nullptr                          /*sampler*/,
+         m_NormalDepthImage->m_ImageView  /*imageView*/,
+         vk::ImageLayout::eGeneral        /*imageLayout*/
+      };
+      vk::WriteDescriptorSet normalDepthImageWrite = {
+         m_DescriptorSets[i]                          /*dstSet*/,
+         BINDING_NORMALDEPTHIMAGE                     /*dstBinding*/,
+         0                                            /*dstArrayElement*/,
+         1                                            /*descriptorCount*/,
+         vk::DescriptorType::eStorageImage            /*descriptorType*/,
+         &normalDepthImageDescriptor                  /*pImageInfo*/,
+         nullptr                                      /*pBufferInfo*/,
+         nullptr                                      /*pTexelBufferView*/
+      };
+
+      std::array<vk::DescriptorImageInfo, 2> denoiseImageDescriptors;
+      for (size_t j = 0; j < m_DenoiseImages.size(); ++j) {
+         denoiseImageDescriptors[j] = {nullptr, m_DenoiseImages[j]->m_ImageView, vk::ImageLayout::eGeneral};
+      }
+      vk::WriteDescriptorSet denoiseImagesWrite = {
+         m_DescriptorSets[i]                                      /*dstSet*/,
+         BINDING_DENOISEIMAGES                                    /*dstBinding*/,
+         0                                                        /*dstArrayElement*/,
+         static_cast<uint32_t>(denoiseImageDescriptors.size())   /*descriptorCount*/,
+         vk::DescriptorType::eStorageImage                        /*descriptorType*/,
+         denoiseImageDescriptors.data()                           /*pImageInfo*/,
+         nullptr                                                  /*pBufferInfo*/,
+         nullptr                                                  /*pTexelBufferView*/
+      };
+
+      // temporal reprojection images
+      const std::array<std::pair<uint32_t, vk::ImageView>, 3> temporalImages = {{
+         {BINDING_POSITIONIMAGE,        m_PositionImage->m_ImageView},
+         {BINDING_HISTORYIMAGE,         m_HistoryImage->m_ImageView},
+         {BINDING_HISTORYPOSITIONIMAGE, m_HistoryPositionImage->m_ImageView}
+      }};
+      std::array<vk::DescriptorImageInfo, 3> temporalImageDescriptors;
+      for (size_t j = 0; j < temporalImages.size(); ++j) {
+         temporalImageDescriptors[j] = {nullptr, temporalImages[j].second, vk::ImageLayout::eGeneral};
+      }
+
       vk::DescriptorImageInfo outputImageDescriptor = {
          nullptr                       /*sampler*/,
          m_OutputImage->m_ImageView   /*imageView*/,
@@ -1700,9 +2819,9 @@ void RayTracer::CreateDescriptorSets() {
          BINDING_UNIFORMBUFFER                        /*dstBinding*/,
          0                                            /*dstArrayElement*/,
          1                                            /*descriptorCount*/,
-         vk::DescriptorType::eUniformBuffer           /*descriptorType*/,
+         vk::DescriptorType::eUniformBufferDynamic    /*descriptorType*/,
          nullptr                                      /*pImageInfo*/,
-         &m_UniformBuffers[i].m_Descriptor            /*pBufferInfo*/,
+         &m_UniformBuffer->m_Descriptor               /*pBufferInfo*/,
          nullptr                                      /*pTexelBufferView*/
       };
 
@@ -1770,6 +2889,38 @@ void RayTracer::CreateDescriptorSets() {
          nullptr                                      /*pTexelBufferView*/
       };
 
+      vk::DescriptorBufferInfo sphereBufferDescriptor = {
+         m_SphereBuffer->m_Buffer    /*buffer*/,
+         0                           /*offset*/,
+         VK_WHOLE_SIZE               /*range*/
+      };
+      vk::WriteDescriptorSet sphereBufferWrite = {
+         m_DescriptorSets[i]                          /*dstSet*/,
+         BINDING_SPHEREBUFFER                         /*dstBinding*/,
+         0                                            /*dstArrayElement*/,
+         1                                            /*descriptorCount*/,
+         vk::DescriptorType::eStorageBuffer           /*descriptorType*/,
+         nullptr                                      /*pImageInfo*/,
+         &sphereBufferDescriptor                      /*pBufferInfo*/,
+         nullptr                                      /*pTexelBufferView*/
+      };
+
+      vk::DescriptorBufferInfo lightBufferDescriptor = {
+         m_LightBuffer->m_Buffer     /*buffer*/,
+         0                           /*offset*/,
+         VK_WHOLE_SIZE               /*range*/
+      };
+      vk::WriteDescriptorSet lightBufferWrite = {
+         m_DescriptorSets[i]                          /*dstSet*/,
+         BINDING_LIGHTBUFFER                          /*dstBinding*/,
+         0                                            /*dstArrayElement*/,
+         1                                            /*descriptorCount*/,
+         vk::DescriptorType::eStorageBuffer           /*descriptorType*/,
+         nullptr                                      /*pImageInfo*/,
+         &lightBufferDescriptor                       /*pBufferInfo*/,
+         nullptr                                      /*pTexelBufferView*/
+      };
+
       std::vector<vk::DescriptorImageInfo> textureImageDescriptors;
       textureImageDescriptors.reserve(m_Textures.size());
       for(const auto& texture : m_Textures) {
@@ -1807,19 +2958,123 @@ void RayTracer::CreateDescriptorSets() {
          nullptr                                      /*pTexelBufferView*/
       };
 
-      std::array<vk::WriteDescriptorSet, BINDING_NUMBINDINGS> writeDescriptorSets = {
-         accelerationStructureWrite,
+      // (i)th descriptor set counts rays into the (i)th counter.  See CreateRayCountBuffer()
+      vk::DescriptorBufferInfo rayCounterDescriptor = {
+         m_RayCountBuffer->m_Buffer     /*buffer*/,
+         i * m_RayCountStride           /*offset*/,
+         2 * sizeof(uint32_t)           /*range*/
+      };
+      vk::WriteDescriptorSet rayCounterWrite = {
+         m_DescriptorSets[i]                          /*dstSet*/,
+         BINDING_RAYCOUNTER                           /*dstBinding*/,
+         0                                            /*dstArrayElement*/,
+         1                                            /*descriptorCount*/,
+         vk::DescriptorType::eStorageBuffer           /*descriptorType*/,
+         nullptr                                      /*pImageInfo*/,
+         &rayCounterDescriptor                        /*pBufferInfo*/,
+         nullptr                                      /*pTexelBufferView*/
+      };
+
+      std::vector<vk::WriteDescriptorSet> writeDescriptorSets = {
          accumulationImageWrite,
          outputImageWrite,
+         momentsImageWrite,
+         sampleMaskImageWrite,
+         albedoImageWrite,
+         normalDepthImageWrite,
+         denoiseImagesWrite,
          uniformBufferWrite,
          vertexBufferWrite,
          indexBufferWrite,
          offsetBufferWrite,
          materialBufferWrite,
          textureSamplersWrite,
-         skyboxWrite
+         skyboxWrite,
+         sphereBufferWrite,
+         lightBufferWrite,
+         rayCounterWrite
       };
 
+      for (size_t j = 0; j < temporalImages.size(); ++j) {
+         writeDescriptorSets.emplace_back(
+            m_DescriptorSets[i]                          /*dstSet*/,
+            temporalImages[j].first                      /*dstBinding*/,
+            0                                            /*dstArrayElement*/,
+            1                                            /*descriptorCount*/,
+            vk::DescriptorType::eStorageImage            /*descriptorType*/,
+            &temporalImageDescriptors[j]                 /*pImageInfo*/,
+            nullptr                                      /*pBufferInfo*/,
+            nullptr                                      /*pTexelBufferView*/
+         );
+      }
+
+      const std::array<std::pair<uint32_t, vk::Buffer>, 2> samplerBuffers = {{
+         {BINDING_SOBOLBUFFER,     m_SobolBuffer->m_Buffer},
+         {BINDING_BLUENOISEBUFFER, m_BlueNoiseBuffer->m_Buffer}
+      }};
+      std::array<vk::DescriptorBufferInfo, 2> samplerBufferDescriptors;
+      for (size_t j = 0; j < samplerBuffers.size(); ++j) {
+         samplerBufferDescriptors[j] = {samplerBuffers[j].second, 0, VK_WHOLE_SIZE};
+         writeDescriptorSets.emplace_back(
+            m_DescriptorSets[i]                          /*dstSet*/,
+            samplerBuffers[j].first                      /*dstBinding*/,
+            0                                            /*dstArrayElement*/,
+            1                                            /*descriptorCount*/,
+            vk::DescriptorType::eStorageBuffer           /*descriptorType*/,
+            nullptr                                      /*pImageInfo*/,
+            &samplerBufferDescriptors[j]                 /*pBufferInfo*/,
+            nullptr                                      /*pTexelBufferView*/
+         );
+      }
+
+      // compute ray tracing has BVHs instead of the TLAS
+      std::array<vk::DescriptorBufferInfo, 3> bvhBufferDescriptors;
+      if (m_RayTracerSettings.IsComputeRayTracing) {
+         const std::array<std::pair<uint32_t, vk::Buffer>, 3> bvhBuffers = {{
+            {BINDING_BVHNODES,      m_BVHNodeBuffer->m_Buffer},
+            {BINDING_BVHPRIMITIVES, m_BVHPrimitiveBuffer->m_Buffer},
+            {BINDING_BVHINSTANCES,  m_BVHInstanceBuffer->m_Buffer}
+         }};
+         for (size_t j = 0; j < bvhBuffers.size(); ++j) {
+            bvhBufferDescriptors[j] = {bvhBuffers[j].second, 0, VK_WHOLE_SIZE};
+            writeDescriptorSets.emplace_back(
+               m_DescriptorSets[i]                          /*dstSet*/,
+               bvhBuffers[j].first                          /*dstBinding*/,
+               0                                            /*dstArrayElement*/,
+               1                                            /*descriptorCount*/,
+               vk::DescriptorType::eStorageBuffer           /*descriptorType*/,
+               nullptr                                      /*pImageInfo*/,
+               &bvhBufferDescriptors[j]                     /*pBufferInfo*/,
+               nullptr                                      /*pTexelBufferView*/
+            );
+         }
+      } else {
+         writeDescriptorSets.push_back(accelerationStructureWrite);
+      }
+
+      // (i)th descriptor set's queue stats go alongside its ray counters.  See CreateRayCountBuffer()
+      std::array<vk::DescriptorBufferInfo, 3> wavefrontBufferDescriptors;
+      if (m_RayTracerSettings.IsWavefrontPathTracing) {
+         const std::array<uint32_t, 3> wavefrontBindings = {BINDING_PATHSTATES, BINDING_RAYQUEUES, BINDING_QUEUESTATS};
+         wavefrontBufferDescriptors = {{
+            {m_PathStateBuffer->m_Buffer, 0, VK_WHOLE_SIZE},
+            {m_RayQueueBuffer->m_Buffer,  0, VK_WHOLE_SIZE},
+            {m_RayCountBuffer->m_Buffer,  i * m_RayCountStride + m_QueueStatsOffset, sizeof(QueueStats)}
+         }};
+         for (size_t j = 0; j < wavefrontBindings.size(); ++j) {
+            writeDescriptorSets.emplace_back(
+               m_DescriptorSets[i]                          /*dstSet*/,
+               wavefrontBindings[j]                         /*dstBinding*/,
+               0                                            /*dstArrayElement*/,
+               1                                            /*descriptorCount*/,
+               vk::DescriptorType::eStorageBuffer           /*descriptorType*/,
+               nullptr                                      /*pImageInfo*/,
+               &wavefrontBufferDescriptors[j]               /*pBufferInfo*/,
+               nullptr                                      /*pTexelBufferView*/
+            );
+         }
+      }
+
       m_Device.updateDescriptorSets(writeDescriptorSets, nullptr);
    }
 }
@@ -1852,36 +3107,27 @@ void RayTracer::RecordCommandBuffers() {
       1                                 /*layerCount*/
    };
 
-   // TODO: You probably don't actually want these things to be "constants"
-   //       all of them are things that you might want to be able to change
-   //       (without re-recording the entire command buffer)
-   //       Could just shove them into the uniform buffer object instead.
-   Constants constants = {
-      3                           /*min ray bounces*/,
-      64                          /*max ray bounces*/,
-      0.0                         /*lens aperture            DISABLED IN RAYGEN SHADER*/,
-      800.0                       /*lens focal length        DISABLED IN RAYGEN SHADER*/
-   };
-
    const uint32_t handleSizeAligned = Vulkan::AlignedSize(m_RayTracingPipelineProperties.shaderGroupHandleSize, m_RayTracingPipelineProperties.shaderGroupBaseAlignment);
 
-   vk::DeviceAddress deviceAddress = m_ShaderBindingTable->GetBufferDeviceAddress();
+   // (no shader binding table for compute ray tracing)
+   vk::DeviceAddress deviceAddress = m_PipelineVariant->m_ShaderBindingTable ? m_PipelineVariant->m_ShaderBindingTable->GetBufferDeviceAddress() : 0;
    const vk::StridedDeviceAddressRegionKHR raygenShaderBindingTable = {
-      deviceAddress + (handleSizeAligned * EShaderHitGroup::eRayGenGroup),
+      deviceAddress + (handleSizeAligned * EShaderGroup::eRayGenGroup),
       handleSizeAligned         /*stride*/,
       handleSizeAligned * 1     /*size*/
    };
 
+   // miss index 0 is eMissGroup, 1 is eShadowMissGroup
    const vk::StridedDeviceAddressRegionKHR missShaderBindingTable = {
-      deviceAddress + (handleSizeAligned * EShaderHitGroup::eMissGroup),
+      deviceAddress + (handleSizeAligned * EShaderGroup::eMissGroup),
       handleSizeAligned         /*stride*/,
-      handleSizeAligned * 1     /*size*/
+      handleSizeAligned * 2     /*size*/
    };
 
    const vk::StridedDeviceAddressRegionKHR hitShaderBindingTable = {
-      deviceAddress + (handleSizeAligned * EShaderHitGroup::eFirstHitGroup),
-      handleSizeAligned         /*stride*/,
-      handleSizeAligned * 3     /*size*/
+      deviceAddress + (handleSizeAligned * EShaderGroup::eFirstHitGroup),
+      handleSizeAligned                                                /*stride*/,
+      handleSizeAligned * static_cast<uint32_t>(m_HitRecords.size())   /*size*/
    };
 
    const vk::StridedDeviceAddressRegionKHR callableShaderBindingTable = {};
@@ -1889,17 +3135,122 @@ void RayTracer::RecordCommandBuffers() {
    for (uint32_t i = 0; i < m_CommandBuffers.size(); ++i) {
       vk::CommandBuffer& commandBuffer = m_CommandBuffers[i];
       commandBuffer.begin(commandBufferBI);
-      commandBuffer.pushConstants<Constants>(m_PipelineLayout, vk::ShaderStageFlagBits::eRaygenKHR, 0, constants);
-      commandBuffer.bindPipeline(vk::PipelineBindPoint::eRayTracingKHR, m_Pipeline);
-      commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eRayTracingKHR, m_PipelineLayout, 0, m_DescriptorSets[i], nullptr);  // (i)th command buffer is bound to the (i)th descriptor set
-
-      commandBuffer.traceRaysKHR(
-         raygenShaderBindingTable,
-         missShaderBindingTable,
-         hitShaderBindingTable,
-         callableShaderBindingTable,
-         m_Extent.width, m_Extent.height, 1
-      );
+      m_Profiler->BeginCommandBuffer(commandBuffer, i);
+      if (m_RayTracerSettings.IsWavefrontPathTracing) {
+         RecordWavefrontPathTracing(commandBuffer, i);
+      } else if (m_RayTracerSettings.IsComputeRayTracing) {
+         commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_PipelineVariant->m_Pipeline);
+         commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_PipelineLayout, 0, m_DescriptorSets[i], m_UniformBuffer->GetFrameOffset(i));
+
+         // 8x8 local size (see RayTrace.comp)
+         uint32_t traceRaysScope = m_Profiler->BeginGPUScope(commandBuffer, i, "TraceRays");
+         commandBuffer.dispatch((m_Extent.width + 7) / 8, (m_Extent.height + 7) / 8, 1);
+         m_Profiler->EndGPUScope(commandBuffer, i, traceRaysScope);
+      } else {
+         if (m_AnimatedInstance != sm_NoInstance) {
+            // (TLAS is refit to wherever the instances are when this command buffer is submitted)
+            uint32_t refitScope = m_Profiler->BeginGPUScope(commandBuffer, i, "RefitTLAS");
+            RecordTopLevelAccelerationStructureUpdate(commandBuffer, i);
+            m_Profiler->EndGPUScope(commandBuffer, i, refitScope);
+         }
+
+         commandBuffer.bindPipeline(vk::PipelineBindPoint::eRayTracingKHR, m_PipelineVariant->m_Pipeline);
+         commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eRayTracingKHR, m_PipelineLayout, 0, m_DescriptorSets[i], m_UniformBuffer->GetFrameOffset(i));  // (i)th command buffer is bound to the (i)th descriptor set, and the (i)th slice of the uniform buffer
+
+         uint32_t traceRaysScope = m_Profiler->BeginGPUScope(commandBuffer, i, "TraceRays");
+         commandBuffer.traceRaysKHR(
+            raygenShaderBindingTable,
+            missShaderBindingTable,
+            hitShaderBindingTable,
+            callableShaderBindingTable,
+            m_Extent.width, m_Extent.height, 1
+         );
+         m_Profiler->EndGPUScope(commandBuffer, i, traceRaysScope);
+      }
+
+      if (m_ReprojectPipeline) {
+         // Carry accumulated samples over from the previous frame's camera (does nothing unless the camera moved, see Reproject.comp)
+         vk::MemoryBarrier tracedBarrier = {
+            vk::AccessFlagBits::eShaderWrite   /*srcAccessMask*/,
+            vk::AccessFlagBits::eShaderRead    /*dstAccessMask*/
+         };
+         commandBuffer.pipelineBarrier(m_RayTracerSettings.IsComputeRayTracing ? vk::PipelineStageFlagBits::eComputeShader : vk::PipelineStageFlagBits::eRayTracingShaderKHR, vk::PipelineStageFlagBits::eComputeShader, {}, tracedBarrier, nullptr, nullptr);
+
+         commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_ReprojectPipeline);
+         commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_PipelineLayout, 0, m_DescriptorSets[i], m_UniformBuffer->GetFrameOffset(i));
+
+         // 8x8 local size (see Reproject.comp)
+         uint32_t reprojectScope = m_Profiler->BeginGPUScope(commandBuffer, i, "Reproject");
+         commandBuffer.dispatch((m_Extent.width + 7) / 8, (m_Extent.height + 7) / 8, 1);
+         m_Profiler->EndGPUScope(commandBuffer, i, reprojectScope);
+
+         // accumulation and output images are read by the passes that follow (and the copy to the swapchain)
+         vk::MemoryBarrier reprojectedBarrier = {
+            vk::AccessFlagBits::eShaderWrite                                        /*srcAccessMask*/,
+            vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eTransferRead     /*dstAccessMask*/
+         };
+         commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eAllCommands, {}, reprojectedBarrier, nullptr, nullptr);
+      }
+
+      if (m_AdaptiveSamplingPipeline) {
+         // Which pixels get sampled next frame, from the moments that this frame's samples were just added to
+         vk::MemoryBarrier tracedBarrier = {
+            vk::AccessFlagBits::eShaderWrite   /*srcAccessMask*/,
+            vk::AccessFlagBits::eShaderRead    /*dstAccessMask*/
+         };
+         commandBuffer.pipelineBarrier(m_RayTracerSettings.IsComputeRayTracing ? vk::PipelineStageFlagBits::eComputeShader : vk::PipelineStageFlagBits::eRayTracingShaderKHR, vk::PipelineStageFlagBits::eComputeShader, {}, tracedBarrier, nullptr, nullptr);
+
+         commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_AdaptiveSamplingPipeline);
+         commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_PipelineLayout, 0, m_DescriptorSets[i], m_UniformBuffer->GetFrameOffset(i));
+
+         // 8x8 local size (see AdaptiveSampling.comp)
+         uint32_t adaptiveSamplingScope = m_Profiler->BeginGPUScope(commandBuffer, i, "AdaptiveSampling");
+         commandBuffer.dispatch((m_Extent.width + 7) / 8, (m_Extent.height + 7) / 8, 1);
+         m_Profiler->EndGPUScope(commandBuffer, i, adaptiveSamplingScope);
+
+         // sample mask is read by the next frame's ray tracing
+         vk::MemoryBarrier maskBarrier = {
+            vk::AccessFlagBits::eShaderWrite   /*srcAccessMask*/,
+            vk::AccessFlagBits::eShaderRead    /*dstAccessMask*/
+         };
+         commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eAllCommands, {}, maskBarrier, nullptr, nullptr);
+      }
+
+      if (m_DenoisePipeline) {
+         // Denoise this frame's accumulated image into the output image, over the top of what the ray tracing wrote there
+         vk::MemoryBarrier tracedBarrier = {
+            vk::AccessFlagBits::eShaderWrite   /*srcAccessMask*/,
+            vk::AccessFlagBits::eShaderRead    /*dstAccessMask*/
+         };
+         commandBuffer.pipelineBarrier(m_RayTracerSettings.IsComputeRayTracing ? vk::PipelineStageFlagBits::eComputeShader : vk::PipelineStageFlagBits::eRayTracingShaderKHR, vk::PipelineStageFlagBits::eComputeShader, {}, tracedBarrier, nullptr, nullptr);
+
+         commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_DenoisePipeline);
+         commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_DenoisePipelineLayout, 0, m_DescriptorSets[i], m_UniformBuffer->GetFrameOffset(i));
+
+         // each pass reads what the one before it wrote.  8x8 local size (see Denoise.comp)
+         uint32_t denoiseScope = m_Profiler->BeginGPUScope(commandBuffer, i, "Denoise");
+         for (uint32_t iteration = 0; iteration < m_RayTracerSettings.DenoiseIterations; ++iteration) {
+            if (iteration > 0) {
+               vk::MemoryBarrier passBarrier = {
+                  vk::AccessFlagBits::eShaderWrite   /*srcAccessMask*/,
+                  vk::AccessFlagBits::eShaderRead    /*dstAccessMask*/
+               };
+               commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, passBarrier, nullptr, nullptr);
+            }
+            commandBuffer.pushConstants<DenoiseConstants>(m_DenoisePipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, DenoiseConstants {iteration});
+            commandBuffer.dispatch((m_Extent.width + 7) / 8, (m_Extent.height + 7) / 8, 1);
+         }
+         m_Profiler->EndGPUScope(commandBuffer, i, denoiseScope);
+
+         // output image is copied to the swapchain next
+         vk::MemoryBarrier denoisedBarrier = {
+            vk::AccessFlagBits::eShaderWrite   /*srcAccessMask*/,
+            vk::AccessFlagBits::eTransferRead  /*dstAccessMask*/
+         };
+         commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, {}, denoisedBarrier, nullptr, nullptr);
+      }
+
+      uint32_t copyScope = m_Profiler->BeginGPUScope(commandBuffer, i, "CopyOutputImage");
 
       vk::ImageMemoryBarrier barrier = {
          {}                                    /*srcAccessMask*/,
@@ -1938,7 +3289,7 @@ void RayTracer::RecordCommandBuffers() {
          vk::AccessFlagBits::eTransferWrite    /*srcAccessMask*/,
          {}                                    /*dstAccessMask*/,
          vk::ImageLayout::eTransferDstOptimal  /*oldLayout*/,
-         vk::ImageLayout::ePresentSrcKHR       /*newLayout*/,
+         m_PresentLayout                       /*newLayout*/,
          VK_QUEUE_FAMILY_IGNORED               /*srcQueueFamilyIndex*/,
          VK_QUEUE_FAMILY_IGNORED               /*dstQueueFamilyIndex*/,
          m_SwapChainImages[i].m_Image          /*image*/,
@@ -1958,23 +3309,124 @@ void RayTracer::RecordCommandBuffers() {
       };
       commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands, {}, nullptr, nullptr, barrier);
 
+      m_Profiler->EndGPUScope(commandBuffer, i, copyScope);
+
+      // ray count is read on the host once the command buffer has completed.  See CollectRayCount()
+      vk::MemoryBarrier rayCountBarrier = {
+         vk::AccessFlagBits::eShaderWrite   /*srcAccessMask*/,
+         vk::AccessFlagBits::eHostRead      /*dstAccessMask*/
+      };
+      commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eHost, {}, rayCountBarrier, nullptr, nullptr);
+
       commandBuffer.end();
    }
 }
 
 
+void RayTracer::RecordWavefrontPathTracing(vk::CommandBuffer commandBuffer, const uint32_t commandBufferIndex) {
+   const uint32_t pathCount = m_Extent.width * m_Extent.height;
+
+   // kernel's push constants: bounce, the queue that it takes paths from, and pathCount (for where each queue's entries are)
+   auto setQueue = [&] (const uint32_t bounce, const uint32_t queue) {
+      commandBuffer.pushConstants<WavefrontConstants>(m_WavefrontPipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, WavefrontConstants {bounce, queue, pathCount});
+   };
+
+   // dispatch of the kernel for a queue is as many workgroups as the kernels before it put into it
+   auto dispatchQueue = [&] (const uint32_t queue) {
+      commandBuffer.dispatchIndirect(m_RayQueueBuffer->m_Buffer, queue * sizeof(RayQueue));
+   };
+
+   // each kernel reads the path states and queues that the one before it wrote (including the queue headers, as indirect dispatch arguments)
+   auto kernelBarrier = [&] () {
+      vk::MemoryBarrier barrier = {
+         vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite                                           /*srcAccessMask*/,
+         vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eIndirectCommandRead  /*dstAccessMask*/
+      };
+      commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect, {}, barrier, nullptr, nullptr);
+   };
+
+   // empties queues (first..first+count-1).  Waits for anything that was still reading them
+   auto clearQueues = [&] (const uint32_t first, const uint32_t count) {
+      vk::MemoryBarrier barrier = {
+         vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eIndirectCommandRead  /*srcAccessMask*/,
+         vk::AccessFlagBits::eTransferWrite                                                                              /*dstAccessMask*/
+      };
+      commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect, vk::PipelineStageFlagBits::eTransfer, {}, barrier, nullptr, nullptr);
+      const std::vector<RayQueue> emptyQueues(count, RayQueue {0, 1, 1, 0});
+      commandBuffer.updateBuffer(m_RayQueueBuffer->m_Buffer, first * sizeof(RayQueue), count * sizeof(RayQueue), emptyQueues.data());
+   };
+
+   commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_WavefrontPipelineLayout, 0, m_DescriptorSets[commandBufferIndex], m_UniformBuffer->GetFrameOffset(commandBufferIndex));
+
+   // (same name as the other ray tracing modes' scope, so that they can be compared.  Queue stats say where the time goes within it)
+   uint32_t traceRaysScope = m_Profiler->BeginGPUScope(commandBuffer, commandBufferIndex, "TraceRays");
+
+   clearQueues(0, QUEUE_COUNT);
+   kernelBarrier();
+
+   // 8x8 local size (see WavefrontGenerate.comp)
+   commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_PipelineVariant->m_WavefrontGeneratePipeline);
+   setQueue(0, QUEUE_EXTEND);
+   commandBuffer.dispatch((m_Extent.width + 7) / 8, (m_Extent.height + 7) / 8, 1);
+
+   // Every bounce up to the most that any quality preset allows is recorded (so that changing preset does not need a re-record), but once
+   // paths have all finished, their queues are empty and the dispatches have no workgroups
+   const uint32_t maxRayBounces = std::max_element(sm_QualityPresets.begin(), sm_QualityPresets.end(), [](const QualityPreset& a, const QualityPreset& b) { return a.m_MaxRayBounces < b.m_MaxRayBounces; })->m_MaxRayBounces;
+   for (uint32_t bounce = 0; bounce <= maxRayBounces; ++bounce) {
+      const uint32_t extendQueue = QUEUE_EXTEND + (bounce & 1);
+      const uint32_t nextExtendQueue = QUEUE_EXTEND + ((bounce + 1) & 1);
+      if (bounce > 0) {
+         // (all of them are already empty for the first bounce)
+         clearQueues(nextExtendQueue, 1);
+         clearQueues(QUEUE_SHADE, QUEUE_SHADECOUNT + 1);   // shade queues, and the shadow queue after them
+      }
+      kernelBarrier();
+
+      commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_PipelineVariant->m_WavefrontExtendPipeline);
+      setQueue(bounce, extendQueue);
+      dispatchQueue(extendQueue);
+      kernelBarrier();
+
+      // one material per dispatch (with the shade kernel for that material).  They take from (and add to) different queues, so there is no need for barriers in between
+      for (uint32_t material = 0; material < QUEUE_SHADECOUNT; ++material) {
+         commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_PipelineVariant->m_WavefrontShadePipelines[material]);
+         setQueue(bounce, QUEUE_SHADE + material);
+         dispatchQueue(QUEUE_SHADE + material);
+      }
+      kernelBarrier();
+
+      commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_PipelineVariant->m_WavefrontShadowPipeline);
+      setQueue(bounce, QUEUE_SHADOW);
+      dispatchQueue(QUEUE_SHADOW);
+   }
+   kernelBarrier();
+
+   // 8x8 local size (see WavefrontAccumulate.comp)
+   commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_PipelineVariant->m_WavefrontAccumulatePipeline);
+   commandBuffer.dispatch((m_Extent.width + 7) / 8, (m_Extent.height + 7) / 8, 1);
+
+   m_Profiler->EndGPUScope(commandBuffer, commandBufferIndex, traceRaysScope);
+}
+
+
 void RayTracer::Update(double deltaTime) {
    __super::Update(deltaTime);
 
-   if (
-      (glfwGetKey(m_Window, GLFW_KEY_W) == GLFW_PRESS) ||
-      (glfwGetKey(m_Window, GLFW_KEY_A) == GLFW_PRESS) ||
-      (glfwGetKey(m_Window, GLFW_KEY_S) == GLFW_PRESS) ||
-      (glfwGetKey(m_Window, GLFW_KEY_D) == GLFW_PRESS) ||
-      (glfwGetKey(m_Window, GLFW_KEY_R) == GLFW_PRESS) ||
-      (glfwGetKey(m_Window, GLFW_KEY_F) == GLFW_PRESS) ||
-      m_LeftMouseDown
-   ) {
+   // Animated instance circles around where it started, at one radian per second.  Transform is row major, so translation is the last column
+   const bool isSceneMoved = (m_AnimatedInstance != sm_NoInstance);
+   if (isSceneMoved) {
+      m_AnimationTime += deltaTime;
+      const float angle = static_cast<float>(m_AnimationTime);
+      glm::mat3x4 transform = m_AnimatedInstanceTransform;
+      transform[0][3] += m_AnimationRadius * (std::cos(angle) - 1.0f);
+      transform[2][3] += m_AnimationRadius * std::sin(angle);
+      SetInstanceTransform(m_AnimatedInstance, transform);
+   }
+
+   // With temporal reprojection, what has been accumulated so far is carried over to the new camera (rather than just thrown away).
+   // Not if anything in the scene has moved though: reprojection only knows about the camera
+   m_IsReprojecting = (m_RayTracerSettings.TemporalHistoryLength > 0) && m_IsCameraMoved && !isSceneMoved && (m_AccumulatedImageCount > 0) && m_Scene.GetAccumulateFrames();
+   if (m_IsCameraMoved || isSceneMoved) {
       m_AccumulatedImageCount = 0;
    }
    if (!m_Scene.GetAccumulateFrames()) {
@@ -1984,32 +3436,374 @@ void RayTracer::Update(double deltaTime) {
 }
 
 
-void RayTracer::RenderFrame() {
+void RayTracer::OnKey(const int key, const int scancode, const int action, const int mods) {
+   __super::OnKey(key, scancode, action, mods);
+
+   // (benchmarks have to render the same way from start to finish)
+   if (m_Settings.IsBenchmark || (action != GLFW_PRESS)) {
+      return;
+   }
+
+   switch (key) {
+      case GLFW_KEY_1:
+      case GLFW_KEY_2:
+      case GLFW_KEY_3:
+         // uniform buffer object only, but samples so far were taken with the other preset
+         m_QualityPreset = static_cast<uint32_t>(key - GLFW_KEY_1);
+         m_AccumulatedImageCount = 0;
+         LOG_INFO("Quality preset: {0}", sm_QualityPresets[m_QualityPreset].m_Name);
+         break;
+      case GLFW_KEY_T:
+         // tonemapping is applied to the accumulated image, so nothing needs to start again
+         m_TonemapOperator = (m_TonemapOperator + 1) % static_cast<uint32_t>(sm_TonemapOperatorNames.size());
+         LOG_INFO("Tonemap operator: {0}", sm_TonemapOperatorNames[m_TonemapOperator]);
+         break;
+      case GLFW_KEY_B:
+         if (!m_Scene.GetSkyboxTextureFileName().empty()) {
+            SetSpecialization({m_Specialization.m_UseSkybox ? 0u : 1u});
+            LOG_INFO("Skybox: {0}", m_Specialization.m_UseSkybox ? "on" : "off");
+         }
+         break;
+   }
+}
+
 
-   glm::mat4 projection = glm::perspective(m_FoVRadians, static_cast<float>(m_Extent.width) / static_cast<float>(m_Extent.height), 0.01f, 100.0f);
+UniformBufferObject RayTracer::GetUniformBufferObject(const uint32_t width, const uint32_t height) const {
+   glm::mat4 projection = glm::perspective(m_FoVRadians, static_cast<float>(width) / static_cast<float>(height), 0.01f, 100.0f);
    // flip y axis for vulkan
    projection[1][1] *= -1;
    glm::mat4 modelView = glm::lookAt(m_Eye, m_Eye + glm::normalize(m_Direction), m_Up);
 
-   UniformBufferObject ubo = {
+   return UniformBufferObject {
       glm::inverse(modelView),
       glm::inverse(projection),
+      m_PreviousViewProjection,
       glm::vec4{m_Scene.GetHorizonColor(), 0.0f},
       glm::vec4{m_Scene.GetZenithColor(), 0.0f},
-      m_Scene.GetSkyboxTextureFileName().empty()? 0u : 1u,
-      m_AccumulatedImageCount
+      m_AccumulatedImageCount,
+      m_FrameNumber,
+      m_LightCount,
+      m_TotalLightPower,
+      m_RayTracerSettings.AdaptiveSamplingThreshold,
+      sm_AdaptiveMinSamples,
+      m_RayTracerSettings.DenoiseIterations,
+      m_RayTracerSettings.TemporalHistoryLength,
+      m_IsReprojecting ? 1u : 0u,
+      m_SamplerType,
+      sm_QualityPresets[m_QualityPreset].m_MinRayBounces,
+      sm_QualityPresets[m_QualityPreset].m_MaxRayBounces,
+      m_LensAperture,
+      m_LensFocalLength,
+      m_TonemapOperator
    };
+}
+
+
+// Root mean square error (over RGB, in [0, 1]) of RGBA8 pixels against the given image file.  Negative if the file cannot be compared
+static double ImageError(const uint8_t* pixels, const uint32_t width, const uint32_t height, const char* referenceImageFileName) {
+   int referenceWidth;
+   int referenceHeight;
+   int referenceChannels;
+   stbi_uc* reference = stbi_load(referenceImageFileName, &referenceWidth, &referenceHeight, &referenceChannels, STBI_rgb_alpha);
+   if (!reference) {
+      LOG_ERROR("failed to load reference image '{0}'", referenceImageFileName);
+      return -1.0;
+   }
+   if ((referenceWidth != static_cast<int>(width)) || (referenceHeight != static_cast<int>(height))) {
+      LOG_ERROR("reference image '{0}' is {1}x{2}, but output image is {3}x{4}", referenceImageFileName, referenceWidth, referenceHeight, width, height);
+      stbi_image_free(reference);
+      return -1.0;
+   }
+
+   double sumSquaredError = 0.0;
+   const size_t pixelCount = static_cast<size_t>(width) * height;
+   for (size_t i = 0; i < pixelCount; ++i) {
+      for (size_t c = 0; c < 3; ++c) {
+         const double error = (static_cast<double>(pixels[i * 4 + c]) - reference[i * 4 + c]) / 255.0;
+         sumSquaredError += error * error;
+      }
+   }
+   stbi_image_free(reference);
+   return std::sqrt(sumSquaredError / (pixelCount * 3));
+}
+
+
+void RayTracer::Run() {
+   if (!m_CPURenderer) {
+      if (m_RayTracerSettings.IsSamplerComparison) {
+         RunSamplerComparison();
+         return;
+      }
+      if ((m_Settings.IsHeadless || m_Settings.IsBenchmark) && (m_RayTracerSettings.TimeLimit > 0.0)) {
+         // (as Vulkan::Application::Run() does, but for as long as the time limit rather than a number of frames)
+         CompleteStartup();
+         RunFixedFrameCount(m_RayTracerSettings.TimeLimit);
+      } else {
+         Vulkan::Application::Run();
+      }
+      if (m_RayTracerSettings.IsWavefrontPathTracing) {
+         ReportQueueOccupancy();
+      }
+      return;
+   }
+
+   const uint32_t frameCount = (m_Settings.SamplesPerPixel > 0) ? m_Settings.SamplesPerPixel : m_Settings.FrameCount;
+   if (m_RayTracerSettings.TimeLimit > 0.0) {
+      LOG_INFO("Rendering for {0:.1f}s at {1}x{2} on the CPU", m_RayTracerSettings.TimeLimit, m_Settings.WindowWidth, m_Settings.WindowHeight);
+   } else {
+      LOG_INFO("Rendering {0} frames at {1}x{2} on the CPU", frameCount, m_Settings.WindowWidth, m_Settings.WindowHeight);
+   }
+   auto startTime = std::chrono::steady_clock::now();
+   uint32_t framesRendered = 0;
+   for (uint32_t frame = 0; (m_RayTracerSettings.TimeLimit > 0.0) || (frame < frameCount); ++frame) {
+      if ((m_RayTracerSettings.TimeLimit > 0.0) && (std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count() >= m_RayTracerSettings.TimeLimit)) {
+         break;
+      }
+      m_AccumulatedImageCount = m_Scene.GetAccumulateFrames() ? m_AccumulatedImageCount + 1 : 1;
+      m_CPURenderer->RenderFrame(GetUniformBufferObject(m_Settings.WindowWidth, m_Settings.WindowHeight));
+      ++framesRendered;
+   }
+   std::chrono::duration<double> renderTime = std::chrono::steady_clock::now() - startTime;
+   const double samples = static_cast<double>(m_Settings.WindowWidth) * m_Settings.WindowHeight * framesRendered;
+   LOG_INFO("CPU render of {0} frames took {1:.1f}s ({2:.2f} Msamples/s, {3:.2f} Mrays/s)", framesRendered, renderTime.count(), samples / renderTime.count() / 1e6, m_CPURenderer->GetRayCount() / renderTime.count() / 1e6);
+   if (m_RayTracerSettings.ReferenceImageFileName) {
+      const double imageError = ImageError(m_CPURenderer->GetOutputImage().data(), m_Settings.WindowWidth, m_Settings.WindowHeight, m_RayTracerSettings.ReferenceImageFileName);
+      if (imageError >= 0.0) {
+         LOG_INFO("RMSE vs. reference image '{0}': {1:.6f}", m_RayTracerSettings.ReferenceImageFileName, imageError);
+      }
+   }
+   m_CPURenderer->WriteOutputImage(m_RayTracerSettings.OutputImageFileName);
+}
+
+
+void RayTracer::RunSamplerComparison() {
+   // Each sampler starts accumulating from scratch with the same camera, so the only difference between them is where the samples go.
+   // RMSE is logged at every power of two samples per pixel (and at the end), for error vs. spp curves
+   if (!m_RayTracerSettings.ReferenceImageFileName) {
+      throw std::runtime_error("sampler comparison needs a reference image (--reference)");
+   }
+   FlushUploads();
+
+   const uint32_t samplesPerPixel = (m_Settings.SamplesPerPixel > 0) ? m_Settings.SamplesPerPixel : m_Settings.FrameCount;
+   LOG_INFO("Comparing samplers at up to {0} samples per pixel, against reference image '{1}'", samplesPerPixel, m_RayTracerSettings.ReferenceImageFileName);
+   for (uint32_t samplerType = 0; samplerType < sm_SamplerNames.size(); ++samplerType) {
+      m_SamplerType = samplerType;
+      m_AccumulatedImageCount = 0;
+      for (uint32_t spp = 1; spp <= samplesPerPixel; ++spp) {
+         if (m_Window) {
+            glfwPollEvents();
+         }
+         Update(0.0);
+         RenderFrame();
+         if (((spp & (spp - 1)) == 0) || (spp == samplesPerPixel)) {
+            m_Device.waitIdle();
+            const double imageError = GetOutputImageError();
+            if (imageError < 0.0) {
+               return;
+            }
+            LOG_INFO("Sampler {0}: {1} spp, RMSE {2:.6f}", sm_SamplerNames[samplerType], spp, imageError);
+         }
+      }
+   }
+   m_Device.waitIdle();
+}
+
+
+void RayTracer::RenderFrame() {
+
+   UniformBufferObject ubo = GetUniformBufferObject(m_Extent.width, m_Extent.height);
 
    // All the rendering instructions are in pre-recorded command buffer (which gets submitted to the GPU in EndFrame()).  All we have to do here is update the uniform buffer.
    BeginFrame();
-   m_UniformBuffers[m_CurrentImage].CopyFromHost(0, sizeof(UniformBufferObject), &ubo);
+   CollectRayCount(m_CurrentImage);
+   m_UniformBuffer->BeginFrame(m_CurrentImage);
+   m_UniformBuffer->Push(ubo);
    EndFrame();
+
+   // (for temporal reprojection, next frame)
+   m_PreviousViewProjection = glm::inverse(ubo.viewInverse * ubo.projInverse);
+   ++m_FrameNumber;
+
+   if (m_AdaptiveSamplingPipeline) {
+      ReportActivePixels();
+   }
+}
+
+
+void RayTracer::ReportActivePixels() {
+   if (m_ActivePixelCount == sm_NoPixelCount) {
+      return;
+   }
+
+   // In the window title every frame.  Logged whenever it changes by a whole percent (so that headless runs report it too, without a line per frame)
+   const double activeFraction = static_cast<double>(m_ActivePixelCount) / (static_cast<double>(m_Extent.width) * m_Extent.height);
+   if (m_Window) {
+      char title[256];
+      snprintf(title, sizeof(title), "%s - %.1f%% of pixels active", m_Settings.ApplicationName, activeFraction * 100.0);
+      glfwSetWindowTitle(m_Window, title);
+   }
+   const int activePercent = static_cast<int>(activeFraction * 100.0);
+   if (activePercent != m_ReportedActivePercent) {
+      LOG_INFO("Adaptive sampling: {0:.1f}% of pixels active", activeFraction * 100.0);
+      m_ReportedActivePercent = activePercent;
+   }
+}
+
+
+void RayTracer::ReportQueueOccupancy() {
+   // (device is idle once Run() is done, so every command buffer's stats can be collected)
+   GetRayCount();
+   if (m_FrameNumber == 0) {
+      return;
+   }
+
+   static constexpr std::array<const char*, QUEUE_SHADECOUNT> materialNames = {"lambertian", "phong", "metallic", "dielectric", "light", "smoke"};  // indexed by MATERIAL_XXX
+   auto report = [this] (const std::string& name, const uint32_t firstQueue, const uint32_t queueCount) {
+      uint64_t items = 0;
+      uint64_t groups = 0;
+      for (uint32_t queue = firstQueue; queue < firstQueue + queueCount; ++queue) {
+         items += m_QueueItems[queue];
+         groups += m_QueueGroups[queue];
+      }
+      if (groups > 0) {
+         const double utilization = static_cast<double>(items) / (static_cast<double>(groups) * WAVEFRONT_GROUPSIZE);
+         LOG_INFO("   {0:<18} {1:>12.0f} paths/frame, {2:>5.1f}% of invocations busy", name, static_cast<double>(items) / m_FrameNumber, utilization * 100.0);
+      }
+   };
+
+   LOG_INFO("Wavefront queue occupancy over {0} frames:", m_FrameNumber);
+   report("extend", QUEUE_EXTEND, 2);
+   report("shade", QUEUE_SHADE, QUEUE_SHADECOUNT);
+   for (uint32_t material = 0; material < QUEUE_SHADECOUNT; ++material) {
+      report(std::string {"   "} + materialNames[material], QUEUE_SHADE + material, 1);
+   }
+   report("shadow", QUEUE_SHADOW, 1);
+}
+
+
+uint64_t RayTracer::GetRayCount() {
+   if (m_RayCountBuffer) {
+      for (uint32_t i = 0; i < m_CommandBuffers.size(); ++i) {
+         CollectRayCount(i);
+      }
+   }
+   return m_RayCount;
+}
+
+
+double RayTracer::GetOutputImageError() {
+   if (!m_RayTracerSettings.ReferenceImageFileName) {
+      return -1.0;
+   }
+
+   // Read back the output image (which is in general layout, between frames)
+   const vk::DeviceSize size = static_cast<vk::DeviceSize>(m_Extent.width) * m_Extent.height * 4;
+   Vulkan::Buffer readbackBuffer(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+
+   SubmitSingleTimeCommands([this, &readbackBuffer] (vk::CommandBuffer commandBuffer) {
+      vk::ImageSubresourceRange subresourceRange = {
+         vk::ImageAspectFlagBits::eColor   /*aspectMask*/,
+         0                                 /*baseMipLevel*/,
+         1                                 /*levelCount*/,
+         0                                 /*baseArrayLayer*/,
+         1                                 /*layerCount*/
+      };
+
+      vk::ImageMemoryBarrier barrier = {
+         vk::AccessFlagBits::eShaderWrite      /*srcAccessMask*/,
+         vk::AccessFlagBits::eTransferRead     /*dstAccessMask*/,
+         vk::ImageLayout::eGeneral             /*oldLayout*/,
+         vk::ImageLayout::eTransferSrcOptimal  /*newLayout*/,
+         VK_QUEUE_FAMILY_IGNORED               /*srcQueueFamilyIndex*/,
+         VK_QUEUE_FAMILY_IGNORED               /*dstQueueFamilyIndex*/,
+         m_OutputImage->m_Image                /*image*/,
+         subresourceRange
+      };
+      commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eTransfer, {}, nullptr, nullptr, barrier);
+
+      vk::BufferImageCopy copyRegion = {
+         0                                           /*bufferOffset*/,
+         0                                           /*bufferRowLength*/,
+         0                                           /*bufferImageHeight*/,
+         {vk::ImageAspectFlagBits::eColor, 0, 0, 1}  /*imageSubresource*/,
+         {0, 0, 0}                                   /*imageOffset*/,
+         {m_Extent.width, m_Extent.height, 1}        /*imageExtent*/
+      };
+      commandBuffer.copyImageToBuffer(m_OutputImage->m_Image, vk::ImageLayout::eTransferSrcOptimal, readbackBuffer.m_Buffer, copyRegion);
+
+      barrier = {
+         vk::AccessFlagBits::eTransferRead     /*srcAccessMask*/,
+         {}                                    /*dstAccessMask*/,
+         vk::ImageLayout::eTransferSrcOptimal  /*oldLayout*/,
+         vk::ImageLayout::eGeneral             /*newLayout*/,
+         VK_QUEUE_FAMILY_IGNORED               /*srcQueueFamilyIndex*/,
+         VK_QUEUE_FAMILY_IGNORED               /*dstQueueFamilyIndex*/,
+         m_OutputImage->m_Image                /*image*/,
+         subresourceRange
+      };
+      commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands, {}, nullptr, nullptr, barrier);
+
+      vk::BufferMemoryBarrier hostBarrier = {
+         vk::AccessFlagBits::eTransferWrite    /*srcAccessMask*/,
+         vk::AccessFlagBits::eHostRead         /*dstAccessMask*/,
+         VK_QUEUE_FAMILY_IGNORED               /*srcQueueFamilyIndex*/,
+         VK_QUEUE_FAMILY_IGNORED               /*dstQueueFamilyIndex*/,
+         readbackBuffer.m_Buffer               /*buffer*/,
+         0                                     /*offset*/,
+         VK_WHOLE_SIZE                         /*size*/
+      };
+      commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, {}, nullptr, hostBarrier, nullptr);
+   });
+
+   const uint8_t* pData = static_cast<const uint8_t*>(readbackBuffer.m_pMappedData);
+   std::vector<uint8_t> pixels(pData, pData + size);
+
+   // output image has the swap chain's format, which may be BGRA
+   if ((m_Format == vk::Format::eB8G8R8A8Unorm) || (m_Format == vk::Format::eB8G8R8A8Srgb)) {
+      for (size_t i = 0; i < pixels.size(); i += 4) {
+         std::swap(pixels[i], pixels[i + 2]);
+      }
+   }
+   return ImageError(pixels.data(), m_Extent.width, m_Extent.height, m_RayTracerSettings.ReferenceImageFileName);
+}
+
+
+void RayTracer::CollectRayCount(const uint32_t commandBufferIndex) {
+   uint32_t* pRayCount = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(m_RayCountBuffer->m_pMappedData) + commandBufferIndex * m_RayCountStride);
+   m_RayCount += pRayCount[0];
+   pRayCount[0] = 0;
+
+   // Active pixels + 1, so zero only if the command buffer has not run yet (or adaptive sampling is off).  See AdaptiveSampling.comp
+   if (pRayCount[1] > 0) {
+      m_ActivePixelCount = pRayCount[1] - 1;
+      pRayCount[1] = 0;
+   }
+
+   if (m_RayTracerSettings.IsWavefrontPathTracing) {
+      QueueStats* pQueueStats = reinterpret_cast<QueueStats*>(static_cast<uint8_t*>(m_RayCountBuffer->m_pMappedData) + commandBufferIndex * m_RayCountStride + m_QueueStatsOffset);
+      for (uint32_t queue = 0; queue < QUEUE_COUNT; ++queue) {
+         m_QueueItems[queue] += pQueueStats->items[queue];
+         m_QueueGroups[queue] += pQueueStats->groups[queue];
+         pQueueStats->items[queue] = 0;
+         pQueueStats->groups[queue] = 0;
+      }
+   }
 }
 
 
 void RayTracer::OnWindowResized() {
+   // Number of command buffers (and so ray counters, and uniform buffer slices) could change.  Keep what has been counted so far
+   m_Device.waitIdle();
+   GetRayCount();
+
    __super::OnWindowResized();
    DestroyDescriptorSets();
+   DestroyUniformBuffers();
+   CreateUniformBuffers();
+   DestroyRayCountBuffer();
+   CreateRayCountBuffer();
+   DestroyWavefrontBuffers();
+   CreateWavefrontBuffers();
    CreateStorageImages();
    CreateDescriptorSets();
    RecordCommandBuffers();
@@ -1,19 +1,101 @@
 #include "Application.h"
 
 #include "Buffer.h"
+#include "CPURenderer.h"
 #include "Image.h"
+#include "RingBuffer.h"
+#include "SamplerTables.h"
 #include "Scene.h"
+#include "Sphere.h"
 
+#include "Specialization.glsl"
+
+#include <array>
 #include <filesystem>
+#include <map>
 #include <memory>
 
+// Settings that only the ray tracer has (on top of Vulkan::ApplicationSettings).  See RayTracer::ParseCommandLineOption()
+struct RayTracerSettings {
+   bool IsCPURender = false;                 // render FrameCount (or SamplesPerPixel) frames with the CPU reference renderer (no Vulkan device needed), and write the result to OutputImageFileName
+   const char* OutputImageFileName = "output.png";
+   bool IsInstanceFlatteningEnabled = true;  // small instanced models are baked into a merged BLAS where that is estimated to be cheaper to trace
+   bool IsComputeRayTracing = false;         // trace rays in a compute shader (with a BVH built on the CPU) instead of the ray tracing pipeline.  Does not need the ray tracing extensions
+   bool IsNextEventEstimationEnabled = true; // lights are sampled directly at each diffuse bounce (combined with BSDF sampling by multiple importance sampling)
+   double TimeLimit = 0.0;                   // headless, benchmark and CPU render modes: if non-zero, render frames until this many seconds have passed (instead of a fixed number of frames).  For comparing convergence at equal time
+   const char* ReferenceImageFileName = nullptr;  // at the end of a headless, benchmark or CPU render run, the output image is compared with this one (RMSE is logged, and goes in the benchmark report)
+   float AdaptiveSamplingThreshold = 0.0f;   // if non-zero, pixels stop being sampled once their estimated relative error is below this
+   uint32_t DenoiseIterations = 0;           // number of edge-avoiding a-trous wavelet passes run over the accumulated image before it is displayed.  0 = no denoising
+   uint32_t TemporalHistoryLength = 0;       // if non-zero, accumulated samples are reprojected (at most this many per pixel) when the camera moves, instead of being thrown away
+   const char* SamplerName = nullptr;        // which sample generator to use ("random", "sobol" or "bluenoise").  nullptr = "sobol"
+   bool IsSamplerComparison = false;         // instead of a normal run, render with each sample generator in turn up to SamplesPerPixel (or FrameCount) samples per pixel, logging RMSE vs. ReferenceImageFileName as it goes
+   bool IsWavefrontPathTracing = false;      // trace paths as a sequence of smaller kernels (generate, extend, shade per material, shadow, accumulate) that pass rays between them in queues, instead of one kernel per path.  Implies IsComputeRayTracing
+   const char* QualityPresetName = nullptr;  // render quality preset to start with ("draft", "preview" or "final").  nullptr = "final"
+   const char* TonemapOperatorName = nullptr; // how the output image is tonemapped ("exponential", "reinhard" or "aces").  nullptr = "exponential"
+   bool IsAnimationEnabled = false;          // one of the scene's instances moves (see Vulkan::Application::SetInstanceTransform())
+};
+
+
 class RayTracer final : public Vulkan::Application {
 public:
 
    RayTracer(int argc, const char* argv[]);
    ~RayTracer();
 
+   virtual void Run() override;
+
 protected:
+   // Recognised options (as well as those of Vulkan::Application::ParseCommandLine()) are:
+   //    --cpu                 render with the CPU reference renderer (see RayTracerSettings::IsCPURender)
+   //    --output <f>          CPU render: write the output image to file f (default output.png)
+   //    --no-flatten          do not bake small instanced models into merged BLASes (see RayTracerSettings::IsInstanceFlatteningEnabled)
+   //    --compute             trace rays in a compute shader instead of the ray tracing pipeline (see RayTracerSettings::IsComputeRayTracing)
+   //    --no-nee              no next event estimation (see RayTracerSettings::IsNextEventEstimationEnabled)
+   //    --time <s>            headless, benchmark and CPU render modes: render for s seconds (instead of a number of frames)
+   //    --reference <f>       compare the output image with reference image f at the end of the run (or as it goes, with --compare-samplers)
+   //    --adaptive <t>        adaptive sampling, with relative error threshold t (see RayTracerSettings::AdaptiveSamplingThreshold)
+   //    --denoise <n>         denoise with n a-trous wavelet passes
+   //    --temporal <n>        reproject up to n accumulated samples per pixel when the camera moves
+   //    --sampler <name>      sample generator: random, sobol or bluenoise
+   //    --compare-samplers    log RMSE vs. samples per pixel of each sample generator in turn (needs --reference)
+   //    --wavefront           wavefront path tracing (see RayTracerSettings::IsWavefrontPathTracing).  Implies --compute
+   //    --quality <name>      quality preset to start with: draft, preview or final
+   //    --tonemap <name>      tonemapping operator: exponential, reinhard or aces
+   //    --animate             move one of the scene's instances
+   virtual bool ParseCommandLineOption(const int argc, const char* argv[], int& i) override;
+
+   // Values that the path tracing pipelines are compiled for (specialization constants, see Specialization.glsl), as opposed to those in
+   // the uniform buffer object.  Changing them means changing to another pipeline variant, and re-recording the command buffers (which
+   // is why quality preset values such as the ray bounce counts are not in here)
+   struct Specialization {
+      uint32_t m_UseSkybox;
+
+      // Values of all SPECIALIZATION_XXX constants, for a shader that is specialized for the given material type (or not, MATERIAL_ANY)
+      std::array<uint32_t, SPECIALIZATION_COUNT> GetValues(const uint32_t materialType = MATERIAL_ANY) const;
+
+      bool operator<(const Specialization& other) const { return m_UseSkybox < other.m_UseSkybox; }
+   };
+
+   // Path tracing pipelines compiled for one Specialization.  Which of them there are depends on settings: the ray tracing pipeline and
+   // its shader binding table, RayTrace.comp (also m_Pipeline), or the wavefront kernels
+   struct PipelineVariant {
+      vk::Pipeline m_Pipeline;
+      std::unique_ptr<Vulkan::Buffer> m_ShaderBindingTable;
+      vk::Pipeline m_WavefrontGeneratePipeline;
+      vk::Pipeline m_WavefrontExtendPipeline;
+      std::vector<vk::Pipeline> m_WavefrontShadePipelines;    // one per shade queue (QUEUE_SHADE + MATERIAL_XXX), specialized for that material as well
+      vk::Pipeline m_WavefrontShadowPipeline;
+      vk::Pipeline m_WavefrontAccumulatePipeline;
+   };
+
+   // Render quality presets.  Their values are all in the uniform buffer object, so changing preset does not need anything to be
+   // re-recorded or recompiled
+   struct QualityPreset {
+      const char* m_Name;
+      uint32_t m_MinRayBounces;   // russian roulette starts after this many bounces
+      uint32_t m_MaxRayBounces;
+   };
+
    virtual void Init() override;
 
    virtual std::vector<const char*> GetRequiredInstanceExtensions() override;
@@ -23,6 +105,10 @@ protected:
 
    void CreateScene();
 
+   // Usage of the vertex, index and AABB buffers.  They only need device addresses to be acceleration structure build inputs, which
+   // compute ray tracing does not have (nor, necessarily, the bufferDeviceAddress feature)
+   vk::BufferUsageFlags GetGeometryBufferUsage() const;
+
    void CreateVertexBuffer();
    void DestroyVertexBuffer();
 
@@ -38,27 +124,80 @@ protected:
    void CreateMaterialBuffer();
    void DestroyMaterialBuffer();
 
+   void CreateSphereBuffer();
+   void DestroySphereBuffer();
+
+   // Emitting surfaces sampled by next event estimation (see Light.glsl)
+   void CreateLightBuffer();
+   void DestroyLightBuffer();
+
+   // Tables for the low discrepancy samplers (see Sampler.glsl)
+   void CreateSamplerBuffers();
+   void DestroySamplerBuffers();
+
    void CreateTextureResources();
    void DestroyTextureResources();
 
-   void CreateAccelerationStructures();
+   // Which hit groups the ray tracing pipeline needs for the scene, and the shader binding table hit records that the instances select
+   // (depends on scene, see CreatePipeline())
+   void CreateHitRecords();
+
+   void CreateAccelerationStructures(); // depends on hit records
    void DestroyAccelerationStructures();
 
+   // Software ray tracing (m_RayTracerSettings.IsComputeRayTracing) equivalent of the acceleration structures
+   void CreateBVHBuffers();
+   void DestroyBVHBuffers();
+
    void CreateStorageImages();
    void DestroyStorageImages();
 
    void CreateUniformBuffers();
    void DestroyUniformBuffers();
 
+   void CreateRayCountBuffer();
+   void DestroyRayCountBuffer();
+
+   // Path states and ray queues for wavefront path tracing (only if m_RayTracerSettings.IsWavefrontPathTracing).  Sized for the window, see Wavefront.glsl
+   void CreateWavefrontBuffers();
+   void DestroyWavefrontBuffers();
+
    void CreateDescriptorSetLayout();
    void DestroyDescriptorSetLayout();
 
    void CreatePipelineLayout(); // depends on descriptor set layout
    void DestroyPipelineLayout();
 
+   // Path tracing pipelines for the starting specialization (from the scene and settings).  See SetSpecialization()
    void CreatePipeline();
    void DestroyPipeline();
 
+   // Pipeline variant cache: pipelines for the given specialization, compiled the first time that they are asked for
+   PipelineVariant& GetPipelineVariant(const Specialization& specialization);
+   void CreateRayTracingPipeline(PipelineVariant& variant, const Specialization& specialization);
+   void CreateComputePipeline(PipelineVariant& variant, const Specialization& specialization);
+   void CreateWavefrontPipelines(PipelineVariant& variant, const Specialization& specialization);   // depends on wavefront pipeline layout
+   void DestroyPipelineVariant(PipelineVariant& variant);
+
+   // Change to the pipeline variant for the given specialization, and re-record the command buffers to use it
+   void SetSpecialization(const Specialization& specialization);
+
+   // Compute pass that decides which pixels are sampled next frame (only if m_RayTracerSettings.AdaptiveSamplingThreshold is set).  See AdaptiveSampling.comp
+   void CreateAdaptiveSamplingPipeline();
+   void DestroyAdaptiveSamplingPipeline();
+
+   // Compute passes that denoise the accumulated image on its way to the output image (only if m_RayTracerSettings.DenoiseIterations is set).  See Denoise.comp
+   void CreateDenoisePipeline();
+   void DestroyDenoisePipeline();
+
+   // Compute pass that carries accumulated samples over camera movement (only if m_RayTracerSettings.TemporalHistoryLength is set).  See Reproject.comp
+   void CreateReprojectPipeline();
+   void DestroyReprojectPipeline();
+
+   // Layout of the wavefront path tracing kernels, which are in place of the one compute shader (only if m_RayTracerSettings.IsWavefrontPathTracing).  See Wavefront.glsl
+   void CreateWavefrontPipelineLayout();
+   void DestroyWavefrontPipelineLayout();
+
    void CreateDescriptorPool();
    void DestroyDescriptorPool();
 
@@ -67,13 +206,43 @@ protected:
 
    void RecordCommandBuffers();
 
+   // Generate, then extend, shade and shadow for each bounce, then accumulate.  In place of the compute ray tracing dispatch
+   void RecordWavefrontPathTracing(vk::CommandBuffer commandBuffer, const uint32_t commandBufferIndex);
+
+   // Shared by the GPU and CPU renderers
+   UniformBufferObject GetUniformBufferObject(const uint32_t width, const uint32_t height) const;
+
    virtual void Update(double deltaTime) override;
 
    virtual void RenderFrame() override;
 
+   // 1, 2, 3: quality preset.  T: next tonemapping operator.  B: skybox on/off (if the scene has one)
+   virtual void OnKey(const int key, const int scancode, const int action, const int mods) override;
+
    virtual void OnWindowResized() override;
 
+   virtual uint64_t GetRayCount() override;
+
+   // Compares with m_RayTracerSettings.ReferenceImageFileName, if there is one
+   virtual double GetOutputImageError() override;
+
+   // Add the rays counted by the given command buffer (which must have completed) into m_RayCount, and reset its counter.
+   // Also picks up the number of pixels that its adaptive sampling pass left active (m_ActivePixelCount), and its wavefront queue stats
+   void CollectRayCount(const uint32_t commandBufferIndex);
+
+   // Adaptive sampling: fraction of pixels that are still being sampled (in the window title, and logged as it changes)
+   void ReportActivePixels();
+
+   // Wavefront path tracing: paths per frame taken from each kind of queue, and what fraction of the invocations dispatched had one to work on
+   void ReportQueueOccupancy();
+
+   // Run() for m_RayTracerSettings.IsSamplerComparison: error vs. samples per pixel of each sampler in turn
+   void RunSamplerComparison();
+
 private:
+   // Adds the sphere set as a model, and a single instance of it
+   void AddSphereSet(std::unique_ptr<SphereSet> sphereSet);
+
    void CreateSceneFurnaceTest();
    void CreateSceneNormalsTest();
    void CreateSceneSimple();
@@ -88,35 +257,104 @@ private:
    void CreateSceneShaderBall();
 
 private:
+   RayTracerSettings m_RayTracerSettings;
    Scene m_Scene;
    std::unique_ptr<Vulkan::Buffer> m_VertexBuffer;
    std::unique_ptr<Vulkan::IndexBuffer> m_IndexBuffer;
    std::unique_ptr<Vulkan::Buffer> m_OffsetBuffer;
    std::unique_ptr<Vulkan::Buffer> m_AABBBuffer;
    std::unique_ptr<Vulkan::Buffer> m_MaterialBuffer;
+   std::unique_ptr<Vulkan::Buffer> m_SphereBuffer;
+   std::unique_ptr<Vulkan::Buffer> m_LightBuffer;
+   uint32_t m_LightCount = 0;                              // 0 if next event estimation is off (or there is nothing to sample)
+   float m_TotalLightPower = 0.0f;
+   std::unique_ptr<Vulkan::Buffer> m_SobolBuffer;
+   std::unique_ptr<Vulkan::Buffer> m_BlueNoiseBuffer;
+   uint32_t m_SamplerType = SAMPLER_SOBOL;                 // SAMPLER_XXX (see SamplerTables.glsl)
+   std::unique_ptr<Vulkan::Buffer> m_BVHNodeBuffer;        // only if m_RayTracerSettings.IsComputeRayTracing
+   std::unique_ptr<Vulkan::Buffer> m_BVHPrimitiveBuffer;   //
+   std::unique_ptr<Vulkan::Buffer> m_BVHInstanceBuffer;    //
+   std::unique_ptr<Vulkan::Buffer> m_RayCountBuffer;       // one counter per command buffer, each m_RayCountStride bytes apart
+   vk::DeviceSize m_RayCountStride = 0;
+   vk::DeviceSize m_QueueStatsOffset = 0;                  // wavefront path tracing: each command buffer's QueueStats follow its counters, at this offset
+   std::vector<uint64_t> m_QueueItems;                     // wavefront path tracing: QueueStats summed over all frames so far
+   std::vector<uint64_t> m_QueueGroups;                    //
+   std::unique_ptr<Vulkan::Buffer> m_PathStateBuffer;      // only if m_RayTracerSettings.IsWavefrontPathTracing
+   std::unique_ptr<Vulkan::Buffer> m_RayQueueBuffer;       //
+   uint64_t m_RayCount = 0;
+   uint32_t m_ActivePixelCount = sm_NoPixelCount;          // adaptive sampling: pixels that still get samples, as of the last completed frame
+   int m_ReportedActivePercent = -1;
    std::vector<std::unique_ptr<Vulkan::Image>> m_Textures;
    vk::Sampler m_TextureSampler;
    std::unique_ptr<Vulkan::Image> m_SkyboxTexture;
    std::unique_ptr<Vulkan::Image> m_OutputImage;
    std::unique_ptr<Vulkan::Image> m_AccumumlationImage;
+   std::unique_ptr<Vulkan::Image> m_MomentsImage;          // adaptive sampling: per pixel luminance moments and error estimate (see Adaptive.glsl)
+   std::unique_ptr<Vulkan::Image> m_SampleMaskImage;       // adaptive sampling: non-zero for pixels that are sampled next frame
+   std::unique_ptr<Vulkan::Image> m_AlbedoImage;           // denoiser: first hit albedo, averaged over samples
+   std::unique_ptr<Vulkan::Image> m_NormalDepthImage;      // denoiser: first hit normal and distance from camera, averaged over samples
+   std::array<std::unique_ptr<Vulkan::Image>, 2> m_DenoiseImages;  // denoiser: passes ping-pong between these
+   std::unique_ptr<Vulkan::Image> m_PositionImage;         // temporal reprojection: first hit world position and distance from camera
+   std::unique_ptr<Vulkan::Image> m_HistoryImage;          // temporal reprojection: accumulated image from before the camera moved
+   std::unique_ptr<Vulkan::Image> m_HistoryPositionImage;  // temporal reprojection: and the first hit positions that went with it
    uint32_t m_AccumulatedImageCount = 0;
-   std::vector<Vulkan::Buffer> m_UniformBuffers;
+   uint32_t m_AnimatedInstance = sm_NoInstance;            // --animate: index into m_Scene.GetInstances() of the instance that moves (see CreateScene() and Update())
+   glm::mat3x4 m_AnimatedInstanceTransform;                // where it started
+   float m_AnimationRadius = 0.0f;                         // it circles around there, with this radius
+   double m_AnimationTime = 0.0;
+   uint32_t m_FrameNumber = 0;
+   bool m_IsReprojecting = false;                          // temporal reprojection: camera has moved since the previous frame, whose accumulated samples are carried over
+   glm::mat4 m_PreviousViewProjection = glm::mat4 {1.0f};  // temporal reprojection: camera of the previous frame
+   std::unique_ptr<Vulkan::RingBuffer> m_UniformBuffer;
    vk::PhysicalDeviceRayTracingPipelinePropertiesKHR m_RayTracingPipelineProperties;
    vk::DescriptorSetLayout m_DescriptorSetLayout;
    vk::PipelineLayout m_PipelineLayout;
-   vk::Pipeline m_Pipeline;
+   Specialization m_Specialization = {};
+   std::map<Specialization, PipelineVariant> m_PipelineVariants;   // every variant that has been used so far
+   PipelineVariant* m_PipelineVariant = nullptr;                   // the one for m_Specialization
+   uint32_t m_QualityPreset = 0;                                   // index into sm_QualityPresets
+   uint32_t m_TonemapOperator = 0;                                 // TONEMAP_XXX (see UniformBufferObject.glsl)
+   float m_LensAperture = 0.0f;                                    // (thin lens camera is disabled, see RayTrace.rgen)
+   float m_LensFocalLength = 800.0f;                               //
+   vk::Pipeline m_AdaptiveSamplingPipeline;
+   vk::PipelineLayout m_DenoisePipelineLayout;             // same descriptor set layout as m_PipelineLayout, but with DenoiseConstants for push constants
+   vk::Pipeline m_DenoisePipeline;
+   vk::Pipeline m_ReprojectPipeline;
+   vk::PipelineLayout m_WavefrontPipelineLayout;           // same descriptor set layout as m_PipelineLayout, but with WavefrontConstants for push constants
    
-   enum EShaderHitGroup {
+   // Shader groups that are always there.  The hit groups follow, one for each of m_HitGroups
+   enum EShaderGroup {
       eRayGenGroup,
       eMissGroup,
-      eFirstHitGroup,
-      eTrianglesHitGroup = eFirstHitGroup,
-      eSphereHitGroup,
-      eBoxHitGroup,
+      eShadowMissGroup,
 
-      eNumShaderGroups
+      eFirstHitGroup
    };
-   std::unique_ptr<Vulkan::Buffer> m_ShaderBindingTable;
+
+   // Closest hit shader for one type of geometry (HITGROUP_XXX, see BVH.glsl), specialized for one type of material (MATERIAL_XXX,
+   // or MATERIAL_ANY if the geometry's primitives are not all the same)
+   struct HitGroup {
+      uint32_t m_GeometryType;
+      uint32_t m_MaterialType;
+
+      bool operator==(const HitGroup& other) const { return (m_GeometryType == other.m_GeometryType) && (m_MaterialType == other.m_MaterialType); }
+   };
+   std::vector<HitGroup> m_HitGroups;                 // only those that the scene uses
+   std::vector<uint32_t> m_HitRecords;                // shader binding table hit region: index into m_HitGroups of each record
+   std::vector<uint32_t> m_InstanceHitRecordOffsets;  // per scene instance: its first hit record (one record for each geometry of its model)
+
+   std::unique_ptr<CPURenderer> m_CPURenderer;   // only if m_RayTracerSettings.IsCPURender
+
+   static constexpr uint32_t sm_NoInstance = ~0u;
+   static constexpr uint32_t sm_NoPixelCount = ~0u;       // no adaptive sampling pass has completed yet
+   static constexpr uint32_t sm_AdaptiveMinSamples = 16;  // every pixel gets at least this many samples before adaptive sampling can stop it
+   static constexpr std::array<const char*, 3> sm_SamplerNames = {"random", "sobol", "bluenoise"};  // indexed by SAMPLER_XXX
+   static constexpr std::array<const char*, 3> sm_TonemapOperatorNames = {"exponential", "reinhard", "aces"};  // indexed by TONEMAP_XXX
+   static constexpr std::array<QualityPreset, 3> sm_QualityPresets = {{
+      {"draft",   1,  4},
+      {"preview", 2, 16},
+      {"final",   3, 64}
+   }};
 
    const uint32_t m_TrianglesShaderHitGroupIndex = 0;
    const uint32_t m_SphereShaderHitGroupIndex = 1;
@@ -0,0 +1,146 @@
+#include "SamplerTables.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <random>
+
+std::vector<uint32_t> GenerateSobolMatrices() {
+   // Primitive polynomials (degree s, coefficients a) and initial direction numbers m, for dimensions after the first
+   // Joe and Kuo "Constructing Sobol sequences with better two-dimensional projections" (2008), new-joe-kuo-6.21201
+   struct DirectionNumbers {
+      uint32_t s;
+      uint32_t a;
+      std::array<uint32_t, 3> m;
+   };
+   static const std::array<DirectionNumbers, SOBOL_DIMENSIONS - 1> directionNumbers = {
+      DirectionNumbers {1, 0, {1, 0, 0}},
+      DirectionNumbers {2, 1, {1, 3, 0}},
+      DirectionNumbers {3, 1, {1, 3, 1}}
+   };
+
+   std::vector<uint32_t> matrices(SOBOL_DIMENSIONS * SOBOL_BITS);
+
+   // first dimension is the van der Corput sequence (bit reversal of the index)
+   for (uint32_t i = 0; i < SOBOL_BITS; ++i) {
+      matrices[i] = 1u << (31 - i);
+   }
+
+   for (uint32_t dimension = 1; dimension < SOBOL_DIMENSIONS; ++dimension) {
+      const DirectionNumbers& numbers = directionNumbers[dimension - 1];
+      uint32_t* v = &matrices[dimension * SOBOL_BITS];
+      for (uint32_t i = 0; i < SOBOL_BITS; ++i) {
+         if (i < numbers.s) {
+            v[i] = numbers.m[i] << (31 - i);
+         } else {
+            v[i] = v[i - numbers.s] ^ (v[i - numbers.s] >> numbers.s);
+            for (uint32_t k = 1; k < numbers.s; ++k) {
+               v[i] ^= ((numbers.a >> (numbers.s - 1 - k)) & 1) * v[i - k];
+            }
+         }
+      }
+   }
+   return matrices;
+}
+
+
+std::vector<float> GenerateBlueNoise() {
+   constexpr int size = BLUENOISE_SIZE;
+   constexpr int count = size * size;
+   constexpr float sigma = 1.5f;
+
+   // energy that a point contributes at each offset from it (wrapping around at the edges, so that the result tiles)
+   std::vector<float> kernel(count);
+   for (int y = 0; y < size; ++y) {
+      for (int x = 0; x < size; ++x) {
+         const float dx = static_cast<float>(std::min(x, size - x));
+         const float dy = static_cast<float>(std::min(y, size - y));
+         kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+      }
+   }
+
+   std::vector<bool> isPoint(count, false);
+   std::vector<float> energy(count, 0.0f);
+
+   auto addPoint = [&](const int pixel, const bool add) {
+      isPoint[pixel] = add;
+      const int px = pixel % size;
+      const int py = pixel / size;
+      const float sign = add ? 1.0f : -1.0f;
+      for (int y = 0; y < size; ++y) {
+         for (int x = 0; x < size; ++x) {
+            energy[y * size + x] += sign * kernel[((y - py + size) % size) * size + (x - px + size) % size];
+         }
+      }
+   };
+
+   // point with the most energy (i.e. most crowded by other points)
+   auto tightestCluster = [&]() {
+      int cluster = -1;
+      for (int i = 0; i < count; ++i) {
+         if (isPoint[i] && ((cluster < 0) || (energy[i] > energy[cluster]))) {
+            cluster = i;
+         }
+      }
+      return cluster;
+   };
+
+   // empty pixel with the least energy (i.e. furthest from other points)
+   auto largestVoid = [&]() {
+      int largest = -1;
+      for (int i = 0; i < count; ++i) {
+         if (!isPoint[i] && ((largest < 0) || (energy[i] < energy[largest]))) {
+            largest = i;
+         }
+      }
+      return largest;
+   };
+
+   // Initial pattern: a tenth of the pixels, at random to begin with, then evened out by moving the point in the tightest cluster
+   // to the largest void until that puts it straight back where it was
+   std::mt19937 random(0);  // fixed seed, so that the noise is the same every run
+   std::uniform_int_distribution<int> pixels(0, count - 1);
+   const int initialCount = count / 10;
+   for (int placed = 0; placed < initialCount;) {
+      const int pixel = pixels(random);
+      if (!isPoint[pixel]) {
+         addPoint(pixel, true);
+         ++placed;
+      }
+   }
+   for (;;) {
+      const int cluster = tightestCluster();
+      addPoint(cluster, false);
+      const int largest = largestVoid();
+      addPoint(largest, true);
+      if (largest == cluster) {
+         break;
+      }
+   }
+   const std::vector<bool> initialPoints = isPoint;
+   const std::vector<float> initialEnergy = energy;
+
+   // Ranks below initialCount: take points out of the initial pattern, tightest cluster first
+   std::vector<int> rank(count);
+   for (int r = initialCount - 1; r >= 0; --r) {
+      const int cluster = tightestCluster();
+      addPoint(cluster, false);
+      rank[cluster] = r;
+   }
+
+   // The rest: fill in the initial pattern, largest void first.
+   // (Ulichney switches to the tightest cluster of empty pixels once half are filled, but with a gaussian energy that is the same pixel)
+   isPoint = initialPoints;
+   energy = initialEnergy;
+   for (int r = initialCount; r < count; ++r) {
+      const int largest = largestVoid();
+      addPoint(largest, true);
+      rank[largest] = r;
+   }
+
+   std::vector<float> noise(count);
+   for (int i = 0; i < count; ++i) {
+      noise[i] = (static_cast<float>(rank[i]) + 0.5f) / static_cast<float>(count);
+   }
+   return noise;
+}
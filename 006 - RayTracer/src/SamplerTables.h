@@ -0,0 +1,16 @@
+#pragma once
+
+#include "SamplerTables.glsl"
+
+#include <cstdint>
+#include <vector>
+
+// Tables for the low discrepancy samplers in Sampler.glsl.  Generated when the application starts (rather than shipped as assets)
+// and uploaded to storage buffers (see RayTracer::CreateSamplerBuffers())
+
+// Sobol sequence generator matrices, for the first SOBOL_DIMENSIONS dimensions.
+// SOBOL_BITS uints per dimension, bit i of the sample index selecting the i'th one (to xor into the result)
+std::vector<uint32_t> GenerateSobolMatrices();
+
+// BLUENOISE_SIZE x BLUENOISE_SIZE blue noise (that tiles), by void and cluster (Ulichney 1993).  Values are in [0, 1), each equally often
+std::vector<float> GenerateBlueNoise();
@@ -1,4 +1,67 @@
 #include "Scene.h"
+#include "Core.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <map>
+
+using Bounds = std::array<glm::vec3, 2>;
+
+// Relative costs for the flattening decision.  Traversing one BVH node costs 1.
+// Entering an instance is a lot more expensive (ray has to be transformed, and traversal restarted in another tree)
+static const float s_InstanceCost = 8.0f;
+
+// Models with more triangles than this are never flattened (duplicating them would cost too much memory)
+static const size_t s_MaxFlattenModelTriangles = 1024;
+
+// Upper limit on total number of triangles in the flattened model
+static const size_t s_MaxFlattenedTriangles = 1 << 20;
+
+
+static float SurfaceArea(const Bounds& bounds) {
+   const glm::vec3 size = glm::max(bounds[1] - bounds[0], glm::vec3 {0.0f});
+   return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+
+static Bounds Union(const Bounds& a, const Bounds& b) {
+   return {glm::min(a[0], b[0]), glm::max(a[1], b[1])};
+}
+
+
+static const Bounds s_EmptyBounds = {glm::vec3 {std::numeric_limits<float>::max()}, glm::vec3 {std::numeric_limits<float>::lowest()}};
+
+
+// Instance transforms are row major 3x4 (i.e. the same as vk::TransformMatrixKHR)
+static glm::vec3 TransformPoint(const glm::mat3x4& transform, const glm::vec3& point) {
+   const glm::vec4 p = {point, 1.0f};
+   return {glm::dot(transform[0], p), glm::dot(transform[1], p), glm::dot(transform[2], p)};
+}
+
+
+static Bounds TransformBounds(const glm::mat3x4& transform, const Bounds& bounds) {
+   Bounds transformed = s_EmptyBounds;
+   for (int i = 0; i < 8; ++i) {
+      const glm::vec3 corner = {bounds[i & 1].x, bounds[(i >> 1) & 1].y, bounds[(i >> 2) & 1].z};
+      const glm::vec3 p = TransformPoint(transform, corner);
+      transformed = Union(transformed, {p, p});
+   }
+   return transformed;
+}
+
+
+static Bounds GetModelBounds(const Model& model) {
+   if (model.IsProcedural()) {
+      return model.GetBoundingBox();
+   }
+   Bounds bounds = s_EmptyBounds;
+   for (const auto& vertex : model.GetVertices()) {
+      bounds = Union(bounds, {vertex.pos, vertex.pos});
+   }
+   return bounds;
+}
+
 
 glm::vec3 Scene::GetHorizonColor() const {
    return m_HorizonColor;
@@ -42,8 +105,19 @@ void Scene::SetAccumulateFrames(const bool b) {
 
 uint32_t
 Scene::AddModel(std::unique_ptr<Model> model) {
+   const uint64_t hash = model->GetContentHash();
+   auto [first, last] = m_ModelIndices.equal_range(hash);
+   for (auto existing = first; existing != last; ++existing) {
+      if (m_Models[existing->second]->HasSameContent(*model)) {
+         ++m_DuplicateModelCount;
+         m_DuplicateModelSize += model->GetContentSize();
+         return existing->second;
+      }
+   }
+   const uint32_t modelIndex = static_cast<uint32_t>(m_Models.size());
    m_Models.emplace_back(std::move(model));
-   return static_cast<uint32_t>(m_Models.size() - 1);
+   m_ModelIndices.emplace(hash, modelIndex);
+   return modelIndex;
 }
 
 
@@ -66,6 +140,16 @@ const std::vector<std::unique_ptr<Model>>& Scene::GetModels() const {
 }
 
 
+uint32_t Scene::GetDuplicateModelCount() const {
+   return m_DuplicateModelCount;
+}
+
+
+size_t Scene::GetDuplicateModelSize() const {
+   return m_DuplicateModelSize;
+}
+
+
 const std::vector<std::string>& Scene::GetTextureFileNames() const {
    return m_TextureFileNames;
 }
@@ -87,3 +171,156 @@ int Scene::GetTextureId(const std::string& name) const {
 const std::vector<std::unique_ptr<Instance>>& Scene::GetInstances() const {
    return m_Instances;
 }
+
+
+Bounds Scene::GetInstanceBounds(const uint32_t instanceIndex) const {
+   const Instance& instance = *m_Instances.at(instanceIndex);
+   return TransformBounds(instance.GetTransform(), GetModelBounds(*m_Models[instance.GetModelIndex()]));
+}
+
+
+uint32_t Scene::FlattenInstances() {
+   if (m_Instances.empty()) {
+      return 0;
+   }
+
+   std::vector<Bounds> modelBounds;
+   modelBounds.reserve(m_Models.size());
+   for (const auto& model : m_Models) {
+      modelBounds.emplace_back(GetModelBounds(*model));
+   }
+
+   std::vector<Bounds> instanceBounds;
+   instanceBounds.reserve(m_Instances.size());
+   Bounds sceneBounds = s_EmptyBounds;
+   for (const auto& instance : m_Instances) {
+      instanceBounds.emplace_back(TransformBounds(instance->GetTransform(), modelBounds[instance->GetModelIndex()]));
+      sceneBounds = Union(sceneBounds, instanceBounds.back());
+   }
+   const float sceneArea = SurfaceArea(sceneBounds);
+   if (sceneArea <= 0.0f) {
+      return 0;
+   }
+
+   // Candidates are instances of small, single geometry, triangle models
+   std::map<uint32_t, std::vector<size_t>> candidates;  // model index -> instance indices
+   for (size_t i = 0; i < m_Instances.size(); ++i) {
+      const Model& model = *m_Models[m_Instances[i]->GetModelIndex()];
+      if (
+         !model.IsProcedural() &&
+         (model.GetGeometries().size() == 1) &&
+         (model.GetIndices().size() / 3 <= s_MaxFlattenModelTriangles)
+      ) {
+         candidates[m_Instances[i]->GetModelIndex()].push_back(i);
+      }
+   }
+
+   // Decide, model by model, whether its instances are cheaper to trace flattened.
+   // Expected cost of a ray against an instance is (probability ray hits instance bounds) x (cost once it has).
+   // By SAH, the probability is proportional to surface area.
+   //    instanced: each instance is a TLAS leaf.  Cost = traverse TLAS + enter instance + traverse model BLAS
+   //    flattened: model's triangles are all in one BLAS.  Cost = traverse (smaller) TLAS + traverse (bigger) combined BLAS.
+   //               plus, the combined BLAS is itself an instance, which is entered with probability area(combined bounds)
+   const float instanceCount = static_cast<float>(m_Instances.size());
+   std::vector<size_t> flatten;
+   Bounds flattenedBounds = s_EmptyBounds;
+   size_t flattenedTriangles = 0;
+   for (const auto& [modelIndex, instanceIndices] : candidates) {
+      if (instanceIndices.size() < 2) {
+         continue;
+      }
+      const float modelTriangles = static_cast<float>(m_Models[modelIndex]->GetIndices().size() / 3);
+      const float n = static_cast<float>(instanceIndices.size());
+      const size_t triangles = static_cast<size_t>(modelTriangles * n);
+      if (flattenedTriangles + triangles > s_MaxFlattenedTriangles) {
+         continue;
+      }
+
+      float instancedCost = 0.0f;
+      float flattenedCost = 0.0f;
+      Bounds bounds = flattenedBounds;
+      for (const size_t i : instanceIndices) {
+         const float p = SurfaceArea(instanceBounds[i]) / sceneArea;
+         instancedCost += p * (std::log2(instanceCount) + s_InstanceCost + std::log2(std::max(modelTriangles, 1.0f)));
+         flattenedCost += p * (std::log2(std::max(instanceCount - n + 1.0f, 1.0f)) + std::log2(std::max(static_cast<float>(flattenedTriangles + triangles), 1.0f)));
+         bounds = Union(bounds, instanceBounds[i]);
+      }
+      flattenedCost += (SurfaceArea(bounds) - SurfaceArea(flattenedBounds)) / sceneArea * s_InstanceCost;
+
+      if (flattenedCost < instancedCost) {
+         flatten.insert(flatten.end(), instanceIndices.begin(), instanceIndices.end());
+         flattenedBounds = bounds;
+         flattenedTriangles += triangles;
+      }
+   }
+   if (flatten.size() < 2) {
+      return 0;
+   }
+
+   // Group by material, so that each distinct material is one geometry of the combined model
+   std::vector<Material> materials;
+   std::vector<std::vector<size_t>> materialInstances;
+   for (const size_t i : flatten) {
+      const Material& material = m_Instances[i]->GetMaterial();
+      size_t j = 0;
+      while ((j < materials.size()) && (memcmp(&materials[j], &material, sizeof(Material)) != 0)) {
+         ++j;
+      }
+      if (j == materials.size()) {
+         materials.emplace_back(material);
+         materialInstances.emplace_back();
+      }
+      materialInstances[j].push_back(i);
+   }
+
+   std::vector<Vertex> vertices;
+   std::vector<uint32_t> indices;
+   std::vector<ModelGeometry> geometries;
+   vertices.reserve(flattenedTriangles * 3);
+   indices.reserve(flattenedTriangles * 3);
+   for (const auto& instanceIndices : materialInstances) {
+      ModelGeometry geometry = {static_cast<uint32_t>(indices.size()), 0};
+      for (const size_t i : instanceIndices) {
+         const Instance& instance = *m_Instances[i];
+         const Model& model = *m_Models[instance.GetModelIndex()];
+         const glm::mat3x4& transform = instance.GetTransform();
+         const glm::mat3 normalTransform = glm::transpose(glm::inverse(glm::transpose(glm::mat3 {transform})));
+         const uint32_t firstVertex = static_cast<uint32_t>(vertices.size());
+         for (const auto& vertex : model.GetVertices()) {
+            vertices.push_back({TransformPoint(transform, vertex.pos), glm::normalize(normalTransform * vertex.normal), vertex.uv});
+         }
+         for (const auto index : model.GetIndices()) {
+            indices.push_back(firstVertex + index);
+         }
+      }
+      geometry.m_IndexCount = static_cast<uint32_t>(indices.size()) - geometry.m_FirstIndex;
+      geometries.emplace_back(geometry);
+   }
+
+   const uint32_t flattenedModelIndex = AddModel(std::make_unique<Model>(std::move(vertices), std::move(indices), std::move(geometries)));
+
+   std::vector<bool> isFlattened(m_Instances.size(), false);
+   for (const size_t i : flatten) {
+      isFlattened[i] = true;
+   }
+   std::vector<std::unique_ptr<Instance>> instances;
+   instances.reserve(m_Instances.size() - flatten.size() + 1);
+   for (size_t i = 0; i < m_Instances.size(); ++i) {
+      if (!isFlattened[i]) {
+         instances.emplace_back(std::move(m_Instances[i]));
+      }
+   }
+   instances.emplace_back(std::make_unique<Instance>(
+      flattenedModelIndex,
+      glm::mat3x4 {
+         {1.0f, 0.0f, 0.0f, 0.0f},
+         {0.0f, 1.0f, 0.0f, 0.0f},
+         {0.0f, 0.0f, 1.0f, 0.0f},
+      },
+      materials
+   ));
+   m_Instances = std::move(instances);
+
+   LOG_INFO("Flattened {0} instances into one model ({1} triangles, {2} geometries).  Scene now has {3} instances", flatten.size(), flattenedTriangles, materials.size(), m_Instances.size());
+   return static_cast<uint32_t>(flatten.size());
+}
@@ -3,6 +3,8 @@
 #include "Instance.h"
 #include "Model.h"
 
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
 class Scene {
@@ -19,6 +21,8 @@ public:
    bool GetAccumulateFrames() const;
    void SetAccumulateFrames(const bool b);
 
+   // If the scene already has a model with the same content (see Model::HasSameContent()), then the new model is discarded
+   // and the index of the existing one is returned.  That way identical geometry gets only one vertex/index range and one BLAS.
    uint32_t AddModel(std::unique_ptr<Model> model);
    uint32_t AddTextureResource(std::string name, std::string fileName);
    uint32_t AddInstance(std::unique_ptr<Instance> instance);
@@ -28,11 +32,29 @@ public:
    int GetTextureId(const std::string& name) const;
    const std::vector<std::unique_ptr<Instance>>& GetInstances() const;
 
+   // World space bounding box (min, max) of an instance
+   std::array<glm::vec3, 2> GetInstanceBounds(const uint32_t instanceIndex) const;
+
+   // Number of models that AddModel() found to be duplicates, and the GPU memory that saved
+   uint32_t GetDuplicateModelCount() const;
+   size_t GetDuplicateModelSize() const;
+
+   // Scene optimisation.
+   // Instances of small triangle models are pre-transformed and merged into one combined model (and so one BLAS, and one TLAS instance),
+   // for those models where an SAH-style cost estimate says that is cheaper to trace than keeping them as separate instances.
+   // Each material of the merged instances becomes a geometry of the combined model.
+   // Must be called before any GPU resources are created from the scene.
+   // Returns the number of instances that were merged.
+   uint32_t FlattenInstances();
+
 private:
    glm::vec3 m_HorizonColor = glm::one<glm::vec3>();
    glm::vec3 m_ZenithColor = glm::one<glm::vec3>();
    std::string m_SkyboxTextureName;
    std::vector<std::unique_ptr<Model>> m_Models;                 // unique models
+   std::unordered_multimap<uint64_t, uint32_t> m_ModelIndices;   // content hash -> model index
+   uint32_t m_DuplicateModelCount = 0;
+   size_t m_DuplicateModelSize = 0;
    std::vector<std::string> m_TextureNames;
    std::vector<std::string> m_TextureFileNames;
    std::vector<std::unique_ptr<Instance>> m_Instances;           // instances of models (i.e. tuples of model, transform, texture, material)
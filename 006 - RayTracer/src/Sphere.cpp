@@ -1,6 +1,8 @@
 #include "Sphere.h"
 #include "Core.h"
 
+#include <limits>
+
 uint32_t Sphere::sm_ShaderHitGroupIndex = ~0;
 uint32_t SphereInstance::sm_ModelIndex = ~0;
 
@@ -23,6 +25,55 @@ void Sphere::SetDefaultShaderHitGroupIndex(const uint32_t shaderHitGroupIndex) {
 }
 
 
+uint32_t Sphere::GetDefaultShaderHitGroupIndex() {
+   return sm_ShaderHitGroupIndex;
+}
+
+
+SphereSet::SphereSet() : Model(Sphere::GetDefaultShaderHitGroupIndex()) {}
+
+
+void SphereSet::AddSphere(const glm::vec3& centre, const float radius, const Material& material) {
+   m_Spheres.emplace_back(centre, radius);
+   m_Materials.emplace_back(material);
+}
+
+
+bool SphereSet::IsProcedural() const {
+   return true;
+}
+
+
+std::array<glm::vec3, 2> SphereSet::GetBoundingBox() const {
+   std::array<glm::vec3, 2> boundingBox = {glm::vec3 {std::numeric_limits<float>::max()}, glm::vec3 {std::numeric_limits<float>::lowest()}};
+   for (const auto& sphere : m_Spheres) {
+      boundingBox[0] = glm::min(boundingBox[0], glm::vec3 {sphere} - sphere.w);
+      boundingBox[1] = glm::max(boundingBox[1], glm::vec3 {sphere} + sphere.w);
+   }
+   return boundingBox;
+}
+
+
+std::vector<std::array<glm::vec3, 2>> SphereSet::GetBoundingBoxes() const {
+   std::vector<std::array<glm::vec3, 2>> boundingBoxes;
+   boundingBoxes.reserve(m_Spheres.size());
+   for (const auto& sphere : m_Spheres) {
+      boundingBoxes.push_back({glm::vec3 {sphere} - sphere.w, glm::vec3 {sphere} + sphere.w});
+   }
+   return boundingBoxes;
+}
+
+
+const std::vector<glm::vec4>& SphereSet::GetSpheres() const {
+   return m_Spheres;
+}
+
+
+const std::vector<Material>& SphereSet::GetMaterials() const {
+   return m_Materials;
+}
+
+
 SphereInstance::SphereInstance(const glm::vec3& centre, const float radius, const Material& material)
 : Instance {
    sm_ModelIndex,
@@ -41,3 +92,18 @@ SphereInstance::SphereInstance(const glm::vec3& centre, const float radius, cons
 void SphereInstance::SetModelIndex(uint32_t modelIndex) {
    sm_ModelIndex = modelIndex;
 }
+
+
+SphereSetInstance::SphereSetInstance(const uint32_t modelIndex, const std::vector<Material>& materials)
+: Instance {
+   modelIndex,
+   glm::mat3x4 {
+      {1.0f, 0.0f, 0.0f, 0.0f},
+      {0.0f, 1.0f, 0.0f, 0.0f},
+      {0.0f, 0.0f, 1.0f, 0.0f},
+   },
+   materials
+}
+{
+   ASSERT(!materials.empty(), "ERROR: SphereSet has no spheres");
+}
@@ -15,12 +15,39 @@ public:
 
 public:
    static void SetDefaultShaderHitGroupIndex(const uint32_t shaderHitGroupIndex);
+   static uint32_t GetDefaultShaderHitGroupIndex();
 
 private:
    static uint32_t sm_ShaderHitGroupIndex;
 };
 
 
+// Lots of spheres in one BLAS (one AABB per sphere), instead of one TLAS instance per sphere.
+// The sphere intersection shader finds the centre and radius of each sphere (in object space) via gl_PrimitiveID.
+// Use with a SphereSetInstance.
+class SphereSet : public Model {
+public:
+   SphereSet();
+
+   void AddSphere(const glm::vec3& centre, const float radius, const Material& material);
+
+   bool IsProcedural() const override;
+
+   std::array<glm::vec3, 2> GetBoundingBox() const override;
+
+   std::vector<std::array<glm::vec3, 2>> GetBoundingBoxes() const override;
+
+   // xyz = centre, w = radius
+   const std::vector<glm::vec4>& GetSpheres() const;
+
+   const std::vector<Material>& GetMaterials() const;
+
+private:
+   std::vector<glm::vec4> m_Spheres;
+   std::vector<Material> m_Materials;
+};
+
+
 class SphereInstance : public Instance {
 public:
    SphereInstance(const glm::vec3& centre, const float radius, const Material& material);
@@ -31,3 +58,11 @@ public:
 private:
    static uint32_t sm_ModelIndex;
 };
+
+
+class SphereSetInstance : public Instance {
+public:
+   // materials are one per sphere (i.e. SphereSet::GetMaterials()).  Not taken from the model because
+   // the set might have been de-duplicated (by Scene::AddModel()) to another one with different materials.
+   SphereSetInstance(const uint32_t modelIndex, const std::vector<Material>& materials);
+};
@@ -1,15 +1,93 @@
 #include "Application.h"
+#include "Core.h"
 #include "Log.h"
 #include "Utility.h"
 
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
+#include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/rotate_vector.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
 #include <set>
+#include <string>
+#include <thread>
 
 namespace Vulkan {
 
+// The pipeline cache file is the data returned by vkGetPipelineCacheData(), preceded by this.
+// The vulkan data has its own header (which identifies the device), but we also want to know
+// the driver version, and whether the file is complete.
+struct PipelineCacheFileHeader {
+   uint32_t m_Magic;
+   uint32_t m_DriverVersion;
+   uint64_t m_DataSize;
+};
+
+static const uint32_t s_PipelineCacheMagic = 0x43505641; // "AVPC"
+
+
+// An acceleration structure cache file is the data written by vkCmdCopyAccelerationStructureToMemoryKHR(), preceded by this.
+// The vulkan data starts with the driver and compatibility UUIDs (which are checked with vkGetDeviceAccelerationStructureCompatibilityKHR),
+// followed by the serialized size and the deserialized size (and then other things we do not care about)
+struct AccelerationStructureCacheFileHeader {
+   uint32_t m_Magic;
+   uint32_t m_Reserved;
+   uint64_t m_CacheKey;
+   uint64_t m_DataSize;
+};
+
+static const uint32_t s_AccelerationStructureCacheMagic = 0x43415641; // "AVAC"
+
+// Where the serialized acceleration structure data must start (device address alignment required by the copy commands)
+static const vk::DeviceSize s_AccelerationStructureSerializationAlignment = 256;
+
+
+// Application name, made safe for use as a file name
+static std::string GetSafeFileName(std::string fileName) {
+   for (auto& ch : fileName) {
+      if (!isalnum(static_cast<unsigned char>(ch))) {
+         ch = '_';
+      }
+   }
+   return fileName;
+}
+
+
+// Write to a temporary file, and then move that over the top of the real one.
+// That way, a crash (or a second instance of the app) cannot leave a half written file behind.
+static bool WriteFileAtomically(const std::string& fileName, const void* pHeader, const size_t headerSize, const void* pData, const size_t dataSize) {
+   std::string tempFileName = fileName + ".tmp";
+   bool ok = false;
+   {
+      std::ofstream file(tempFileName, std::ios::out | std::ios::binary | std::ios::trunc);
+      if (file.is_open()) {
+         file.write(static_cast<const char*>(pHeader), headerSize);
+         file.write(static_cast<const char*>(pData), dataSize);
+         file.flush();
+         ok = file.good();
+      }
+   }
+   std::error_code ec;
+   if (ok) {
+      std::filesystem::rename(tempFileName, fileName, ec);
+   }
+   if (!ok || ec) {
+      std::filesystem::remove(tempFileName, ec);
+      return false;
+   }
+   return true;
+}
+
+
 Application::Application(const ApplicationSettings& settings, const bool enableValidation)
 : m_Settings(settings)
 , m_EnableValidation(enableValidation)
@@ -19,6 +97,7 @@ Application::Application(const ApplicationSettings& settings, const bool enableV
 Application::~Application() {
    DestroyPipelineCache();
    DestroySyncObjects();
+   DestroyProfiler();
    DestroyCommandBuffers();
    DestroyCommandPool();
    DestroyFrameBuffers();
@@ -26,6 +105,10 @@ Application::~Application() {
    DestroyDepthStencil();
    DestroyImageViews();
    DestroySwapChain(m_SwapChain);
+   DestroyTopLevelAccelerationStructure();
+   DestroyBottomLevelAccelerationStructures();
+   DestroyUploader();
+   DestroyMemoryAllocator();
    DestroyDevice();
    DestroySurface();
    DestroyInstance();
@@ -34,17 +117,136 @@ Application::~Application() {
 
 
 void Application::Run() {
+   CompleteStartup();
+
+   if (m_Settings.IsHeadless || m_Settings.IsBenchmark) {
+      RunFixedFrameCount();
+      return;
+   }
+
    glfwSetTime(m_LastTime);
    while (!glfwWindowShouldClose(m_Window)) {
       glfwPollEvents();
       //
       // TODO: do nothing if window is minimized
+      Profiler::CPUScope frameScope(m_Profiler.get(), "Frame");
       double currentTime = glfwGetTime();
-      Update(currentTime - m_LastTime);
+      {
+         Profiler::CPUScope updateScope(m_Profiler.get(), "Update");
+         Update(currentTime - m_LastTime);
+      }
       RenderFrame();
       m_LastTime = currentTime;
    }
    m_Device.waitIdle();
+   ReportProfile();
+}
+
+
+void Application::CompleteStartup() {
+   // Make sure everything uploaded during Init() has landed before we start rendering
+   FlushUploads();
+   m_Uploader->LogStatistics();
+
+   std::chrono::duration<double> startupTime = std::chrono::steady_clock::now() - m_InitStartTime;
+   CORE_LOG_INFO("Startup took {0:.1f}ms ({1} pipeline cache, {2}/{3} acceleration structures from cache)", startupTime.count() * 1000.0, m_IsPipelineCacheWarm ? "warm" : "cold", m_AccelerationStructureCacheHits, m_AccelerationStructureCacheHits + m_AccelerationStructureCacheMisses);
+}
+
+
+void Application::RunFixedFrameCount(const double timeLimit) {
+   uint32_t frameCount = m_Settings.FrameCount;
+   if (m_Settings.IsBenchmark && (m_Settings.SamplesPerPixel > 0)) {
+      const uint32_t samplesPerFrame = GetSamplesPerPixelPerFrame();
+      frameCount = (m_Settings.SamplesPerPixel + samplesPerFrame - 1) / samplesPerFrame;
+   }
+
+   // Update() is given a fixed time step so that runs are repeatable.
+   const double deltaTime = 1.0 / 60.0;
+   uint32_t framesRendered = 0;
+   auto startTime = std::chrono::steady_clock::now();
+   auto frameStartTime = startTime;
+   for (uint32_t frame = 0; (timeLimit > 0.0) || (frame < frameCount); ++frame) {
+      if ((timeLimit > 0.0) && (std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count() >= timeLimit)) {
+         break;
+      }
+      if (m_Window) {
+         glfwPollEvents();
+         if (glfwWindowShouldClose(m_Window)) {
+            break;
+         }
+      }
+      {
+         Profiler::CPUScope frameScope(m_Profiler.get(), "Frame");
+         {
+            Profiler::CPUScope updateScope(m_Profiler.get(), "Update");
+            Update(deltaTime);
+         }
+         RenderFrame();
+      }
+      m_LastTime += deltaTime;
+      ++framesRendered;
+
+      auto frameEndTime = std::chrono::steady_clock::now();
+      if (m_Benchmark) {
+         m_Benchmark->RecordFrameTime(std::chrono::duration<double>(frameEndTime - frameStartTime).count());
+      }
+      frameStartTime = frameEndTime;
+   }
+   m_Device.waitIdle();
+   std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+   const uint64_t rayCount = GetRayCount();
+   if (rayCount > 0) {
+      CORE_LOG_INFO("Rendered {0} frames in {1:.3f}s ({2:.1f} Mrays/s)", framesRendered, elapsed.count(), rayCount / elapsed.count() / 1e6);
+   } else {
+      CORE_LOG_INFO("Rendered {0} frames in {1:.3f}s", framesRendered, elapsed.count());
+   }
+
+   const double imageError = GetOutputImageError();
+   if (imageError >= 0.0) {
+      CORE_LOG_INFO("RMSE vs. reference image: {0:.6f}", imageError);
+   }
+
+   if (m_Benchmark) {
+      BenchmarkInfo info;
+      info.ApplicationName = m_Settings.ApplicationName;
+      info.DeviceName = m_PhysicalDeviceProperties.deviceName.data();
+      info.DriverVersion = m_PhysicalDeviceProperties.driverVersion;
+      info.SceneName = m_Settings.SceneName ? m_Settings.SceneName : "default";
+      info.Width = m_Extent.width;
+      info.Height = m_Extent.height;
+      info.SamplesPerPixelPerFrame = GetSamplesPerPixelPerFrame();
+      info.RayCount = rayCount;
+      info.ImageError = imageError;
+      m_Benchmark->WriteReport(m_Settings.BenchmarkReportFileName, info, elapsed.count());
+   }
+   ReportProfile();
+}
+
+
+uint32_t Application::GetSamplesPerPixelPerFrame() const {
+   return 1;
+}
+
+
+uint64_t Application::GetRayCount() {
+   return 0;
+}
+
+
+double Application::GetOutputImageError() {
+   return -1.0;
+}
+
+
+void Application::ReportProfile() {
+   // Results from the last few frames are still sitting in the query pool
+   for (uint32_t i = 0; i < m_CommandBuffers.size(); ++i) {
+      m_Profiler->CollectGPUResults(i);
+   }
+   m_Profiler->LogStatistics();
+   if (m_Settings.ProfileFileName) {
+      m_Profiler->WriteChromeTrace(m_Settings.ProfileFileName);
+   }
 }
 
 
@@ -68,19 +270,74 @@ void Application::OnMouseButton(const int button, const int action, const int mo
 }
 
 
+void Application::ParseCommandLine(const int argc, const char* argv[]) {
+   for (int i = 1; i < argc; ++i) {
+      if (strcmp(argv[i], "--headless") == 0) {
+         m_Settings.IsHeadless = true;
+      } else if ((strcmp(argv[i], "--frames") == 0) && (i + 1 < argc)) {
+         m_Settings.FrameCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+      } else if ((strcmp(argv[i], "--profile") == 0) && (i + 1 < argc)) {
+         m_Settings.ProfileFileName = argv[++i];
+      } else if (strcmp(argv[i], "--benchmark") == 0) {
+         m_Settings.IsBenchmark = true;
+         m_Settings.IsResizable = false;
+      } else if ((strcmp(argv[i], "--scene") == 0) && (i + 1 < argc)) {
+         m_Settings.SceneName = argv[++i];
+      } else if ((strcmp(argv[i], "--resolution") == 0) && (i + 1 < argc)) {
+         unsigned int width = 0;
+         unsigned int height = 0;
+         if ((sscanf(argv[++i], "%ux%u", &width, &height) != 2) || (width == 0) || (height == 0)) {
+            throw std::runtime_error("bad --resolution '" + std::string(argv[i]) + "' (expected <width>x<height>)");
+         }
+         m_Settings.WindowWidth = width;
+         m_Settings.WindowHeight = height;
+      } else if ((strcmp(argv[i], "--spp") == 0) && (i + 1 < argc)) {
+         m_Settings.SamplesPerPixel = static_cast<uint32_t>(std::stoul(argv[++i]));
+      } else if ((strcmp(argv[i], "--camera-path") == 0) && (i + 1 < argc)) {
+         m_Settings.CameraPathFileName = argv[++i];
+      } else if ((strcmp(argv[i], "--report") == 0) && (i + 1 < argc)) {
+         m_Settings.BenchmarkReportFileName = argv[++i];
+      } else if (strcmp(argv[i], "--no-compaction") == 0) {
+         m_Settings.IsAccelerationStructureCompactionEnabled = false;
+      } else if (strcmp(argv[i], "--host-as-build") == 0) {
+         m_Settings.IsHostAccelerationStructureBuildEnabled = true;
+      } else if (strcmp(argv[i], "--no-as-cache") == 0) {
+         m_Settings.IsAccelerationStructureCacheEnabled = false;
+      } else if (!ParseCommandLineOption(argc, argv, i)) {
+         CORE_LOG_WARN("Ignoring unrecognised command line option '{0}'", argv[i]);
+      }
+   }
+}
+
+
+bool Application::ParseCommandLineOption(const int argc, const char* argv[], int& i) {
+   return false;
+}
+
+
 void Application::Init() {
-   glfwSetErrorCallback(glfwErrorCallback);
-   if (!glfwInit()) {
-      throw std::runtime_error("glfwInit() failed");
+   m_InitStartTime = std::chrono::steady_clock::now();
+   if (m_Settings.IsBenchmark) {
+      m_Benchmark = std::make_unique<Benchmark>(m_Settings.CameraPathFileName ? m_Settings.CameraPathFileName : "");
    }
-   if (!glfwVulkanSupported()) {
-      throw std::runtime_error("glfwVulkanSupported() failed");
+   if (!m_Settings.IsHeadless) {
+      glfwSetErrorCallback(glfwErrorCallback);
+      if (!glfwInit()) {
+         throw std::runtime_error("glfwInit() failed");
+      }
+      if (!glfwVulkanSupported()) {
+         throw std::runtime_error("glfwVulkanSupported() failed");
+      }
+      CreateWindow();
    }
-   CreateWindow();
    CreateInstance();
-   CreateSurface();
+   if (!m_Settings.IsHeadless) {
+      CreateSurface();
+   }
    SelectPhysicalDevice();
    CreateDevice();
+   CreateMemoryAllocator();
+   CreateUploader();
    CreateSwapChain();
    CreateImageViews();
    CreateDepthStencil();
@@ -88,6 +345,7 @@ void Application::Init() {
    CreateFrameBuffers();
    CreateCommandPool();
    CreateCommandBuffers();
+   CreateProfiler();
    CreateSyncObjects();
    CreatePipelineCache();
    // TODO: UI overlay
@@ -142,8 +400,10 @@ void Application::CreateWindow() {
 
 
 void Application::DestroyWindow() {
-   glfwDestroyWindow(m_Window);
-   m_Window = nullptr;
+   if (m_Window) {
+      glfwDestroyWindow(m_Window);
+      m_Window = nullptr;
+   }
 }
 
 
@@ -152,7 +412,11 @@ void Application::CreateInstance() {
    PFN_vkGetInstanceProcAddr vkGetInstanceProcAddr = dl.getProcAddress<PFN_vkGetInstanceProcAddr>("vkGetInstanceProcAddr");
    VULKAN_HPP_DEFAULT_DISPATCHER.init(vkGetInstanceProcAddr);
 
-   std::vector<const char*> layers = {"VK_LAYER_LUNARG_monitor"};
+   // monitor layer puts the frame rate in the window title.  No use without a window (and it is not available on render nodes anyway)
+   std::vector<const char*> layers;
+   if (!m_Settings.IsHeadless) {
+      layers.push_back("VK_LAYER_LUNARG_monitor");
+   }
    if (m_EnableValidation) {
       layers.push_back("VK_LAYER_KHRONOS_validation");
    }
@@ -160,11 +424,13 @@ void Application::CreateInstance() {
 
    std::vector<const char*> extensions = GetRequiredInstanceExtensions();
 
-   uint32_t glfwExtensionCount = 0;
-   const char** glfwExtensions;
-   glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+   if (!m_Settings.IsHeadless) {
+      uint32_t glfwExtensionCount = 0;
+      const char** glfwExtensions;
+      glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-   extensions.insert(extensions.end(), glfwExtensions, glfwExtensions + glfwExtensionCount);
+      extensions.insert(extensions.end(), glfwExtensions, glfwExtensions + glfwExtensionCount);
+   }
 
    if (m_EnableValidation) {
       extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -304,7 +570,10 @@ bool Application::IsPhysicalDeviceSuitable(vk::PhysicalDevice physicalDevice) {
    QueueFamilyIndices indices = FindQueueFamilies(physicalDevice);
    if (indices.IsComplete()) {
       extensionsSupported = CheckDeviceExtensionSupport(physicalDevice, GetRequiredDeviceExtensions());
-      if (extensionsSupported) {
+      if (extensionsSupported && m_Settings.IsHeadless) {
+         // nothing to present to, so don't care about swap chain support
+         swapChainAdequate = true;
+      } else if (extensionsSupported) {
          SwapChainSupportDetails swapChainSupport = QuerySwapChainSupport(physicalDevice, m_Surface);
          swapChainAdequate = !swapChainSupport.Formats.empty() && !swapChainSupport.PresentModes.empty();
       }
@@ -318,6 +587,9 @@ void Application::CreateDevice() {
 
    std::vector<vk::DeviceQueueCreateInfo> deviceQueueCIs;
    std::set<uint32_t> uniqueQueueFamilies = {m_QueueFamilyIndices.GraphicsFamily.value(), m_QueueFamilyIndices.PresentFamily.value()};
+   if (m_QueueFamilyIndices.TransferFamily.has_value()) {
+      uniqueQueueFamilies.insert(m_QueueFamilyIndices.TransferFamily.value());
+   }
 
    for (uint32_t queueFamily : uniqueQueueFamilies) {
       deviceQueueCIs.emplace_back(
@@ -330,8 +602,10 @@ void Application::CreateDevice() {
 
    std::vector<const char*> deviceExtensions = GetRequiredDeviceExtensions();
 
-   // We always need swap chain extension
-   deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+   // We always need swap chain extension (unless headless)
+   if (!m_Settings.IsHeadless) {
+      deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+   }
 
    m_EnabledPhysicalDeviceFeatures = GetRequiredPhysicalDeviceFeatures(m_PhysicalDeviceFeatures);
 
@@ -357,6 +631,9 @@ void Application::CreateDevice() {
 
    m_GraphicsQueue = m_Device.getQueue(m_QueueFamilyIndices.GraphicsFamily.value(), 0);
    m_PresentQueue = m_Device.getQueue(m_QueueFamilyIndices.PresentFamily.value(), 0);
+   if (m_QueueFamilyIndices.TransferFamily.has_value()) {
+      m_TransferQueue = m_Device.getQueue(m_QueueFamilyIndices.TransferFamily.value(), 0);
+   }
 }
 
 
@@ -373,7 +650,42 @@ std::vector<const char*> Application::GetRequiredDeviceExtensions() {
 }
 
 
+void Application::CreateMemoryAllocator() {
+   m_MemoryAllocator = std::make_unique<MemoryAllocator>(m_Device, m_PhysicalDevice);
+   MemoryAllocator::SetDefault(m_MemoryAllocator.get());
+}
+
+
+void Application::DestroyMemoryAllocator() {
+   // allocator logs its statistics on destruction
+   m_MemoryAllocator.reset(nullptr);
+}
+
+
+void Application::CreateUploader() {
+   m_Uploader = std::make_unique<Uploader>(m_Device, m_PhysicalDevice, m_QueueFamilyIndices.GraphicsFamily.value(), m_GraphicsQueue, m_QueueFamilyIndices.TransferFamily, m_TransferQueue);
+}
+
+
+void Application::DestroyUploader() {
+   m_Uploader.reset(nullptr);
+}
+
+
 void Application::CreateSwapChain() {
+   if (m_Settings.IsHeadless) {
+      // One offscreen image per frame in flight stands in for the swap chain images.
+      // They are left in transfer src layout at the end of each frame, ready to be read back
+      m_Format = vk::Format::eB8G8R8A8Unorm;
+      m_Extent = vk::Extent2D {m_Settings.WindowWidth, m_Settings.WindowHeight};
+      m_PresentLayout = vk::ImageLayout::eTransferSrcOptimal;
+      m_SwapChainImages.reserve(m_Settings.MaxFramesInFlight);
+      for (uint32_t i = 0; i < m_Settings.MaxFramesInFlight; ++i) {
+         m_SwapChainImages.emplace_back(m_Device, m_PhysicalDevice, vk::ImageViewType::e2D, m_Extent.width, m_Extent.height, 1, vk::SampleCountFlagBits::e1, m_Format, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal);
+      }
+      return;
+   }
+
    vk::SwapchainKHR oldSwapChain = m_SwapChain;
 
    SwapChainSupportDetails swapChainSupport = QuerySwapChainSupport(m_PhysicalDevice, m_Surface);
@@ -458,6 +770,8 @@ void Application::DestroySwapChain(vk::SwapchainKHR& swapChain) {
       m_SwapChainImages.clear();
       m_Device.destroy(swapChain);
       swapChain = nullptr;
+   } else if (m_Settings.IsHeadless) {
+      m_SwapChainImages.clear();
    }
 }
 
@@ -521,7 +835,7 @@ void Application::CreateRenderPass() {
          vk::AttachmentLoadOp::eDontCare            /*stencilLoadOp*/,
          vk::AttachmentStoreOp::eDontCare           /*stencilStoreOp*/,
          vk::ImageLayout::eUndefined                /*initialLayout*/,
-         vk::ImageLayout::ePresentSrcKHR            /*finalLayout*/     // anti-aliasing = vk::ImageLayout::eColorAttachmentOptimal here
+         m_PresentLayout                            /*finalLayout*/     // anti-aliasing = vk::ImageLayout::eColorAttachmentOptimal here
       },
       {
          {}                                              /*flags*/,
@@ -682,6 +996,16 @@ void Application::DestroyCommandBuffers() {
 }
 
 
+void Application::CreateProfiler() {
+   m_Profiler = std::make_unique<Profiler>(m_Device, m_PhysicalDevice, m_QueueFamilyIndices.GraphicsFamily.value(), static_cast<uint32_t>(m_CommandBuffers.size()));
+}
+
+
+void Application::DestroyProfiler() {
+   m_Profiler.reset(nullptr);
+}
+
+
 void Application::CreateSyncObjects() {
    m_ImageAvailableSemaphores.reserve(m_Settings.MaxFramesInFlight);
    m_RenderFinishedSemaphores.reserve(m_Settings.MaxFramesInFlight);
@@ -719,14 +1043,92 @@ void Application::DestroySyncObjects() {
 }
 
 
+std::string Application::GetPipelineCacheFileName() const {
+   if (m_Settings.PipelineCacheFileName) {
+      return m_Settings.PipelineCacheFileName;
+   }
+   return GetSafeFileName(m_Settings.ApplicationName) + ".pipelinecache";
+}
+
+
+bool Application::IsPipelineCacheCompatible(const std::vector<char>& data) const {
+   if (data.size() < sizeof(PipelineCacheFileHeader)) {
+      return false;
+   }
+   PipelineCacheFileHeader fileHeader;
+   memcpy(&fileHeader, data.data(), sizeof(PipelineCacheFileHeader));
+   if ((fileHeader.m_Magic != s_PipelineCacheMagic) || (fileHeader.m_DataSize != data.size() - sizeof(PipelineCacheFileHeader))) {
+      CORE_LOG_WARN("Pipeline cache file is truncated or corrupt.  Ignoring it");
+      return false;
+   }
+   if (fileHeader.m_DriverVersion != m_PhysicalDeviceProperties.driverVersion) {
+      CORE_LOG_INFO("Pipeline cache file is from a different driver version.  Ignoring it");
+      return false;
+   }
+
+   // VkPipelineCacheHeaderVersionOne
+   const char* pData = data.data() + sizeof(PipelineCacheFileHeader);
+   uint32_t headerLength;
+   uint32_t headerVersion;
+   uint32_t vendorID;
+   uint32_t deviceID;
+   if (fileHeader.m_DataSize < 16 + VK_UUID_SIZE) {
+      return false;
+   }
+   memcpy(&headerLength, pData, sizeof(uint32_t));
+   memcpy(&headerVersion, pData + 4, sizeof(uint32_t));
+   memcpy(&vendorID, pData + 8, sizeof(uint32_t));
+   memcpy(&deviceID, pData + 12, sizeof(uint32_t));
+   if (
+      (headerLength < 16 + VK_UUID_SIZE) ||
+      (headerVersion != static_cast<uint32_t>(vk::PipelineCacheHeaderVersion::eOne)) ||
+      (vendorID != m_PhysicalDeviceProperties.vendorID) ||
+      (deviceID != m_PhysicalDeviceProperties.deviceID) ||
+      (memcmp(pData + 16, m_PhysicalDeviceProperties.pipelineCacheUUID.data(), VK_UUID_SIZE) != 0)
+   ) {
+      CORE_LOG_INFO("Pipeline cache file is for a different device.  Ignoring it");
+      return false;
+   }
+   return true;
+}
+
+
 void Application::CreatePipelineCache() {
-   m_PipelineCache = m_Device.createPipelineCache({});
+   std::string fileName = GetPipelineCacheFileName();
+   std::vector<char> data;
+   if (std::filesystem::exists(fileName)) {
+      data = ReadFile(fileName);
+   }
+
+   m_IsPipelineCacheWarm = IsPipelineCacheCompatible(data);
+   if (m_IsPipelineCacheWarm) {
+      m_PipelineCache = m_Device.createPipelineCache({
+         {}                                                 /*flags*/,
+         data.size() - sizeof(PipelineCacheFileHeader)     /*initialDataSize*/,
+         data.data() + sizeof(PipelineCacheFileHeader)     /*pInitialData*/
+      });
+      CORE_LOG_INFO("Loaded pipeline cache '{0}' ({1} bytes)", fileName, data.size());
+   } else {
+      m_PipelineCache = m_Device.createPipelineCache({});
+   }
 }
 
 
 void Application::DestroyPipelineCache() {
    if (m_Device && m_PipelineCache) {
+      std::vector<uint8_t> data = m_Device.getPipelineCacheData(m_PipelineCache);
+      std::string fileName = GetPipelineCacheFileName();
+      PipelineCacheFileHeader fileHeader = {
+         s_PipelineCacheMagic                       /*m_Magic*/,
+         m_PhysicalDeviceProperties.driverVersion   /*m_DriverVersion*/,
+         data.size()                                /*m_DataSize*/
+      };
+      if (!WriteFileAtomically(fileName, &fileHeader, sizeof(PipelineCacheFileHeader), data.data(), data.size())) {
+         CORE_LOG_WARN("failed to save pipeline cache '{0}'", fileName);
+      }
+
       m_Device.destroy(m_PipelineCache);
+      m_PipelineCache = nullptr;
    }
 }
 
@@ -734,22 +1136,35 @@ void Application::DestroyPipelineCache() {
 void Application::Update(double dt) {
    auto deltaTime = static_cast<float>(dt);
 
+   const glm::vec3 oldEye = m_Eye;
+   const glm::vec3 oldDirection = m_Direction;
+   const glm::vec3 oldUp = m_Up;
+
+   if (m_Benchmark) {
+      // keyboard and mouse are ignored, so that every run is the same
+      if (m_Benchmark->HasCameraPath()) {
+         m_Benchmark->GetCamera(m_LastTime, m_Eye, m_Direction, m_Up);
+      }
+      m_IsCameraMoved = (m_Eye != oldEye) || (m_Direction != oldDirection) || (m_Up != oldUp);
+      return;
+   }
+
    // TODO: abstract this into a camera controller
-   if (glfwGetKey(m_Window, GLFW_KEY_W) == GLFW_PRESS) {
+   if (IsKeyPressed(GLFW_KEY_W)) {
       m_Eye += deltaTime * m_Direction;
-   } else if (glfwGetKey(m_Window, GLFW_KEY_S) == GLFW_PRESS) {
+   } else if (IsKeyPressed(GLFW_KEY_S)) {
       m_Eye -= deltaTime * m_Direction;
    }
 
-   if (glfwGetKey(m_Window, GLFW_KEY_A) == GLFW_PRESS) {
+   if (IsKeyPressed(GLFW_KEY_A)) {
       m_Eye -= deltaTime * glm::cross(m_Direction, m_Up);
-   } else if (glfwGetKey(m_Window, GLFW_KEY_D) == GLFW_PRESS) {
+   } else if (IsKeyPressed(GLFW_KEY_D)) {
       m_Eye += deltaTime * glm::cross(m_Direction, m_Up);
    }
 
-   if (glfwGetKey(m_Window, GLFW_KEY_R) == GLFW_PRESS) {
+   if (IsKeyPressed(GLFW_KEY_R)) {
       m_Eye += deltaTime * m_Up * glm::length(m_Direction);
-   } else if (glfwGetKey(m_Window, GLFW_KEY_F) == GLFW_PRESS) {
+   } else if (IsKeyPressed(GLFW_KEY_F)) {
       m_Eye -= deltaTime * m_Up * glm::length(m_Direction);
    }
 
@@ -771,10 +1186,23 @@ void Application::Update(double dt) {
       m_Up = glm::rotate(m_Up, deltaTime * deltaY, right);
 
    }
+   m_IsCameraMoved = (m_Eye != oldEye) || (m_Direction != oldDirection) || (m_Up != oldUp);
 }
 
 
 void Application::BeginFrame() {
+   Profiler::CPUScope scope(m_Profiler.get(), "BeginFrame");
+   FlushUploads();
+
+   if (m_Settings.IsHeadless) {
+      // There is one offscreen image per frame in flight, so once the fence says the frame is done, so is the image
+      m_CurrentImage = m_CurrentFrame;
+      auto result = m_Device.waitForFences(m_InFlightFences[m_CurrentFrame], true, UINT64_MAX);
+      m_Profiler->CollectGPUResults(m_CurrentImage);
+      UpdateTopLevelAccelerationStructure();
+      return;
+   }
+
    auto rv = m_Device.acquireNextImageKHR(m_SwapChain, UINT64_MAX, m_ImageAvailableSemaphores[m_CurrentFrame], nullptr);
 
    if (rv.result == vk::Result::eErrorOutOfDateKHR) {
@@ -795,6 +1223,12 @@ void Application::BeginFrame() {
    // Note that m_CurrentFrame and m_CurrentImage are not necessarily equal (particularly if we have, say, 3 swap chain images, and 2 frames-in-flight)
    // However, we do know that the GPU has finished with m_CurrentImage'th command buffer so long as the m_CurrentFrame'th fence is signaled
    auto result = m_Device.waitForFences(m_InFlightFences[m_CurrentFrame], true, UINT64_MAX);
+
+   // The last time m_CurrentImage'th command buffer was submitted, it wrote some timestamps.  Those are now available.
+   m_Profiler->CollectGPUResults(m_CurrentImage);
+
+   // ...and the instances that it refits the TLAS to can be changed
+   UpdateTopLevelAccelerationStructure();
 }
 
 
@@ -803,6 +1237,19 @@ void Application::RenderFrame() {
 
 
 void Application::EndFrame() {
+   Profiler::CPUScope scope(m_Profiler.get(), "EndFrame");
+   if (m_Settings.IsHeadless) {
+      // nothing to wait for, and nothing to present
+      vk::SubmitInfo si;
+      si.commandBufferCount = 1;
+      si.pCommandBuffers = &m_CommandBuffers[m_CurrentImage];
+      m_Device.resetFences(m_InFlightFences[m_CurrentFrame]);
+      m_GraphicsQueue.submit(si, m_InFlightFences[m_CurrentFrame]);
+      m_Profiler->OnSubmit(m_CurrentImage);
+      m_CurrentFrame = ++m_CurrentFrame % m_Settings.MaxFramesInFlight;
+      return;
+   }
+
    vk::PipelineStageFlags waitStages[] = {{vk::PipelineStageFlagBits::eColorAttachmentOutput}};
    vk::SubmitInfo si = {
       1                                             /*waitSemaphoreCount*/,
@@ -816,6 +1263,7 @@ void Application::EndFrame() {
 
    m_Device.resetFences(m_InFlightFences[m_CurrentFrame]);
    m_GraphicsQueue.submit(si, m_InFlightFences[m_CurrentFrame]);
+   m_Profiler->OnSubmit(m_CurrentImage);
 
    vk::PresentInfoKHR pi = {
       1                                            /*waitSemaphoreCount*/,
@@ -859,6 +1307,12 @@ void Application::OnWindowResized() {
    // Command buffers need to be recreated as they may store references to the recreated frame buffers
    DestroyCommandBuffers();
    CreateCommandBuffers();
+   m_Profiler->SetSlotCount(static_cast<uint32_t>(m_CommandBuffers.size()));
+
+   // Number of command buffers could have changed, and with it the number of copies of the TLAS instances
+   if (m_TLAS.m_AccelerationStructure) {
+      CreateTopLevelInstanceBuffer();
+   }
    m_WantResize = false;
 }
 
@@ -888,13 +1342,26 @@ QueueFamilyIndices Application::FindQueueFamilies(vk::PhysicalDevice physicalDev
    QueueFamilyIndices indices;
 
    std::vector<vk::QueueFamilyProperties> queueFamilies = physicalDevice.getQueueFamilyProperties();
+
+   // dedicated transfer queue (if any) is typically a DMA engine that can run uploads alongside graphics work
+   for (uint32_t j = 0; j < queueFamilies.size(); ++j) {
+      const auto flags = queueFamilies[j].queueFlags;
+      if ((flags & vk::QueueFlagBits::eTransfer) && !(flags & vk::QueueFlagBits::eGraphics) && !(flags & vk::QueueFlagBits::eCompute)) {
+         indices.TransferFamily = j;
+         break;
+      }
+   }
+
    int i = 0;
    for (const auto& queueFamily : queueFamilies) {
       if (queueFamily.queueFlags & vk::QueueFlagBits::eGraphics) {
          indices.GraphicsFamily = i;
       }
 
-      if (physicalDevice.getSurfaceSupportKHR(i, m_Surface)) {
+      if (m_Settings.IsHeadless) {
+         // no presenting to be done.  Say that the graphics queue is the "present" queue so that the rest of the code does not need to care
+         indices.PresentFamily = indices.GraphicsFamily;
+      } else if (physicalDevice.getSurfaceSupportKHR(i, m_Surface)) {
          indices.PresentFamily = i;
       }
 
@@ -909,6 +1376,11 @@ QueueFamilyIndices Application::FindQueueFamilies(vk::PhysicalDevice physicalDev
 }
 
 
+bool Application::IsKeyPressed(const int key) const {
+   return m_Window && (glfwGetKey(m_Window, key) == GLFW_PRESS);
+}
+
+
 vk::Format Application::FindSupportedFormat(const std::vector<vk::Format>& candidates, vk::ImageTiling tiling, vk::FormatFeatureFlags features) {
    for (auto format : candidates) {
       vk::FormatProperties props = m_PhysicalDevice.getFormatProperties(format);
@@ -923,6 +1395,9 @@ vk::Format Application::FindSupportedFormat(const std::vector<vk::Format>& candi
 
 
 void Application::SubmitSingleTimeCommands(const std::function<void(vk::CommandBuffer)>& action) {
+   // action may well depend on things that are still sitting in the upload batch
+   FlushUploads();
+
    std::vector<vk::CommandBuffer> commandBuffers = m_Device.allocateCommandBuffers({
       m_CommandPool                    /*commandPool*/,
       vk::CommandBufferLevel::ePrimary /*level*/,
@@ -933,17 +1408,32 @@ void Application::SubmitSingleTimeCommands(const std::function<void(vk::CommandB
    action(commandBuffers[0]);
    commandBuffers[0].end();
 
+   // wait on a fence rather than m_GraphicsQueue.waitIdle(), so we do not also wait for anything else that happens to be on the queue
+   vk::Fence fence = m_Device.createFence({});
    vk::SubmitInfo si;
    si.commandBufferCount = 1;
    si.pCommandBuffers = commandBuffers.data();
-   m_GraphicsQueue.submit(si, nullptr);
-   m_GraphicsQueue.waitIdle();
+   m_GraphicsQueue.submit(si, fence);
+   if (m_Device.waitForFences(fence, true, UINT64_MAX) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to wait for single time commands fence!");
+   }
+   m_Device.destroy(fence);
    m_Device.freeCommandBuffers(m_CommandPool, commandBuffers);
 }
 
 
+void Application::UploadToBuffer(const void* pData, const vk::DeviceSize size, vk::Buffer dst, const vk::DeviceSize dstOffset) {
+   m_Uploader->UploadToBuffer(pData, size, dst, dstOffset);
+}
+
+
+void Application::UploadToImage(const void* pData, const vk::DeviceSize size, vk::Image image, const uint32_t width, const uint32_t height, const uint32_t mipLevels) {
+   m_Uploader->UploadToImage(pData, size, image, width, height, mipLevels);
+}
+
+
 void Application::CopyBuffer(vk::Buffer src, vk::Buffer dst, const vk::DeviceSize srcOffset, const vk::DeviceSize dstOffset, const vk::DeviceSize size) {
-   SubmitSingleTimeCommands([src, dst, srcOffset, dstOffset, size] (vk::CommandBuffer cmd) {
+   m_Uploader->Record([src, dst, srcOffset, dstOffset, size] (vk::CommandBuffer cmd) {
       vk::BufferCopy copyRegion = {
          srcOffset,
          dstOffset,
@@ -955,7 +1445,7 @@ void Application::CopyBuffer(vk::Buffer src, vk::Buffer dst, const vk::DeviceSiz
 
 
 void Application::TransitionImageLayout(vk::Image image, const vk::ImageLayout oldLayout, const vk::ImageLayout newLayout, const uint32_t mipLevels) {
-   SubmitSingleTimeCommands([image, oldLayout, newLayout, mipLevels] (vk::CommandBuffer cmd) {
+   m_Uploader->Record([image, oldLayout, newLayout, mipLevels] (vk::CommandBuffer cmd) {
       vk::ImageMemoryBarrier barrier = {
          {}                                  /*srcAccessMask*/,
          {}                                  /*dstAccessMask*/,
@@ -1006,7 +1496,7 @@ void Application::TransitionImageLayout(vk::Image image, const vk::ImageLayout o
 
 
 void Application::CopyBufferToImage(vk::Buffer buffer, vk::Image image, const uint32_t width, const uint32_t height) {
-   SubmitSingleTimeCommands([buffer, image, width, height] (vk::CommandBuffer cmd) {
+   m_Uploader->Record([buffer, image, width, height] (vk::CommandBuffer cmd) {
       vk::BufferImageCopy region = {
          0                                    /*bufferOffset*/,
          0                                    /*bufferRowLength*/,
@@ -1032,7 +1522,7 @@ void Application::GenerateMIPMaps(vk::Image image, const vk::Format format, cons
       throw std::runtime_error("texture image format does not support linear blitting!");
    }
 
-   SubmitSingleTimeCommands([image, width, height, mipLevels] (vk::CommandBuffer cmd) {
+   m_Uploader->Record([image, width, height, mipLevels] (vk::CommandBuffer cmd) {
       vk::ImageMemoryBarrier barrier = {
          {}                                   /*srcAccessMask*/,
          {}                                   /*dstAccessMask*/,
@@ -1099,82 +1589,619 @@ void Application::GenerateMIPMaps(vk::Image image, const vk::Format format, cons
 }
 
 
-void Application::BuildAccelerationStructure(AccelerationStructure& accelerationStructure, const vk::AccelerationStructureTypeKHR type, const GeometryGroup& geometryGroup) {
-   // TODO: It might be slightly nicer to not have to re-query this stuff here.  Do it once on app startup...
-   auto features = m_PhysicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceAccelerationStructureFeaturesKHR>();
-
-   vk::AccelerationStructureBuildGeometryInfoKHR accelerationStructureBuildGeometryInfo = {
-      type                                                          /*type*/,
-      vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace   /*flags*/,
-      vk::BuildAccelerationStructureModeKHR::eBuild                 /*mode*/,
-      {}                                                            /*srcAccelerationStructure*/,
-      {}                                                            /*dstAccelerationStructure*/,
-      1                                                             /*geometryCount*/,
-      geometryGroup.m_Geometries.data()                             /*pGeometries*/,
-      nullptr                                                       /*ppGeometries*/,
-      nullptr                                                       /*scratchData*/
-   };
+void Application::FlushUploads() {
+   if (m_Uploader) {
+      m_Uploader->Flush();
+   }
+}
+
 
-   std::vector<uint32_t> primitiveCounts;
-   primitiveCounts.reserve(geometryGroup.m_BuildRanges.size());
-   for (const auto& buildRange : geometryGroup.m_BuildRanges) {
-      primitiveCounts.emplace_back(buildRange.primitiveCount);
+void Application::QueryAccelerationStructureSupport() {
+   if (!m_IsAccelerationStructureSupportQueried) {
+      auto features = m_PhysicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceAccelerationStructureFeaturesKHR>();
+      auto properties = m_PhysicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceAccelerationStructurePropertiesKHR>();
+      m_AccelerationStructureFeatures = features.get<vk::PhysicalDeviceAccelerationStructureFeaturesKHR>();
+      m_AccelerationStructureProperties = properties.get<vk::PhysicalDeviceAccelerationStructurePropertiesKHR>();
+      m_IsAccelerationStructureSupportQueried = true;
+      if (m_Settings.IsHostAccelerationStructureBuildEnabled && !m_AccelerationStructureFeatures.accelerationStructureHostCommands) {
+         CORE_LOG_WARN("Device does not support host acceleration structure builds.  Acceleration structures will be built on the device");
+      }
    }
-   vk::AccelerationStructureBuildSizesInfoKHR accelerationStructureBuildSizesInfo = m_Device.getAccelerationStructureBuildSizesKHR(vk::AccelerationStructureBuildTypeKHR::eDevice, accelerationStructureBuildGeometryInfo, primitiveCounts);
+}
 
-   accelerationStructure.m_Buffer = std::make_unique<Buffer>(
-      m_Device,
-      m_PhysicalDevice,
-      accelerationStructureBuildSizesInfo.accelerationStructureSize,
-      vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
-      vk::MemoryPropertyFlagBits::eDeviceLocal
-   );
 
-   vk::AccelerationStructureCreateInfoKHR accelerationStructureCreateInfo = {
-      {}                                               /*createFlags*/,
-      accelerationStructure.m_Buffer->m_Buffer         /*buffer*/,
-      {}                                               /*offset*/,
-      {}                                               /*size*/,
-      type                                             /*type*/,
-      {}                                               /*deviceAddress*/
-   };
+bool Application::IsHostAccelerationStructureBuild() {
+   QueryAccelerationStructureSupport();
+   return m_Settings.IsHostAccelerationStructureBuildEnabled && m_AccelerationStructureFeatures.accelerationStructureHostCommands;
+}
 
-   accelerationStructure.m_AccelerationStructure = m_Device.createAccelerationStructureKHR(accelerationStructureCreateInfo);
-   accelerationStructure.m_DeviceAddress = m_Device.getAccelerationStructureAddressKHR({ accelerationStructure.m_AccelerationStructure });
 
-   Buffer scratch(
-      m_Device,
-      m_PhysicalDevice,
-      accelerationStructureBuildSizesInfo.buildScratchSize,
-      vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
-      vk::MemoryPropertyFlagBits::eDeviceLocal
-   );
+void Application::BuildAccelerationStructure(AccelerationStructure& accelerationStructure, const vk::AccelerationStructureTypeKHR type, const GeometryGroup& geometryGroup) {
+   BuildAccelerationStructures({&accelerationStructure}, type, geometryGroup);
+}
+
+
+void Application::BuildAccelerationStructures(const std::vector<AccelerationStructure*>& accelerationStructures, const vk::AccelerationStructureTypeKHR type, vk::ArrayProxy<const GeometryGroup> geometryGroups, const vk::BuildAccelerationStructureFlagsKHR flags) {
+   CORE_ASSERT(accelerationStructures.size() == geometryGroups.size(), "BuildAccelerationStructures(): must have one geometry group per acceleration structure");
+   Profiler::CPUScope scope(m_Profiler.get(), "BuildAccelerationStructures");
+   auto startTime = std::chrono::steady_clock::now();
+
+   QueryAccelerationStructureSupport();
+   const vk::DeviceSize scratchAlignment = m_AccelerationStructureProperties.minAccelerationStructureScratchOffsetAlignment;
+
+   // Host builds read their inputs from host memory, and build into memory that the host can write to, with host scratch.
+   // All of the geometry groups have to be one or the other
+   const bool isHostBuild = !geometryGroups.empty() && geometryGroups.front().m_IsOnHost;
+   CORE_ASSERT(std::all_of(geometryGroups.begin(), geometryGroups.end(), [isHostBuild](const GeometryGroup& group) { return group.m_IsOnHost == isHostBuild; }), "BuildAccelerationStructures(): geometry groups must be all on the host, or all on the device");
+   CORE_ASSERT(!isHostBuild || IsHostAccelerationStructureBuild(), "BuildAccelerationStructures(): host builds are not enabled");
+
+   // build inputs (vertices, indices, instances etc.) must have finished uploading
+   FlushUploads();
 
-   accelerationStructureBuildGeometryInfo.dstAccelerationStructure = accelerationStructure.m_AccelerationStructure;
-   accelerationStructureBuildGeometryInfo.scratchData.deviceAddress = scratch.GetBufferDeviceAddress();
+   // Size everything up front, and create the acceleration structures
+   std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> buildGeometryInfos;
+   std::vector<const vk::AccelerationStructureBuildRangeInfoKHR*> buildRanges;
+   std::vector<vk::DeviceSize> scratchSizes;
+   buildGeometryInfos.reserve(geometryGroups.size());
+   buildRanges.reserve(geometryGroups.size());
+   scratchSizes.reserve(geometryGroups.size());
+   vk::DeviceSize totalSize = 0;
+   vk::DeviceSize maxScratchSize = 0;
+   vk::DeviceSize totalScratchSize = 0;
 
-   if (features.get<vk::PhysicalDeviceAccelerationStructureFeaturesKHR>().accelerationStructureHostCommands) {
-      // build on host
-      m_Device.buildAccelerationStructuresKHR(
-         {},
-         accelerationStructureBuildGeometryInfo,
-         geometryGroup.m_BuildRanges.data()
+   uint32_t i = 0;
+   for (const auto& geometryGroup : geometryGroups) {
+      AccelerationStructure& accelerationStructure = *accelerationStructures[i++];
+      vk::AccelerationStructureBuildGeometryInfoKHR buildGeometryInfo = {
+         type                                                          /*type*/,
+         flags                                                         /*flags*/,
+         vk::BuildAccelerationStructureModeKHR::eBuild                 /*mode*/,
+         {}                                                            /*srcAccelerationStructure*/,
+         {}                                                            /*dstAccelerationStructure*/,
+         static_cast<uint32_t>(geometryGroup.m_Geometries.size())      /*geometryCount*/,
+         geometryGroup.m_Geometries.data()                             /*pGeometries*/,
+         nullptr                                                       /*ppGeometries*/,
+         nullptr                                                       /*scratchData*/
+      };
+
+      std::vector<uint32_t> primitiveCounts;
+      primitiveCounts.reserve(geometryGroup.m_BuildRanges.size());
+      for (const auto& buildRange : geometryGroup.m_BuildRanges) {
+         primitiveCounts.emplace_back(buildRange.primitiveCount);
+      }
+      vk::AccelerationStructureBuildSizesInfoKHR buildSizesInfo = m_Device.getAccelerationStructureBuildSizesKHR(isHostBuild ? vk::AccelerationStructureBuildTypeKHR::eHost : vk::AccelerationStructureBuildTypeKHR::eDevice, buildGeometryInfo, primitiveCounts);
+      if (isHostBuild) {
+         // Whatever is built on the host can still be compacted, refit or rebuilt on the device afterwards (e.g. UpdateTopLevelAccelerationStructure()),
+         // so must be big enough for a device build as well
+         vk::AccelerationStructureBuildSizesInfoKHR deviceBuildSizesInfo = m_Device.getAccelerationStructureBuildSizesKHR(vk::AccelerationStructureBuildTypeKHR::eDevice, buildGeometryInfo, primitiveCounts);
+         buildSizesInfo.accelerationStructureSize = std::max(buildSizesInfo.accelerationStructureSize, deviceBuildSizesInfo.accelerationStructureSize);
+      }
+
+      accelerationStructure.m_Buffer = std::make_unique<Buffer>(
+         m_Device,
+         m_PhysicalDevice,
+         buildSizesInfo.accelerationStructureSize,
+         vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
+         isHostBuild ? vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent : vk::MemoryPropertyFlagBits::eDeviceLocal
       );
+
+      vk::AccelerationStructureCreateInfoKHR accelerationStructureCreateInfo = {
+         {}                                               /*createFlags*/,
+         accelerationStructure.m_Buffer->m_Buffer         /*buffer*/,
+         {}                                               /*offset*/,
+         buildSizesInfo.accelerationStructureSize         /*size*/,
+         type                                             /*type*/,
+         {}                                               /*deviceAddress*/
+      };
+
+      accelerationStructure.m_AccelerationStructure = m_Device.createAccelerationStructureKHR(accelerationStructureCreateInfo);
+      accelerationStructure.m_DeviceAddress = m_Device.getAccelerationStructureAddressKHR({ accelerationStructure.m_AccelerationStructure });
+
+      buildGeometryInfo.dstAccelerationStructure = accelerationStructure.m_AccelerationStructure;
+      buildGeometryInfos.emplace_back(buildGeometryInfo);
+      buildRanges.emplace_back(geometryGroup.m_BuildRanges.data());
+
+      const vk::DeviceSize scratchSize = (buildSizesInfo.buildScratchSize + scratchAlignment - 1) / scratchAlignment * scratchAlignment;
+      scratchSizes.emplace_back(scratchSize);
+      totalSize += buildSizesInfo.accelerationStructureSize;
+      totalScratchSize += scratchSize;
+      maxScratchSize = std::max(maxScratchSize, scratchSize);
+   }
+
+   // One scratch arena is shared by all of the builds.
+   // Ideally, it is big enough for every build to have its own piece, so that they can all go in a single vkCmdBuildAccelerationStructuresKHR.
+   // If that would be too big, then the builds are split into batches that each fit into the arena, with a barrier between batches
+   // so that the next batch does not stomp on scratch memory that the previous one is still using.
+   // Scratch is only needed for the duration of the builds, so linear sub-allocation is fine.
+   // (its device address must be aligned to minAccelerationStructureScratchOffsetAlignment, which is not implied by the buffer memory requirements)
+   // Host builds use plain host memory for scratch.
+   const vk::DeviceSize scratchArenaSize = std::max(maxScratchSize, std::min(totalScratchSize, m_Settings.MaxAccelerationStructureScratchSize));
+   std::unique_ptr<Buffer> scratch;
+   std::vector<uint8_t> hostScratch;
+   vk::DeviceAddress scratchAddress = 0;
+   if (isHostBuild) {
+      hostScratch.resize(scratchArenaSize);
    } else {
-      // build on device
-      SubmitSingleTimeCommands([&accelerationStructureBuildGeometryInfo, &geometryGroup](vk::CommandBuffer cmd) {
-         cmd.buildAccelerationStructuresKHR(accelerationStructureBuildGeometryInfo, geometryGroup.m_BuildRanges.data());
+      scratch = std::make_unique<Buffer>(
+         m_Device,
+         m_PhysicalDevice,
+         scratchArenaSize,
+         vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
+         vk::MemoryPropertyFlagBits::eDeviceLocal,
+         MemoryAllocator::Strategy::Linear,
+         scratchAlignment
+      );
+      scratchAddress = scratch->GetBufferDeviceAddress();
+   }
+
+   std::vector<std::pair<uint32_t, uint32_t>> batches;   // first, count
+   vk::DeviceSize scratchOffset = 0;
+   for (uint32_t j = 0; j < buildGeometryInfos.size(); ++j) {
+      if (batches.empty() || (scratchOffset + scratchSizes[j] > scratchArenaSize)) {
+         batches.emplace_back(j, 0);
+         scratchOffset = 0;
+      }
+      if (isHostBuild) {
+         buildGeometryInfos[j].scratchData.hostAddress = hostScratch.data() + scratchOffset;
+      } else {
+         buildGeometryInfos[j].scratchData.deviceAddress = scratchAddress + scratchOffset;
+      }
+      scratchOffset += scratchSizes[j];
+      ++batches.back().second;
+   }
+
+   uint32_t threadCount = 1;
+   if (isHostBuild) {
+      // Each build is its own deferred operation, so that independent builds can proceed concurrently.
+      // (builds in a batch have separate pieces of scratch, but batches must still be done one after the other)
+      for (const auto& [first, count] : batches) {
+         std::vector<vk::DeferredOperationKHR> operations;
+         operations.reserve(count);
+         for (uint32_t j = first; j < first + count; ++j) {
+            vk::DeferredOperationKHR operation = m_Device.createDeferredOperationKHR();
+            vk::Result result = m_Device.buildAccelerationStructuresKHR(operation, 1, &buildGeometryInfos[j], &buildRanges[j]);
+            if (result == vk::Result::eOperationDeferredKHR) {
+               operations.emplace_back(operation);
+            } else {
+               // eOperationNotDeferredKHR (or eSuccess) means it has already been done
+               m_Device.destroy(operation);
+               if ((result != vk::Result::eSuccess) && (result != vk::Result::eOperationNotDeferredKHR)) {
+                  throw std::runtime_error("failed to build acceleration structures on host");
+               }
+            }
+         }
+         threadCount = std::max(threadCount, JoinDeferredOperations(operations));
+      }
+   } else {
+      SubmitSingleTimeCommands([&buildGeometryInfos, &buildRanges, &batches](vk::CommandBuffer cmd) {
+         for (uint32_t j = 0; j < batches.size(); ++j) {
+            if (j > 0) {
+               vk::MemoryBarrier barrier = {
+                  vk::AccessFlagBits::eAccelerationStructureWriteKHR                                                 /*srcAccessMask*/,
+                  vk::AccessFlagBits::eAccelerationStructureReadKHR | vk::AccessFlagBits::eAccelerationStructureWriteKHR /*dstAccessMask*/
+               };
+               cmd.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {}, barrier, nullptr, nullptr);
+            }
+            const auto [first, count] = batches[j];
+            cmd.buildAccelerationStructuresKHR(count, buildGeometryInfos.data() + first, buildRanges.data() + first);
+         }
       });
    }
 
+   std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+   CORE_LOG_INFO("Built {0} {1} acceleration structure(s) ({2:.2f} MB, {3:.2f} MB scratch) in {4} batch(es) on {5}, {6:.2f}ms", buildGeometryInfos.size(), type == vk::AccelerationStructureTypeKHR::eTopLevel ? "top level" : "bottom level", totalSize / (1024.0 * 1024.0), scratchArenaSize / (1024.0 * 1024.0), batches.size(), isHostBuild ? "host (" + std::to_string(threadCount) + " thread(s))" : std::string("device"), elapsed.count() * 1000.0);
+}
+
+
+uint32_t Application::JoinDeferredOperations(const std::vector<vk::DeferredOperationKHR>& operations) {
+   if (operations.empty()) {
+      return 0;
+   }
+
+   // Enough threads to keep every operation as busy as it can be, but no more than the machine has.
+   uint32_t maxConcurrency = 0;
+   for (const auto operation : operations) {
+      maxConcurrency += m_Device.getDeferredOperationMaxConcurrencyKHR(operation);
+   }
+   const uint32_t threadCount = std::max(1u, std::min(maxConcurrency, std::max(1u, std::thread::hardware_concurrency())));
+
+   // Each thread works on an operation until that operation has nothing more for it to do (eThreadDoneKHR, or eSuccess),
+   // and then moves on to the next one.  Operations that still have other threads working on them are revisited, since
+   // the implementation might not have been able to split the work up until it got going (eThreadIdleKHR).
+   std::atomic<uint32_t> next = 0;
+   auto worker = [this, &operations, &next] () {
+      for (uint32_t i = next++; i < operations.size(); i = next++) {
+         vk::Result result;
+         do {
+            result = m_Device.deferredOperationJoinKHR(operations[i]);
+            if (result == vk::Result::eThreadIdleKHR) {
+               std::this_thread::yield();
+            }
+         } while (result == vk::Result::eThreadIdleKHR);
+      }
+   };
+
+   // The calling thread is one of the workers
+   std::vector<std::thread> threads;
+   threads.reserve(threadCount - 1);
+   for (uint32_t i = 1; i < threadCount; ++i) {
+      threads.emplace_back(worker);
+   }
+   worker();
+   for (auto& thread : threads) {
+      thread.join();
+   }
+
+   // eThreadDoneKHR from a join only means "nothing more for this thread", not that the operation is complete.
+   // Any operation still going is finished off here.
+   bool isFailed = false;
+   for (const auto operation : operations) {
+      vk::Result result = m_Device.getDeferredOperationResultKHR(operation);
+      while (result == vk::Result::eNotReady) {
+         if (m_Device.deferredOperationJoinKHR(operation) == vk::Result::eThreadIdleKHR) {
+            std::this_thread::yield();
+         }
+         result = m_Device.getDeferredOperationResultKHR(operation);
+      }
+      isFailed = isFailed || (result != vk::Result::eSuccess);
+      m_Device.destroy(operation);
+   }
+   if (isFailed) {
+      throw std::runtime_error("failed to build acceleration structures on host");
+   }
+   return threadCount;
 }
 
 
-void Application::CreateBottomLevelAccelerationStructures(vk::ArrayProxy<GeometryGroup> geometryGroups) {
+void Application::CreateBottomLevelAccelerationStructures(vk::ArrayProxy<GeometryGroup> geometryGroups, const std::vector<uint64_t>& cacheKeys) {
+   CORE_ASSERT(cacheKeys.empty() || (cacheKeys.size() == geometryGroups.size()), "CreateBottomLevelAccelerationStructures(): must have one cache key per geometry group");
+   const size_t first = m_BLAS.size();
+   m_BLAS.resize(first + geometryGroups.size());
+   std::vector<AccelerationStructure*> accelerationStructures;
+   accelerationStructures.reserve(geometryGroups.size());
+   for (size_t i = first; i < m_BLAS.size(); ++i) {
+      accelerationStructures.emplace_back(&m_BLAS[i]);
+   }
+
+   const vk::BuildAccelerationStructureFlagsKHR flags = m_Settings.IsAccelerationStructureCompactionEnabled ?
+      vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace | vk::BuildAccelerationStructureFlagBitsKHR::eAllowCompaction :
+      vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace
+   ;
+
+   // Anything that is in the cache does not need to be built.
+   // Cached BLAS are only any good if they were built the same way, so build flags are part of the key as well as content
+   const bool isCacheEnabled = m_Settings.IsAccelerationStructureCacheEnabled && !cacheKeys.empty();
+   std::vector<uint64_t> flagsCacheKeys;
+   std::vector<bool> isLoaded(accelerationStructures.size(), false);
+   if (isCacheEnabled) {
+      const VkBuildAccelerationStructureFlagsKHR flagBits = static_cast<VkBuildAccelerationStructureFlagsKHR>(flags);
+      flagsCacheKeys.reserve(cacheKeys.size());
+      for (const uint64_t cacheKey : cacheKeys) {
+         flagsCacheKeys.emplace_back(HashBytes(&flagBits, sizeof(flagBits), cacheKey));
+      }
+      isLoaded = LoadAccelerationStructures(accelerationStructures, vk::AccelerationStructureTypeKHR::eBottomLevel, flagsCacheKeys);
+   }
+
+   std::vector<AccelerationStructure*> toBuild;
+   std::vector<GeometryGroup> toBuildGeometryGroups;
+   std::vector<uint64_t> toBuildCacheKeys;
+   uint32_t i = 0;
    for (const auto& geometryGroup : geometryGroups) {
-      m_BLAS.emplace_back();
-      BuildAccelerationStructure(m_BLAS.back(), vk::AccelerationStructureTypeKHR::eBottomLevel, geometryGroup);
+      if (!isLoaded[i]) {
+         toBuild.emplace_back(accelerationStructures[i]);
+         toBuildGeometryGroups.emplace_back(geometryGroup);
+         if (isCacheEnabled) {
+            toBuildCacheKeys.emplace_back(flagsCacheKeys[i]);
+         }
+      }
+      ++i;
+   }
+   if (toBuild.empty()) {
+      return;
+   }
+
+   // All of the BLAS are built together (see BuildAccelerationStructures())
+   BuildAccelerationStructures(toBuild, vk::AccelerationStructureTypeKHR::eBottomLevel, toBuildGeometryGroups, flags);
+   if (flags & vk::BuildAccelerationStructureFlagBitsKHR::eAllowCompaction) {
+      CompactAccelerationStructures(toBuild, vk::AccelerationStructureTypeKHR::eBottomLevel);
+   }
+
+   if (isCacheEnabled) {
+      SaveAccelerationStructures(toBuild, toBuildCacheKeys);
+   }
+}
+
+
+std::string Application::GetAccelerationStructureCacheFileName(const uint64_t cacheKey) const {
+   std::string directory = m_Settings.AccelerationStructureCacheDirectory ? m_Settings.AccelerationStructureCacheDirectory : GetSafeFileName(m_Settings.ApplicationName) + ".ascache";
+   char name[32];
+   snprintf(name, sizeof(name), "%016llx.blas", static_cast<unsigned long long>(cacheKey));
+   return (std::filesystem::path(directory) / name).string();
+}
+
+
+std::vector<bool> Application::LoadAccelerationStructures(const std::vector<AccelerationStructure*>& accelerationStructures, const vk::AccelerationStructureTypeKHR type, const std::vector<uint64_t>& cacheKeys) {
+   Profiler::CPUScope scope(m_Profiler.get(), "LoadAccelerationStructures");
+   auto startTime = std::chrono::steady_clock::now();
+   std::vector<bool> isLoaded(accelerationStructures.size(), false);
+
+   // Read (and check) the files
+   const size_t versionDataSize = 2 * VK_UUID_SIZE;
+   const size_t minDataSize = versionDataSize + 2 * sizeof(uint64_t);
+   std::vector<std::vector<char>> files(accelerationStructures.size());
+   std::vector<uint64_t> deserializedSizes(accelerationStructures.size());
+   for (size_t i = 0; i < accelerationStructures.size(); ++i) {
+      std::string fileName = GetAccelerationStructureCacheFileName(cacheKeys[i]);
+      if (!std::filesystem::exists(fileName)) {
+         ++m_AccelerationStructureCacheMisses;
+         continue;
+      }
+      std::vector<char> data = ReadFile(fileName);
+      AccelerationStructureCacheFileHeader fileHeader = {};
+      if (data.size() >= sizeof(AccelerationStructureCacheFileHeader)) {
+         memcpy(&fileHeader, data.data(), sizeof(AccelerationStructureCacheFileHeader));
+      }
+      if (
+         (fileHeader.m_Magic != s_AccelerationStructureCacheMagic) ||
+         (fileHeader.m_CacheKey != cacheKeys[i]) ||
+         (fileHeader.m_DataSize < minDataSize) ||
+         (fileHeader.m_DataSize != data.size() - sizeof(AccelerationStructureCacheFileHeader))
+      ) {
+         CORE_LOG_WARN("Acceleration structure cache file '{0}' is truncated or corrupt.  Ignoring it", fileName);
+         ++m_AccelerationStructureCacheMisses;
+         continue;
+      }
+
+      const uint8_t* pData = reinterpret_cast<const uint8_t*>(data.data() + sizeof(AccelerationStructureCacheFileHeader));
+      vk::AccelerationStructureVersionInfoKHR versionInfo = {pData};
+      if (m_Device.getAccelerationStructureCompatibilityKHR(versionInfo) != vk::AccelerationStructureCompatibilityKHR::eCompatible) {
+         CORE_LOG_INFO("Acceleration structure cache file '{0}' is for a different device or driver.  Ignoring it", fileName);
+         ++m_AccelerationStructureCacheMisses;
+         continue;
+      }
+      memcpy(&deserializedSizes[i], pData + versionDataSize + sizeof(uint64_t), sizeof(uint64_t));
+      files[i] = std::move(data);
+      ++m_AccelerationStructureCacheHits;
+   }
+
+   // Deserialize everything that passed the checks in one go
+   std::vector<std::unique_ptr<Buffer>> serializedBuffers;
+   std::vector<vk::CopyMemoryToAccelerationStructureInfoKHR> copyInfos;
+   vk::DeviceSize totalSize = 0;
+   for (size_t i = 0; i < accelerationStructures.size(); ++i) {
+      if (files[i].empty()) {
+         continue;
+      }
+      const vk::DeviceSize dataSize = files[i].size() - sizeof(AccelerationStructureCacheFileHeader);
+      serializedBuffers.emplace_back(std::make_unique<Buffer>(
+         m_Device,
+         m_PhysicalDevice,
+         dataSize,
+         vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
+         vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+         MemoryAllocator::Strategy::Linear,
+         s_AccelerationStructureSerializationAlignment
+      ));
+      serializedBuffers.back()->CopyFromHost(0, dataSize, files[i].data() + sizeof(AccelerationStructureCacheFileHeader));
+
+      AccelerationStructure& accelerationStructure = *accelerationStructures[i];
+      accelerationStructure.m_Buffer = std::make_unique<Buffer>(
+         m_Device,
+         m_PhysicalDevice,
+         deserializedSizes[i],
+         vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
+         vk::MemoryPropertyFlagBits::eDeviceLocal
+      );
+      vk::AccelerationStructureCreateInfoKHR accelerationStructureCreateInfo = {
+         {}                                               /*createFlags*/,
+         accelerationStructure.m_Buffer->m_Buffer         /*buffer*/,
+         {}                                               /*offset*/,
+         deserializedSizes[i]                             /*size*/,
+         type                                             /*type*/,
+         {}                                               /*deviceAddress*/
+      };
+      accelerationStructure.m_AccelerationStructure = m_Device.createAccelerationStructureKHR(accelerationStructureCreateInfo);
+      accelerationStructure.m_DeviceAddress = m_Device.getAccelerationStructureAddressKHR({ accelerationStructure.m_AccelerationStructure });
+
+      copyInfos.push_back({
+         serializedBuffers.back()->GetBufferDeviceAddress()   /*src*/,
+         accelerationStructure.m_AccelerationStructure        /*dst*/,
+         vk::CopyAccelerationStructureModeKHR::eDeserialize   /*mode*/
+      });
+      totalSize += deserializedSizes[i];
+      isLoaded[i] = true;
+   }
+
+   if (!copyInfos.empty()) {
+      SubmitSingleTimeCommands([&copyInfos](vk::CommandBuffer cmd) {
+         for (const auto& copyInfo : copyInfos) {
+            cmd.copyMemoryToAccelerationStructureKHR(copyInfo);
+         }
+      });
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+      CORE_LOG_INFO("Loaded {0} of {1} acceleration structure(s) from cache ({2:.2f} MB), {3:.2f}ms", copyInfos.size(), accelerationStructures.size(), totalSize / (1024.0 * 1024.0), elapsed.count() * 1000.0);
+   }
+   return isLoaded;
+}
+
+
+void Application::SaveAccelerationStructures(const std::vector<AccelerationStructure*>& accelerationStructures, const std::vector<uint64_t>& cacheKeys) {
+   if (accelerationStructures.empty()) {
+      return;
+   }
+   Profiler::CPUScope scope(m_Profiler.get(), "SaveAccelerationStructures");
+
+   const uint32_t count = static_cast<uint32_t>(accelerationStructures.size());
+   std::vector<vk::AccelerationStructureKHR> handles;
+   handles.reserve(count);
+   for (const auto accelerationStructure : accelerationStructures) {
+      handles.emplace_back(accelerationStructure->m_AccelerationStructure);
+   }
+
+   vk::QueryPool queryPool = m_Device.createQueryPool({
+      {}                                                          /*flags*/,
+      vk::QueryType::eAccelerationStructureSerializationSizeKHR   /*queryType*/,
+      count                                                       /*queryCount*/,
+      {}                                                          /*pipelineStatistics*/
+   });
+   SubmitSingleTimeCommands([&handles, queryPool, count](vk::CommandBuffer cmd) {
+      vk::MemoryBarrier barrier = {
+         vk::AccessFlagBits::eAccelerationStructureWriteKHR  /*srcAccessMask*/,
+         vk::AccessFlagBits::eAccelerationStructureReadKHR   /*dstAccessMask*/
+      };
+      cmd.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {}, barrier, nullptr, nullptr);
+      cmd.resetQueryPool(queryPool, 0, count);
+      cmd.writeAccelerationStructuresPropertiesKHR(handles, vk::QueryType::eAccelerationStructureSerializationSizeKHR, queryPool, 0);
+   });
+   std::vector<vk::DeviceSize> serializedSizes(count);
+   auto result = m_Device.getQueryPoolResults(queryPool, 0, count, serializedSizes.size() * sizeof(vk::DeviceSize), serializedSizes.data(), sizeof(vk::DeviceSize), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+   m_Device.destroy(queryPool);
+   if (result != vk::Result::eSuccess) {
+      CORE_LOG_WARN("Failed to query acceleration structure serialization sizes ({0}).  Acceleration structures will not be cached", vk::to_string(result));
+      return;
+   }
+
+   std::vector<std::unique_ptr<Buffer>> serializedBuffers;
+   std::vector<vk::CopyAccelerationStructureToMemoryInfoKHR> copyInfos;
+   for (uint32_t i = 0; i < count; ++i) {
+      serializedBuffers.emplace_back(std::make_unique<Buffer>(
+         m_Device,
+         m_PhysicalDevice,
+         serializedSizes[i],
+         vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eShaderDeviceAddress,
+         vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+         MemoryAllocator::Strategy::Linear,
+         s_AccelerationStructureSerializationAlignment
+      ));
+      copyInfos.push_back({
+         handles[i]                                           /*src*/,
+         serializedBuffers.back()->GetBufferDeviceAddress()   /*dst*/,
+         vk::CopyAccelerationStructureModeKHR::eSerialize     /*mode*/
+      });
+   }
+   SubmitSingleTimeCommands([&copyInfos](vk::CommandBuffer cmd) {
+      for (const auto& copyInfo : copyInfos) {
+         cmd.copyAccelerationStructureToMemoryKHR(copyInfo);
+      }
+      vk::MemoryBarrier barrier = {
+         vk::AccessFlagBits::eTransferWrite   /*srcAccessMask*/,
+         vk::AccessFlagBits::eHostRead        /*dstAccessMask*/
+      };
+      cmd.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eHost, {}, barrier, nullptr, nullptr);
+   });
+
+   std::error_code ec;
+   std::filesystem::create_directories(std::filesystem::path(GetAccelerationStructureCacheFileName(0)).parent_path(), ec);
+   vk::DeviceSize totalSize = 0;
+   for (uint32_t i = 0; i < count; ++i) {
+      std::string fileName = GetAccelerationStructureCacheFileName(cacheKeys[i]);
+      AccelerationStructureCacheFileHeader fileHeader = {
+         s_AccelerationStructureCacheMagic   /*m_Magic*/,
+         0                                   /*m_Reserved*/,
+         cacheKeys[i]                        /*m_CacheKey*/,
+         serializedSizes[i]                  /*m_DataSize*/
+      };
+      if (WriteFileAtomically(fileName, &fileHeader, sizeof(AccelerationStructureCacheFileHeader), serializedBuffers[i]->m_pMappedData, static_cast<size_t>(serializedSizes[i]))) {
+         totalSize += serializedSizes[i];
+      } else {
+         CORE_LOG_WARN("failed to save acceleration structure cache file '{0}'", fileName);
+      }
+   }
+   CORE_LOG_INFO("Saved {0} acceleration structure(s) to cache ({1:.2f} MB)", count, totalSize / (1024.0 * 1024.0));
+}
+
+
+void Application::CompactAccelerationStructures(const std::vector<AccelerationStructure*>& accelerationStructures, const vk::AccelerationStructureTypeKHR type) {
+   if (accelerationStructures.empty()) {
+      return;
+   }
+   Profiler::CPUScope scope(m_Profiler.get(), "CompactAccelerationStructures");
+   auto startTime = std::chrono::steady_clock::now();
+
+   // The acceleration structures must have been built with eAllowCompaction, and the build must have finished
+   // (which it has, since BuildAccelerationStructures() waits for it).
+   // Compaction is always done with device commands (even if the build was on the host), as it is just a query and a copy.
+   const uint32_t count = static_cast<uint32_t>(accelerationStructures.size());
+   std::vector<vk::AccelerationStructureKHR> handles;
+   handles.reserve(count);
+   for (const auto accelerationStructure : accelerationStructures) {
+      handles.emplace_back(accelerationStructure->m_AccelerationStructure);
+   }
+
+   vk::QueryPool queryPool = m_Device.createQueryPool({
+      {}                                                          /*flags*/,
+      vk::QueryType::eAccelerationStructureCompactedSizeKHR       /*queryType*/,
+      count                                                       /*queryCount*/,
+      {}                                                          /*pipelineStatistics*/
+   });
+
+   SubmitSingleTimeCommands([&handles, queryPool, count](vk::CommandBuffer cmd) {
+      vk::MemoryBarrier barrier = {
+         vk::AccessFlagBits::eAccelerationStructureWriteKHR  /*srcAccessMask*/,
+         vk::AccessFlagBits::eAccelerationStructureReadKHR   /*dstAccessMask*/
+      };
+      cmd.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {}, barrier, nullptr, nullptr);
+      cmd.resetQueryPool(queryPool, 0, count);
+      cmd.writeAccelerationStructuresPropertiesKHR(handles, vk::QueryType::eAccelerationStructureCompactedSizeKHR, queryPool, 0);
+   });
+
+   std::vector<vk::DeviceSize> compactedSizes(count);
+   auto result = m_Device.getQueryPoolResults(queryPool, 0, count, compactedSizes.size() * sizeof(vk::DeviceSize), compactedSizes.data(), sizeof(vk::DeviceSize), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+   m_Device.destroy(queryPool);
+   if (result != vk::Result::eSuccess) {
+      CORE_LOG_WARN("Failed to query compacted acceleration structure sizes ({0}).  Acceleration structures will not be compacted", vk::to_string(result));
+      return;
+   }
+
+   // Create right-sized acceleration structures, and copy the originals into them
+   std::vector<AccelerationStructure> compacted(count);
+   for (uint32_t i = 0; i < count; ++i) {
+      compacted[i].m_Buffer = std::make_unique<Buffer>(
+         m_Device,
+         m_PhysicalDevice,
+         compactedSizes[i],
+         vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
+         vk::MemoryPropertyFlagBits::eDeviceLocal
+      );
+
+      vk::AccelerationStructureCreateInfoKHR accelerationStructureCreateInfo = {
+         {}                                               /*createFlags*/,
+         compacted[i].m_Buffer->m_Buffer                  /*buffer*/,
+         {}                                               /*offset*/,
+         compactedSizes[i]                                /*size*/,
+         type                                             /*type*/,
+         {}                                               /*deviceAddress*/
+      };
+      compacted[i].m_AccelerationStructure = m_Device.createAccelerationStructureKHR(accelerationStructureCreateInfo);
+      compacted[i].m_DeviceAddress = m_Device.getAccelerationStructureAddressKHR({ compacted[i].m_AccelerationStructure });
+   }
+
+   SubmitSingleTimeCommands([&handles, &compacted](vk::CommandBuffer cmd) {
+      for (size_t i = 0; i < handles.size(); ++i) {
+         cmd.copyAccelerationStructureKHR({
+            handles[i]                                           /*src*/,
+            compacted[i].m_AccelerationStructure                 /*dst*/,
+            vk::CopyAccelerationStructureModeKHR::eCompact       /*mode*/
+         });
+      }
+   });
+
+   // Swap the compacted ones in, and free the originals
+   vk::DeviceSize totalOriginalSize = 0;
+   vk::DeviceSize totalCompactedSize = 0;
+   for (uint32_t i = 0; i < count; ++i) {
+      AccelerationStructure& accelerationStructure = *accelerationStructures[i];
+      const vk::DeviceSize originalSize = accelerationStructure.m_Buffer->m_Size;
+      CORE_LOG_INFO("Compacted acceleration structure {0}: {1} -> {2} bytes", i, originalSize, compactedSizes[i]);
+      totalOriginalSize += originalSize;
+      totalCompactedSize += compactedSizes[i];
+
+      m_Device.destroy(accelerationStructure.m_AccelerationStructure);
+      accelerationStructure = std::move(compacted[i]);
    }
+
+   std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+   CORE_LOG_INFO("Compacted {0} acceleration structure(s): {1} -> {2} bytes ({3:.1f}%), {4:.2f}ms", count, totalOriginalSize, totalCompactedSize, totalOriginalSize > 0 ? 100.0 * totalCompactedSize / totalOriginalSize : 100.0, elapsed.count() * 1000.0);
 }
 
 
@@ -1189,16 +2216,209 @@ void Application::DestroyBottomLevelAccelerationStructures() {
 }
 
 
-void Application::CreateTopLevelAccelerationStructure(GeometryGroup geometryGroup) {
-   BuildAccelerationStructure(m_TLAS, vk::AccelerationStructureTypeKHR::eTopLevel, geometryGroup);
+static glm::vec3 GetInstancePosition(const vk::AccelerationStructureInstanceKHR& instance) {
+   return {instance.transform.matrix[0][3], instance.transform.matrix[1][3], instance.transform.matrix[2][3]};
+}
+
+
+// Fills positions with the instance positions, and returns the size (diagonal) of their bounding box
+static float GetInstancePositions(const std::vector<vk::AccelerationStructureInstanceKHR>& instances, std::vector<glm::vec3>& positions) {
+   glm::vec3 minPosition = glm::vec3{std::numeric_limits<float>::max()};
+   glm::vec3 maxPosition = glm::vec3{std::numeric_limits<float>::lowest()};
+   positions.clear();
+   positions.reserve(instances.size());
+   for (const auto& instance : instances) {
+      positions.emplace_back(GetInstancePosition(instance));
+      minPosition = glm::min(minPosition, positions.back());
+      maxPosition = glm::max(maxPosition, positions.back());
+   }
+   return instances.empty() ? 0.0f : glm::length(maxPosition - minPosition);
+}
+
+
+void Application::CreateTopLevelAccelerationStructure(const std::vector<vk::AccelerationStructureInstanceKHR>& instances) {
+   m_TLASInstances = instances;
+   CreateTopLevelInstanceBuffer();
+
+   const vk::BuildAccelerationStructureFlagsKHR flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace | vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
+   if (IsHostAccelerationStructureBuild()) {
+      // A host build refers to each BLAS by its handle, rather than by its device address, and reads the instances from host memory.
+      // (refits and rebuilds later on are on the device, from the per command buffer copies in m_TLASInstanceBuffer)
+      std::vector<vk::AccelerationStructureInstanceKHR> hostInstances = m_TLASInstances;
+      for (auto& instance : hostInstances) {
+         auto blas = std::find_if(m_BLAS.begin(), m_BLAS.end(), [&instance](const AccelerationStructure& blas) { return blas.m_DeviceAddress == instance.accelerationStructureReference; });
+         CORE_ASSERT(blas != m_BLAS.end(), "CreateTopLevelAccelerationStructure(): instance does not refer to a BLAS");
+         instance.accelerationStructureReference = reinterpret_cast<uint64_t>(static_cast<VkAccelerationStructureKHR>(blas->m_AccelerationStructure));
+      }
+      GeometryGroup group;
+      group.m_IsOnHost = true;
+      group.AddInstances(hostInstances.data(), 0, false, hostInstances.size());
+      BuildAccelerationStructures({&m_TLAS}, vk::AccelerationStructureTypeKHR::eTopLevel, group, flags);
+   } else {
+      GeometryGroup group = GetTopLevelGeometryGroup(0);
+      BuildAccelerationStructures({&m_TLAS}, vk::AccelerationStructureTypeKHR::eTopLevel, group, flags);
+   }
+
+   m_TLASBuildExtent = GetInstancePositions(m_TLASInstances, m_TLASBuildPositions);
+   m_TLASRefitCount = 0;
+   m_IsTLASDirty = false;
 }
 
 
 void Application::DestroyTopLevelAccelerationStructure() {
    if (m_Device && m_TLAS.m_AccelerationStructure) {
       m_Device.destroy(m_TLAS.m_AccelerationStructure);
+      m_TLAS.m_AccelerationStructure = nullptr;
       m_TLAS.m_Buffer.reset(nullptr);
    }
+   m_TLASScratch.reset(nullptr);
+   m_TLASInstanceBuffer.reset(nullptr);
+   m_IsTLASInstanceCopyStale.clear();
+   m_TLASInstances.clear();
+   m_TLASBuildPositions.clear();
+   m_IsTLASDirty = false;
+}
+
+
+void Application::CreateTopLevelInstanceBuffer() {
+   const vk::DeviceSize copySize = sizeof(vk::AccelerationStructureInstanceKHR) * m_TLASInstances.size();
+   const size_t copyCount = std::max(m_CommandBuffers.size(), size_t(1));
+   m_TLASInstanceBuffer = std::make_unique<Buffer>(
+      m_Device,
+      m_PhysicalDevice,
+      copySize * copyCount,
+      vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
+      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
+   );
+   for (size_t i = 0; i < copyCount; ++i) {
+      m_TLASInstanceBuffer->CopyFromHost(i * copySize, copySize, m_TLASInstances.data());
+   }
+   m_IsTLASInstanceCopyStale.assign(copyCount, false);
+}
+
+
+GeometryGroup Application::GetTopLevelGeometryGroup(const uint32_t commandBufferIndex) const {
+   GeometryGroup group;
+   group.AddInstances(m_TLASInstanceBuffer->GetBufferDeviceAddress(), commandBufferIndex * sizeof(vk::AccelerationStructureInstanceKHR) * m_TLASInstances.size(), false, m_TLASInstances.size());
+   return group;
+}
+
+
+vk::AccelerationStructureBuildGeometryInfoKHR Application::GetTopLevelBuildGeometryInfo(const GeometryGroup& group, const vk::BuildAccelerationStructureModeKHR mode) {
+   const bool isUpdate = (mode == vk::BuildAccelerationStructureModeKHR::eUpdate);
+   vk::AccelerationStructureBuildGeometryInfoKHR buildGeometryInfo = {
+      vk::AccelerationStructureTypeKHR::eTopLevel                                                                     /*type*/,
+      vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace | vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate /*flags*/,
+      mode                                                                                                            /*mode*/,
+      isUpdate ? m_TLAS.m_AccelerationStructure : vk::AccelerationStructureKHR{}                                         /*srcAccelerationStructure*/,
+      m_TLAS.m_AccelerationStructure                                                                                  /*dstAccelerationStructure*/,
+      static_cast<uint32_t>(group.m_Geometries.size())                                                                /*geometryCount*/,
+      group.m_Geometries.data()                                                                                       /*pGeometries*/,
+      nullptr                                                                                                         /*ppGeometries*/,
+      nullptr                                                                                                         /*scratchData*/
+   };
+
+   if (!m_TLASScratch) {
+      QueryAccelerationStructureSupport();
+      const uint32_t instanceCount = static_cast<uint32_t>(m_TLASInstances.size());
+      vk::AccelerationStructureBuildSizesInfoKHR buildSizesInfo = m_Device.getAccelerationStructureBuildSizesKHR(vk::AccelerationStructureBuildTypeKHR::eDevice, buildGeometryInfo, instanceCount);
+      m_TLASScratch = std::make_unique<Buffer>(
+         m_Device,
+         m_PhysicalDevice,
+         std::max(buildSizesInfo.buildScratchSize, buildSizesInfo.updateScratchSize),
+         vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
+         vk::MemoryPropertyFlagBits::eDeviceLocal,
+         MemoryAllocator::Strategy::Buddy,
+         m_AccelerationStructureProperties.minAccelerationStructureScratchOffsetAlignment
+      );
+   }
+   buildGeometryInfo.scratchData.deviceAddress = m_TLASScratch->GetBufferDeviceAddress();
+   return buildGeometryInfo;
+}
+
+
+// The TLAS (and its scratch buffer) is shared by all frames in flight, so a build must wait for earlier frames to finish
+// tracing against it (and building it), and whatever comes after must wait for the build
+static void RecordTopLevelBuild(vk::CommandBuffer commandBuffer, const vk::AccelerationStructureBuildGeometryInfoKHR& buildGeometryInfo, const GeometryGroup& group) {
+   vk::MemoryBarrier before = {
+      vk::AccessFlagBits::eAccelerationStructureReadKHR | vk::AccessFlagBits::eAccelerationStructureWriteKHR   /*srcAccessMask*/,
+      vk::AccessFlagBits::eAccelerationStructureReadKHR | vk::AccessFlagBits::eAccelerationStructureWriteKHR   /*dstAccessMask*/
+   };
+   commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eRayTracingShaderKHR | vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {}, before, nullptr, nullptr);
+
+   commandBuffer.buildAccelerationStructuresKHR(buildGeometryInfo, group.m_BuildRanges.data());
+
+   vk::MemoryBarrier after = {
+      vk::AccessFlagBits::eAccelerationStructureWriteKHR  /*srcAccessMask*/,
+      vk::AccessFlagBits::eAccelerationStructureReadKHR   /*dstAccessMask*/
+   };
+   commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eRayTracingShaderKHR, {}, after, nullptr, nullptr);
+}
+
+
+void Application::SetInstanceTransform(const uint32_t instanceIndex, const glm::mat3x4& transform) {
+   CORE_ASSERT(instanceIndex < m_TLASInstances.size(), "SetInstanceTransform(): instance index out of range");
+   memcpy(&m_TLASInstances[instanceIndex].transform, glm::value_ptr(transform), sizeof(vk::TransformMatrixKHR));
+   m_IsTLASInstanceCopyStale.assign(m_IsTLASInstanceCopyStale.size(), true);
+   m_IsTLASDirty = true;
+}
+
+
+void Application::RecordTopLevelAccelerationStructureUpdate(vk::CommandBuffer commandBuffer, const uint32_t commandBufferIndex) {
+   CORE_ASSERT(commandBufferIndex < m_IsTLASInstanceCopyStale.size(), "RecordTopLevelAccelerationStructureUpdate(): command buffer index out of range");
+
+   // Refit every frame, whether or not anything moved since the last one.  Refits are cheap compared to the tracing after them
+   const GeometryGroup group = GetTopLevelGeometryGroup(commandBufferIndex);
+   const vk::AccelerationStructureBuildGeometryInfoKHR buildGeometryInfo = GetTopLevelBuildGeometryInfo(group, vk::BuildAccelerationStructureModeKHR::eUpdate);
+   RecordTopLevelBuild(commandBuffer, buildGeometryInfo, group);
+}
+
+
+void Application::UpdateTopLevelAccelerationStructure() {
+   if (!m_TLAS.m_AccelerationStructure) {
+      return;
+   }
+
+   // The current command buffer is no longer in use (BeginFrame() has waited for it), so neither is its copy of the instances
+   if (m_IsTLASInstanceCopyStale[m_CurrentImage]) {
+      const vk::DeviceSize copySize = sizeof(vk::AccelerationStructureInstanceKHR) * m_TLASInstances.size();
+      m_TLASInstanceBuffer->CopyFromHost(m_CurrentImage * copySize, copySize, m_TLASInstances.data());
+      m_IsTLASInstanceCopyStale[m_CurrentImage] = false;
+   }
+
+   if (!m_IsTLASDirty) {
+      return;
+   }
+   Profiler::CPUScope scope(m_Profiler.get(), "UpdateTopLevelAccelerationStructure");
+   m_IsTLASDirty = false;
+
+   // Refitting keeps the tree structure from the last full build and just grows/shrinks the bounding boxes,
+   // so trace performance gets worse the further instances wander from where they were when the tree was built.
+   // Rebuild if they have moved too far on average (relative to the size of the scene), or if we've refit too many times in a row.
+   double totalDisplacement = 0.0;
+   for (size_t i = 0; i < m_TLASInstances.size(); ++i) {
+      totalDisplacement += glm::length(GetInstancePosition(m_TLASInstances[i]) - m_TLASBuildPositions[i]);
+   }
+   const bool isRebuild =
+      (m_TLASRefitCount >= m_Settings.MaxTopLevelRefitCount) ||
+      (totalDisplacement > m_Settings.TopLevelRebuildThreshold * m_TLASBuildExtent * m_TLASInstances.size())
+   ;
+   if (!isRebuild) {
+      // (refit itself is in the frame's command buffer, see RecordTopLevelAccelerationStructureUpdate())
+      ++m_TLASRefitCount;
+      return;
+   }
+
+   // Rebuilds are rare enough (every MaxTopLevelRefitCount frames of movement, at most) to be done here and waited for,
+   // rather than having a second version of every command buffer
+   const GeometryGroup group = GetTopLevelGeometryGroup(m_CurrentImage);
+   const vk::AccelerationStructureBuildGeometryInfoKHR buildGeometryInfo = GetTopLevelBuildGeometryInfo(group, vk::BuildAccelerationStructureModeKHR::eBuild);
+   SubmitSingleTimeCommands([&buildGeometryInfo, &group](vk::CommandBuffer cmd) {
+      RecordTopLevelBuild(cmd, buildGeometryInfo, group);
+   });
+
+   m_TLASBuildExtent = GetInstancePositions(m_TLASInstances, m_TLASBuildPositions);
+   m_TLASRefitCount = 0;
 }
 
 
@@ -1,15 +1,21 @@
 #pragma once
 
+#include "Benchmark.h"
 #include "Buffer.h"
 #include "GeometryInstance.h"
 #include "Image.h"
+#include "MemoryAllocator.h"
+#include "Profiler.h"
 #include "QueueFamilyIndices.h"
+#include "Uploader.h"
 
 #include <glm/glm.hpp>
 #include <vulkan/vulkan.hpp>
 
+#include <chrono>
 #include <functional>
 #include <memory>
+#include <string>
 
 struct GLFWwindow;
 
@@ -24,6 +30,22 @@ struct ApplicationSettings {
    bool IsResizable = true;
    bool IsFullScreen = false;
    bool IsCursorEnabled = true;
+   bool IsHeadless = false;            // no window, surface or swap chain.  Frames are rendered into offscreen images instead
+   uint32_t FrameCount = 100;          // in headless and benchmark modes, Run() renders this many frames and then returns
+   bool IsBenchmark = false;           // camera follows CameraPathFileName (instead of keyboard/mouse), time steps are fixed, and a report is written when Run() finishes
+   uint32_t SamplesPerPixel = 0;       // benchmark mode (and apps' own fixed length modes): if non-zero, render enough frames to get this many samples per pixel (instead of FrameCount)
+   const char* SceneName = nullptr;    // for apps that have more than one scene.  nullptr = app's default scene
+   const char* CameraPathFileName = nullptr;
+   const char* BenchmarkReportFileName = "benchmark.json";
+   vk::DeviceSize MaxAccelerationStructureScratchSize = 256 * 1024 * 1024;  // acceleration structure builds that need more scratch than this (in total) are split into batches
+   bool IsAccelerationStructureCompactionEnabled = true; // bottom level acceleration structures are compacted after they are built
+   bool IsHostAccelerationStructureBuildEnabled = false; // acceleration structures are built on the host (by a pool of worker threads) instead of the device, if the device supports that.  See Application::IsHostAccelerationStructureBuild()
+   uint32_t MaxTopLevelRefitCount = 100;           // TLAS is fully rebuilt (instead of refit) after this many refits...
+   float TopLevelRebuildThreshold = 0.1f;          // ...or when instances have moved (on average) more than this fraction of the scene's size since the last full build
+   const char* ProfileFileName = nullptr; // if set, a chrome://tracing profile is written here when Run() finishes
+   const char* PipelineCacheFileName = nullptr; // where the pipeline cache is kept between runs.  If not set, "<ApplicationName>.pipelinecache" in the working directory
+   bool IsAccelerationStructureCacheEnabled = true;            // bottom level acceleration structures are serialized to disk, and loaded from there (instead of being built) next time
+   const char* AccelerationStructureCacheDirectory = nullptr;  // if not set, "<ApplicationName>.ascache" in the working directory
 };
 
 
@@ -34,6 +56,7 @@ struct GeometryGroup {
 
    std::vector<vk::AccelerationStructureGeometryKHR> m_Geometries;
    std::vector<vk::AccelerationStructureBuildRangeInfoKHR> m_BuildRanges;
+   bool m_IsOnHost = false;   // data given to AddXXX() is host addresses (which makes it a host build, see Application::IsHostAccelerationStructureBuild())
 };
 
 
@@ -50,13 +73,34 @@ public:
    Application(const ApplicationSettings& settings, const bool enableValidation);
    virtual ~Application();
 
-   void Run();
+   virtual void Run();
 
    virtual void OnKey(const int key, const int scancode, const int action, const int mods);
    virtual void OnCursorPos(const double xpos, const double ypos);
    virtual void OnMouseButton(const int button, const int action, const int mods);
 
 protected:
+   // Pick up settings from the command line.  Derived app should call this before Init()
+   // Recognised options are:
+   //    --headless            render offscreen, with no window (see ApplicationSettings::IsHeadless)
+   //    --frames <n>          number of frames to render in headless or benchmark mode
+   //    --profile <f>         write a chrome://tracing profile to file f
+   //    --benchmark           benchmark mode (see ApplicationSettings::IsBenchmark)
+   //    --scene <name>        which scene to render (for apps that have more than one)
+   //    --resolution <w>x<h>  window (or offscreen image) size
+   //    --spp <n>             benchmark mode: render until there are n samples per pixel
+   //    --camera-path <f>     benchmark mode: camera keyframes (see Vulkan::Benchmark)
+   //    --report <f>          benchmark mode: write JSON report to file f (default benchmark.json)
+   //    --no-compaction       do not compact bottom level acceleration structures (see ApplicationSettings::IsAccelerationStructureCompactionEnabled)
+   //    --no-as-cache         do not load or save bottom level acceleration structures (see ApplicationSettings::IsAccelerationStructureCacheEnabled)
+   //    --host-as-build       build acceleration structures on the host (see ApplicationSettings::IsHostAccelerationStructureBuildEnabled)
+   // Anything else is offered to ParseCommandLineOption()
+   void ParseCommandLine(const int argc, const char* argv[]);
+
+   // Pick up an app specific option from the command line.  argv[i] is the option, and i should be advanced past any values that it
+   // takes.  Returns false if the option is not recognised
+   virtual bool ParseCommandLineOption(const int argc, const char* argv[], int& i);
+
    // Initialise self.
    // This will create most of the vulkan objects required for a working app.
    // At a minimum, derived app must override Init() to provide the graphics pipeline.
@@ -110,10 +154,19 @@ protected:
    // Base implementation returns nothing.
    virtual std::vector<const char*> GetRequiredDeviceExtensions();
 
+   // Creates the allocator that Buffers and Images get their memory from.  Depends on device.
+   virtual void CreateMemoryAllocator();
+   virtual void DestroyMemoryAllocator();
+
+   // Creates the uploader that batches up CopyBuffer(), TransitionImageLayout() etc.  Depends on device and memory allocator.
+   virtual void CreateUploader();
+   virtual void DestroyUploader();
+
 
    ////////////////////////////////////////////////
    //
    // swap chain stuff
+   // In headless mode, creates offscreen images in place of the swap chain images
    virtual void CreateSwapChain();
    virtual void DestroySwapChain(vk::SwapchainKHR& swapChain);
 
@@ -140,9 +193,14 @@ protected:
    virtual void CreateCommandBuffers();   // by default, we allocate one command buffer per framebuffer.  Derived app may do something different
    virtual void DestroyCommandBuffers();
 
+   // Creates the frame profiler.  Depends on command buffers (one profiler "slot" per command buffer)
+   virtual void CreateProfiler();
+   virtual void DestroyProfiler();
+
    virtual void CreateSyncObjects();
    virtual void DestroySyncObjects();
 
+   // Pipeline cache is loaded from disk (if there is a compatible one), and saved back to disk when destroyed.
    virtual void CreatePipelineCache();
    virtual void DestroyPipelineCache();
 
@@ -156,6 +214,33 @@ protected:
 
    virtual void OnWindowResized();
 
+   // Flush everything uploaded during Init(), and log how long startup took.  Run() starts with this
+   void CompleteStartup();
+
+   // Render a fixed number of frames with a fixed time step (headless and benchmark modes).  If timeLimit is non-zero, frames are
+   // rendered until that many seconds have passed instead
+   void RunFixedFrameCount(const double timeLimit = 0.0);
+
+   // Log profiler statistics, and write the trace file (if one was asked for)
+   void ReportProfile();
+
+   // Number of samples per pixel that each frame contributes (for benchmark samples per second, and --spp)
+   virtual uint32_t GetSamplesPerPixelPerFrame() const;
+
+   // Total number of rays traced so far, for apps that count them (for rays per second in headless and benchmark modes).  0 = not counted
+   // Only called when the device is idle.
+   virtual uint64_t GetRayCount();
+
+   // Root mean square error of the output image (tonemapped, 8 bits per channel) compared with a reference image, for apps that have
+   // one.  Negative if there is no reference image, or the comparison could not be done.
+   // Only called when the device is idle.
+   virtual double GetOutputImageError();
+
+   std::string GetPipelineCacheFileName() const;
+
+   // Check that pipeline cache file data is complete, and was written by this driver for this device
+   bool IsPipelineCacheCompatible(const std::vector<char>& data) const;
+
 protected:
 
    vk::ShaderModule CreateShaderModule(std::vector<char> code);
@@ -163,10 +248,22 @@ protected:
 
    QueueFamilyIndices FindQueueFamilies(vk::PhysicalDevice physicalDevice);
 
+   // Returns false if there is no window (i.e. headless)
+   bool IsKeyPressed(const int key) const;
+
    vk::Format FindSupportedFormat(const std::vector<vk::Format>& candidates, vk::ImageTiling tiling, vk::FormatFeatureFlags features);
 
+   // Records commands, submits them, and waits for them to complete.
+   // Any batched uploads are flushed first.
    void SubmitSingleTimeCommands(const std::function<void(vk::CommandBuffer)>& action);
 
+   // The following are batched up by m_Uploader, and are not submitted to the GPU until FlushUploads()
+   // (which happens automatically at the latest on BeginFrame(), SubmitSingleTimeCommands() and BuildAccelerationStructure())
+   // Source buffers passed to CopyBuffer() and CopyBufferToImage() must therefore live until the uploads are flushed.
+   void UploadToBuffer(const void* pData, const vk::DeviceSize size, vk::Buffer dst, const vk::DeviceSize dstOffset = 0);
+
+   void UploadToImage(const void* pData, const vk::DeviceSize size, vk::Image image, const uint32_t width, const uint32_t height, const uint32_t mipLevels);
+
    void CopyBuffer(vk::Buffer src, vk::Buffer dst, const vk::DeviceSize srcOffset, const vk::DeviceSize dstOffset, const vk::DeviceSize size);
 
    void TransitionImageLayout(vk::Image image, const vk::ImageLayout oldLayout, const vk::ImageLayout newLayout, const uint32_t mipLevels);
@@ -175,17 +272,69 @@ protected:
 
    void GenerateMIPMaps(vk::Image image, const vk::Format format, const uint32_t width, const uint32_t height, uint32_t mipLevels);
 
+   void FlushUploads();
+
    ///////////////////////////////
    // Ray tracing stuff
 
+   void QueryAccelerationStructureSupport();
+
+   // True if acceleration structures are to be built on the host (m_Settings.IsHostAccelerationStructureBuildEnabled, and the device
+   // supports accelerationStructureHostCommands).  Derived app must then enable accelerationStructureHostCommands when the device
+   // is created, and give BuildAccelerationStructures() geometry groups with host addresses (m_IsOnHost).
+   bool IsHostAccelerationStructureBuild();
+
    void BuildAccelerationStructure(AccelerationStructure& accelerationStructure, const vk::AccelerationStructureTypeKHR type, const GeometryGroup& geometryGroup);
 
-   void CreateBottomLevelAccelerationStructures(vk::ArrayProxy<GeometryGroup> geometryGroups);
+   // Build several acceleration structures (one per geometry group) with a single submit, or (if the geometry groups are on the host)
+   // concurrently on the host.  Builds share one scratch buffer (see ApplicationSettings::MaxAccelerationStructureScratchSize)
+   void BuildAccelerationStructures(const std::vector<AccelerationStructure*>& accelerationStructures, const vk::AccelerationStructureTypeKHR type, vk::ArrayProxy<const GeometryGroup> geometryGroups, const vk::BuildAccelerationStructureFlagsKHR flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace);
+
+   // Join worker threads to deferred host operations until they are all complete.  Returns number of threads used.
+   uint32_t JoinDeferredOperations(const std::vector<vk::DeferredOperationKHR>& operations);
+
+   // Replace each acceleration structure with a copy in a right-sized buffer.
+   // Acceleration structures must have been built with eAllowCompaction.
+   void CompactAccelerationStructures(const std::vector<AccelerationStructure*>& accelerationStructures, const vk::AccelerationStructureTypeKHR type);
+
+   // cacheKeys are optional.  If given, there must be one per geometry group, uniquely identifying its content (e.g. a hash of vertices and indices).
+   // BLAS whose key is in the acceleration structure cache are then loaded from there instead of being built (and the others are added to the cache).
+   void CreateBottomLevelAccelerationStructures(vk::ArrayProxy<GeometryGroup> geometryGroups, const std::vector<uint64_t>& cacheKeys = {});
    void DestroyBottomLevelAccelerationStructures();
 
-   void CreateTopLevelAccelerationStructure(GeometryGroup geometryGroup);
+   // Where the acceleration structure with the given cache key is kept in the acceleration structure cache
+   std::string GetAccelerationStructureCacheFileName(const uint64_t cacheKey) const;
+
+   // Returns, for each acceleration structure, whether it was loaded.  (those that were not are left untouched)
+   std::vector<bool> LoadAccelerationStructures(const std::vector<AccelerationStructure*>& accelerationStructures, const vk::AccelerationStructureTypeKHR type, const std::vector<uint64_t>& cacheKeys);
+   void SaveAccelerationStructures(const std::vector<AccelerationStructure*>& accelerationStructures, const std::vector<uint64_t>& cacheKeys);
+
+   // The TLAS keeps its own (persistent) copy of the instances, and is built with eAllowUpdate so that
+   // instances can be moved afterwards (SetInstanceTransform()) without rebuilding everything.
+   void CreateTopLevelAccelerationStructure(const std::vector<vk::AccelerationStructureInstanceKHR>& instances);
    void DestroyTopLevelAccelerationStructure();
 
+   // transform is row-major (same layout as vk::TransformMatrixKHR).
+   // Changes are not seen by the GPU until the next frame's command buffer refits the TLAS (see RecordTopLevelAccelerationStructureUpdate())
+   void SetInstanceTransform(const uint32_t instanceIndex, const glm::mat3x4& transform);
+
+   // Records a refit of the TLAS to the instances as they are when the command buffer is submitted.
+   // Apps whose instances move record this into each of their command buffers, ahead of any ray tracing.
+   void RecordTopLevelAccelerationStructureUpdate(vk::CommandBuffer commandBuffer, const uint32_t commandBufferIndex);
+
+   // Copies moved instances to where the current command buffer's refit reads them from, and fully rebuilds the TLAS
+   // instead if refitting has degraded it too much.  Happens automatically on BeginFrame().  Only a rebuild waits for the GPU.
+   void UpdateTopLevelAccelerationStructure();
+
+   // One copy of the instances for each command buffer, so that the CPU can move instances while earlier frames are still in flight
+   void CreateTopLevelInstanceBuffer();
+
+   // The given command buffer's copy of the instances
+   GeometryGroup GetTopLevelGeometryGroup(const uint32_t commandBufferIndex) const;
+
+   // Rebuild (or refit) of the TLAS from group.  Creates the scratch buffer that all TLAS updates share, if need be
+   vk::AccelerationStructureBuildGeometryInfoKHR GetTopLevelBuildGeometryInfo(const GeometryGroup& group, const vk::BuildAccelerationStructureModeKHR mode);
+
    //
    //////////////////////////////
 
@@ -207,15 +356,20 @@ protected:
    QueueFamilyIndices m_QueueFamilyIndices;
 
    vk::Device m_Device;
+   std::unique_ptr<MemoryAllocator> m_MemoryAllocator;
 
    vk::Queue m_GraphicsQueue;
    vk::Queue m_PresentQueue;
+   vk::Queue m_TransferQueue;   // only valid if m_QueueFamilyIndices.TransferFamily has a value
+
+   std::unique_ptr<Uploader> m_Uploader;
 
    // swap chain stuff (encapsulate?) ///////////////
    vk::Format m_Format = vk::Format::eUndefined;
    vk::Extent2D m_Extent;
    vk::SwapchainKHR m_SwapChain;
    std::vector<Image> m_SwapChainImages;
+   vk::ImageLayout m_PresentLayout = vk::ImageLayout::ePresentSrcKHR;   // layout that swap chain images must be left in at the end of a frame
    bool m_WantResize = false;
    //////////////////////////////////////////////////
 
@@ -229,6 +383,8 @@ protected:
    vk::CommandPool m_CommandPool;
    std::vector<vk::CommandBuffer> m_CommandBuffers;
 
+   std::unique_ptr<Profiler> m_Profiler;
+
    uint32_t m_CurrentFrame = 0; // which frame (up to MaxFramesInFlight) are we currently rendering
    uint32_t m_CurrentImage = 0; // which swap chain image are we currently rendering to
    std::vector<vk::Semaphore> m_ImageAvailableSemaphores;
@@ -236,13 +392,31 @@ protected:
    std::vector<vk::Fence> m_InFlightFences;
 
    vk::PipelineCache m_PipelineCache;
+   bool m_IsPipelineCacheWarm = false;   // true if m_PipelineCache was loaded from disk
+
+   std::chrono::steady_clock::time_point m_InitStartTime;
 
    double m_LastTime = 0.0;
 
+   std::unique_ptr<Benchmark> m_Benchmark;   // only in benchmark mode
+
    ////////////////////////////
    // Ray tracing stuff
    std::vector<AccelerationStructure> m_BLAS;
    AccelerationStructure m_TLAS;
+   std::vector<vk::AccelerationStructureInstanceKHR> m_TLASInstances;
+   std::vector<glm::vec3> m_TLASBuildPositions;       // instance positions when the TLAS was last (fully) built
+   float m_TLASBuildExtent = 0.0f;                    // size of the bounding box of m_TLASBuildPositions
+   std::unique_ptr<Buffer> m_TLASInstanceBuffer;      // one copy of m_TLASInstances per command buffer (see CreateTopLevelInstanceBuffer())
+   std::vector<bool> m_IsTLASInstanceCopyStale;       // per command buffer: m_TLASInstances have changed since its copy was written
+   std::unique_ptr<Buffer> m_TLASScratch;              // for updates and rebuilds (initial build has its own)
+   uint32_t m_TLASRefitCount = 0;                     // number of frames with moved instances since the last full build
+   bool m_IsTLASDirty = false;                        // instances have moved since UpdateTopLevelAccelerationStructure() last looked
+   vk::PhysicalDeviceAccelerationStructureFeaturesKHR m_AccelerationStructureFeatures;
+   vk::PhysicalDeviceAccelerationStructurePropertiesKHR m_AccelerationStructureProperties;
+   bool m_IsAccelerationStructureSupportQueried = false;
+   uint32_t m_AccelerationStructureCacheHits = 0;
+   uint32_t m_AccelerationStructureCacheMisses = 0;
    //
    ///////////////////////////
 
@@ -254,6 +428,7 @@ protected:
    glm::vec3 m_Direction = glm::normalize(glm::vec3 {0.0f, 0.0f, -4.0f});
    glm::vec3 m_Up = glm::normalize(glm::vec3 {0.0f, 1.0f, 0.0f});
    float m_FoVRadians = glm::radians(45.0f);
+   bool m_IsCameraMoved = false;   // did the camera move in the last Update()
    //
    ////////////////////////////////
 
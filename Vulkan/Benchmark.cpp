@@ -0,0 +1,147 @@
+#include "Benchmark.h"
+#include "Core.h"
+
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+
+namespace Vulkan {
+
+static std::string JSONEscape(const std::string& s) {
+   std::string escaped;
+   for (char ch : s) {
+      if ((ch == '"') || (ch == '\\')) {
+         escaped += '\\';
+      }
+      if (static_cast<unsigned char>(ch) >= 0x20) {
+         escaped += ch;
+      }
+   }
+   return escaped;
+}
+
+
+Benchmark::Benchmark(const std::string& cameraPathFileName) {
+   if (cameraPathFileName.empty()) {
+      return;
+   }
+
+   std::ifstream file(cameraPathFileName);
+   if (!file.is_open()) {
+      throw std::runtime_error("failed to open camera path file '" + cameraPathFileName + "'");
+   }
+
+   std::string line;
+   while (std::getline(file, line)) {
+      if (line.empty() || (line[0] == '#')) {
+         continue;
+      }
+      std::istringstream ss(line);
+      CameraKeyframe keyframe;
+      ss >> keyframe.m_Time;
+      ss >> keyframe.m_Eye.x >> keyframe.m_Eye.y >> keyframe.m_Eye.z;
+      ss >> keyframe.m_Direction.x >> keyframe.m_Direction.y >> keyframe.m_Direction.z;
+      ss >> keyframe.m_Up.x >> keyframe.m_Up.y >> keyframe.m_Up.z;
+      if (ss.fail()) {
+         throw std::runtime_error("bad camera keyframe '" + line + "' in '" + cameraPathFileName + "'");
+      }
+      if (!m_CameraPath.empty() && (keyframe.m_Time <= m_CameraPath.back().m_Time)) {
+         throw std::runtime_error("camera keyframes are not in increasing time order in '" + cameraPathFileName + "'");
+      }
+      m_CameraPath.emplace_back(keyframe);
+   }
+   CORE_LOG_INFO("Loaded {0} camera keyframes from '{1}'", m_CameraPath.size(), cameraPathFileName);
+}
+
+
+bool Benchmark::HasCameraPath() const {
+   return !m_CameraPath.empty();
+}
+
+
+void Benchmark::GetCamera(const double time, glm::vec3& eye, glm::vec3& direction, glm::vec3& up) const {
+   CORE_ASSERT(HasCameraPath(), "Benchmark::GetCamera() called with no camera path");
+   auto next = std::upper_bound(m_CameraPath.begin(), m_CameraPath.end(), time, [] (const double t, const CameraKeyframe& keyframe) { return t < keyframe.m_Time; });
+   if (next == m_CameraPath.begin()) {
+      eye = next->m_Eye;
+      direction = next->m_Direction;
+      up = next->m_Up;
+      return;
+   }
+   auto prev = next - 1;
+   if (next == m_CameraPath.end()) {
+      eye = prev->m_Eye;
+      direction = prev->m_Direction;
+      up = prev->m_Up;
+      return;
+   }
+
+   float t = static_cast<float>((time - prev->m_Time) / (next->m_Time - prev->m_Time));
+   eye = glm::mix(prev->m_Eye, next->m_Eye, t);
+
+   // Direction is not necessarily unit length (its length is the camera movement speed), so interpolate length and direction separately
+   float length = glm::mix(glm::length(prev->m_Direction), glm::length(next->m_Direction), t);
+   direction = length * glm::normalize(glm::mix(glm::normalize(prev->m_Direction), glm::normalize(next->m_Direction), t));
+   up = glm::normalize(glm::mix(prev->m_Up, next->m_Up, t));
+}
+
+
+void Benchmark::RecordFrameTime(const double seconds) {
+   m_FrameTimes.emplace_back(seconds);
+}
+
+
+void Benchmark::WriteReport(const std::string& fileName, const BenchmarkInfo& info, const double wallTimeSeconds) const {
+   std::ofstream file(fileName, std::ios::out | std::ios::trunc);
+   if (!file.is_open()) {
+      CORE_LOG_ERROR("failed to open benchmark report file '{0}'", fileName);
+      return;
+   }
+
+   std::vector<double> sorted = m_FrameTimes;
+   std::sort(sorted.begin(), sorted.end());
+   auto percentile = [&sorted] (const double p) {
+      return sorted.empty() ? 0.0 : sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+   };
+   double avg = sorted.empty() ? 0.0 : std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+
+   const double samples = static_cast<double>(info.Width) * info.Height * info.SamplesPerPixelPerFrame * m_FrameTimes.size();
+   const double samplesPerSecond = wallTimeSeconds > 0.0 ? samples / wallTimeSeconds : 0.0;
+   const double raysPerSecond = wallTimeSeconds > 0.0 ? info.RayCount / wallTimeSeconds : 0.0;
+
+   file.precision(6);
+   file << "{\n";
+   file << "   \"application\": \"" << JSONEscape(info.ApplicationName) << "\",\n";
+   file << "   \"device\": \"" << JSONEscape(info.DeviceName) << "\",\n";
+   file << "   \"driverVersion\": " << info.DriverVersion << ",\n";
+   file << "   \"scene\": \"" << JSONEscape(info.SceneName) << "\",\n";
+   file << "   \"width\": " << info.Width << ",\n";
+   file << "   \"height\": " << info.Height << ",\n";
+   file << "   \"frames\": " << m_FrameTimes.size() << ",\n";
+   file << "   \"samplesPerPixel\": " << info.SamplesPerPixelPerFrame * m_FrameTimes.size() << ",\n";
+   file << "   \"wallTimeSeconds\": " << wallTimeSeconds << ",\n";
+   file << "   \"samplesPerSecond\": " << samplesPerSecond << ",\n";
+   file << "   \"rays\": " << info.RayCount << ",\n";
+   file << "   \"raysPerSecond\": " << raysPerSecond << ",\n";
+   if (info.ImageError >= 0.0) {
+      file << "   \"rmse\": " << info.ImageError << ",\n";
+   }
+   file << "   \"frameTimeMs\": {";
+   file << "\"min\": " << (sorted.empty() ? 0.0 : sorted.front()) * 1000.0;
+   file << ", \"avg\": " << avg * 1000.0;
+   file << ", \"p50\": " << percentile(0.5) * 1000.0;
+   file << ", \"p99\": " << percentile(0.99) * 1000.0;
+   file << ", \"max\": " << (sorted.empty() ? 0.0 : sorted.back()) * 1000.0;
+   file << "},\n";
+   file << "   \"frameTimesMs\": [";
+   for (size_t i = 0; i < m_FrameTimes.size(); ++i) {
+      file << (i == 0 ? "" : ", ") << m_FrameTimes[i] * 1000.0;
+   }
+   file << "]\n";
+   file << "}\n";
+
+   CORE_LOG_INFO("Benchmark: {0} frames in {1:.3f}s, avg {2:.3f}ms, p99 {3:.3f}ms, {4:.1f} Msamples/s, {5:.1f} Mrays/s.  Report written to '{6}'", m_FrameTimes.size(), wallTimeSeconds, avg * 1000.0, percentile(0.99) * 1000.0, samplesPerSecond / 1e6, raysPerSecond / 1e6, fileName);
+}
+
+}
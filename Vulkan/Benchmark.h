@@ -0,0 +1,56 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+namespace Vulkan {
+
+// Things about the run that go into the benchmark report (alongside the frame times)
+struct BenchmarkInfo {
+   std::string ApplicationName;
+   std::string DeviceName;
+   uint32_t DriverVersion = 0;
+   std::string SceneName;
+   uint32_t Width = 0;
+   uint32_t Height = 0;
+   uint32_t SamplesPerPixelPerFrame = 1;
+   uint64_t RayCount = 0;   // total for the run.  0 if the app does not count rays
+   double ImageError = -1.0;  // RMSE of final image vs. reference image.  Negative if there was no comparison
+};
+
+
+// Benchmark mode support: a scripted camera path (so that every run sees exactly the same views),
+// and collection of frame times for a JSON report.
+//
+// Camera path file is plain text, one keyframe per line:
+//    time eye.x eye.y eye.z direction.x direction.y direction.z up.x up.y up.z
+// Lines starting with # are comments.  Keyframes must be in increasing time order.
+// Camera is linearly interpolated between keyframes, and held at the first/last keyframe outside of them.
+class Benchmark {
+public:
+   // cameraPathFileName can be empty, in which case the camera is left wherever the app put it
+   Benchmark(const std::string& cameraPathFileName);
+
+   bool HasCameraPath() const;
+
+   void GetCamera(const double time, glm::vec3& eye, glm::vec3& direction, glm::vec3& up) const;
+
+   void RecordFrameTime(const double seconds);
+
+   void WriteReport(const std::string& fileName, const BenchmarkInfo& info, const double wallTimeSeconds) const;
+
+private:
+   struct CameraKeyframe {
+      double m_Time;
+      glm::vec3 m_Eye;
+      glm::vec3 m_Direction;
+      glm::vec3 m_Up;
+   };
+
+   std::vector<CameraKeyframe> m_CameraPath;
+   std::vector<double> m_FrameTimes;   // seconds
+};
+
+}
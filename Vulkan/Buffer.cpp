@@ -3,8 +3,9 @@
 
 namespace Vulkan {
 
-Buffer::Buffer(vk::Device device, const vk::PhysicalDevice physicalDevice, const vk::DeviceSize size, const vk::BufferUsageFlags usage, const vk::MemoryPropertyFlags memoryProperties)
+Buffer::Buffer(vk::Device device, const vk::PhysicalDevice physicalDevice, const vk::DeviceSize size, const vk::BufferUsageFlags usage, const vk::MemoryPropertyFlags memoryProperties, const MemoryAllocator::Strategy strategy, const vk::DeviceSize minAlignment)
 : m_Device(device)
+, m_Allocator(MemoryAllocator::GetDefault())
 , m_Size(size)
 , m_Usage(usage)
 , m_Properties(memoryProperties)
@@ -20,19 +21,30 @@ Buffer::Buffer(vk::Device device, const vk::PhysicalDevice physicalDevice, const
    m_Buffer = m_Device.createBuffer(ci);
 
    const auto requirements = m_Device.getBufferMemoryRequirements(m_Buffer);
-   vk::MemoryAllocateInfo ai = {
-      requirements.size                                                        /*allocationSize*/,
-      FindMemoryType(physicalDevice, requirements.memoryTypeBits, memoryProperties)  /*memoryTypeIndex*/
-   };
-   vk::MemoryAllocateFlagsInfo afi = {
-      vk::MemoryAllocateFlagBits::eDeviceAddress /*flags*/,
-      {}                                         /*deviceMask*/
-   };
-   if (usage & vk::BufferUsageFlagBits::eShaderDeviceAddress) {
-      ai.setPNext(&afi);
+   const bool deviceAddress = static_cast<bool>(usage & vk::BufferUsageFlagBits::eShaderDeviceAddress);
+   if (m_Allocator) {
+      m_Allocation = m_Allocator->Allocate(requirements, memoryProperties, false, deviceAddress, strategy, minAlignment);
+   } else {
+      vk::MemoryAllocateInfo ai = {
+         requirements.size                                                        /*allocationSize*/,
+         FindMemoryType(physicalDevice, requirements.memoryTypeBits, memoryProperties)  /*memoryTypeIndex*/
+      };
+      vk::MemoryAllocateFlagsInfo afi = {
+         vk::MemoryAllocateFlagBits::eDeviceAddress /*flags*/,
+         {}                                         /*deviceMask*/
+      };
+      if (deviceAddress) {
+         ai.setPNext(&afi);
+      }
+      m_Allocation.m_Memory = m_Device.allocateMemory(ai);
+      m_Allocation.m_Size = requirements.size;
+      if (memoryProperties & vk::MemoryPropertyFlagBits::eHostVisible) {
+         m_Allocation.m_pMappedData = m_Device.mapMemory(m_Allocation.m_Memory, 0, VK_WHOLE_SIZE);
+      }
    }
-   m_Memory = m_Device.allocateMemory(ai);
-   m_Device.bindBufferMemory(m_Buffer, m_Memory, 0);
+   m_Memory = m_Allocation.m_Memory;
+   m_pMappedData = m_Allocation.m_pMappedData;
+   m_Device.bindBufferMemory(m_Buffer, m_Memory, m_Allocation.m_Offset);
    m_Descriptor.buffer = m_Buffer;
    m_Descriptor.offset = 0;
    m_Descriptor.range = size;
@@ -48,14 +60,20 @@ Buffer& Buffer::operator=(Buffer&& that) {
    if (this != &that) {
       m_Device = that.m_Device;
       m_Buffer = that.m_Buffer;
+      m_Allocator = that.m_Allocator;
       m_Memory = that.m_Memory;
+      m_Allocation = that.m_Allocation;
+      m_pMappedData = that.m_pMappedData;
       m_Descriptor = that.m_Descriptor;
       m_Size = that.m_Size;
       m_Usage = that.m_Usage;
       m_Properties = that.m_Properties;
       that.m_Device = nullptr;
       that.m_Buffer = nullptr;
+      that.m_Allocator = nullptr;
       that.m_Memory = nullptr;
+      that.m_Allocation = {};
+      that.m_pMappedData = nullptr;
       that.m_Descriptor = vk::DescriptorBufferInfo{};
       that.m_Size = 0;
       that.m_Usage = {};
@@ -71,10 +89,16 @@ Buffer::~Buffer() {
          m_Device.destroy(m_Buffer);
          m_Buffer = nullptr;
       }
-      if (m_Memory) {
+      if (m_Allocation.m_Block) {
+         m_Allocator->Free(m_Allocation);
+      } else if (m_Memory) {
+         if (m_pMappedData) {
+            m_Device.unmapMemory(m_Memory);
+         }
          m_Device.freeMemory(m_Memory);
-         m_Memory = nullptr;
       }
+      m_Memory = nullptr;
+      m_pMappedData = nullptr;
    }
 }
 
@@ -97,10 +121,9 @@ uint32_t Buffer::FindMemoryType(const vk::PhysicalDevice physicalDevice, const u
 
 void Buffer::CopyFromHost(const vk::DeviceSize offset, const vk::DeviceSize sizeArg, const void* pData) {
    vk::DeviceSize size = (sizeArg == VK_WHOLE_SIZE) ? m_Size : sizeArg;
-   CORE_ASSERT(size <= m_Size, "Cannot copy in excess of buffer size!");
-   void* pDataDst = m_Device.mapMemory(m_Memory, offset, size);
-   memcpy(pDataDst, pData, static_cast<size_t>(size));
-   m_Device.unmapMemory(m_Memory);
+   CORE_ASSERT(offset + size <= m_Size, "Cannot copy in excess of buffer size!");
+   CORE_ASSERT(m_pMappedData, "Cannot copy from host to a buffer that is not host visible!");
+   memcpy(static_cast<char*>(m_pMappedData) + offset, pData, static_cast<size_t>(size));
 }
 
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "MemoryAllocator.h"
+
 #include <vulkan/vulkan.hpp>
 
 namespace Vulkan {
@@ -7,7 +9,9 @@ namespace Vulkan {
 class Buffer {
 public:
 
-   Buffer(vk::Device device, const vk::PhysicalDevice physicalDevice, const vk::DeviceSize size, const vk::BufferUsageFlags usage, const vk::MemoryPropertyFlags memoryProperties);
+   // Memory comes from MemoryAllocator::GetDefault() (if there is one), using the specified strategy.
+   // minAlignment can be used to request alignment stricter than what the buffer memory requirements say (e.g. for acceleration structure scratch buffers)
+   Buffer(vk::Device device, const vk::PhysicalDevice physicalDevice, const vk::DeviceSize size, const vk::BufferUsageFlags usage, const vk::MemoryPropertyFlags memoryProperties, const MemoryAllocator::Strategy strategy = MemoryAllocator::Strategy::Buddy, const vk::DeviceSize minAlignment = 1);
    Buffer(const Buffer&) = delete;   // You cannot copy Vulkan::Buffer wrapper object
    Buffer(Buffer&& that);            // but you can move it (i.e. move the underlying vulkan resources to another Vulkan::Buffer wrapper)
 
@@ -23,10 +27,13 @@ public:
    vk::MemoryPropertyFlags m_Properties;
    vk::Buffer m_Buffer;
    vk::DeviceMemory m_Memory;
+   MemoryAllocation m_Allocation;   // the part of m_Memory that belongs to this buffer
+   void* m_pMappedData = nullptr;   // host visible buffers stay mapped for their whole lifetime
    vk::DescriptorBufferInfo m_Descriptor;
 
    // Copy memory from host (pData) to the GPU buffer
-   // You can do this only if buffer was created with host visible property
+   // You can do this only if buffer was created with host visible (and host coherent) property
+   // The buffer is already mapped, so this is just a memcpy.
    void CopyFromHost(const vk::DeviceSize offset, const vk::DeviceSize size, const void* pData);
 
 public:
@@ -34,6 +41,7 @@ public:
 
 protected:
    vk::Device m_Device;
+   MemoryAllocator* m_Allocator = nullptr;
 };
 
 
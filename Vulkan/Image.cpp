@@ -6,6 +6,7 @@ namespace Vulkan {
 
 Image::Image(vk::Device device, const vk::PhysicalDevice physicalDevice, const vk::ImageViewType type, const uint32_t width, const uint32_t height, const uint32_t mipLevels, vk::SampleCountFlagBits numSamples, const vk::Format format, const vk::ImageTiling tiling, const vk::ImageUsageFlags usage, const vk::MemoryPropertyFlags properties)
 : m_Device(device)
+, m_Allocator(MemoryAllocator::GetDefault())
 , m_Type(type)
 {
    vk::ImageType imageType = vk::ImageType::e2D;
@@ -67,11 +68,17 @@ Image::Image(vk::Device device, const vk::PhysicalDevice physicalDevice, const v
    });
 
    vk::MemoryRequirements memRequirements = m_Device.getImageMemoryRequirements(m_Image);
-   m_Memory = m_Device.allocateMemory({
-      memRequirements.size                                        /*allocationSize*/,
-      Buffer::FindMemoryType(physicalDevice, memRequirements.memoryTypeBits, properties)  /*memoryTypeIndex*/
-   });
-   m_Device.bindImageMemory(m_Image, m_Memory, 0);
+   if (m_Allocator) {
+      m_Allocation = m_Allocator->Allocate(memRequirements, properties, tiling == vk::ImageTiling::eOptimal, false);
+   } else {
+      m_Allocation.m_Memory = m_Device.allocateMemory({
+         memRequirements.size                                        /*allocationSize*/,
+         Buffer::FindMemoryType(physicalDevice, memRequirements.memoryTypeBits, properties)  /*memoryTypeIndex*/
+      });
+      m_Allocation.m_Size = memRequirements.size;
+   }
+   m_Memory = m_Allocation.m_Memory;
+   m_Device.bindImageMemory(m_Image, m_Memory, m_Allocation.m_Offset);
 }
 
 
@@ -103,7 +110,11 @@ Image::~Image() {
             m_Device.destroy(m_Image);
             m_Image = nullptr;
          }
-         m_Device.freeMemory(m_Memory);
+         if (m_Allocation.m_Block) {
+            m_Allocator->Free(m_Allocation);
+         } else {
+            m_Device.freeMemory(m_Memory);
+         }
          m_Memory = nullptr;
       }
    }
@@ -113,10 +124,17 @@ Image::~Image() {
 Image& Image::operator=(Image&& that) {
    if (this != &that) {
       m_Device = that.m_Device;
+      m_Allocator = that.m_Allocator;
+      m_Type = that.m_Type;
       m_Image = that.m_Image;
+      m_Memory = that.m_Memory;
+      m_Allocation = that.m_Allocation;
       m_ImageView = that.m_ImageView;
       that.m_Device = nullptr;
+      that.m_Allocator = nullptr;
       that.m_Image = nullptr;
+      that.m_Memory = nullptr;
+      that.m_Allocation = {};
       that.m_ImageView = nullptr;
    }
    return *this;
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "MemoryAllocator.h"
+
 #include <vulkan/vulkan.hpp>
 
 namespace Vulkan {
@@ -20,6 +22,7 @@ public:
    vk::ImageViewType m_Type = vk::ImageViewType::e2D;
    vk::Image m_Image;
    vk::DeviceMemory m_Memory;
+   MemoryAllocation m_Allocation;   // the part of m_Memory that belongs to this image
    vk::ImageView m_ImageView;
 
    void CreateImageView(const vk::Format format, const vk::ImageAspectFlags imageAspect, const uint32_t mipLevels);
@@ -27,6 +30,7 @@ public:
 
 protected:
    vk::Device m_Device;
+   MemoryAllocator* m_Allocator = nullptr;
 };
 
 }
\ No newline at end of file
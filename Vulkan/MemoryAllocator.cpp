@@ -0,0 +1,379 @@
+#include "MemoryAllocator.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <set>
+
+namespace Vulkan {
+
+// Smallest piece the buddy allocator will hand out
+static const vk::DeviceSize s_MinBuddySize = 256;
+
+
+static vk::DeviceSize AlignUp(const vk::DeviceSize value, const vk::DeviceSize alignment) {
+   return (value + alignment - 1) & ~(alignment - 1);
+}
+
+
+static vk::DeviceSize NextPowerOfTwo(const vk::DeviceSize value) {
+   vk::DeviceSize result = 1;
+   while (result < value) {
+      result <<= 1;
+   }
+   return result;
+}
+
+
+static uint32_t Log2(vk::DeviceSize value) {
+   uint32_t result = 0;
+   while (value >>= 1) {
+      ++result;
+   }
+   return result;
+}
+
+
+struct MemoryBlock {
+   vk::DeviceMemory m_Memory;
+   void* m_pMappedData = nullptr;
+   vk::DeviceSize m_Size = 0;
+   uint32_t m_MemoryTypeIndex = 0;
+   bool m_IsImage = false;
+   bool m_DeviceAddress = false;
+   MemoryAllocator::Strategy m_Strategy = MemoryAllocator::Strategy::Buddy;
+   bool m_IsDedicated = false;
+
+   uint32_t m_AllocationCount = 0;
+   vk::DeviceSize m_UsedBytes = 0;
+
+   // Linear strategy
+   vk::DeviceSize m_Head = 0;
+
+   // Buddy strategy.
+   // m_FreeLists[i] holds the offsets of free nodes of size (s_MinBuddySize << i)
+   std::vector<std::set<vk::DeviceSize>> m_FreeLists;
+
+   bool Allocate(const vk::DeviceSize size, const vk::DeviceSize alignment, vk::DeviceSize& offset, vk::DeviceSize& allocatedSize);
+   void Free(const vk::DeviceSize offset, const vk::DeviceSize allocatedSize);
+   vk::DeviceSize LargestFreeRange() const;
+};
+
+
+bool MemoryBlock::Allocate(const vk::DeviceSize size, const vk::DeviceSize alignment, vk::DeviceSize& offset, vk::DeviceSize& allocatedSize) {
+   if (m_IsDedicated) {
+      if (m_AllocationCount > 0) {
+         return false;
+      }
+      offset = 0;
+      allocatedSize = m_Size;
+      return true;
+   }
+
+   if (m_Strategy == MemoryAllocator::Strategy::Linear) {
+      vk::DeviceSize start = AlignUp(m_Head, alignment);
+      if (start + size > m_Size) {
+         return false;
+      }
+      offset = start;
+      allocatedSize = size;
+      m_Head = start + size;
+      return true;
+   }
+
+   // Buddy.  Nodes are naturally aligned to their size (within the block), so
+   // asking for a node at least as big as the alignment takes care of alignment too.
+   const vk::DeviceSize nodeSize = NextPowerOfTwo(std::max({size, alignment, s_MinBuddySize}));
+   const uint32_t order = Log2(nodeSize / s_MinBuddySize);
+   if (order >= m_FreeLists.size()) {
+      return false;
+   }
+   uint32_t i = order;
+   while ((i < m_FreeLists.size()) && m_FreeLists[i].empty()) {
+      ++i;
+   }
+   if (i == m_FreeLists.size()) {
+      return false;
+   }
+   vk::DeviceSize nodeOffset = *m_FreeLists[i].begin();
+   m_FreeLists[i].erase(m_FreeLists[i].begin());
+   while (i > order) {
+      --i;
+      m_FreeLists[i].insert(nodeOffset + (s_MinBuddySize << i));
+   }
+   offset = nodeOffset;
+   allocatedSize = nodeSize;
+   return true;
+}
+
+
+void MemoryBlock::Free(const vk::DeviceSize offset, const vk::DeviceSize allocatedSize) {
+   if (m_IsDedicated) {
+      return;
+   }
+
+   if (m_Strategy == MemoryAllocator::Strategy::Linear) {
+      // nothing to do until the whole block is empty (see MemoryAllocator::Free())
+      return;
+   }
+
+   vk::DeviceSize nodeOffset = offset;
+   uint32_t order = Log2(allocatedSize / s_MinBuddySize);
+   while (order + 1 < m_FreeLists.size()) {
+      const vk::DeviceSize buddy = nodeOffset ^ (s_MinBuddySize << order);
+      auto it = m_FreeLists[order].find(buddy);
+      if (it == m_FreeLists[order].end()) {
+         break;
+      }
+      m_FreeLists[order].erase(it);
+      nodeOffset = std::min(nodeOffset, buddy);
+      ++order;
+   }
+   m_FreeLists[order].insert(nodeOffset);
+}
+
+
+vk::DeviceSize MemoryBlock::LargestFreeRange() const {
+   if (m_IsDedicated) {
+      return m_AllocationCount == 0 ? m_Size : 0;
+   }
+   if (m_Strategy == MemoryAllocator::Strategy::Linear) {
+      return m_AllocationCount == 0 ? m_Size : m_Size - m_Head;
+   }
+   for (size_t i = m_FreeLists.size(); i > 0; --i) {
+      if (!m_FreeLists[i - 1].empty()) {
+         return s_MinBuddySize << (i - 1);
+      }
+   }
+   return 0;
+}
+
+
+MemoryAllocator* MemoryAllocator::sm_DefaultAllocator = nullptr;
+
+
+MemoryAllocator::MemoryAllocator(vk::Device device, vk::PhysicalDevice physicalDevice, const vk::DeviceSize blockSize)
+: m_Device(device)
+, m_MemoryProperties(physicalDevice.getMemoryProperties())
+, m_BlockSize(NextPowerOfTwo(std::max(blockSize, s_MinBuddySize)))
+{}
+
+
+MemoryAllocator::~MemoryAllocator() {
+   LogStatistics();
+   if (m_LiveSubAllocationCount > 0) {
+      CORE_LOG_WARN("Memory allocator destroyed with {0} allocations still live!", m_LiveSubAllocationCount);
+   }
+   for (auto& block : m_Blocks) {
+      if (block->m_pMappedData) {
+         m_Device.unmapMemory(block->m_Memory);
+      }
+      m_Device.freeMemory(block->m_Memory);
+   }
+   m_Blocks.clear();
+   if (sm_DefaultAllocator == this) {
+      sm_DefaultAllocator = nullptr;
+   }
+}
+
+
+MemoryAllocation MemoryAllocator::Allocate(const vk::MemoryRequirements& requirements, const vk::MemoryPropertyFlags properties, const bool isImage, const bool deviceAddress, const Strategy strategy, const vk::DeviceSize minAlignment) {
+   std::lock_guard<std::mutex> lock(m_Mutex);
+
+   const uint32_t memoryTypeIndex = FindMemoryType(requirements.memoryTypeBits, properties);
+   const vk::DeviceSize alignment = std::max(requirements.alignment, minAlignment);
+
+   MemoryAllocation allocation;
+   vk::DeviceSize allocatedSize = 0;
+
+   MemoryBlock* block = nullptr;
+   if (requirements.size > m_BlockSize / 2) {
+      block = CreateBlock(memoryTypeIndex, requirements.size, isImage, deviceAddress, strategy, true);
+      block->Allocate(requirements.size, alignment, allocation.m_Offset, allocatedSize);
+   } else {
+      for (auto& candidate : m_Blocks) {
+         if (
+            !candidate->m_IsDedicated &&
+            (candidate->m_MemoryTypeIndex == memoryTypeIndex) &&
+            (candidate->m_IsImage == isImage) &&
+            (candidate->m_DeviceAddress == deviceAddress) &&
+            (candidate->m_Strategy == strategy) &&
+            candidate->Allocate(requirements.size, alignment, allocation.m_Offset, allocatedSize)
+         ) {
+            block = candidate.get();
+            break;
+         }
+      }
+      if (!block) {
+         block = CreateBlock(memoryTypeIndex, m_BlockSize, isImage, deviceAddress, strategy, false);
+         if (!block->Allocate(requirements.size, alignment, allocation.m_Offset, allocatedSize)) {
+            throw std::runtime_error("failed to sub-allocate from new memory block!");
+         }
+      }
+   }
+
+   ++block->m_AllocationCount;
+   block->m_UsedBytes += allocatedSize;
+
+   allocation.m_Memory = block->m_Memory;
+   allocation.m_Size = allocatedSize;
+   allocation.m_Block = block;
+   if (block->m_pMappedData) {
+      allocation.m_pMappedData = static_cast<char*>(block->m_pMappedData) + allocation.m_Offset;
+   }
+
+   ++m_SubAllocationCount;
+   ++m_LiveSubAllocationCount;
+   m_PeakLiveSubAllocationCount = std::max(m_PeakLiveSubAllocationCount, m_LiveSubAllocationCount);
+   m_UsedBytes += allocatedSize;
+   m_PeakUsedBytes = std::max(m_PeakUsedBytes, m_UsedBytes);
+
+   return allocation;
+}
+
+
+void MemoryAllocator::Free(MemoryAllocation& allocation) {
+   if (!allocation) {
+      return;
+   }
+   std::lock_guard<std::mutex> lock(m_Mutex);
+
+   MemoryBlock* block = allocation.m_Block;
+   CORE_ASSERT(block, "Attempted to free memory that did not come from the allocator!");
+
+   block->Free(allocation.m_Offset, allocation.m_Size);
+   --block->m_AllocationCount;
+   block->m_UsedBytes -= allocation.m_Size;
+
+   --m_LiveSubAllocationCount;
+   m_UsedBytes -= allocation.m_Size;
+
+   if (block->m_AllocationCount == 0) {
+      block->m_Head = 0;
+      // Dedicated blocks always go straight back to the driver.
+      // Pooled blocks are kept around if they are the only empty block of their kind (to avoid allocate/free churn)
+      bool release = block->m_IsDedicated;
+      if (!release) {
+         for (const auto& other : m_Blocks) {
+            if (
+               (other.get() != block) &&
+               !other->m_IsDedicated &&
+               (other->m_AllocationCount == 0) &&
+               (other->m_MemoryTypeIndex == block->m_MemoryTypeIndex) &&
+               (other->m_IsImage == block->m_IsImage) &&
+               (other->m_DeviceAddress == block->m_DeviceAddress) &&
+               (other->m_Strategy == block->m_Strategy)
+            ) {
+               release = true;
+               break;
+            }
+         }
+      }
+      if (release) {
+         DestroyBlock(block);
+      }
+   }
+
+   allocation = {};
+}
+
+
+void MemoryAllocator::LogStatistics() const {
+   std::lock_guard<std::mutex> lock(m_Mutex);
+
+   CORE_LOG_INFO("Memory allocator: {0} allocations served from {1} vkAllocateMemory calls", m_SubAllocationCount, m_DeviceMemoryAllocationCount);
+   CORE_LOG_INFO("Memory allocator: peak {0} live allocations in {1} blocks.  Peak {2} MB used of {3} MB allocated", m_PeakLiveSubAllocationCount, m_PeakBlockCount, m_PeakUsedBytes / (1024 * 1024), m_PeakAllocatedBytes / (1024 * 1024));
+
+   for (uint32_t i = 0; i < m_MemoryProperties.memoryTypeCount; ++i) {
+      vk::DeviceSize allocated = 0;
+      vk::DeviceSize used = 0;
+      vk::DeviceSize largestFree = 0;
+      size_t blockCount = 0;
+      for (const auto& block : m_Blocks) {
+         if (block->m_MemoryTypeIndex == i) {
+            ++blockCount;
+            allocated += block->m_Size;
+            used += block->m_UsedBytes;
+            largestFree = std::max(largestFree, block->LargestFreeRange());
+         }
+      }
+      if (blockCount > 0) {
+         // fragmentation here is 1 - (largest free range / total free).  0 means all free memory is in one piece
+         const vk::DeviceSize free = allocated - used;
+         const double fragmentation = free > 0 ? 1.0 - static_cast<double>(largestFree) / static_cast<double>(free) : 0.0;
+         CORE_LOG_INFO("Memory type {0} ({1}): {2} blocks, {3} KB used of {4} KB, fragmentation {5:.2f}", i, vk::to_string(m_MemoryProperties.memoryTypes[i].propertyFlags), blockCount, used / 1024, allocated / 1024, fragmentation);
+      }
+   }
+}
+
+
+MemoryAllocator* MemoryAllocator::GetDefault() {
+   return sm_DefaultAllocator;
+}
+
+
+void MemoryAllocator::SetDefault(MemoryAllocator* allocator) {
+   sm_DefaultAllocator = allocator;
+}
+
+
+uint32_t MemoryAllocator::FindMemoryType(const uint32_t typeFilter, const vk::MemoryPropertyFlags properties) const {
+   for (uint32_t i = 0; i < m_MemoryProperties.memoryTypeCount; ++i) {
+      if ((typeFilter & (1 << i)) && ((m_MemoryProperties.memoryTypes[i].propertyFlags & properties) == properties)) {
+         return i;
+      }
+   }
+   throw std::runtime_error("failed to find suitable memory type!");
+}
+
+
+MemoryBlock* MemoryAllocator::CreateBlock(const uint32_t memoryTypeIndex, const vk::DeviceSize size, const bool isImage, const bool deviceAddress, const Strategy strategy, const bool isDedicated) {
+   vk::MemoryAllocateInfo ai = {
+      size                                       /*allocationSize*/,
+      memoryTypeIndex                            /*memoryTypeIndex*/
+   };
+   vk::MemoryAllocateFlagsInfo afi = {
+      vk::MemoryAllocateFlagBits::eDeviceAddress /*flags*/,
+      {}                                         /*deviceMask*/
+   };
+   if (deviceAddress) {
+      ai.setPNext(&afi);
+   }
+
+   auto block = std::make_unique<MemoryBlock>();
+   block->m_Memory = m_Device.allocateMemory(ai);
+   block->m_Size = size;
+   block->m_MemoryTypeIndex = memoryTypeIndex;
+   block->m_IsImage = isImage;
+   block->m_DeviceAddress = deviceAddress;
+   block->m_Strategy = strategy;
+   block->m_IsDedicated = isDedicated;
+   if (m_MemoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible) {
+      block->m_pMappedData = m_Device.mapMemory(block->m_Memory, 0, VK_WHOLE_SIZE);
+   }
+   if (!isDedicated && (strategy == Strategy::Buddy)) {
+      block->m_FreeLists.resize(Log2(size / s_MinBuddySize) + 1);
+      block->m_FreeLists.back().insert(0);
+   }
+
+   ++m_DeviceMemoryAllocationCount;
+   m_AllocatedBytes += size;
+   m_PeakAllocatedBytes = std::max(m_PeakAllocatedBytes, m_AllocatedBytes);
+
+   m_Blocks.emplace_back(std::move(block));
+   m_PeakBlockCount = std::max(m_PeakBlockCount, m_Blocks.size());
+   return m_Blocks.back().get();
+}
+
+
+void MemoryAllocator::DestroyBlock(MemoryBlock* block) {
+   auto it = std::find_if(m_Blocks.begin(), m_Blocks.end(), [block](const auto& candidate) { return candidate.get() == block; });
+   CORE_ASSERT(it != m_Blocks.end(), "Attempted to destroy unknown memory block!");
+   m_AllocatedBytes -= block->m_Size;
+   if (block->m_pMappedData) {
+      m_Device.unmapMemory(block->m_Memory);
+   }
+   m_Device.freeMemory(block->m_Memory);
+   m_Blocks.erase(it);
+}
+
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "Utility.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Vulkan {
+
+struct MemoryBlock;
+
+// A range of a vk::DeviceMemory, handed out by MemoryAllocator.
+// If m_Block is nullptr, then the allocation is not from a pool (it owns the whole of m_Memory)
+struct MemoryAllocation {
+   vk::DeviceMemory m_Memory;
+   vk::DeviceSize m_Offset = 0;
+   vk::DeviceSize m_Size = 0;
+   MemoryBlock* m_Block = nullptr;
+   void* m_pMappedData = nullptr;   // host visible memory is mapped for the lifetime of the block.  This points at m_Offset within that mapping
+
+   explicit operator bool() const { return static_cast<bool>(m_Memory); }
+};
+
+
+// Sub-allocates buffers and images out of large vk::DeviceMemory blocks.
+// Blocks are kept per memory type, and per "kind" of resource (buffers and optimal tiling images never share a block,
+// which saves us having to worry about bufferImageGranularity)
+// Requests larger than half a block get a dedicated vk::DeviceMemory of their own.
+// Blocks in host visible memory types are persistently mapped (vkMapMemory is called once per block, not once per write)
+class MemoryAllocator {
+public:
+
+   enum class Strategy {
+      Buddy,   // general purpose.  Freed memory is merged back with its buddy straight away
+      Linear   // bump pointer.  Very cheap, but a block is only reclaimed once everything in it has been freed.  Use for short lived stuff (staging, scratch)
+   };
+
+   MemoryAllocator(vk::Device device, vk::PhysicalDevice physicalDevice, const vk::DeviceSize blockSize = 64 * 1024 * 1024);
+   NON_COPYABLE(MemoryAllocator);
+   ~MemoryAllocator();
+
+   // isImage should be true for optimal tiling images, false for buffers (and linear tiling images)
+   // deviceAddress should be true if the memory will be used for a buffer with eShaderDeviceAddress usage.
+   // minAlignment lets caller ask for stricter alignment than requirements.alignment (e.g. acceleration structure scratch)
+   MemoryAllocation Allocate(const vk::MemoryRequirements& requirements, const vk::MemoryPropertyFlags properties, const bool isImage, const bool deviceAddress, const Strategy strategy = Strategy::Buddy, const vk::DeviceSize minAlignment = 1);
+   void Free(MemoryAllocation& allocation);
+
+   void LogStatistics() const;
+
+   // Buffers and Images get their memory from the default allocator (if there is one).
+   // Otherwise they fall back to a dedicated vk::DeviceMemory each.
+   static MemoryAllocator* GetDefault();
+   static void SetDefault(MemoryAllocator* allocator);
+
+private:
+   uint32_t FindMemoryType(const uint32_t typeFilter, const vk::MemoryPropertyFlags properties) const;
+   MemoryBlock* CreateBlock(const uint32_t memoryTypeIndex, const vk::DeviceSize size, const bool isImage, const bool deviceAddress, const Strategy strategy, const bool isDedicated);
+   void DestroyBlock(MemoryBlock* block);
+
+private:
+   vk::Device m_Device;
+   vk::PhysicalDeviceMemoryProperties m_MemoryProperties;
+   vk::DeviceSize m_BlockSize;
+   std::vector<std::unique_ptr<MemoryBlock>> m_Blocks;
+   mutable std::mutex m_Mutex;
+
+   // statistics
+   uint64_t m_DeviceMemoryAllocationCount = 0;     // total number of calls to vkAllocateMemory
+   uint64_t m_SubAllocationCount = 0;              // total number of allocations handed out
+   uint64_t m_LiveSubAllocationCount = 0;
+   uint64_t m_PeakLiveSubAllocationCount = 0;
+   size_t m_PeakBlockCount = 0;
+   vk::DeviceSize m_AllocatedBytes = 0;            // bytes of vk::DeviceMemory currently allocated
+   vk::DeviceSize m_PeakAllocatedBytes = 0;
+   vk::DeviceSize m_UsedBytes = 0;                 // bytes currently handed out to callers
+   vk::DeviceSize m_PeakUsedBytes = 0;
+
+   static MemoryAllocator* sm_DefaultAllocator;
+};
+
+}
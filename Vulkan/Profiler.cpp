@@ -0,0 +1,197 @@
+#include "Profiler.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+
+namespace Vulkan {
+
+Profiler::CPUScope::CPUScope(Profiler* profiler, const char* name)
+: m_Profiler(profiler)
+, m_Name(name)
+, m_Start(std::chrono::steady_clock::now())
+{}
+
+
+Profiler::CPUScope::~CPUScope() {
+   if (m_Profiler) {
+      auto end = std::chrono::steady_clock::now();
+      double start = m_Profiler->MicrosecondsSinceStart(m_Start);
+      m_Profiler->AddEvent(m_Name, start, m_Profiler->MicrosecondsSinceStart(end) - start, false);
+   }
+}
+
+
+Profiler::Profiler(vk::Device device, const vk::PhysicalDevice physicalDevice, const uint32_t queueFamilyIndex, const uint32_t slotCount, const uint32_t maxScopesPerSlot)
+: m_Device(device)
+, m_Slots(slotCount)
+, m_MaxScopesPerSlot(maxScopesPerSlot)
+, m_TimestampPeriod(physicalDevice.getProperties().limits.timestampPeriod)
+, m_StartTime(std::chrono::steady_clock::now())
+{
+   uint32_t validBits = physicalDevice.getQueueFamilyProperties()[queueFamilyIndex].timestampValidBits;
+   m_IsGPUTimingSupported = (validBits > 0);
+   m_TimestampMask = (validBits >= 64) ? ~uint64_t(0) : ((uint64_t(1) << validBits) - 1);
+   if (!m_IsGPUTimingSupported) {
+      CORE_LOG_WARN("Queue family {0} does not support timestamps.  GPU scopes will not be profiled", queueFamilyIndex);
+   }
+   CreateQueryPool();
+}
+
+
+Profiler::~Profiler() {
+   DestroyQueryPool();
+}
+
+
+void Profiler::SetSlotCount(const uint32_t slotCount) {
+   DestroyQueryPool();
+   m_Slots.clear();
+   m_Slots.resize(slotCount);
+   CreateQueryPool();
+}
+
+
+void Profiler::BeginCommandBuffer(vk::CommandBuffer commandBuffer, const uint32_t slot) {
+   m_Slots[slot].m_Scopes.clear();
+   m_Slots[slot].m_QueryCount = 0;
+   m_Slots[slot].m_IsPending = false;
+   if (m_QueryPool) {
+      commandBuffer.resetQueryPool(m_QueryPool, slot * m_MaxScopesPerSlot * 2, m_MaxScopesPerSlot * 2);
+   }
+}
+
+
+uint32_t Profiler::BeginGPUScope(vk::CommandBuffer commandBuffer, const uint32_t slot, const char* name) {
+   Slot& s = m_Slots[slot];
+   uint32_t id = static_cast<uint32_t>(s.m_Scopes.size());
+   if (!m_QueryPool || (id >= m_MaxScopesPerSlot)) {
+      return ~0u;
+   }
+   uint32_t query = (slot * m_MaxScopesPerSlot * 2) + s.m_QueryCount++;
+   s.m_Scopes.push_back({name, query, ~0u});
+   commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, m_QueryPool, query);
+   return id;
+}
+
+
+void Profiler::EndGPUScope(vk::CommandBuffer commandBuffer, const uint32_t slot, const uint32_t id) {
+   Slot& s = m_Slots[slot];
+   if (id >= s.m_Scopes.size()) {
+      return;
+   }
+   uint32_t query = (slot * m_MaxScopesPerSlot * 2) + s.m_QueryCount++;
+   s.m_Scopes[id].m_EndQuery = query;
+   commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, m_QueryPool, query);
+}
+
+
+void Profiler::OnSubmit(const uint32_t slot) {
+   m_Slots[slot].m_IsPending = !m_Slots[slot].m_Scopes.empty();
+   m_Slots[slot].m_SubmitTime = std::chrono::steady_clock::now();
+}
+
+
+void Profiler::CollectGPUResults(const uint32_t slot) {
+   Slot& s = m_Slots[slot];
+   if (!s.m_IsPending) {
+      return;
+   }
+   s.m_IsPending = false;
+
+   // Timestamps are all in the slot's range of queries, starting at the first one
+   std::vector<uint64_t> timestamps(s.m_QueryCount);
+   auto result = m_Device.getQueryPoolResults(m_QueryPool, slot * m_MaxScopesPerSlot * 2, s.m_QueryCount, timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+   if (result != vk::Result::eSuccess) {
+      return;
+   }
+
+   // There is no common clock between CPU and GPU (without VK_EXT_calibrated_timestamps).
+   // For the trace, we (approximately) line up the first GPU timestamp in the command buffer with the time it was submitted.
+   uint64_t origin = timestamps[0] & m_TimestampMask;
+   double submitMicroseconds = MicrosecondsSinceStart(s.m_SubmitTime);
+   for (const auto& scope : s.m_Scopes) {
+      if (scope.m_EndQuery == ~0u) {
+         continue;
+      }
+      uint32_t base = slot * m_MaxScopesPerSlot * 2;
+      uint64_t begin = timestamps[scope.m_BeginQuery - base] & m_TimestampMask;
+      uint64_t end = timestamps[scope.m_EndQuery - base] & m_TimestampMask;
+      double startMicroseconds = submitMicroseconds + ((begin - origin) & m_TimestampMask) * m_TimestampPeriod / 1000.0;
+      double durationMicroseconds = ((end - begin) & m_TimestampMask) * m_TimestampPeriod / 1000.0;
+      AddEvent(scope.m_Name, startMicroseconds, durationMicroseconds, true);
+   }
+}
+
+
+void Profiler::LogStatistics() const {
+   CORE_LOG_INFO("Profiler: {0:<32} {1:>8} {2:>10} {3:>10} {4:>10}", "scope", "count", "min (ms)", "avg (ms)", "p99 (ms)");
+   for (const auto& [name, durations] : m_Durations) {
+      if (durations.empty()) {
+         continue;
+      }
+      std::vector<double> sorted = durations;
+      std::sort(sorted.begin(), sorted.end());
+      double avg = std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+      double p99 = sorted[std::min(sorted.size() - 1, static_cast<size_t>(0.99 * sorted.size()))];
+      CORE_LOG_INFO("Profiler: {0:<32} {1:>8} {2:>10.3f} {3:>10.3f} {4:>10.3f}", name, sorted.size(), sorted.front(), avg, p99);
+   }
+}
+
+
+void Profiler::WriteChromeTrace(const std::string& fileName) const {
+   std::ofstream file(fileName, std::ios::out | std::ios::trunc);
+   if (!file.is_open()) {
+      CORE_LOG_ERROR("failed to open profile trace file '{0}'", fileName);
+      return;
+   }
+
+   // CPU events on thread 1, GPU events on thread 2 (so that they show up as separate tracks)
+   file << "{\"traceEvents\":[\n";
+   file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+   file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+   file.precision(3);
+   file << std::fixed;
+   for (const auto& event : m_Events) {
+      file << ",\n{\"name\":\"" << event.m_Name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << (event.m_IsGPU ? 2 : 1) << ",\"ts\":" << event.m_StartMicroseconds << ",\"dur\":" << event.m_DurationMicroseconds << "}";
+   }
+   file << "\n]}\n";
+
+   CORE_LOG_INFO("Wrote {0} profile events to '{1}'", m_Events.size(), fileName);
+}
+
+
+void Profiler::CreateQueryPool() {
+   if (m_IsGPUTimingSupported && !m_Slots.empty()) {
+      m_QueryPool = m_Device.createQueryPool({
+         {}                                                               /*flags*/,
+         vk::QueryType::eTimestamp                                        /*queryType*/,
+         static_cast<uint32_t>(m_Slots.size()) * m_MaxScopesPerSlot * 2   /*queryCount*/,
+         {}                                                               /*pipelineStatistics*/
+      });
+   }
+}
+
+
+void Profiler::DestroyQueryPool() {
+   if (m_Device && m_QueryPool) {
+      m_Device.destroy(m_QueryPool);
+      m_QueryPool = nullptr;
+   }
+}
+
+
+void Profiler::AddEvent(const std::string& name, const double startMicroseconds, const double durationMicroseconds, const bool isGPU) {
+   m_Durations[isGPU ? "GPU: " + name : name].push_back(durationMicroseconds / 1000.0);
+   if (m_Events.size() < sm_MaxEvents) {
+      m_Events.push_back({name, startMicroseconds, durationMicroseconds, isGPU});
+   }
+}
+
+
+double Profiler::MicrosecondsSinceStart(const std::chrono::steady_clock::time_point time) const {
+   return std::chrono::duration<double, std::micro>(time - m_StartTime).count();
+}
+
+}
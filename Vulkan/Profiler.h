@@ -0,0 +1,113 @@
+#pragma once
+
+#include "Utility.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Vulkan {
+
+// Frame profiler.
+//
+// GPU: regions of a command buffer are bracketed by a pair of timestamp queries (BeginGPUScope() / EndGPUScope()).
+// Command buffers are pre-recorded, one per swap chain image, so each command buffer ("slot") gets its own range of queries.
+// Results for a slot are read back when that command buffer is next about to be used (by which time it has finished executing).
+//
+// CPU: scopes are timed with a steady clock (CPUScope).
+//
+// Every scope that completes is folded into per-name statistics (min / avg / p99), and also kept as an event so that
+// the whole run can be written out in chrome://tracing (JSON) format.
+class Profiler {
+public:
+
+   // RAII timer for a CPU scope
+   class CPUScope {
+   public:
+      CPUScope(Profiler* profiler, const char* name);
+      NON_COPYABLE(CPUScope);
+      ~CPUScope();
+
+   private:
+      Profiler* m_Profiler;
+      const char* m_Name;
+      std::chrono::steady_clock::time_point m_Start;
+   };
+
+   // slotCount is the number of command buffers that will be instrumented.
+   Profiler(vk::Device device, const vk::PhysicalDevice physicalDevice, const uint32_t queueFamilyIndex, const uint32_t slotCount, const uint32_t maxScopesPerSlot = 16);
+   NON_COPYABLE(Profiler);
+   ~Profiler();
+
+   // Call when the command buffers are re-created (e.g. window resized).  Accumulated statistics are kept.
+   void SetSlotCount(const uint32_t slotCount);
+
+   // Must be called at the start of recording the command buffer for slot (outside of a render pass).
+   // Resets the slot's queries and forgets any GPU scopes previously recorded for it.
+   void BeginCommandBuffer(vk::CommandBuffer commandBuffer, const uint32_t slot);
+
+   // Returns an id to be passed to EndGPUScope().
+   // Scopes beyond maxScopesPerSlot are silently ignored.
+   uint32_t BeginGPUScope(vk::CommandBuffer commandBuffer, const uint32_t slot, const char* name);
+   void EndGPUScope(vk::CommandBuffer commandBuffer, const uint32_t slot, const uint32_t id);
+
+   // Call after the command buffer for slot has been submitted
+   void OnSubmit(const uint32_t slot);
+
+   // Call once the command buffer for slot is known to have finished executing (and before it is submitted again)
+   void CollectGPUResults(const uint32_t slot);
+
+   // Log min / avg / p99 for every scope seen so far
+   void LogStatistics() const;
+
+   // Write everything recorded so far in chrome://tracing format.
+   void WriteChromeTrace(const std::string& fileName) const;
+
+private:
+   struct Event {
+      std::string m_Name;
+      double m_StartMicroseconds;
+      double m_DurationMicroseconds;
+      bool m_IsGPU;
+   };
+
+   struct GPUScope {
+      std::string m_Name;
+      uint32_t m_BeginQuery;
+      uint32_t m_EndQuery;
+   };
+
+   struct Slot {
+      std::vector<GPUScope> m_Scopes;
+      uint32_t m_QueryCount = 0;                           // number of queries used so far in this slot
+      bool m_IsPending = false;                            // submitted, but results not yet collected
+      std::chrono::steady_clock::time_point m_SubmitTime;
+   };
+
+   void CreateQueryPool();
+   void DestroyQueryPool();
+
+   void AddEvent(const std::string& name, const double startMicroseconds, const double durationMicroseconds, const bool isGPU);
+
+   double MicrosecondsSinceStart(const std::chrono::steady_clock::time_point time) const;
+
+private:
+   vk::Device m_Device;
+   vk::QueryPool m_QueryPool;
+   std::vector<Slot> m_Slots;
+   uint32_t m_MaxScopesPerSlot;
+   float m_TimestampPeriod;          // nanoseconds per tick
+   uint64_t m_TimestampMask;         // queue family might not write all 64 bits
+   bool m_IsGPUTimingSupported;
+
+   std::chrono::steady_clock::time_point m_StartTime;
+   std::vector<Event> m_Events;
+   std::map<std::string, std::vector<double>> m_Durations; // milliseconds, by scope name.  "GPU: " prefix for gpu scopes
+
+   static constexpr size_t sm_MaxEvents = 1000000;
+};
+
+}
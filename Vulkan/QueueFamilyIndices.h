@@ -7,6 +7,7 @@ namespace Vulkan {
 struct QueueFamilyIndices {
    std::optional<uint32_t> GraphicsFamily;
    std::optional<uint32_t> PresentFamily;
+   std::optional<uint32_t> TransferFamily;   // only set if there is a dedicated (i.e. not graphics or compute) transfer queue family
 
    bool IsComplete() {
       return GraphicsFamily.has_value() && PresentFamily.has_value();
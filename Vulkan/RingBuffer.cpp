@@ -0,0 +1,57 @@
+#include "RingBuffer.h"
+#include "Core.h"
+
+#include <algorithm>
+
+namespace Vulkan {
+
+static vk::DeviceSize RingBufferAlignment(const vk::PhysicalDevice physicalDevice, const vk::BufferUsageFlags usage) {
+   const auto limits = physicalDevice.getProperties().limits;
+   vk::DeviceSize alignment = 1;
+   if (usage & vk::BufferUsageFlagBits::eUniformBuffer) {
+      alignment = std::max(alignment, limits.minUniformBufferOffsetAlignment);
+   }
+   if (usage & vk::BufferUsageFlagBits::eStorageBuffer) {
+      alignment = std::max(alignment, limits.minStorageBufferOffsetAlignment);
+   }
+   return alignment;
+}
+
+
+static vk::DeviceSize AlignUp(const vk::DeviceSize value, const vk::DeviceSize alignment) {
+   return (value + alignment - 1) / alignment * alignment;
+}
+
+
+RingBuffer::RingBuffer(vk::Device device, const vk::PhysicalDevice physicalDevice, const vk::DeviceSize elementSize, const vk::DeviceSize frameSize, const uint32_t frameCount, const vk::BufferUsageFlags usage)
+: Buffer(device, physicalDevice, AlignUp(frameSize, RingBufferAlignment(physicalDevice, usage)) * frameCount, usage, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent)
+, m_Alignment(RingBufferAlignment(physicalDevice, usage))
+, m_FrameSize(AlignUp(frameSize, m_Alignment))
+, m_FrameCount(frameCount)
+{
+   m_Descriptor.range = elementSize;
+}
+
+
+void RingBuffer::BeginFrame(const uint32_t frameIndex) {
+   CORE_ASSERT(frameIndex < m_FrameCount, "RingBuffer frame index out of range!");
+   m_FrameIndex = frameIndex;
+   m_Head = 0;
+}
+
+
+uint32_t RingBuffer::Push(const vk::DeviceSize size, const void* pData) {
+   CORE_ASSERT(m_Head + size <= m_FrameSize, "RingBuffer frame slice overflow!");
+   const vk::DeviceSize offset = GetFrameOffset(m_FrameIndex) + m_Head;
+   CopyFromHost(offset, size, pData);
+   m_Head = AlignUp(m_Head + size, m_Alignment);
+   return static_cast<uint32_t>(offset);
+}
+
+
+uint32_t RingBuffer::GetFrameOffset(const uint32_t frameIndex) const {
+   CORE_ASSERT(frameIndex < m_FrameCount, "RingBuffer frame index out of range!");
+   return static_cast<uint32_t>(frameIndex * m_FrameSize);
+}
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "Buffer.h"
+
+namespace Vulkan {
+
+// One large, persistently mapped, host visible buffer divided into a slice per frame.
+// BeginFrame() rewinds the given frame's slice, and Push() then copies data into it,
+// returning an offset suitable for use as a dynamic offset (i.e. bind the buffer with eUniformBufferDynamic)
+//
+// Since each frame has its own slice, the CPU can be writing one frame's data while the GPU is still reading
+// another's.  This replaces the "one Vulkan::Buffer per swap chain image" pattern for uniform data.
+//
+// Note that apps here pre-record their command buffers (one per swap chain image), and so the dynamic offsets
+// are baked in at record time.  GetFrameOffset(i) is the offset of the first Push() in frame i.
+class RingBuffer : public Buffer {
+public:
+
+   // frameSize is the maximum amount of data that will be pushed in any one frame.
+   // m_Descriptor.range is set to elementSize (i.e. what a shader sees at each dynamic offset)
+   RingBuffer(vk::Device device, const vk::PhysicalDevice physicalDevice, const vk::DeviceSize elementSize, const vk::DeviceSize frameSize, const uint32_t frameCount, const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eUniformBuffer);
+
+   void BeginFrame(const uint32_t frameIndex);
+
+   // Copy size bytes from pData into current frame's slice.
+   // Returns offset (from the start of the buffer) of the copied data.
+   uint32_t Push(const vk::DeviceSize size, const void* pData);
+
+   template<typename T>
+   uint32_t Push(const T& data) {
+      return Push(sizeof(T), &data);
+   }
+
+   uint32_t GetFrameOffset(const uint32_t frameIndex) const;
+
+   vk::DeviceSize m_Alignment;
+   vk::DeviceSize m_FrameSize;
+   uint32_t m_FrameCount;
+
+private:
+   uint32_t m_FrameIndex = 0;
+   vk::DeviceSize m_Head = 0;
+};
+
+}
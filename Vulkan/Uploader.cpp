@@ -0,0 +1,280 @@
+#include "Uploader.h"
+#include "Log.h"
+
+#include <algorithm>
+
+namespace Vulkan {
+
+Uploader::Uploader(vk::Device device, const vk::PhysicalDevice physicalDevice, const uint32_t graphicsFamily, vk::Queue graphicsQueue, const std::optional<uint32_t> transferFamily, vk::Queue transferQueue, const vk::DeviceSize stagingSize)
+: m_Device(device)
+, m_PhysicalDevice(physicalDevice)
+, m_GraphicsFamily(graphicsFamily)
+, m_GraphicsQueue(graphicsQueue)
+, m_TransferFamily(transferFamily.value_or(graphicsFamily))
+, m_TransferQueue(transferFamily.has_value() ? transferQueue : graphicsQueue)
+, m_HasTransferQueue(transferFamily.has_value() && (transferFamily.value() != graphicsFamily))
+{
+   m_GraphicsCommandPool = m_Device.createCommandPool({
+      {vk::CommandPoolCreateFlagBits::eTransient} /*flags*/,
+      m_GraphicsFamily                             /*queueFamilyIndex*/
+   });
+   std::vector<vk::CommandBuffer> commandBuffers = m_Device.allocateCommandBuffers({
+      m_GraphicsCommandPool            /*commandPool*/,
+      vk::CommandBufferLevel::ePrimary /*level*/,
+      2                                /*commandBufferCount*/
+   });
+   m_GraphicsCommandBuffer = commandBuffers[0];
+   m_AcquireCommandBuffer = commandBuffers[1];
+
+   if (m_HasTransferQueue) {
+      m_TransferCommandPool = m_Device.createCommandPool({
+         {vk::CommandPoolCreateFlagBits::eTransient} /*flags*/,
+         m_TransferFamily                             /*queueFamilyIndex*/
+      });
+      m_TransferCommandBuffer = m_Device.allocateCommandBuffers({
+         m_TransferCommandPool            /*commandPool*/,
+         vk::CommandBufferLevel::ePrimary /*level*/,
+         1                                /*commandBufferCount*/
+      }).front();
+      m_TransferCompleteSemaphore = m_Device.createSemaphore({});
+      CORE_LOG_INFO("Uploads will use dedicated transfer queue family {0}", m_TransferFamily);
+   }
+
+   m_Fence = m_Device.createFence({});
+
+   m_StagingBuffer = std::make_unique<Buffer>(m_Device, m_PhysicalDevice, stagingSize, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+}
+
+
+Uploader::~Uploader() {
+   Flush();
+   m_StagingBuffer.reset(nullptr);
+   if (m_Fence) {
+      m_Device.destroy(m_Fence);
+   }
+   if (m_TransferCompleteSemaphore) {
+      m_Device.destroy(m_TransferCompleteSemaphore);
+   }
+   if (m_TransferCommandPool) {
+      m_Device.destroy(m_TransferCommandPool);
+   }
+   if (m_GraphicsCommandPool) {
+      m_Device.destroy(m_GraphicsCommandPool);
+   }
+}
+
+
+void Uploader::UploadToBuffer(const void* pData, const vk::DeviceSize size, vk::Buffer dst, const vk::DeviceSize dstOffset) {
+   if (size == 0) {
+      return;
+   }
+   auto [src, srcOffset] = Stage(pData, size, 4);
+
+   vk::CommandBuffer cmd = GetUploadCommandBuffer();
+   cmd.copyBuffer(src, dst, vk::BufferCopy {srcOffset, dstOffset, size});
+
+   if (cmd == m_TransferCommandBuffer) {
+      m_BufferReleases.emplace_back(
+         vk::AccessFlagBits::eTransferWrite     /*srcAccessMask*/,
+         vk::AccessFlags {}                     /*dstAccessMask*/,
+         m_TransferFamily                       /*srcQueueFamilyIndex*/,
+         m_GraphicsFamily                       /*dstQueueFamilyIndex*/,
+         dst                                    /*buffer*/,
+         dstOffset                              /*offset*/,
+         size                                   /*size*/
+      );
+   }
+}
+
+
+void Uploader::UploadToImage(const void* pData, const vk::DeviceSize size, vk::Image image, const uint32_t width, const uint32_t height, const uint32_t mipLevels) {
+   // bufferOffset must be a multiple of the texel size (up to 16 bytes for the formats we use)
+   auto [src, srcOffset] = Stage(pData, size, 16);
+
+   vk::CommandBuffer cmd = GetUploadCommandBuffer();
+
+   vk::ImageMemoryBarrier barrier = {
+      {}                                    /*srcAccessMask*/,
+      vk::AccessFlagBits::eTransferWrite    /*dstAccessMask*/,
+      vk::ImageLayout::eUndefined           /*oldLayout*/,
+      vk::ImageLayout::eTransferDstOptimal  /*newLayout*/,
+      VK_QUEUE_FAMILY_IGNORED               /*srcQueueFamilyIndex*/,
+      VK_QUEUE_FAMILY_IGNORED               /*dstQueueFamilyIndex*/,
+      image                                 /*image*/,
+      {
+         vk::ImageAspectFlagBits::eColor       /*aspectMask*/,
+         0                                     /*baseMipLevel*/,
+         mipLevels                             /*levelCount*/,
+         0                                     /*baseArrayLayer*/,
+         VK_REMAINING_ARRAY_LAYERS             /*layerCount*/
+      }                                     /*subresourceRange*/
+   };
+   cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, {}, nullptr, nullptr, barrier);
+
+   vk::BufferImageCopy region = {
+      srcOffset                            /*bufferOffset*/,
+      0                                    /*bufferRowLength*/,
+      0                                    /*bufferImageHeight*/,
+      vk::ImageSubresourceLayers {
+         vk::ImageAspectFlagBits::eColor      /*aspectMask*/,
+         0                                    /*mipLevel*/,
+         0                                    /*baseArrayLayer*/,
+         1                                    /*layerCount*/
+      }                                    /*imageSubresource*/,
+      {0, 0, 0}                            /*imageOffset*/,
+      {width, height, 1}                   /*imageExtent*/
+   };
+   cmd.copyBufferToImage(src, image, vk::ImageLayout::eTransferDstOptimal, region);
+
+   if (cmd == m_TransferCommandBuffer) {
+      barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+      barrier.dstAccessMask = {};
+      barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+      barrier.srcQueueFamilyIndex = m_TransferFamily;
+      barrier.dstQueueFamilyIndex = m_GraphicsFamily;
+      m_ImageReleases.emplace_back(barrier);
+   }
+}
+
+
+void Uploader::Record(const std::function<void(vk::CommandBuffer)>& action) {
+   action(GetGraphicsCommandBuffer());
+}
+
+
+bool Uploader::HasPendingWork() const {
+   return m_IsRecordingGraphics || m_IsRecordingTransfer;
+}
+
+
+void Uploader::Flush() {
+   if (!HasPendingWork()) {
+      return;
+   }
+   auto startTime = std::chrono::high_resolution_clock::now();
+
+   bool waitForTransfer = false;
+   if (m_IsRecordingTransfer) {
+      // release ownership of everything we uploaded to the graphics queue family...
+      m_TransferCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, {}, nullptr, m_BufferReleases, m_ImageReleases);
+      m_TransferCommandBuffer.end();
+
+      vk::SubmitInfo si;
+      si.commandBufferCount = 1;
+      si.pCommandBuffers = &m_TransferCommandBuffer;
+      si.signalSemaphoreCount = 1;
+      si.pSignalSemaphores = &m_TransferCompleteSemaphore;
+      m_TransferQueue.submit(si, nullptr);
+      ++m_SubmitCount;
+      waitForTransfer = true;
+
+      // ...and acquire it on the graphics queue
+      for (auto& barrier : m_BufferReleases) {
+         barrier.srcAccessMask = {};
+         barrier.dstAccessMask = vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite;
+      }
+      for (auto& barrier : m_ImageReleases) {
+         barrier.srcAccessMask = {};
+         barrier.dstAccessMask = vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite;
+      }
+      m_AcquireCommandBuffer.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+      m_AcquireCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eAllCommands, {}, nullptr, m_BufferReleases, m_ImageReleases);
+      m_AcquireCommandBuffer.end();
+   }
+
+   std::vector<vk::CommandBuffer> commandBuffers;
+   if (waitForTransfer) {
+      commandBuffers.emplace_back(m_AcquireCommandBuffer);
+   }
+   if (m_IsRecordingGraphics) {
+      m_GraphicsCommandBuffer.end();
+      commandBuffers.emplace_back(m_GraphicsCommandBuffer);
+   }
+
+   vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eAllCommands;
+   vk::SubmitInfo si;
+   si.waitSemaphoreCount = waitForTransfer ? 1 : 0;
+   si.pWaitSemaphores = &m_TransferCompleteSemaphore;
+   si.pWaitDstStageMask = &waitStage;
+   si.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+   si.pCommandBuffers = commandBuffers.data();
+   m_GraphicsQueue.submit(si, m_Fence);
+   ++m_SubmitCount;
+
+   if (m_Device.waitForFences(m_Fence, true, UINT64_MAX) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to wait for upload fence!");
+   }
+   m_Device.resetFences(m_Fence);
+
+   m_Device.resetCommandPool(m_GraphicsCommandPool, {});
+   if (m_TransferCommandPool) {
+      m_Device.resetCommandPool(m_TransferCommandPool, {});
+   }
+   m_IsRecordingGraphics = false;
+   m_IsRecordingTransfer = false;
+   m_BufferReleases.clear();
+   m_ImageReleases.clear();
+   m_StagingHead = 0;
+   m_OverflowBuffers.clear();
+
+   m_FlushTime += std::chrono::high_resolution_clock::now() - startTime;
+}
+
+
+void Uploader::LogStatistics() const {
+   CORE_LOG_INFO("Uploader: {0} uploads, {1:.2f} MB in {2} submits.  {3:.2f}ms staging, {4:.2f}ms submit and wait", m_UploadCount, m_BytesUploaded / (1024.0 * 1024.0), m_SubmitCount, m_StagingTime.count() * 1000.0, m_FlushTime.count() * 1000.0);
+}
+
+
+std::pair<vk::Buffer, vk::DeviceSize> Uploader::Stage(const void* pData, const vk::DeviceSize size, const vk::DeviceSize alignment) {
+   auto startTime = std::chrono::high_resolution_clock::now();
+
+   ++m_UploadCount;
+   m_BytesUploaded += size;
+
+   std::pair<vk::Buffer, vk::DeviceSize> staged;
+   if (size > m_StagingBuffer->m_Size) {
+      // too big for the ring.  Give it a staging buffer of its own (lives until next flush)
+      m_OverflowBuffers.emplace_back(m_Device, m_PhysicalDevice, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, MemoryAllocator::Strategy::Linear);
+      m_OverflowBuffers.back().CopyFromHost(0, size, pData);
+      staged = {m_OverflowBuffers.back().m_Buffer, 0};
+   } else {
+      vk::DeviceSize offset = (m_StagingHead + alignment - 1) / alignment * alignment;
+      if (offset + size > m_StagingBuffer->m_Size) {
+         // ring is full.  Flush what we have so far, and start again at the beginning
+         m_StagingTime += std::chrono::high_resolution_clock::now() - startTime;
+         Flush();
+         startTime = std::chrono::high_resolution_clock::now();
+         offset = 0;
+      }
+      m_StagingBuffer->CopyFromHost(offset, size, pData);
+      m_StagingHead = offset + size;
+      staged = {m_StagingBuffer->m_Buffer, offset};
+   }
+
+   m_StagingTime += std::chrono::high_resolution_clock::now() - startTime;
+   return staged;
+}
+
+
+vk::CommandBuffer Uploader::GetUploadCommandBuffer() {
+   if (!m_HasTransferQueue || m_IsRecordingGraphics) {
+      return GetGraphicsCommandBuffer();
+   }
+   if (!m_IsRecordingTransfer) {
+      m_TransferCommandBuffer.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+      m_IsRecordingTransfer = true;
+   }
+   return m_TransferCommandBuffer;
+}
+
+
+vk::CommandBuffer Uploader::GetGraphicsCommandBuffer() {
+   if (!m_IsRecordingGraphics) {
+      m_GraphicsCommandBuffer.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+      m_IsRecordingGraphics = true;
+   }
+   return m_GraphicsCommandBuffer;
+}
+
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Buffer.h"
+#include "Utility.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace Vulkan {
+
+// Batches up uploads (and other one-off commands such as image layout transitions) so that they
+// can be submitted to the GPU together, instead of one submit-and-wait per operation.
+//
+// Data to be uploaded is copied into a (reused) staging ring buffer.  If the ring fills up, the batch is flushed and the ring starts over.
+// If the device has a dedicated transfer queue, then uploads are recorded into a command buffer for that queue, and ownership of the
+// destination resources is handed over to the graphics queue when the batch is flushed.
+//
+// Work recorded with Record() always goes to the graphics queue.  Once there is anything on the graphics queue, subsequent uploads
+// in the same batch also go to the graphics queue (so that everything in the batch executes in the order it was recorded).
+class Uploader {
+public:
+
+   Uploader(vk::Device device, const vk::PhysicalDevice physicalDevice, const uint32_t graphicsFamily, vk::Queue graphicsQueue, const std::optional<uint32_t> transferFamily, vk::Queue transferQueue, const vk::DeviceSize stagingSize = 32 * 1024 * 1024);
+   NON_COPYABLE(Uploader);
+   ~Uploader();
+
+   // Copy size bytes from pData to buffer dst (which must have been created with eTransferDst usage)
+   void UploadToBuffer(const void* pData, const vk::DeviceSize size, vk::Buffer dst, const vk::DeviceSize dstOffset);
+
+   // Copy size bytes from pData to the first mip level of image.
+   // All mip levels of image are transitioned from undefined to transfer dst layout, and left in that layout
+   // (typically followed by GenerateMIPMaps() or a transition to shader read only)
+   void UploadToImage(const void* pData, const vk::DeviceSize size, vk::Image image, const uint32_t width, const uint32_t height, const uint32_t mipLevels);
+
+   // Record arbitrary commands into the batch (on the graphics queue)
+   void Record(const std::function<void(vk::CommandBuffer)>& action);
+
+   bool HasPendingWork() const;
+
+   // Submit everything recorded so far, and wait (on a fence) for it to complete.
+   void Flush();
+
+   void LogStatistics() const;
+
+private:
+   // Copy data into staging memory.  Returns buffer and offset where the data was put.
+   std::pair<vk::Buffer, vk::DeviceSize> Stage(const void* pData, const vk::DeviceSize size, const vk::DeviceSize alignment);
+
+   vk::CommandBuffer GetUploadCommandBuffer();
+   vk::CommandBuffer GetGraphicsCommandBuffer();
+
+private:
+   vk::Device m_Device;
+   vk::PhysicalDevice m_PhysicalDevice;
+
+   uint32_t m_GraphicsFamily;
+   vk::Queue m_GraphicsQueue;
+   uint32_t m_TransferFamily;
+   vk::Queue m_TransferQueue;
+   bool m_HasTransferQueue;
+
+   vk::CommandPool m_GraphicsCommandPool;
+   vk::CommandPool m_TransferCommandPool;
+   vk::CommandBuffer m_GraphicsCommandBuffer;
+   vk::CommandBuffer m_AcquireCommandBuffer;    // ownership acquire barriers for resources uploaded on transfer queue
+   vk::CommandBuffer m_TransferCommandBuffer;
+   bool m_IsRecordingGraphics = false;
+   bool m_IsRecordingTransfer = false;
+   vk::Semaphore m_TransferCompleteSemaphore;
+   vk::Fence m_Fence;
+
+   std::unique_ptr<Buffer> m_StagingBuffer;
+   vk::DeviceSize m_StagingHead = 0;
+   std::vector<Buffer> m_OverflowBuffers;       // for uploads too big for the staging ring.  Released on flush.
+
+   std::vector<vk::BufferMemoryBarrier> m_BufferReleases;
+   std::vector<vk::ImageMemoryBarrier> m_ImageReleases;
+
+   // statistics
+   vk::DeviceSize m_BytesUploaded = 0;
+   uint64_t m_UploadCount = 0;
+   uint64_t m_SubmitCount = 0;
+   std::chrono::duration<double> m_StagingTime = {};   // time spent copying into staging memory
+   std::chrono::duration<double> m_FlushTime = {};     // time spent submitting and waiting for the GPU
+};
+
+}
@@ -153,4 +153,15 @@ uint32_t AlignedSize(uint32_t value, uint32_t alignment) {
    return (value + alignment - 1) & ~(alignment - 1);
 }
 
+
+uint64_t HashBytes(const void* pData, const size_t size, const uint64_t seed) {
+   uint64_t hash = seed;
+   const uint8_t* pBytes = static_cast<const uint8_t*>(pData);
+   for (size_t i = 0; i < size; ++i) {
+      hash ^= pBytes[i];
+      hash *= 1099511628211ull;
+   }
+   return hash;
+}
+
 }
@@ -37,4 +37,7 @@ std::vector<char> ReadFile(const std::string& filename);
 
 uint32_t AlignedSize(uint32_t value, uint32_t alignment);
 
+// 64 bit FNV-1a.  Pass the result of a previous call as seed to hash several pieces of data together.
+uint64_t HashBytes(const void* pData, const size_t size, const uint64_t seed = 14695981039346656037ull);
+
 }
\ No newline at end of file